@@ -0,0 +1,118 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BENCH_BENCHMARK_H
+#define AR_BENCH_BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+#include "commontypes.h"
+#include "fastq.h"
+
+namespace ar
+{
+
+class userconfig;
+
+
+/** Synthetic reads and settings shared by all benchmarks. */
+struct bench_input
+{
+    /** Creates an empty set of inputs. */
+    bench_input();
+
+    //! Mate 1 reads, as read from a FASTQ file
+    fastq_vec mates_1;
+    //! Mate 2 reads, as read from a FASTQ file
+    fastq_vec mates_2;
+    //! Adapter pairs used to generate (and to trim) reads
+    fastq_pair_vec adapters;
+    //! Seed used for generating reads and barcodes
+    unsigned seed;
+};
+
+
+/**
+ * Base class for micro-benchmarks; each benchmark prepares its input in the
+ * constructor, and 'run' processes this input once. Timings are reported per
+ * read and per byte of input, as set using 'set_size'.
+ */
+class micro_benchmark
+{
+public:
+    /** Constructor; 'name' is used to select and to compare benchmarks. */
+    micro_benchmark(const std::string& name);
+
+    /** Destructor; does nothing. */
+    virtual ~micro_benchmark();
+
+    /**
+     * Processes the input once; returns a value depending on the results, to
+     * prevent the compiler from optimizing away the work being measured.
+     */
+    virtual size_t run() = 0;
+
+    /** Returns the name of the benchmark. */
+    const std::string& name() const;
+    /** Returns the number of reads processed per 'run'. */
+    size_t reads() const;
+    /** Returns the number of bytes processed per 'run'. */
+    size_t bytes() const;
+
+protected:
+    /** Sets the number of reads and bytes processed per 'run'. */
+    void set_size(size_t reads, size_t bytes);
+
+private:
+    //! Not implemented
+    micro_benchmark(const micro_benchmark&);
+    //! Not implemented
+    micro_benchmark& operator=(const micro_benchmark&);
+
+    //! Name of the benchmark
+    std::string m_name;
+    //! Number of reads processed per 'run'
+    size_t m_reads;
+    //! Number of bytes processed per 'run'
+    size_t m_bytes;
+};
+
+
+typedef std::vector<micro_benchmark*> benchmark_vec;
+
+
+/**
+ * Returns a new userconfig object for the default settings, modified by the
+ * command-line arguments in 'args'; throws std::invalid_argument on errors.
+ */
+userconfig* new_config(const string_vec& args);
+
+
+/** Appends all benchmarks supported by this build to 'benchmarks'. */
+void add_benchmarks(const bench_input& input, benchmark_vec& benchmarks);
+
+} // namespace ar
+
+#endif
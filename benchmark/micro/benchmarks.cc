@@ -0,0 +1,614 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "alignment.h"
+#include "alignment_simd.h"
+#include "benchmark.h"
+#include "demultiplex.h"
+#include "fastq_enc.h"
+#include "fastq_io.h"
+#include "linereader.h"
+#include "main.h"
+#include "profile.h"
+#include "simd.h"
+#include "userconfig.h"
+
+namespace ar
+{
+
+micro_benchmark::micro_benchmark(const std::string& name)
+    : m_name(name)
+    , m_reads(0)
+    , m_bytes(0)
+{
+}
+
+
+micro_benchmark::~micro_benchmark()
+{
+}
+
+
+const std::string& micro_benchmark::name() const
+{
+    return m_name;
+}
+
+
+size_t micro_benchmark::reads() const
+{
+    return m_reads;
+}
+
+
+size_t micro_benchmark::bytes() const
+{
+    return m_bytes;
+}
+
+
+void micro_benchmark::set_size(size_t reads, size_t bytes)
+{
+    m_reads = reads;
+    m_bytes = bytes;
+}
+
+
+bench_input::bench_input()
+    : mates_1()
+    , mates_2()
+    , adapters()
+    , seed(1)
+{
+}
+
+
+userconfig* new_config(const string_vec& args)
+{
+    string_vec all_args;
+    all_args.push_back(NAME);
+    all_args.push_back("--file1");
+    all_args.push_back("/dev/null");
+    all_args.insert(all_args.end(), args.begin(), args.end());
+
+    std::vector<char*> argv;
+    for (string_vec::iterator it = all_args.begin(); it != all_args.end(); ++it) {
+        argv.push_back(&(*it)[0]);
+    }
+
+    std::auto_ptr<userconfig> config(new userconfig(NAME, VERSION, HELPTEXT));
+    if (config->parse_args(static_cast<int>(argv.size()), &argv.front()) != argparse::pr_ok) {
+        throw std::invalid_argument("could not configure benchmark");
+    }
+
+    return config.release();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+
+/** Returns the total number of bytes in sequences and qualities. */
+size_t count_bytes(const fastq_vec& reads)
+{
+    size_t bytes = 0;
+    for (fastq_vec::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        bytes += it->length() * 2;
+    }
+
+    return bytes;
+}
+
+
+/** Returns copies of all mate 2 reads, reverse complemented as when trimming. */
+fastq_vec reverse_complemented_mates(const bench_input& input)
+{
+    fastq_vec mates_2 = input.mates_2;
+    for (fastq_vec::iterator it = mates_2.begin(); it != mates_2.end(); ++it) {
+        it->reverse_complement();
+    }
+
+    return mates_2;
+}
+
+
+/** Deletes all chunks in a list of chunks returned by an analytical step. */
+void delete_chunks(const chunk_vec& chunks)
+{
+    for (chunk_vec::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+        delete it->second;
+    }
+}
+
+
+/** Minimal line reader for lines stored in memory; lines are viewed in place. */
+class memory_line_reader : public line_reader_base
+{
+public:
+    memory_line_reader(const std::string& data)
+        : line_reader_base()
+        , m_data(data)
+        , m_offset(0)
+    {
+    }
+
+    bool getline(std::string& dst)
+    {
+        line_view line;
+        if (!next_line(line)) {
+            return false;
+        }
+
+        dst.assign(line.data, line.length);
+        return true;
+    }
+
+    bool next_line(line_view& dst)
+    {
+        if (m_offset >= m_data.length()) {
+            return false;
+        }
+
+        size_t end = m_data.find('\n', m_offset);
+        if (end == std::string::npos) {
+            end = m_data.length();
+        }
+
+        dst.data = m_data.data() + m_offset;
+        dst.length = end - m_offset;
+        m_offset = end + 1;
+
+        return true;
+    }
+
+private:
+    //! Not implemented
+    memory_line_reader(const memory_line_reader&);
+    //! Not implemented
+    memory_line_reader& operator=(const memory_line_reader&);
+
+    //! Lines being read, each terminated by a newline
+    const std::string& m_data;
+    //! Offset of the next line in 'm_data'
+    size_t m_offset;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Alignments
+
+/** Compares overlapping mates using each compare_subsequences kernel. */
+class compare_subsequences_benchmark : public micro_benchmark
+{
+public:
+    compare_subsequences_benchmark(const bench_input& input, simd::instruction_set is)
+        : micro_benchmark("compare_subsequences[" + simd::name(is) + "]")
+        , m_compare(select_compare_subsequences(is))
+        , m_mates_1(input.mates_1)
+        , m_mates_2(reverse_complemented_mates(input))
+    {
+        set_size(m_mates_1.size(), count_bytes(m_mates_1) / 2 + count_bytes(m_mates_2) / 2);
+    }
+
+    size_t run()
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < m_mates_1.size(); ++i) {
+            const std::string& seq_1 = m_mates_1.at(i).sequence();
+            const std::string& seq_2 = m_mates_2.at(i).sequence();
+
+            // Mates are compared in full; early termination is (rarely) possible
+            const alignment_info best;
+            alignment_info current;
+            current.length = std::min(seq_1.length(), seq_2.length());
+
+            result += m_compare(best, current, seq_1.data(), seq_2.data());
+            result += current.n_mismatches;
+        }
+
+        return result;
+    }
+
+private:
+    //! Kernel being benchmarked
+    const compare_subsequences_func m_compare;
+    //! Mate 1 reads
+    const fastq_vec m_mates_1;
+    //! Mate 2 reads, reverse complemented
+    const fastq_vec m_mates_2;
+};
+
+
+/** Aligns mates and adapters for all read pairs. */
+class align_pe_benchmark : public micro_benchmark
+{
+public:
+    align_pe_benchmark(const bench_input& input)
+        : micro_benchmark("align_paired_ended_sequences")
+        , m_adapters(input.adapters)
+        , m_mates_1(input.mates_1)
+        , m_mates_2(reverse_complemented_mates(input))
+    {
+        set_size(m_mates_1.size(), count_bytes(m_mates_1) / 2 + count_bytes(m_mates_2) / 2);
+    }
+
+    size_t run()
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < m_mates_1.size(); ++i) {
+            const alignment_info alignment
+                = align_paired_ended_sequences(m_mates_1.at(i), m_mates_2.at(i), m_adapters, 2);
+
+            result += alignment.length;
+        }
+
+        return result;
+    }
+
+private:
+    //! Adapter pairs aligned against the mates
+    const fastq_pair_vec m_adapters;
+    //! Mate 1 reads
+    const fastq_vec m_mates_1;
+    //! Mate 2 reads, reverse complemented
+    const fastq_vec m_mates_2;
+};
+
+
+/** Collapses all read pairs that overlap sufficiently (--collapse). */
+class collapse_pe_benchmark : public micro_benchmark
+{
+public:
+    collapse_pe_benchmark(const bench_input& input)
+        : micro_benchmark("collapse_paired_ended_sequences")
+        , m_alignments()
+        , m_mates_1()
+        , m_mates_2()
+    {
+        string_vec args;
+        args.push_back("--collapse");
+        const std::auto_ptr<userconfig> config(new_config(args));
+
+        const fastq_vec mates_2 = reverse_complemented_mates(input);
+        for (size_t i = 0; i < input.mates_1.size(); ++i) {
+            fastq mate_1 = input.mates_1.at(i);
+            fastq mate_2 = mates_2.at(i);
+
+            const alignment_info alignment
+                = align_paired_ended_sequences(mate_1, mate_2, input.adapters, 2);
+
+            if (config->is_alignment_collapsible(alignment)) {
+                truncate_paired_ended_sequences(alignment, mate_1, mate_2);
+
+                m_alignments.push_back(alignment);
+                m_mates_1.push_back(mate_1);
+                m_mates_2.push_back(mate_2);
+            }
+        }
+
+        set_size(m_mates_1.size(), count_bytes(m_mates_1) + count_bytes(m_mates_2));
+    }
+
+    size_t run()
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < m_mates_1.size(); ++i) {
+            const fastq collapsed = collapse_paired_ended_sequences(m_alignments.at(i),
+                                                                    m_mates_1.at(i),
+                                                                    m_mates_2.at(i));
+
+            result += collapsed.length();
+        }
+
+        return result;
+    }
+
+private:
+    //! Alignment of each pair of mates
+    alignment_vec m_alignments;
+    //! Truncated mate 1 reads
+    fastq_vec m_mates_1;
+    //! Truncated mate 2 reads, reverse complemented
+    fastq_vec m_mates_2;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing
+
+/** Parses serialized mate 1 reads using fastq::read. */
+class fastq_read_benchmark : public micro_benchmark
+{
+public:
+    fastq_read_benchmark(const bench_input& input)
+        : micro_benchmark("fastq::read")
+        , m_data()
+    {
+        for (fastq_vec::const_iterator it = input.mates_1.begin(); it != input.mates_1.end(); ++it) {
+            it->to_str(m_data);
+        }
+
+        set_size(input.mates_1.size(), m_data.size());
+    }
+
+    size_t run()
+    {
+        memory_line_reader reader(m_data);
+
+        size_t result = 0;
+        for (fastq record; record.read(reader); ) {
+            result += record.length();
+        }
+
+        return result;
+    }
+
+private:
+    //! Serialized FASTQ records
+    std::string m_data;
+};
+
+
+/** Decodes Phred+64 quality scores; scores are first copied to a buffer. */
+class fastq_decode_benchmark : public micro_benchmark
+{
+public:
+    fastq_decode_benchmark(const bench_input& input)
+        : micro_benchmark("fastq_encoding::decode[phred_64]")
+        , m_qualities()
+        , m_buffer()
+    {
+        for (fastq_vec::const_iterator it = input.mates_1.begin(); it != input.mates_1.end(); ++it) {
+            std::string qualities = it->qualities();
+            FASTQ_ENCODING_64.encode_string(qualities.begin(), qualities.end());
+
+            m_qualities.push_back(qualities);
+        }
+
+        set_size(input.mates_1.size(), count_bytes(input.mates_1) / 2);
+    }
+
+    size_t run()
+    {
+        size_t result = 0;
+        for (string_vec::const_iterator it = m_qualities.begin(); it != m_qualities.end(); ++it) {
+            m_buffer.assign(*it);
+            FASTQ_ENCODING_64.decode_string(m_buffer.begin(), m_buffer.end());
+
+            result += m_buffer.at(0);
+        }
+
+        return result;
+    }
+
+private:
+    //! Phred+64 encoded quality scores
+    string_vec m_qualities;
+    //! Buffer for decoded quality scores
+    std::string m_buffer;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Demultiplexing
+
+/** Exposes demultiplex_reads::select_barcode for benchmarking. */
+class barcode_selector : public demultiplex_se_reads
+{
+public:
+    barcode_selector(const userconfig* config)
+        : demultiplex_se_reads(config)
+    {
+    }
+
+    using demultiplex_reads::select_barcode;
+};
+
+
+/**
+ * Selects barcodes for mate 1 reads prefixed with one of 96 random barcodes,
+ * one in four of which contains a mismatch. More than two mismatches cannot
+ * be handled by the barcode table, and the quadtree is therefore used.
+ */
+class select_barcode_benchmark : public micro_benchmark
+{
+public:
+    select_barcode_benchmark(const bench_input& input, size_t mismatches)
+        : micro_benchmark(std::string("select_barcode[") + (mismatches > 2 ? "tree" : "table") + "]")
+        , m_config()
+        , m_selector()
+        , m_reads()
+    {
+        bench_rng rng(input.seed);
+
+        string_vec barcodes;
+        while (barcodes.size() < 96) {
+            std::string barcode;
+            for (size_t i = 0; i < 8; ++i) {
+                barcode.push_back(rng.nucleotide());
+            }
+
+            if (std::find(barcodes.begin(), barcodes.end(), barcode) == barcodes.end()) {
+                barcodes.push_back(barcode);
+            }
+        }
+
+        char filename[] = "/tmp/ar_bench_barcodes_XXXXXX";
+        const int fd = mkstemp(filename);
+        if (fd < 0) {
+            throw std::runtime_error("could not create temporary barcode table");
+        }
+
+        FILE* handle = fdopen(fd, "w");
+        for (size_t i = 0; i < barcodes.size(); ++i) {
+            std::fprintf(handle, "sample_%u %s\n", static_cast<unsigned>(i), barcodes.at(i).c_str());
+        }
+        std::fclose(handle);
+
+        std::ostringstream mm;
+        mm << mismatches;
+
+        string_vec args;
+        args.push_back("--barcode-list");
+        args.push_back(filename);
+        args.push_back("--barcode-mm");
+        args.push_back(mm.str());
+
+        try {
+            m_config.reset(new_config(args));
+        } catch (...) {
+            unlink(filename);
+            throw;
+        }
+        unlink(filename);
+
+        m_selector.reset(new barcode_selector(m_config.get()));
+
+        for (size_t i = 0; i < input.mates_1.size(); ++i) {
+            const fastq& read = input.mates_1.at(i);
+            std::string barcode = barcodes.at(rng.next() % barcodes.size());
+            if (i % 4 == 0) {
+                barcode.at(rng.next() % barcode.length()) = rng.nucleotide();
+            }
+
+            m_reads.push_back(fastq(read.header(), barcode + read.sequence(),
+                                    std::string(barcode.length(), 'I') + read.qualities()));
+        }
+
+        set_size(m_reads.size(), m_reads.size() * barcodes.front().length());
+    }
+
+    size_t run()
+    {
+        const fastq empty_read;
+
+        size_t result = 0;
+        for (fastq_vec::const_iterator it = m_reads.begin(); it != m_reads.end(); ++it) {
+            result += m_selector->select_barcode(*it, empty_read);
+        }
+
+        return result;
+    }
+
+private:
+    //! Configuration containing the barcodes
+    std::auto_ptr<userconfig> m_config;
+    //! Demultiplexer for the barcodes
+    std::auto_ptr<barcode_selector> m_selector;
+    //! Mate 1 reads prefixed with barcodes
+    fastq_vec m_reads;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Compression
+
+/** Compresses serialized mate 1 reads using an output compression step. */
+template <typename T>
+class compression_benchmark : public micro_benchmark
+{
+public:
+    compression_benchmark(const bench_input& input, const std::string& name)
+        : micro_benchmark(name)
+        , m_config(new_config(string_vec()))
+        , m_reads(input.mates_1)
+    {
+        std::string data;
+        for (fastq_vec::const_iterator it = m_reads.begin(); it != m_reads.end(); ++it) {
+            it->to_str(data);
+        }
+
+        set_size(m_reads.size(), data.size());
+    }
+
+    size_t run()
+    {
+        // A stream per run, so that each run also flushes the compressed data
+        T step(*m_config, 0);
+
+        size_t result = 0;
+        for (size_t offset = 0; offset < m_reads.size(); offset += FASTQ_CHUNK_SIZE) {
+            const size_t end = std::min(m_reads.size(), offset + FASTQ_CHUNK_SIZE);
+
+            std::auto_ptr<fastq_output_chunk> chunk(new fastq_output_chunk(end == m_reads.size()));
+            for (size_t i = offset; i < end; ++i) {
+                chunk->add(FASTQ_ENCODING_33, m_reads.at(i));
+            }
+
+            const chunk_vec chunks = step.process(chunk.release());
+            result += chunks.size();
+            delete_chunks(chunks);
+        }
+
+        return result;
+    }
+
+private:
+    //! Not implemented
+    compression_benchmark(const compression_benchmark&);
+    //! Not implemented
+    compression_benchmark& operator=(const compression_benchmark&);
+
+    //! Configuration for compression levels
+    const std::auto_ptr<userconfig> m_config;
+    //! Reads serialized for each chunk
+    const fastq_vec m_reads;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+void add_benchmarks(const bench_input& input, benchmark_vec& benchmarks)
+{
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        benchmarks.push_back(new compare_subsequences_benchmark(input, *it));
+    }
+
+    benchmarks.push_back(new align_pe_benchmark(input));
+    benchmarks.push_back(new collapse_pe_benchmark(input));
+    benchmarks.push_back(new fastq_read_benchmark(input));
+    benchmarks.push_back(new fastq_decode_benchmark(input));
+    benchmarks.push_back(new select_barcode_benchmark(input, 1));
+    benchmarks.push_back(new select_barcode_benchmark(input, 3));
+
+#ifdef AR_GZIP_SUPPORT
+    benchmarks.push_back(new compression_benchmark<gzip_paired_fastq>(input, "gzip_paired_fastq"));
+    benchmarks.push_back(new compression_benchmark<bgzf_paired_fastq>(input, "bgzf_paired_fastq"));
+#endif
+#ifdef AR_BZIP2_SUPPORT
+    benchmarks.push_back(new compression_benchmark<bzip2_paired_fastq>(input, "bzip2_paired_fastq"));
+#endif
+}
+
+} // namespace ar
@@ -0,0 +1,279 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "argparse.h"
+#include "benchmark.h"
+#include "main.h"
+#include "profile.h"
+#include "timer.h"
+#include "userconfig.h"
+
+using namespace ar;
+
+const std::string BENCH_HELPTEXT = \
+    "Micro-benchmarks for the performance critical parts of AdapterRemoval,\n"
+    "using synthetic reads simulated from a pIRS error profile. Results may\n"
+    "be saved using --output, and compared to earlier results using\n"
+    "--compare, in which case the exit code is non-zero if any benchmark is\n"
+    "slower than permitted by --max-slowdown.\n";
+
+
+/** Timing of a single benchmark. */
+struct bench_result
+{
+    bench_result()
+        : ns_per_read(0)
+        , gb_per_sec(0)
+    {
+    }
+
+    //! Best time per read, in nanoseconds
+    double ns_per_read;
+    //! Throughput for the best time, in GB per second
+    double gb_per_sec;
+};
+
+
+typedef std::map<std::string, bench_result> result_map;
+
+
+/** Runs a benchmark for at least 'min_time' seconds, returning the best timing. */
+bench_result time_benchmark(micro_benchmark& benchmark, double min_time)
+{
+    // Warm up caches, branch predictors, and lazily initialized tables
+    size_t checksum = benchmark.run();
+
+    double best = std::numeric_limits<double>::max();
+    double total = 0;
+    for (size_t iterations = 0; iterations < 3 || total < min_time; ++iterations) {
+        const double start = get_current_time();
+        checksum += benchmark.run();
+        const double elapsed = get_current_time() - start;
+
+        best = std::min(best, elapsed);
+        total += elapsed;
+    }
+
+    // Prevents the work done by 'run' from being optimized away
+    if (checksum == std::numeric_limits<size_t>::max()) {
+        std::cerr << "checksum: " << checksum << std::endl;
+    }
+
+    bench_result result;
+    result.ns_per_read = best * 1e9 / std::max<size_t>(1, benchmark.reads());
+    result.gb_per_sec = benchmark.bytes() / best / 1e9;
+
+    return result;
+}
+
+
+/** Reads results written using --output; throws on failure. */
+result_map read_results(const std::string& filename)
+{
+    std::ifstream stream(filename.c_str());
+    if (!stream) {
+        throw std::invalid_argument("could not open results file '" + filename + "'");
+    }
+
+    result_map results;
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.empty() || line.at(0) == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string name;
+        bench_result result;
+
+        if (!std::getline(fields, name, '\t') || !(fields >> result.ns_per_read >> result.gb_per_sec)) {
+            throw std::invalid_argument("invalid line in results file '" + filename + "'");
+        }
+
+        results[name] = result;
+    }
+
+    return results;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string profile_filename = "benchmark/profiles/humNew.PE100.matrix.gz";
+    std::string output_filename;
+    std::string compare_filename;
+    std::string filter;
+    unsigned n_reads = 50000;
+    unsigned read_length = 100;
+    unsigned seed = 1;
+    double min_time = 0.5;
+    double max_slowdown = 0.1;
+
+    argparse::parser argparser("AdapterRemoval micro-benchmarks", VERSION, BENCH_HELPTEXT);
+    argparser["--profile"] =
+        new argparse::any(&profile_filename, "FILENAME",
+            "pIRS error profile used to simulate reads [current: %default].");
+    argparser["--reads"] =
+        new argparse::knob(&n_reads, "N",
+            "Number of read pairs simulated [current: %default].");
+    argparser["--read-length"] =
+        new argparse::knob(&read_length, "N",
+            "Length of simulated reads [current: %default].");
+    argparser["--seed"] =
+        new argparse::knob(&seed, "SEED",
+            "Seed used when simulating reads [current: %default].");
+    argparser["--min-time"] =
+        new argparse::floaty_knob(&min_time, "SECONDS",
+            "Minimum time spent running each benchmark; the best of at least "
+            "3 runs is reported [current: %default].");
+    argparser["--filter"] =
+        new argparse::any(&filter, "TEXT",
+            "Only run benchmarks with names containing TEXT.");
+    argparser.add_seperator();
+    argparser["--output"] =
+        new argparse::any(&output_filename, "FILENAME",
+            "Write results to FILENAME as a table, for use with --compare.");
+    argparser["--compare"] =
+        new argparse::any(&compare_filename, "FILENAME",
+            "Compare timings per read to those in a table written by --output.");
+    argparser["--max-slowdown"] =
+        new argparse::floaty_knob(&max_slowdown, "FRACTION",
+            "Benchmarks taking more than (1 + FRACTION) times the time per "
+            "read in --compare are reported as regressions [current: %default].");
+
+    const argparse::parse_result result = argparser.parse_args(argc, argv);
+    if (result == argparse::pr_exit) {
+        return 0;
+    } else if (result == argparse::pr_error) {
+        return 1;
+    } else if (!n_reads || !read_length) {
+        std::cerr << "Error: --reads and --read-length must be greater than 0." << std::endl;
+        return 1;
+    }
+
+    try {
+        result_map baseline;
+        if (!compare_filename.empty()) {
+            baseline = read_results(compare_filename);
+        }
+
+        std::cerr << "Simulating " << n_reads << " read pairs using '"
+                  << profile_filename << "' ..." << std::endl;
+
+        // Reads are simulated using the default adapter sequences
+        const std::auto_ptr<userconfig> config(new_config(string_vec()));
+
+        bench_input input;
+        input.seed = seed;
+        input.adapters = config->adapters.get_adapter_set(0);
+
+        // Adapter 2 is stored in the orientation of reverse complemented mates
+        const fastq_pair& adapters = input.adapters.front();
+        fastq adapter_2 = adapters.second;
+        adapter_2.reverse_complement();
+
+        bench_rng rng(seed);
+        const error_profile profile(profile_filename);
+        profile.generate(n_reads, read_length, adapters.first.sequence(), adapter_2.sequence(),
+                         rng, input.mates_1, input.mates_2);
+
+        benchmark_vec benchmarks;
+        add_benchmarks(input, benchmarks);
+
+        std::auto_ptr<std::ofstream> output;
+        if (!output_filename.empty()) {
+            output.reset(new std::ofstream(output_filename.c_str()));
+            if (!*output) {
+                throw std::invalid_argument("could not open output file '" + output_filename + "'");
+            }
+
+            *output << "#benchmark\tns_per_read\tgb_per_sec\n";
+        }
+
+        std::cout << std::left << std::setw(36) << "Benchmark" << std::right
+                  << std::setw(12) << "ns/read" << std::setw(10) << "GB/s";
+        if (!baseline.empty()) {
+            std::cout << std::setw(12) << "baseline" << std::setw(10) << "change";
+        }
+        std::cout << std::endl;
+
+        size_t regressions = 0;
+        for (benchmark_vec::iterator it = benchmarks.begin(); it != benchmarks.end(); ++it) {
+            std::auto_ptr<micro_benchmark> benchmark(*it);
+            *it = NULL;
+
+            if (benchmark->name().find(filter) == std::string::npos) {
+                continue;
+            }
+
+            const bench_result timing = time_benchmark(*benchmark, min_time);
+            std::cout << std::left << std::setw(36) << benchmark->name() << std::right
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(12) << timing.ns_per_read
+                      << std::setprecision(3) << std::setw(10) << timing.gb_per_sec;
+
+            const result_map::const_iterator previous = baseline.find(benchmark->name());
+            if (previous != baseline.end()) {
+                const double change = timing.ns_per_read / previous->second.ns_per_read - 1.0;
+                const bool is_regression = change > max_slowdown;
+
+                std::cout << std::setprecision(1) << std::setw(12) << previous->second.ns_per_read
+                          << std::showpos << std::setw(9) << change * 100 << "%"
+                          << std::noshowpos << (is_regression ? "  REGRESSION" : "");
+
+                regressions += is_regression;
+            }
+            std::cout << std::endl;
+
+            if (output.get()) {
+                *output << benchmark->name() << std::fixed
+                        << "\t" << std::setprecision(2) << timing.ns_per_read
+                        << "\t" << std::setprecision(4) << timing.gb_per_sec << "\n";
+            }
+        }
+
+        if (regressions) {
+            std::cerr << "Error: " << regressions << " benchmark(s) were more than "
+                      << max_slowdown * 100 << "% slower than in '"
+                      << compare_filename << "'" << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "linereader.h"
+#include "profile.h"
+
+namespace ar
+{
+
+bench_rng::bench_rng(unsigned seed)
+    : m_state(seed ? seed : 2463534242u)
+{
+}
+
+
+unsigned bench_rng::next()
+{
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+
+    return m_state;
+}
+
+
+double bench_rng::uniform()
+{
+    return next() / 4294967296.0;
+}
+
+
+char bench_rng::nucleotide()
+{
+    return "ACGT"[next() >> 30];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/** Returns the reverse complement of a sequence of ACGTs. */
+std::string reverse_complement(const std::string& sequence)
+{
+    std::string result(sequence.rbegin(), sequence.rend());
+    for (std::string::iterator it = result.begin(); it != result.end(); ++it) {
+        switch (*it) {
+            case 'A': *it = 'T'; break;
+            case 'C': *it = 'G'; break;
+            case 'G': *it = 'C'; break;
+            case 'T': *it = 'A'; break;
+            default: break;
+        }
+    }
+
+    return result;
+}
+
+
+/** Appends 'sequence' to 'dst', replacing Ns with random nucleotides. */
+void append_sequence(std::string& dst, const std::string& sequence, bench_rng& rng)
+{
+    for (std::string::const_iterator it = sequence.begin(); it != sequence.end(); ++it) {
+        dst.push_back(*it == 'N' ? rng.nucleotide() : *it);
+    }
+}
+
+
+error_profile::error_profile(const std::string& filename)
+    : m_cumulative()
+{
+    line_reader reader(filename);
+
+    bool in_matrix = false;
+    std::string line;
+    while (reader.getline(line)) {
+        if (!in_matrix) {
+            in_matrix = (line == "[DistMatrix]");
+            continue;
+        } else if (line.substr(0, 5) == "<<END") {
+            break;
+        } else if (line.empty() || line.at(0) == '#') {
+            continue;
+        }
+
+        std::istringstream stream(line);
+        std::string ref;
+        size_t cycle = 0;
+        if (!(stream >> ref >> cycle) || ref.size() != 1 || !cycle) {
+            throw std::invalid_argument("invalid [DistMatrix] row in " + filename);
+        }
+
+        const size_t index = (cycle - 1) * 4 + ACGT_TO_IDX(ref.at(0));
+        if (index >= m_cumulative.size()) {
+            m_cumulative.resize(cycle * 4);
+        }
+
+        std::vector<double>& counts = m_cumulative.at(index);
+        counts.resize(N_OUTCOMES);
+
+        double total = 0;
+        for (size_t i = 0; i < N_OUTCOMES; ++i) {
+            double count = 0;
+            if (!(stream >> count)) {
+                throw std::invalid_argument("truncated [DistMatrix] row in " + filename);
+            }
+
+            counts.at(i) = (total += count);
+        }
+    }
+
+    if (m_cumulative.empty()) {
+        throw std::invalid_argument("no [DistMatrix] section in " + filename);
+    }
+}
+
+
+size_t error_profile::cycles() const
+{
+    return m_cumulative.size() / 4;
+}
+
+
+void error_profile::generate(size_t n_pairs,
+                             size_t read_length,
+                             const std::string& adapter1,
+                             const std::string& adapter2,
+                             bench_rng& rng,
+                             fastq_vec& mates_1,
+                             fastq_vec& mates_2) const
+{
+    // Mate 2 reads are simulated using the second half of PE profiles
+    const size_t mate_2_offset = (cycles() >= 2 * read_length) ? cycles() / 2 : 0;
+    const size_t min_insert = std::max<size_t>(1, read_length / 4);
+    const size_t max_insert = 2 * read_length;
+
+    for (size_t nth = 0; nth < n_pairs; ++nth) {
+        const size_t insert_size = min_insert + rng.next() % (max_insert - min_insert + 1);
+
+        std::string fragment;
+        for (size_t i = 0; i < insert_size; ++i) {
+            fragment.push_back(rng.nucleotide());
+        }
+
+        std::string templ_1 = fragment.substr(0, read_length);
+        std::string templ_2 = reverse_complement(fragment).substr(0, read_length);
+        append_sequence(templ_1, adapter1, rng);
+        append_sequence(templ_2, adapter2, rng);
+
+        while (templ_1.length() < read_length || templ_2.length() < read_length) {
+            templ_1.push_back(rng.nucleotide());
+            templ_2.push_back(rng.nucleotide());
+        }
+
+        std::ostringstream name;
+        name << "read_" << nth + 1;
+
+        mates_1.push_back(sequence(name.str() + "/1", templ_1.substr(0, read_length), 0, rng));
+        mates_2.push_back(sequence(name.str() + "/2", templ_2.substr(0, read_length),
+                                   mate_2_offset, rng));
+    }
+}
+
+
+fastq error_profile::sequence(const std::string& name,
+                              const std::string& templ,
+                              size_t offset,
+                              bench_rng& rng) const
+{
+    std::string sequence;
+    std::string qualities;
+
+    for (size_t i = 0; i < templ.length(); ++i) {
+        const size_t cycle = std::min(offset + i, cycles() - 1);
+        const std::vector<double>& counts = m_cumulative.at(cycle * 4 + ACGT_TO_IDX(templ.at(i)));
+
+        if (counts.empty() || !counts.back()) {
+            // No observations for this cycle / base; assume a good call
+            sequence.push_back(templ.at(i));
+            qualities.push_back(PHRED_OFFSET_33 + 30);
+        } else {
+            const double value = rng.uniform() * counts.back();
+            const size_t outcome = std::upper_bound(counts.begin(), counts.end(), value)
+                                   - counts.begin();
+
+            sequence.push_back("ACGT"[outcome / 41]);
+            qualities.push_back(PHRED_OFFSET_33 + outcome % 41);
+        }
+    }
+
+    return fastq(name, sequence, qualities);
+}
+
+} // namespace ar
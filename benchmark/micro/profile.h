@@ -0,0 +1,110 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BENCH_PROFILE_H
+#define AR_BENCH_PROFILE_H
+
+#include <string>
+#include <vector>
+
+#include "fastq.h"
+
+namespace ar
+{
+
+/**
+ * Small, deterministic PRNG (xorshift32), so that synthetic reads are the
+ * same for a given seed regardless of the C library used.
+ */
+class bench_rng
+{
+public:
+    /** Constructor; a seed of 0 is replaced by a fixed, non-zero value. */
+    bench_rng(unsigned seed);
+
+    /** Returns the next 32-bit value. */
+    unsigned next();
+
+    /** Returns a value in the range [0, 1). */
+    double uniform();
+
+    /** Returns a random nucleotide (ACGT). */
+    char nucleotide();
+
+private:
+    //! Current state; never zero
+    unsigned m_state;
+};
+
+
+/**
+ * Per-cycle error profile, as produced by the pIRS 'baseCalling' tool (see the
+ * .matrix files in benchmark/profiles). Only the [DistMatrix] section is used, which
+ * for every reference base and cycle counts the observed base and quality.
+ *
+ * Profiles are used to generate synthetic PE reads with realistic qualities
+ * and substitution errors, from random fragments of varying length, about
+ * half of which are shorter than the reads and hence contain adapters.
+ */
+class error_profile
+{
+public:
+    /**
+     * Reads a profile from a (gzip compressed) matrix file; throws
+     * std::invalid_argument if the file contains no [DistMatrix] section.
+     */
+    error_profile(const std::string& filename);
+
+    /** Number of cycles in the profile; PE profiles span both mates. */
+    size_t cycles() const;
+
+    /**
+     * Generates 'n_pairs' read pairs of length 'read_length'; 'adapter1' and
+     * 'adapter2' are found following the fragment in either mate.
+     */
+    void generate(size_t n_pairs,
+                  size_t read_length,
+                  const std::string& adapter1,
+                  const std::string& adapter2,
+                  bench_rng& rng,
+                  fastq_vec& mates_1,
+                  fastq_vec& mates_2) const;
+
+private:
+    /** Simulates sequencing of the template at cycles offset .. */
+    fastq sequence(const std::string& name,
+                   const std::string& templ,
+                   size_t offset,
+                   bench_rng& rng) const;
+
+    //! Number of base / quality combinations per cycle and reference base
+    static const size_t N_OUTCOMES = 4 * 41;
+
+    //! Cumulative counts of outcomes for each cycle (outer) and ref. base
+    std::vector<std::vector<double> > m_cumulative;
+};
+
+} // namespace ar
+
+#endif
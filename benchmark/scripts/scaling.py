@@ -0,0 +1,384 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+# Copyright (c) 2014 Mikkel Schubert <MSchubert@snm.ku.dk>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+"""End-to-end throughput of AdapterRemoval across threads and options.
+
+Runs an AdapterRemoval executable on reads built from 'examples/', while
+varying the number of threads, the output compression (format and level),
+SE / PE mode, read collapsing, and the number of barcodes demultiplexed. For
+each run the throughput (1000s of reads / second of wall time), CPU use, peak
+RSS, and the time spent in each step of the pipeline (via --trace) are
+recorded, in a table that may be summarized with 'tabulate.py throughput'.
+"""
+from __future__ import print_function
+
+import argparse
+import collections
+import itertools
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+_ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+_EXAMPLES = os.path.join(_ROOT, "examples")
+_ADAPTERS = os.path.join(_ROOT, "benchmark", "adapters")
+
+_NUCLEOTIDES = "ACGT"
+_BARCODE_LENGTH = 8
+
+_KEYS = ("Name", "ReadLen", "Reads", "Metric", "Threads", "Nth", "Rate",
+         "Compression", "Level", "Collapse", "Barcodes", "WallTime", "CPU",
+         "MaxRAM")
+
+
+Config = collections.namedtuple("Config", ("mode", "compression", "level",
+                                           "collapse", "barcodes"))
+
+
+###############################################################################
+# Input files
+
+def read_fastq(filename):
+    with open(filename) as handle:
+        while True:
+            lines = [handle.readline().rstrip() for _ in range(4)]
+            if not lines[0]:
+                break
+
+            yield lines
+
+
+def read_adapters():
+    adapters = []
+    for filename in ("adapter_1.txt", "adapter_2.txt"):
+        with open(os.path.join(_ADAPTERS, filename)) as handle:
+            adapters.append(handle.readline().strip())
+
+    return adapters
+
+
+def hamming_distance(seq_1, seq_2):
+    return sum(nt_1 != nt_2 for nt_1, nt_2 in zip(seq_1, seq_2))
+
+
+def random_barcodes(rng, count, min_distance=3):
+    """Returns 'count' random barcodes at least 'min_distance' apart."""
+    barcodes = []
+    while len(barcodes) < count:
+        barcode = "".join(rng.choice(_NUCLEOTIDES)
+                          for _ in range(_BARCODE_LENGTH))
+
+        if all(hamming_distance(barcode, other) >= min_distance
+               for other in barcodes):
+            barcodes.append(barcode)
+
+    return barcodes
+
+
+def write_inputs(args, root, nbarcodes):
+    """Writes 'args.reads' read pairs, by repeating the example reads, with
+    mate 1 reads prefixed with one of 'nbarcodes' barcodes (if not zero)."""
+    rng = random.Random(args.seed)
+    barcodes = random_barcodes(rng, nbarcodes)
+
+    prefix = os.path.join(root, "input_bc%i" % (nbarcodes,))
+    filenames = (prefix + "_1.fq", prefix + "_2.fq")
+    if nbarcodes:
+        with open(prefix + ".barcodes", "w") as handle:
+            for nth, barcode in enumerate(barcodes):
+                print("sample_%i" % (nth + 1,), barcode, file=handle)
+
+    mate_1 = list(read_fastq(os.path.join(_EXAMPLES, "reads_1.fq")))
+    mate_2 = list(read_fastq(os.path.join(_EXAMPLES, "reads_2.fq")))
+    pairs = itertools.cycle(zip(mate_1, mate_2))
+
+    with open(filenames[0], "w") as handle_1:
+        with open(filenames[1], "w") as handle_2:
+            for nth in range(args.reads):
+                (name_1, seq_1, _, qual_1), (name_2, seq_2, _, qual_2) \
+                    = next(pairs)
+
+                name = "@read_%i" % (nth,)
+                if barcodes:
+                    barcode = barcodes[nth % len(barcodes)]
+                    seq_1 = barcode + seq_1
+                    qual_1 = "I" * len(barcode) + qual_1
+
+                handle_1.write("%s/1\n%s\n+\n%s\n" % (name, seq_1, qual_1))
+                handle_2.write("%s/2\n%s\n+\n%s\n" % (name, seq_2, qual_2))
+
+    read_length = max(len(record[1]) for record in mate_1 + mate_2)
+
+    return filenames, read_length
+
+
+###############################################################################
+# Runs
+
+def build_command(args, config, inputs, threads, root):
+    adapter_1, adapter_2 = read_adapters()
+
+    command = [args.executable,
+               "--file1", inputs[0],
+               "--basename", os.path.join(root, "output"),
+               "--adapter1", adapter_1,
+               "--threads", str(threads),
+               "--trace", os.path.join(root, "trace.json")]
+
+    if config.mode == "PE":
+        command.extend(("--file2", inputs[1], "--adapter2", adapter_2))
+
+    if config.compression == "gz":
+        command.extend(("--gzip", "--gzip-level", str(config.level)))
+    elif config.compression == "bz2":
+        command.extend(("--bzip2", "--bzip2-level", str(config.level)))
+
+    if config.collapse:
+        command.append("--collapse")
+
+    if config.barcodes:
+        command.extend(("--barcode-list",
+                        os.path.join(root, "input_bc%i.barcodes"
+                                     % (config.barcodes,)),
+                        "--barcode-mm", str(args.barcode_mm)))
+
+    return command
+
+
+def read_trace(filename):
+    """Returns the running time (in seconds, summed across threads) for each
+    kind of step; output steps ('write:FILENAME') are summed per kind."""
+    with open(filename) as handle:
+        events = json.load(handle)["traceEvents"]
+
+    steps = collections.defaultdict(float)
+    for event in events:
+        if event.get("ph") == "X" and event.get("cat") == "step":
+            steps[event["name"].split(":", 1)[0]] += event["dur"] / 1e6
+
+    return steps
+
+
+def run_once(args, config, inputs, threads, root):
+    command = build_command(args, config, inputs, threads, root)
+    with open(os.devnull, "w") as devnull:
+        start = time.time()
+        proc = subprocess.Popen(command, stdout=devnull, stderr=devnull)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall_time = time.time() - start
+
+    if status:
+        raise RuntimeError("command failed with status %i: %s"
+                           % (status, " ".join(command)))
+
+    cpu_time = usage.ru_utime + usage.ru_stime
+    steps = read_trace(os.path.join(root, "trace.json"))
+
+    for filename in os.listdir(root):
+        if filename.startswith("output"):
+            os.remove(os.path.join(root, filename))
+
+    return wall_time, cpu_time, usage.ru_maxrss, steps
+
+
+def build_name(config):
+    name = ["AdapterRemoval"]
+    if config.collapse:
+        name.append("collapse")
+    if config.barcodes:
+        name.append("bc%i" % (config.barcodes,))
+    if config.compression != "NA":
+        name.append("l%i_%s" % (config.level, config.compression))
+
+    return "-".join(name)
+
+
+###############################################################################
+# Experimental design
+
+def parse_compression(value):
+    result = []
+    for item in value.split(","):
+        if item == "none":
+            result.append(("NA", 0))
+        else:
+            fmt, level = item.split(":") if ":" in item else (item, "6")
+            if fmt not in ("gz", "bz2"):
+                raise argparse.ArgumentTypeError("invalid format %r" % (fmt,))
+            result.append((fmt, int(level)))
+
+    return result
+
+
+def parse_ints(value):
+    return [int(item) for item in value.split(",")]
+
+
+def build_configs(args):
+    """Yields either every combination of options (--full), or each option
+    varied separately from a baseline of uncompressed PE runs."""
+    if args.full:
+        for mode, (fmt, level), collapse, barcodes in itertools.product(
+                args.modes, args.compression, (False, True), args.barcodes):
+            if mode == "SE" and collapse:
+                continue
+
+            yield Config(mode, fmt, level, collapse, barcodes)
+        return
+
+    baseline = Config("PE", "NA", 0, False, 0)
+    configs = [baseline]
+    for mode in args.modes:
+        configs.append(baseline._replace(mode=mode))
+    for fmt, level in args.compression:
+        configs.append(baseline._replace(compression=fmt, level=level))
+    configs.append(baseline._replace(collapse=True))
+    for barcodes in args.barcodes:
+        configs.append(baseline._replace(barcodes=barcodes))
+
+    seen = set()
+    for config in configs:
+        if config not in seen and not (config.mode == "SE" and config.collapse):
+            seen.add(config)
+            yield config
+
+
+def default_threads():
+    ncpus, threads = os.sysconf("SC_NPROCESSORS_ONLN"), [1, 2]
+    while threads[-1] * 2 <= ncpus:
+        threads.append(threads[-1] * 2)
+
+    return ",".join(map(str, threads))
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n", 1)[0])
+    parser.add_argument("executable",
+                        help="AdapterRemoval executable to benchmark")
+    parser.add_argument("--output", default="-",
+                        help="Write table to this file [default: STDOUT]")
+    parser.add_argument("--reads", default=200000, type=int,
+                        help="Number of read pairs in inputs [%(default)s]")
+    parser.add_argument("--threads", default=default_threads(),
+                        type=parse_ints,
+                        help="Comma separated list of threads [%(default)s]")
+    parser.add_argument("--compression", default="none,gz:1,gz:6,bz2:9",
+                        type=parse_compression,
+                        help="Comma separated list of output compression "
+                             "formats (none, gz, or bz2) with optional "
+                             "levels (e.g. gz:6) [%(default)s]")
+    parser.add_argument("--modes", default="SE,PE", type=str.split,
+                        help="SE and / or PE, space separated [%(default)s]")
+    parser.add_argument("--barcodes", default="1,24,96,384", type=parse_ints,
+                        help="Comma separated list of the number of "
+                             "barcodes to demultiplex [%(default)s]")
+    parser.add_argument("--barcode-mm", default=1, type=int,
+                        help="Value passed to --barcode-mm [%(default)s]")
+    parser.add_argument("--replicates", default=3, type=int,
+                        help="Number of runs per combination [%(default)s]")
+    parser.add_argument("--full", default=False, action="store_true",
+                        help="Benchmark every combination of options, "
+                             "rather than varying one option at a time")
+    parser.add_argument("--seed", default=1, type=int,
+                        help="Seed used to generate barcodes [%(default)s]")
+    parser.add_argument("--temp-dir", default=None,
+                        help="Location of inputs and outputs [%(default)s]")
+
+    return parser.parse_args(argv)
+
+
+def write_table(handle, rows):
+    steps = set()
+    for row in rows:
+        steps.update(key for key in row if key.startswith("Step:"))
+
+    keys = _KEYS + tuple(sorted(steps))
+    print("\t".join(keys), file=handle)
+    for row in rows:
+        print("\t".join(str(row.get(key, "NA")) for key in keys), file=handle)
+
+
+def main(argv):
+    args = parse_args(argv)
+    args.executable = os.path.abspath(args.executable)
+
+    configs = list(build_configs(args))
+    root = tempfile.mkdtemp(prefix="ar_scaling_", dir=args.temp_dir)
+
+    try:
+        inputs = {}
+        for nbarcodes in sorted(set(config.barcodes for config in configs)):
+            print("Writing %i reads with %i barcodes ..."
+                  % (args.reads, nbarcodes), file=sys.stderr)
+            inputs[nbarcodes] = write_inputs(args, root, nbarcodes)
+
+        rows = []
+        for config in configs:
+            filenames, read_length = inputs[config.barcodes]
+            nreads = args.reads * (2 if config.mode == "PE" else 1)
+
+            for threads in args.threads:
+                for nth in range(1, args.replicates + 1):
+                    wall_time, cpu_time, max_rss, steps \
+                        = run_once(args, config, filenames, threads, root)
+
+                    row = {"Name": build_name(config),
+                           "ReadLen": read_length,
+                           "Reads": config.mode,
+                           "Metric": "Throughput",
+                           "Threads": threads,
+                           "Nth": nth,
+                           "Rate": "%.1f" % (nreads / wall_time / 1e3,),
+                           "Compression": config.compression,
+                           "Level": config.level or "NA",
+                           "Collapse": "yes" if config.collapse else "no",
+                           "Barcodes": config.barcodes,
+                           "WallTime": "%.3f" % (wall_time,),
+                           "CPU": "%.1f" % (100.0 * cpu_time / wall_time,),
+                           "MaxRAM": "%.3f" % (max_rss / (2.0 ** 10),)}
+
+                    for key, value in steps.items():
+                        row["Step:" + key] = "%.3f" % (value,)
+
+                    print("%s\t%s\t%i threads\t#%i: %s k reads/s"
+                          % (row["Name"], config.mode, threads, nth,
+                             row["Rate"]), file=sys.stderr)
+                    rows.append(row)
+    finally:
+        shutil.rmtree(root)
+
+    if args.output == "-":
+        write_table(sys.stdout, rows)
+    else:
+        with open(args.output, "w") as handle:
+            write_table(handle, rows)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -3,6 +3,8 @@
 
 #include "../../src/adapterset.h"
 #include "../../src/alignment.h"
+#include "../../src/alignment_packed.h"
+#include "../../src/alignment_simd.h"
 #include "../../src/argparse.h"
 #include "../../src/commontypes.h"
 #include "../../src/debug.h"
@@ -13,10 +15,12 @@
 #include "../../src/linereader.h"
 #include "../../src/main.h"
 #include "../../src/scheduler.h"
+#include "../../src/simd.h"
 #include "../../src/statistics.h"
 #include "../../src/strutils.h"
 #include "../../src/threads.h"
 #include "../../src/timer.h"
+#include "../../src/trimmer.h"
 #include "../../src/userconfig.h"
 #include "../../src/vecutils.h"
 
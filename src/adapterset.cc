@@ -455,4 +455,201 @@ const std::string& adapter_set::get_sample_name(size_t nth) const
     return m_samples.at(nth);
 }
 
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'adapter_index' class
+
+/** Rolling 2-bit encoding of the k-mers in a sequence, skipping Ns. */
+class kmer_encoder
+{
+public:
+    kmer_encoder()
+      : m_kmer(0)
+      , m_length(0)
+    {
+    }
+
+    /** Adds a nucleotide; returns true if 'kmer()' is a full k-mer. */
+    bool add(char nt)
+    {
+        switch (nt) {
+            case 'A': m_kmer = (m_kmer << 2); break;
+            case 'C': m_kmer = (m_kmer << 2) | 1; break;
+            case 'G': m_kmer = (m_kmer << 2) | 2; break;
+            case 'T': m_kmer = (m_kmer << 2) | 3; break;
+            default:
+                m_length = 0;
+                return false;
+        }
+
+        return ++m_length >= adapter_index::KMER_LENGTH;
+    }
+
+    unsigned kmer() const
+    {
+        return m_kmer & KMER_MASK;
+    }
+
+private:
+    // Mask covering 2 * KMER_LENGTH bits; written to avoid overflow for k = 16
+    static const unsigned KMER_MASK = ((1u << (2 * adapter_index::KMER_LENGTH - 1)) - 1) * 2 + 1;
+
+    //! The current (partial) k-mer, possibly including bits of older k-mers
+    unsigned m_kmer;
+    //! Number of consecutive nucleotides, not counting Ns
+    size_t m_length;
+};
+
+
+/** Orders k-mer entries by their k-mer only. */
+bool kmer_less(const std::pair<unsigned, size_t>& a,
+               const std::pair<unsigned, size_t>& b)
+{
+    return a.first < b.first;
+}
+
+
+adapter_index::adapter_index(const fastq_pair_vec& adapters, bool paired_end_mode)
+  : m_adapter_count(adapters.size())
+  , m_index_1()
+  , m_index_2()
+  , m_unindexed()
+{
+    for (size_t id = 0; id < adapters.size(); ++id) {
+        const fastq_pair& adapter = adapters.at(id);
+
+        add_kmers(m_index_1, adapter.first.sequence(), id);
+        if (paired_end_mode) {
+            add_kmers(m_index_2, adapter.second.sequence(), id);
+        }
+
+        if (!has_kmers(adapter.first.sequence()) &&
+            !(paired_end_mode && has_kmers(adapter.second.sequence()))) {
+            m_unindexed.push_back(id);
+        }
+    }
+
+    // Sorting on both k-mer and id allows removal of duplicate k-mers
+    std::sort(m_index_1.begin(), m_index_1.end());
+    m_index_1.erase(std::unique(m_index_1.begin(), m_index_1.end()), m_index_1.end());
+
+    std::sort(m_index_2.begin(), m_index_2.end());
+    m_index_2.erase(std::unique(m_index_2.begin(), m_index_2.end()), m_index_2.end());
+}
+
+
+const size_vec& adapter_index::select_candidates(const fastq& read,
+                                                 size_vec& candidates) const
+{
+    candidates.assign(m_adapter_count, 0);
+    count_kmers(m_index_1, read.sequence().data(), read.length(), candidates);
+    finalize_candidates(candidates);
+
+    return candidates;
+}
+
+
+const size_vec& adapter_index::select_candidates(const fastq& read1,
+                                                 const fastq& read2,
+                                                 size_vec& candidates) const
+{
+    candidates.assign(m_adapter_count, 0);
+    count_kmers(m_index_1, read1.sequence().data(), read1.length(), candidates);
+    count_kmers(m_index_2, read2.sequence().data(), read2.length(), candidates);
+    finalize_candidates(candidates);
+
+    return candidates;
+}
+
+
+const size_vec& adapter_index::select_candidates(const fastq_batch& mates1,
+                                                 const fastq_batch& mates2,
+                                                 size_t nth,
+                                                 size_vec& candidates) const
+{
+    candidates.assign(m_adapter_count, 0);
+    count_kmers(m_index_1, mates1.sequence(nth), mates1.length(nth), candidates);
+    count_kmers(m_index_2, mates2.sequence(nth), mates2.length(nth), candidates);
+    finalize_candidates(candidates);
+
+    return candidates;
+}
+
+
+void adapter_index::add_kmers(kmer_vec& index, const std::string& sequence, size_t id)
+{
+    kmer_encoder encoder;
+    for (std::string::const_iterator it = sequence.begin(); it != sequence.end(); ++it) {
+        if (encoder.add(*it)) {
+            index.push_back(kmer_entry(encoder.kmer(), id));
+        }
+    }
+}
+
+
+bool adapter_index::has_kmers(const std::string& sequence)
+{
+    kmer_encoder encoder;
+    for (std::string::const_iterator it = sequence.begin(); it != sequence.end(); ++it) {
+        if (encoder.add(*it)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void adapter_index::count_kmers(const kmer_vec& index, const char* sequence,
+                                size_t length, size_vec& counts)
+{
+    if (index.empty()) {
+        return;
+    }
+
+    kmer_encoder encoder;
+    for (const char* it = sequence; it != sequence + length; ++it) {
+        if (encoder.add(*it)) {
+            const kmer_entry key(encoder.kmer(), 0);
+            kmer_vec::const_iterator hit = std::lower_bound(index.begin(), index.end(), key, kmer_less);
+
+            for (; hit != index.end() && hit->first == key.first; ++hit) {
+                counts.at(hit->second)++;
+            }
+        }
+    }
+}
+
+
+void adapter_index::finalize_candidates(size_vec& counts) const
+{
+    const size_t max_count = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+
+    if (!max_count) {
+        // No k-mers shared; fall back to aligning against every adapter
+        for (size_t id = 0; id < counts.size(); ++id) {
+            counts.at(id) = id;
+        }
+
+        return;
+    }
+
+    // Candidate ids are written in place; 'out' never overtakes 'id'
+    size_t out = 0;
+    size_vec::const_iterator unindexed = m_unindexed.begin();
+    for (size_t id = 0; id < counts.size(); ++id) {
+        const bool is_unindexed = (unindexed != m_unindexed.end() && *unindexed == id);
+        if (is_unindexed) {
+            ++unindexed;
+        }
+
+        if (is_unindexed || counts.at(id) == max_count) {
+            counts.at(out++) = id;
+        }
+    }
+
+    counts.resize(out);
+}
+
 } // namespace ar
@@ -101,6 +101,79 @@ private:
     fastq_pair_vec m_adapters;
 };
 
+/**
+ * K-mer index of a set of adapter (pairs), used to select the adapters that
+ * are most likely to be found in a read prior to alignment.
+ *
+ * The candidate adapters for a read are those sharing the greatest number
+ * of k-mers with the read (mate 1 for the first adapter in each pair, and
+ * reverse complemented mate 2 for the second adapter), along with any
+ * adapters too short to be indexed. If no k-mers are shared with any of the
+ * adapters, all adapters are candidates, in which case the alignment is
+ * identical to aligning without using the index.
+ */
+class adapter_index
+{
+public:
+    //! Length of k-mers used for indexing; at most 16
+    static const size_t KMER_LENGTH = 12;
+
+    /**
+     * Builds an index for a set of adapters, e.g. as returned by
+     * adapter_set::get_adapter_set; the second adapters in each pair are
+     * only indexed in paired_end_mode.
+     */
+    adapter_index(const fastq_pair_vec& adapters, bool paired_end_mode);
+
+    /**
+     * Selects candidate adapters for a SE read. The (sorted) ids are written
+     * to 'candidates', which is also returned.
+     */
+    const size_vec& select_candidates(const fastq& read,
+                                      size_vec& candidates) const;
+
+    /**
+     * Selects candidate adapters for a PE read, with 'read2' in the same
+     * orientation as 'read1' (see align_paired_ended_sequences).
+     */
+    const size_vec& select_candidates(const fastq& read1,
+                                      const fastq& read2,
+                                      size_vec& candidates) const;
+
+    /** Selects candidate adapters for the nth records of two batches of mates. */
+    const size_vec& select_candidates(const fastq_batch& mates1,
+                                      const fastq_batch& mates2,
+                                      size_t nth,
+                                      size_vec& candidates) const;
+
+private:
+    //! Pair of (k-mer, adapter id)
+    typedef std::pair<unsigned, size_t> kmer_entry;
+    typedef std::vector<kmer_entry> kmer_vec;
+
+    /** Adds k-mers from a sequence to an index. */
+    static void add_kmers(kmer_vec& index, const std::string& sequence, size_t id);
+
+    /** Returns true if the sequence contains at least one k-mer. */
+    static bool has_kmers(const std::string& sequence);
+
+    /** Adds the count of shared k-mers to the count for each adapter. */
+    static void count_kmers(const kmer_vec& index, const char* sequence,
+                            size_t length, size_vec& counts);
+
+    /** Converts per adapter counts to candidate ids (see class doc). */
+    void finalize_candidates(size_vec& counts) const;
+
+    //! Number of adapters indexed
+    size_t m_adapter_count;
+    //! Index of k-mers in the first adapter sequence of each pair
+    kmer_vec m_index_1;
+    //! Index of k-mers in the second adapter sequence of each pair
+    kmer_vec m_index_2;
+    //! Sorted ids of adapters without k-mers; these are always candidates
+    size_vec m_unindexed;
+};
+
 } // namespace ar
 
 #endif
@@ -23,6 +23,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
 
+#include <climits>
 #include <cstdlib>
 #include <cmath>
 #include <cstdio>
@@ -32,115 +33,176 @@
 #include <cstring>
 
 #include "alignment.h"
+#include "alignment_packed.h"
+#include "alignment_simd.h"
 #include "debug.h"
 #include "fastq.h"
 
 namespace ar
 {
 
-#if defined(__SSE__) && defined(__SSE2__)
-#include <xmmintrin.h>
+/** Portable kernel, used if no SIMD instructions are available. */
+bool compare_subsequences_none(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr)
+{
+    current.score = current.length;
 
-//! Mask representing those (sparse) bits used when comparing multiple
-//! nucleotides. These are simply the least significant bit in each byte.
-const __m128i BIT_MASK_128 = _mm_set1_epi8(1);
-//! Zero'd 128b integer.
-const __m128i ZERO_128 = _mm_set1_epi8(0);
-//! Mask of all Ns
-const __m128i N_MASK_128 = _mm_set1_epi8('N');
+    return compare_subsequences_std(best, current, seq_1_ptr, seq_2_ptr,
+                                    current.length);
+}
 
 
-/** Counts the number of bits set in a __m128i. **/
-inline size_t COUNT_BITS_128(__m128i value)
+compare_subsequences_func select_compare_subsequences(simd::instruction_set is)
 {
-    // Calculates the abs. difference between each pair of bytes in the upper
-    // and lower 64bit integers, and places the sum of these differences in
-    // the 0th and 4th shorts (16b).
-    value = _mm_sad_epu8(ZERO_128, value);
-    // Return the 0th and 4th shorts containing the sums calculated above
-    return _mm_extract_epi16(value, 0) + _mm_extract_epi16(value, 4);
-}
-#else
-#warning SEE optimizations disabled!
+    switch (is) {
+        case simd::none:
+            return &compare_subsequences_none;
+#if defined(AR_SIMD_X86)
+        case simd::sse2:
+            return &compare_subsequences_sse2;
+        case simd::avx2:
+            return &compare_subsequences_avx2;
+        case simd::avx512:
+            return &compare_subsequences_avx512;
+#endif
+#if defined(AR_SIMD_NEON)
+        case simd::neon:
+            return &compare_subsequences_neon;
 #endif
+        default:
+            throw std::invalid_argument("instruction set not supported by build: "
+                                        + simd::name(is));
+    }
+}
 
 
-/**
- * Compares two subsequences in an alignment to a previous (best) alignment.
- *
- * @param best The currently best alignment, used for evaluating this alignment
- * @param current The current alignment to be evaluated (counts are assumed to be zero'd!)
- * @param seq_1_ptr Pointer to the first base in the first sequence in the alignment.
- * @param seq_2_ptr Pointer to the first base in the second sequence in the alignment.
- * @return True if the current alignment is at least as good as the best alignment, false otherwise.
- *
- * If the function returns false, the current alignment cannot be assumed to
- * have been completely evaluated (due to early termination), and hence counts
- * and scores are not reliable. The function assumes uppercase nucleotides.
- */
-bool compare_subsequences(const alignment_info& best, alignment_info& current,
-                          const char* seq_1_ptr, const char* seq_2_ptr)
-{
-    int remaining_bases = current.score = current.length;
-
-#if defined(__SSE__) && defined(__SSE2__)
-    while (remaining_bases >= 16 && current.score >= best.score) {
-        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1_ptr));
-        const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2_ptr));
+//! Fastest compare_subsequences kernel supported by the current CPU
+const compare_subsequences_func g_compare_subsequences
+    = select_compare_subsequences(simd::best_supported());
 
-        // Sets 0xFF for every byte where one or both nts is N
-        const __m128i ns_mask = _mm_or_si128(_mm_cmpeq_epi8(s1, N_MASK_128),
-                                             _mm_cmpeq_epi8(s2, N_MASK_128));
+//! Bit-parallel alignment engine, using hardware popcount if supported; this
+//! is selected independently of the SIMD kernels, since SSE2 CPUs may or may
+//! not support POPCNT
+const pairwise_align_packed_func g_pairwise_align_packed
+    = select_pairwise_align_packed(simd::has_popcnt());
 
-        // Sets 0xFF for every byte where bytes differ, but neither is N
-        const __m128i mm_mask = ~_mm_or_si128(_mm_cmpeq_epi8(s1, s2), ns_mask);
+//! With hardware popcount, trimming 100 - 250 bp pairs using the bit-parallel
+//! engine is about 1.7x as fast as using the SSE2 kernel, and comparable to
+//! using the AVX2 kernel (faster for short reads, slower for long reads); the
+//! portable popcount only gives a speedup of 1.2 - 1.3x. The engine is
+//! therefore used unless wider SIMD instructions are available.
+const bool g_prefer_packed = (simd::best_supported() == simd::none)
+                          || (simd::best_supported() == simd::sse2);
 
-        current.n_ambiguous += COUNT_BITS_128(_mm_and_si128(ns_mask, BIT_MASK_128));
-        current.n_mismatches += COUNT_BITS_128(_mm_and_si128(mm_mask, BIT_MASK_128));
 
-        // Matches count for 1, Ns for 0, and mismatches for -1
-        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+/**
+ * A sequence consisting of one or two segments (e.g. adapter + read), which
+ * is made available as a contiguous string without heap allocations for
+ * typical read lengths; this avoids allocator contention when aligning
+ * with many adapters using many threads.
+ */
+class joined_sequence
+{
+public:
+    joined_sequence(const char* first, size_t first_length)
+      : m_first(first)
+      , m_first_length(first_length)
+      , m_second(NULL)
+      , m_second_length(0)
+      , m_fallback()
+      , m_data(first)
+      , m_length(first_length)
+    {
+    }
 
-        seq_1_ptr += 16;
-        seq_2_ptr += 16;
-        remaining_bases -= 16;
+    joined_sequence(const char* first, size_t first_length,
+                    const char* second, size_t second_length)
+      : m_first(first)
+      , m_first_length(first_length)
+      , m_second(second)
+      , m_second_length(second_length)
+      , m_fallback()
+      , m_data(m_buffer)
+      , m_length(first_length + second_length)
+    {
+        if (m_length <= BUFFER_SIZE) {
+            std::memcpy(m_buffer, first, first_length);
+            std::memcpy(m_buffer + first_length, second, second_length);
+        } else {
+            m_fallback.reserve(m_length);
+            m_fallback.append(first, first_length).append(second, second_length);
+            m_data = m_fallback.data();
+        }
     }
-#endif
 
-    for (; remaining_bases && current.score >= best.score; --remaining_bases) {
-        const char nt_1 = *seq_1_ptr++;
-        const char nt_2 = *seq_2_ptr++;
+    const char* data() const { return m_data; }
+    size_t length() const { return m_length; }
 
-        if (nt_1 == 'N' || nt_2 == 'N') {
-            current.n_ambiguous++;
-            current.score--;
-        } else if (nt_1 != nt_2) {
-            current.n_mismatches++;
-            current.score -= 2;
-        }
+    /** Packs the sequence; see packed_sequence::append. */
+    bool pack(packed_sequence& packed) const
+    {
+        return packed.append(m_first, m_first_length)
+            && (!m_second || packed.append(m_second, m_second_length));
     }
 
-    return current.is_better_than(best);
-}
+private:
+    //! Not implemented
+    joined_sequence(const joined_sequence&);
+    //! Not implemented
+    joined_sequence& operator=(const joined_sequence&);
+
+    //! Size of the buffer used for the concatenated sequence
+    enum { BUFFER_SIZE = 1024 };
+
+    //! The first and (optional) second segments
+    const char* m_first;
+    size_t m_first_length;
+    const char* m_second;
+    size_t m_second_length;
+    //! Concatenated sequence, if the buffer is too small
+    std::string m_fallback;
+    //! Buffer containing the concatenated sequence
+    char m_buffer[BUFFER_SIZE];
+    //! Pointer to the first base of the (concatenated) sequence
+    const char* m_data;
+    //! Length of the (concatenated) sequence
+    size_t m_length;
+};
 
 
 alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
-                                        const std::string& seq1,
-                                        const std::string& seq2,
+                                        const joined_sequence& seq1,
+                                        const joined_sequence& seq2,
                                         int min_offset = std::numeric_limits<int>::min(),
                                         int max_offset = std::numeric_limits<int>::max())
 {
     const int start_offset = std::max<int>(min_offset, -static_cast<int>(seq2.length()) + 1);
     const int end_offset = std::min<int>(max_offset, static_cast<int>(seq1.length()) - 1);
 
+    if (g_prefer_packed) {
+        packed_sequence packed1;
+        packed_sequence packed2;
+        if (seq1.pack(packed1) && seq2.pack(packed2)) {
+            return g_pairwise_align_packed(best_alignment, packed1, packed2,
+                                           start_offset, end_offset);
+        }
+    }
+
     alignment_info best = best_alignment;
     for (int offset = start_offset; offset <= end_offset; ++offset) {
         const size_t initial_seq1_offset = std::max<int>(0,  offset);
         const size_t initial_seq2_offset = std::max<int>(0, -offset);
-        const size_t length = std::min(seq1.length() - initial_seq1_offset,
+        const size_t seq1_length = seq1.length() - initial_seq1_offset;
+        const size_t length = std::min(seq1_length,
                                        seq2.length() - initial_seq2_offset);
 
-        if (static_cast<int>(length) >= best.score) {
+        if (static_cast<int>(seq1_length) < best.score) {
+            // The remainder of seq1 only shrinks for later offsets; this is
+            // typically the case for most offsets when --shift is 0
+            break;
+        } else if (static_cast<int>(length) >= best.score) {
             alignment_info current;
             current.offset = offset;
             current.length = length;
@@ -148,7 +210,7 @@ alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
             const char* seq_1_ptr = seq1.data() + initial_seq1_offset;
             const char* seq_2_ptr = seq2.data() + initial_seq2_offset;
 
-            if (compare_subsequences(best, current, seq_1_ptr, seq_2_ptr)) {
+            if (g_compare_subsequences(best, current, seq_1_ptr, seq_2_ptr)) {
                 best = current;
             }
         }
@@ -173,15 +235,19 @@ struct phred_scores
 };
 
 
+//! Number of rows / columns in the table of consensus Phred scores
+const size_t PHRED_TABLE_SIZE = MAX_PHRED_SCORE + 1;
+
+
 /**
  * Calculates the phred scores to be assigned to a consensus base based on two
  * bases, depending on the Phred scores assigned two these two bases. A phred
  * score is calculated for both the case where the two bases are identical, and
- * the case where they differ.
+ * the case where they differ; in the latter case, the base with the higher
+ * Phred score is assumed to be selected.
  *
- * The returned vector is inded by (phred1 * MAX_PHRED_SCORE) + phred2, where
- * phred1 is assumed to be >= phred2. This is because we always select the base
- * with the higher Phred score.
+ * The returned (flat) table is indexed by (phred1 * PHRED_TABLE_SIZE) + phred2,
+ * and is symmetric, so that the order of the two scores does not matter.
  */
 std::vector<phred_scores> calculate_phred_score()
 {
@@ -194,11 +260,10 @@ std::vector<phred_scores> calculate_phred_score()
         Ptrue.at(i) = std::log(1.0 - p_err);
     }
 
-    std::vector<phred_scores> new_scores((MAX_PHRED_SCORE + 1) * (MAX_PHRED_SCORE + 1));
+    std::vector<phred_scores> new_scores(PHRED_TABLE_SIZE * PHRED_TABLE_SIZE);
     for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
         for (int j = 0; j <= i; ++j) {
-            const int index = (i * MAX_PHRED_SCORE) + j;
-            phred_scores& scores = new_scores.at(index);
+            phred_scores scores;
 
             {   // When two nucleotides are identical
                 const double ptrue = Ptrue.at(i) + Ptrue.at(j);
@@ -214,6 +279,9 @@ std::vector<phred_scores> calculate_phred_score()
                 const double normconstant = 1.0 + 2.0 * std::exp(perror_both - ptrue) + std::exp(perror_one - ptrue);
                 scores.different_nts = fastq::p_to_phred_33(1.0 - 1.0 / normconstant);
             }
+
+            new_scores.at(i * PHRED_TABLE_SIZE + j) = scores;
+            new_scores.at(j * PHRED_TABLE_SIZE + i) = scores;
         }
     }
 
@@ -221,74 +289,470 @@ std::vector<phred_scores> calculate_phred_score()
 }
 
 
-const phred_scores& get_updated_phred_scores(char qual_1, char qual_2)
+/** Returns the (flat) table of pre-calculated Phred scores; see above. */
+const phred_scores* get_phred_score_table()
 {
-    AR_DEBUG_ASSERT(qual_1 >= qual_2);
-
-    // Cache of pre-calculated Phred scores for consensus bases; see above.
     static const std::vector<phred_scores> updated_phred_scores = calculate_phred_score();
 
-    const size_t index = (static_cast<size_t>(qual_1 - PHRED_OFFSET_33) * MAX_PHRED_SCORE) + static_cast<size_t>(qual_2 - PHRED_OFFSET_33);
-    return updated_phred_scores.at(index);
+    return &updated_phred_scores.front();
 }
 
 
-string_pair collapse_sequence(const std::string& sequence1,
-                              const std::string& sequence2,
-                              const std::string& qualities1,
-                              const std::string& qualities2)
+//! Word used to compare multiple bases at once when collapsing sequences
+typedef size_t collapse_word;
+//! Word with all bytes set to 1
+const collapse_word COLLAPSE_ONES = static_cast<collapse_word>(-1) / 0xFF;
+
+
+/** Returns true if no byte in 'word' is equal to zero. */
+inline bool no_zero_bytes(collapse_word word)
 {
-    AR_DEBUG_ASSERT(sequence1.length() == sequence2.length() &&
-                     sequence1.length() == qualities1.length() &&
-                     sequence1.length() == qualities2.length());
+    return !((word - COLLAPSE_ONES) & ~word & (COLLAPSE_ONES << 7));
+}
 
-    std::string collapsed_seq(sequence1.length(), 'X');
-    std::string collapsed_qual(sequence1.length(), '\0');
 
-    for (size_t i = 0; i < collapsed_seq.size(); ++i) {
-        char nt_1 = sequence1.at(i);
-        char nt_2 = sequence2.at(i);
-        char qual_1 = qualities1.at(i);
-        char qual_2 = qualities2.at(i);
+/**
+ * Collapses 'length' overlapping bases into 'seq_out' / 'qual_out'; see
+ * collapse_paired_ended_sequences. Phred scores are expected to be Phred+33
+ * encoded, and to be in the range 0 .. MAX_PHRED_SCORE.
+ */
+void collapse_sequence(const char* seq_1, const char* qual_1,
+                       const char* seq_2, const char* qual_2,
+                       size_t length, char* seq_out, char* qual_out)
+{
+    const phred_scores* const table = get_phred_score_table();
+
+    size_t i = 0;
+    while (i < length) {
+        // Blocks of identical bases, excluding Ns, only require score lookups
+        if (length - i >= sizeof(collapse_word)) {
+            collapse_word word_1 = 0;
+            collapse_word word_2 = 0;
+            std::memcpy(&word_1, seq_1 + i, sizeof(collapse_word));
+            std::memcpy(&word_2, seq_2 + i, sizeof(collapse_word));
+
+            if (word_1 == word_2 && no_zero_bytes(word_1 ^ (COLLAPSE_ONES * 'N'))) {
+                std::memcpy(seq_out + i, &word_1, sizeof(collapse_word));
+                for (size_t end = i + sizeof(collapse_word); i < end; ++i) {
+                    const size_t index = (qual_1[i] - PHRED_OFFSET_33) * PHRED_TABLE_SIZE
+                                       + (qual_2[i] - PHRED_OFFSET_33);
+                    qual_out[i] = table[index].identical_nts;
+                }
+
+                continue;
+            }
+        }
 
-        if (nt_1 == 'N' || nt_2 == 'N') {
-            // If one of the bases are N, then we suppose that we just have (at
-            // most) a single read at that site and choose that.
-            if (nt_1 != 'N') {
-                collapsed_seq.at(i) = nt_1;
-                collapsed_qual.at(i) = qual_1;
-            } else if (nt_2 != 'N') {
-                collapsed_seq.at(i) = nt_2;
-                collapsed_qual.at(i) = qual_2;
+        const char nt_1 = seq_1[i];
+        const char nt_2 = seq_2[i];
+        const char q_1 = qual_1[i];
+        const char q_2 = qual_2[i];
+        const phred_scores& scores = table[(q_1 - PHRED_OFFSET_33) * PHRED_TABLE_SIZE
+                                           + (q_2 - PHRED_OFFSET_33)];
+
+        if (nt_1 == nt_2) {
+            if (nt_1 == 'N') {
+                seq_out[i] = 'N';
+                qual_out[i] = PHRED_OFFSET_33;
             } else {
-                collapsed_seq.at(i) = 'N';
-                collapsed_qual.at(i) = PHRED_OFFSET_33;
+                seq_out[i] = nt_1;
+                qual_out[i] = scores.identical_nts;
             }
-        } else if (nt_1 != nt_2 && qual_1 == qual_2) {
+        } else if (nt_1 == 'N' || nt_2 == 'N') {
+            // If one of the bases are N, then we suppose that we just have (at
+            // most) a single read at that site and choose that.
+            const bool use_2 = (nt_1 == 'N');
+            seq_out[i] = use_2 ? nt_2 : nt_1;
+            qual_out[i] = use_2 ? q_2 : q_1;
+        } else if (q_1 == q_2) {
             const int shuffle = random() % 2;
-            collapsed_seq.at(i) = shuffle ? nt_1 : nt_2;
-
-            const phred_scores& new_scores = get_updated_phred_scores(qual_1, qual_2);
-            collapsed_qual.at(i) = new_scores.different_nts;
+            seq_out[i] = shuffle ? nt_1 : nt_2;
+            qual_out[i] = scores.different_nts;
         } else {
-            // Ensure that nt_1 / qual_1 always contains the preferred nt / score
-            // This is an assumption of the g_updated_phred_scores cache.
-            if (qual_1 < qual_2) {
-                std::swap(nt_1, nt_2);
-                std::swap(qual_1, qual_2);
+            // The base with the higher Phred score is selected
+            seq_out[i] = (q_1 > q_2) ? nt_1 : nt_2;
+            qual_out[i] = scores.different_nts;
+        }
+
+        ++i;
+    }
+}
+
+
+/**
+ * Aligns the nth adapter against a SE read, replacing 'best_alignment' if the
+ * resulting alignment is better (see alignment_info::is_better_than).
+ */
+void align_single_ended_adapter(const fastq& read,
+                                const fastq_pair_vec& adapters,
+                                size_t adapter_id,
+                                int max_shift,
+                                alignment_info& best_alignment)
+{
+    const fastq& adapter = adapters.at(adapter_id).first;
+    const alignment_info alignment = pairwise_align_sequences(best_alignment,
+                                                              joined_sequence(read.sequence().data(), read.length()),
+                                                              joined_sequence(adapter.sequence().data(), adapter.length()),
+                                                              -max_shift,
+                                                              std::numeric_limits<int>::max());
+
+    if (alignment.is_better_than(best_alignment)) {
+        best_alignment = alignment;
+        best_alignment.adapter_id = adapter_id;
+    }
+}
+
+
+/**
+ * Aligns a pair of PE reads using the nth adapter pair, replacing the
+ * 'best_alignment' if the resulting alignment is better.
+ */
+void align_paired_ended_adapters(const char* read1, size_t len1,
+                                 const char* read2, size_t len2,
+                                 const fastq_pair_vec& adapters,
+                                 size_t adapter_id,
+                                 int max_shift,
+                                 alignment_info& best_alignment)
+{
+    const fastq& adapter1 = adapters.at(adapter_id).first;
+    const fastq& adapter2 = adapters.at(adapter_id).second;
+
+    const joined_sequence sequence1(adapter2.sequence().data(), adapter2.length(),
+                                    read1, len1);
+    const joined_sequence sequence2(read2, len2,
+                                    adapter1.sequence().data(), adapter1.length());
+
+    // Only consider alignments where at least one nucleotide from each read
+    // is aligned against the other, included shifted alignments to account
+    // for missing bases at the 5' ends of the reads.
+    const int min_offset = adapter2.length() - len2 - max_shift;
+    const alignment_info alignment = pairwise_align_sequences(best_alignment,
+                                                              sequence1,
+                                                              sequence2,
+                                                              min_offset,
+                                                              std::numeric_limits<int>::max());
+
+    if (alignment.is_better_than(best_alignment)) {
+        best_alignment = alignment;
+        best_alignment.adapter_id = adapter_id;
+        // Convert the alignment into an alignment between read 1 & 2 only
+        best_alignment.offset -= adapter2.length();
+    }
+}
+
+
+/**
+ * Counts differences between two sequences of 'length' bases, stopping early
+ * if the score drops below 'min_score'. Counts are only reliable if the
+ * resulting score is at least 'min_score'.
+ */
+alignment_info count_differences(const char* seq_1_ptr,
+                                 const char* seq_2_ptr,
+                                 int length,
+                                 int min_score = std::numeric_limits<int>::min())
+{
+    alignment_info threshold;
+    threshold.score = min_score;
+
+    alignment_info counts;
+    if (length > 0) {
+        counts.length = length;
+        g_compare_subsequences(threshold, counts, seq_1_ptr, seq_2_ptr);
+    }
+
+    return counts;
+}
+
+
+/**
+ * PE alignments with multiple adapter pairs, sharing the alignment of the
+ * mates themselves between all adapter pairs.
+ *
+ * Using read coordinates r (relative to the first base in read 1) and the
+ * alignment offset o, the concatenated sequences adapter2+read1 and
+ * read2+adapter1 are aligned as follows, with the mate vs. mate columns
+ * (r in [max(0, o), min(len1, len2 + o))) not depending on the adapters:
+ *
+ *   r <  0,      r - o <  len2: adapter 2 vs. read 2
+ *   r <  0,      r - o >= len2: adapter 2 vs. adapter 1
+ *   r >= 0,      r - o <  len2: read 1    vs. read 2
+ *   r >= 0,      r - o >= len2: read 1    vs. adapter 1
+ *
+ * The mate vs. mate counts are calculated once per offset and cached, while
+ * only the (short) adapter columns are compared per adapter pair. Offsets,
+ * scores, and tie-breaking are identical to aligning each pair separately.
+ */
+class mate_alignment_cache
+{
+    typedef std::vector<int> int_vec;
+
+public:
+    mate_alignment_cache(const char* read1, size_t len1,
+                         const char* read2, size_t len2,
+                         const fastq_pair_vec& adapters,
+                         int max_shift)
+      : m_read1(read1)
+      , m_read2(read2)
+      , m_len1(len1)
+      , m_len2(len2)
+      , m_max_shift(max_shift)
+      , m_max_adapter1(0)
+      , m_max_adapter2(0)
+      , m_min_offset(0)
+      , m_mates()
+      , m_viable()
+    {
+        for (fastq_pair_vec::const_iterator it = adapters.begin(); it != adapters.end(); ++it) {
+            m_max_adapter1 = std::max<int>(m_max_adapter1, it->first.length());
+            m_max_adapter2 = std::max<int>(m_max_adapter2, it->second.length());
+        }
+
+        m_min_offset = min_offset(m_max_adapter1, m_max_adapter2);
+        if (m_len1 > m_min_offset) {
+            m_mates.resize(m_len1 - m_min_offset, unevaluated());
+        }
+
+        // Alignments at offsets without adapter columns are identical for
+        // all adapter pairs, and are therefore fully evaluated by the first
+        // alignment (see align_paired_ended_sequences)
+        for (int offset = m_min_offset; offset < m_len1; ++offset) {
+            if (max_adapter_columns(offset)) {
+                m_viable.push_back(offset);
             }
+        }
+    }
+
+    /**
+     * Aligns the reads using the nth adapter pair, replacing 'best_alignment'
+     * with the result if it is better; equivalent to
+     * align_paired_ended_adapters.
+     */
+    void align(const fastq_pair_vec& adapters,
+               size_t adapter_id,
+               alignment_info& best_alignment)
+    {
+        const std::string& adapter1 = adapters.at(adapter_id).first.sequence();
+        const std::string& adapter2 = adapters.at(adapter_id).second.sequence();
+        const int len_a1 = adapter1.length();
+        const int len_a2 = adapter2.length();
+
+        const int first_offset = min_offset(len_a1, len_a2);
+
+        // Offsets are removed once they can no longer result in a better
+        // alignment; since later offsets win ties, order must be preserved
+        int_vec::iterator viable_out = m_viable.begin();
+        for (int_vec::iterator it = m_viable.begin(); it != m_viable.end(); ++it) {
+            const int offset = *it;
+            *viable_out++ = offset;
+
+            const int length = std::min(m_len1, m_len2 + len_a1 + offset)
+                             - std::max(-len_a2, offset);
 
-            const phred_scores& new_scores = get_updated_phred_scores(qual_1, qual_2);
+            if (offset < first_offset || length < best_alignment.score) {
+                continue;
+            }
+
+            const alignment_info& mates = get_mates(offset, best_alignment);
+            if (mates.score == PRUNED ||
+                mates.score + max_adapter_columns(offset) < best_alignment.score) {
+                // No adapter pair can result in a better alignment
+                --viable_out;
+                continue;
+            }
+
+            // Upper bound on the score, assuming that adapter columns match
+            const int mates_length = std::max(0, std::min(m_len1, m_len2 + offset) - std::max(0, offset));
+            if (mates.score + (length - mates_length) < best_alignment.score) {
+                continue;
+            }
+
+            alignment_info current;
+            current.offset = offset;
+            current.length = length;
+            current.score = mates.score + (length - mates_length);
+            current.n_ambiguous = mates.n_ambiguous;
+            current.n_mismatches = mates.n_mismatches;
+
+            // Adapter 2 vs. read 2, adapter 2 vs. adapter 1, read 1 vs. adapter 1
+            if (!add_counts(current, best_alignment,
+                            adapter2.data() + len_a2, m_read2 - offset,
+                            std::max(-len_a2, offset), std::min(0, m_len2 + offset)) ||
+                !add_counts(current, best_alignment,
+                            adapter2.data() + len_a2, adapter1.data() - offset - m_len2,
+                            std::max(-len_a2, m_len2 + offset), std::min(0, m_len2 + len_a1 + offset)) ||
+                !add_counts(current, best_alignment,
+                            m_read1, adapter1.data() - offset - m_len2,
+                            std::max(0, m_len2 + offset), std::min(m_len1, m_len2 + len_a1 + offset))) {
+                continue;
+            }
 
-            collapsed_seq.at(i) = nt_1;
-            collapsed_qual.at(i) = (nt_1 == nt_2) ? new_scores.identical_nts : new_scores.different_nts;
+            if (current.is_better_than(best_alignment)) {
+                best_alignment = current;
+                best_alignment.adapter_id = adapter_id;
+            }
         }
+
+        m_viable.erase(viable_out, m_viable.end());
+    }
+
+private:
+    //! Not implemented
+    mate_alignment_cache(const mate_alignment_cache&);
+    //! Not implemented
+    mate_alignment_cache& operator=(const mate_alignment_cache&);
+
+    //! Score marking mate alignments that cannot result in a better alignment
+    static const int PRUNED = INT_MIN;
+    //! Score marking mate alignments that have not yet been evaluated
+    static const int UNEVALUATED = INT_MIN + 1;
+
+    static alignment_info unevaluated()
+    {
+        alignment_info info;
+        info.score = UNEVALUATED;
+        return info;
     }
 
-    return string_pair(collapsed_seq, collapsed_qual);
+    /** Lowest offset considered, in read coordinates (see align_paired_ended_adapters). */
+    int min_offset(int len_a1, int len_a2) const
+    {
+        return std::max(-m_len2 - m_max_shift, -(m_len2 + len_a1 + len_a2) + 1);
+    }
+
+    /** Returns the max number of adapter columns for any adapter pair. */
+    int max_adapter_columns(int offset) const
+    {
+        const int mates_length = std::min(m_len1, m_len2 + offset) - std::max(0, offset);
+
+        return std::min(m_len1, m_len2 + m_max_adapter1 + offset)
+             - std::max(-m_max_adapter2, offset)
+             - std::max(0, mates_length);
+    }
+
+    /** Returns counts for the mate vs mate columns at a given offset. */
+    const alignment_info& get_mates(int offset, const alignment_info& best_alignment)
+    {
+        alignment_info& mates = m_mates.at(offset - m_min_offset);
+        if (mates.score == UNEVALUATED) {
+            const int mates_begin = std::max(0, offset);
+            const int mates_end = std::min(m_len1, m_len2 + offset);
+
+            // Since scores of the best alignment only increase, alignments
+            // pruned here can never be better than later best alignments
+            const int min_score = best_alignment.score - max_adapter_columns(offset);
+
+            mates = count_differences(m_read1 + mates_begin,
+                                      m_read2 + mates_begin - offset,
+                                      mates_end - mates_begin,
+                                      min_score);
+
+            if (mates.score < min_score) {
+                mates.score = PRUNED;
+            }
+        }
+
+        return mates;
+    }
+
+    /**
+     * Adds counts for the read-coordinates [begin, end) to 'current', where
+     * current.score is an upper bound assuming that these columns match.
+     * Returns false if the alignment cannot be better than the best alignment.
+     */
+    static bool add_counts(alignment_info& current,
+                           const alignment_info& best_alignment,
+                           const char* seq_1_ptr,
+                           const char* seq_2_ptr,
+                           int begin,
+                           int end)
+    {
+        if (begin < end) {
+            const int length = end - begin;
+            const int min_score = best_alignment.score - (current.score - length);
+            const alignment_info counts = count_differences(seq_1_ptr + begin,
+                                                            seq_2_ptr + begin,
+                                                            length,
+                                                            min_score);
+
+            if (counts.score < min_score) {
+                return false;
+            }
+
+            current.score += counts.score - length;
+            current.n_ambiguous += counts.n_ambiguous;
+            current.n_mismatches += counts.n_mismatches;
+        }
+
+        return true;
+    }
+
+    //! Mate 1 and (reverse complemented) mate 2 sequences
+    const char* m_read1;
+    const char* m_read2;
+    //! Lengths of mate 1 and mate 2
+    const int m_len1;
+    const int m_len2;
+    //! Max number of missing bases at the 5' ends
+    const int m_max_shift;
+    //! Length of the longest adapter 1 and adapter 2 sequences
+    int m_max_adapter1;
+    int m_max_adapter2;
+    //! Offset corresponding to the first value in m_mates
+    int m_min_offset;
+    //! Mate vs mate counts, indexed by offset - m_min_offset
+    std::vector<alignment_info> m_mates;
+    //! Sorted offsets that may still result in a better alignment
+    int_vec m_viable;
+};
+
+
+/** Aligns PE mates using all adapter pairs; see align_paired_ended_sequences. */
+alignment_info align_paired_ended_sequences(const char* read1, size_t len1,
+                                            const char* read2, size_t len2,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift)
+{
+    alignment_info best_alignment;
+    if (adapters.size() > 1) {
+        // The first alignment is used to prune offsets when filling the cache
+        align_paired_ended_adapters(read1, len1, read2, len2, adapters, 0, max_shift, best_alignment);
+
+        mate_alignment_cache cache(read1, len1, read2, len2, adapters, max_shift);
+        for (size_t adapter_id = 1; adapter_id < adapters.size(); ++adapter_id) {
+            cache.align(adapters, adapter_id, best_alignment);
+        }
+    } else if (!adapters.empty()) {
+        align_paired_ended_adapters(read1, len1, read2, len2, adapters, 0, max_shift, best_alignment);
+    }
+
+    return best_alignment;
+}
+
+
+/** Aligns PE mates using a subset of adapter pairs. */
+alignment_info align_paired_ended_sequences(const char* read1, size_t len1,
+                                            const char* read2, size_t len2,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift,
+                                            const size_vec& candidates)
+{
+    alignment_info best_alignment;
+    if (candidates.size() > 1) {
+        align_paired_ended_adapters(read1, len1, read2, len2, adapters, candidates.front(), max_shift, best_alignment);
+
+        mate_alignment_cache cache(read1, len1, read2, len2, adapters, max_shift);
+        for (size_vec::const_iterator it = candidates.begin() + 1; it != candidates.end(); ++it) {
+            cache.align(adapters, *it, best_alignment);
+        }
+    } else if (!candidates.empty()) {
+        align_paired_ended_adapters(read1, len1, read2, len2, adapters, candidates.front(), max_shift, best_alignment);
+    }
+
+    return best_alignment;
 }
 
 
+
 ///////////////////////////////////////////////////////////////////////////////
 // Public functions
 
@@ -324,20 +788,23 @@ alignment_info align_single_ended_sequence(const fastq& read,
                                            const fastq_pair_vec& adapters,
                                            int max_shift)
 {
-    size_t adapter_id = 0;
     alignment_info best_alignment;
-    for (fastq_pair_vec::const_iterator it = adapters.begin(); it != adapters.end(); ++it, ++adapter_id) {
-        const fastq& adapter = it->first;
-        const alignment_info alignment = pairwise_align_sequences(best_alignment,
-                                                                  read.sequence(),
-                                                                  adapter.sequence(),
-                                                                  -max_shift,
-                                                                  std::numeric_limits<int>::max());
-
-        if (alignment.is_better_than(best_alignment)) {
-            best_alignment = alignment;
-            best_alignment.adapter_id = adapter_id;
-        }
+    for (size_t adapter_id = 0; adapter_id < adapters.size(); ++adapter_id) {
+        align_single_ended_adapter(read, adapters, adapter_id, max_shift, best_alignment);
+    }
+
+    return best_alignment;
+}
+
+
+alignment_info align_single_ended_sequence(const fastq& read,
+                                           const fastq_pair_vec& adapters,
+                                           int max_shift,
+                                           const size_vec& candidates)
+{
+    alignment_info best_alignment;
+    for (size_vec::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+        align_single_ended_adapter(read, adapters, *it, max_shift, best_alignment);
     }
 
     return best_alignment;
@@ -349,34 +816,46 @@ alignment_info align_paired_ended_sequences(const fastq& read1,
                                             const fastq_pair_vec& adapters,
                                             int max_shift)
 {
-    size_t adapter_id = 0;
-    alignment_info best_alignment;
-    for (fastq_pair_vec::const_iterator it = adapters.begin(); it != adapters.end(); ++it, ++adapter_id) {
-        const fastq& adapter1 = it->first;
-        const fastq& adapter2 = it->second;
-
-        const std::string sequence1 = adapter2.sequence() + read1.sequence();
-        const std::string sequence2 = read2.sequence() + adapter1.sequence();
-
-        // Only consider alignments where at least one nucleotide from each read
-        // is aligned against the other, included shifted alignments to account
-        // for missing bases at the 5' ends of the reads.
-        const int min_offset = adapter2.length() - read2.length() - max_shift;
-        alignment_info alignment = pairwise_align_sequences(best_alignment,
-                                                            sequence1,
-                                                            sequence2,
-                                                            min_offset,
-                                                            std::numeric_limits<int>::max());
-
-        if (alignment.is_better_than(best_alignment)) {
-            best_alignment = alignment;
-            best_alignment.adapter_id = adapter_id;
-            // Convert the alignment into an alignment between read 1 & 2 only
-            best_alignment.offset -= adapter2.length();
-        }
-    }
+    return align_paired_ended_sequences(read1.sequence().data(), read1.length(),
+                                        read2.sequence().data(), read2.length(),
+                                        adapters, max_shift);
+}
 
-    return best_alignment;
+
+alignment_info align_paired_ended_sequences(const fastq& read1,
+                                            const fastq& read2,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift,
+                                            const size_vec& candidates)
+{
+    return align_paired_ended_sequences(read1.sequence().data(), read1.length(),
+                                        read2.sequence().data(), read2.length(),
+                                        adapters, max_shift, candidates);
+}
+
+
+alignment_info align_paired_ended_sequences(const fastq_batch& mates1,
+                                            const fastq_batch& mates2,
+                                            size_t nth,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift)
+{
+    return align_paired_ended_sequences(mates1.sequence(nth), mates1.length(nth),
+                                        mates2.sequence(nth), mates2.length(nth),
+                                        adapters, max_shift);
+}
+
+
+alignment_info align_paired_ended_sequences(const fastq_batch& mates1,
+                                            const fastq_batch& mates2,
+                                            size_t nth,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift,
+                                            const size_vec& candidates)
+{
+    return align_paired_ended_sequences(mates1.sequence(nth), mates1.length(nth),
+                                        mates2.sequence(nth), mates2.length(nth),
+                                        adapters, max_shift, candidates);
 }
 
 
@@ -418,35 +897,103 @@ size_t truncate_paired_ended_sequences(const alignment_info& alignment,
 }
 
 
-fastq collapse_paired_ended_sequences(const alignment_info& alignment,
-                                      const fastq& read1,
-                                      const fastq& read2)
+size_t truncate_paired_ended_sequences(const alignment_info& alignment,
+                                       fastq_batch& mates1,
+                                       fastq_batch& mates2,
+                                       size_t nth)
 {
-    if (alignment.offset > static_cast<int>(read1.length())) {
+    const size_t len1 = mates1.length(nth);
+    const size_t len2 = mates2.length(nth);
+
+    size_t had_adapter = 0;
+    const int template_length = std::max<int>(0, static_cast<int>(len2) + alignment.offset);
+    if (alignment.offset > static_cast<int>(len1)) {
+        throw std::invalid_argument("invalid offset");
+    } else if (alignment.offset >= 0) {
+        had_adapter += static_cast<size_t>(template_length) < len1;
+        mates1.truncate(nth, 0, static_cast<size_t>(template_length));
+    } else {
+        had_adapter += static_cast<size_t>(template_length) < len1;
+        had_adapter += static_cast<size_t>(template_length) < len2;
+
+        mates1.truncate(nth, 0, static_cast<size_t>(template_length));
+        mates2.truncate(nth, static_cast<size_t>(static_cast<int>(len2) - template_length));
+    }
+
+    return had_adapter;
+}
+
+
+/**
+ * Collapses a pair of mates into 'dst', given pointers to the sequences and
+ * qualities of each; 'dst' must not overlap with either mate.
+ */
+void collapse_paired_ended_sequences(const alignment_info& alignment,
+                                     const char* seq_1, const char* qual_1,
+                                     size_t len_1,
+                                     const char* seq_2, const char* qual_2,
+                                     size_t len_2,
+                                     fastq& dst)
+{
+    if (alignment.offset > static_cast<int>(len_1)) {
         // Gap between the two reads is not allowed
         throw std::invalid_argument("invalid offset");
     }
 
     // Offset to the first base overlapping read 2
     const size_t read_1_offset = static_cast<size_t>(std::max(0, alignment.offset));
-    const std::string read_1_seq = read1.sequence().substr(0, read_1_offset);
-    const std::string read_1_qual = read1.qualities().substr(0, read_1_offset);
-
     // Offset to the last base overlapping read 1
-    const size_t read_2_offset = static_cast<int>(read1.length()) - std::max(0, alignment.offset);
-    const std::string read_2_seq = read2.sequence().substr(read_2_offset);
-    const std::string read_2_qual = read2.qualities().substr(read_2_offset);
+    const size_t read_2_offset = len_1 - read_1_offset;
+    if (read_2_offset > len_2) {
+        throw std::invalid_argument("invalid offset");
+    }
+
+    char* seq_out = NULL;
+    char* qual_out = NULL;
+    dst.resize(read_1_offset + len_2, seq_out, qual_out);
+    if (!seq_out) {
+        return;
+    }
+
+    // Non-overlapping parts are copied as is
+    std::memcpy(seq_out, seq_1, read_1_offset);
+    std::memcpy(qual_out, qual_1, read_1_offset);
+    std::memcpy(seq_out + len_1, seq_2 + read_2_offset, len_2 - read_2_offset);
+    std::memcpy(qual_out + len_1, qual_2 + read_2_offset, len_2 - read_2_offset);
 
     // Collapse only the overlapping parts
-    string_pair collapsed = collapse_sequence(read1.sequence().substr(read_1_offset),
-                                              read2.sequence().substr(0, read_2_offset),
-                                              read1.qualities().substr(read_1_offset),
-                                              read2.qualities().substr(0, read_2_offset));
-
-    return fastq(read1.header(),
-                 read_1_seq + collapsed.first + read_2_seq,
-                 read_1_qual + collapsed.second + read_2_qual,
-                 FASTQ_ENCODING_SAM);
+    collapse_sequence(seq_1 + read_1_offset, qual_1 + read_1_offset,
+                      seq_2, qual_2, read_2_offset,
+                      seq_out + read_1_offset, qual_out + read_1_offset);
+}
+
+
+fastq collapse_paired_ended_sequences(const alignment_info& alignment,
+                                      const fastq& read1,
+                                      const fastq& read2)
+{
+    fastq collapsed(read1.header(), "", "", FASTQ_ENCODING_SAM);
+    collapse_paired_ended_sequences(alignment,
+                                    read1.sequence().data(), read1.qualities().data(), read1.length(),
+                                    read2.sequence().data(), read2.qualities().data(), read2.length(),
+                                    collapsed);
+
+    return collapsed;
+}
+
+
+void collapse_paired_ended_sequences(const alignment_info& alignment,
+                                     const fastq_batch& mates1,
+                                     const fastq_batch& mates2,
+                                     size_t nth,
+                                     fastq& dst)
+{
+    AR_DEBUG_ASSERT(!mates1.is_reversed(nth) && !mates2.is_reversed(nth));
+
+    collapse_paired_ended_sequences(alignment,
+                                    mates1.sequence(nth), mates1.qualities(nth), mates1.length(nth),
+                                    mates2.sequence(nth), mates2.qualities(nth), mates2.length(nth),
+                                    dst);
 }
 
 
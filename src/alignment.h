@@ -25,94 +25,14 @@
 #define ALIGNMENT_H
 
 #include <string>
+#include <vector>
 
+#include "alignment_info.h"
 #include "fastq.h"
 
 namespace ar
 {
 
-/**
- * Summarizes an alignment.
- *
- * A single offset value is used to represent the alignment between two
- * sequences, with values ranging from -inf to seq1.len() - 1. The alignment
- * of the first base in each sequence against each other is defined as having
- * the offset 0, with each other offset defined as the relative position of
- * seq 2 base 0 to seq 1 base 0:
- *
- * Seq 1:           aaaaaaaaa
- * seq 2:           bbbbbbbbbbb
- * Offset: 0
- *
- * Seq 1:            aaaaaaaaa
- * Seq 2: bbbbbbbbbbb
- * Offset: -11
- *
- * Seq 1:           aaaaaaaaa
- * Seq 2:                   bbbbbbbbbbb
- * Offset: 8
- *
- * The meaning of the offset is slightly different in SE and PE mode; in SE
- * mode seq2 is the adapter sequence, and the offset therefore unambigiously
- * shows the starting position of the adapter, regardless of the size of the
- * adapter sequence.
- *
- * In PE mode, while the alignment is between seq1+PCR2 and PCR1+seq2, the
- * offset returned is relative to to seq1 and seq2 only. Thus, if '1'
- * represents PCR1 and '2' represents PCR2, the following alignment results
- * from PE mode (ie. offset = -9 rather than 3):
- *
- * Seq 1:    22222222222aaaaaaaaa
- * Seq 2:      bbbbbbbbbbb1111111111
- * Offset: -9
- *
- * Note that the offset can never be greater than len(read 1) - 1, but can be
- * less than -len(seq 2) + 1, if a positive shift is set in PE mode. In PE
- * mode, an offset <= -len(seq 2) indicates that no non-adapter sequence was
- * found, while an offset <= 0 indicates the same for SE mode. Offsets less
- * than -len(seq 2) for PE or less than 0 for SE indicates that bases have been
- * skipped during sequencing, and are discoverable if a shift is set:
- *
- * Read 1:           ...22222222222aaaaaaaaa
- * Read 2:             bbbbbbbbbbb1111111111...
- * Offset: -12
- *
- */
-struct alignment_info
-{
-    /** Defaults to unaligned (len = 0), for adapter_id -1. **/
-    alignment_info();
-
-    /**
-     * Returns true if this is a better alignment than other.
-     *
-     * When selecting among multiple alignments, the follow criteria are used:
-     * 1. The alignment with the highest score is preferred.
-     * 2. If score is equal, the longest alignment is preferred.
-     * 3. If score and length is equal, the alignment with fewest Ns is preferred.
-     */
-    bool is_better_than(const alignment_info& other) const;
-
-
-    //! Alignment score; equal to length - n_ambiguous - 2 * n_mismatches;
-    int score;
-    //! Zero based id of the adapter which offered the best alignment. Is less
-    //! than zero if no alignment was found.
-    int offset;
-    //! The number of base-pairs included in the alignment. This number
-    //! includes both bases aligned between the two mates (in PE mode) and the
-    //! number of bases aligned between mates and adapter sequences.
-    size_t length;
-    //! Number of positions in the alignment in which the two sequences were
-    //! both called (not N) but differed
-    size_t n_mismatches;
-    //! Number of positions in the alignment where one or both bases were N.
-    size_t n_ambiguous;
-    //! Offset describing the alignment between the two sequences (see above).
-    int adapter_id;
-};
-
-
 /**
  * Attempts to align adapters sequences against a SE read.
  *
@@ -128,6 +48,16 @@ alignment_info align_single_ended_sequence(const fastq& read,
                                            const fastq_pair_vec& adapters,
                                            int max_shift);
 
+/**
+ * Attempts to align a subset of adapters against a SE read; 'candidates'
+ * contains the (sorted) ids of the adapters to align. The result is the same
+ * as for the function above, given the same set of adapters.
+ */
+alignment_info align_single_ended_sequence(const fastq& read,
+                                           const fastq_pair_vec& adapters,
+                                           int max_shift,
+                                           const size_vec& candidates);
+
 
 /**
  * Attempts to align PE mates, along with any adapter pairs.
@@ -153,6 +83,34 @@ alignment_info align_paired_ended_sequences(const fastq& read1,
                                             const fastq_pair_vec& adapters,
                                             int max_shift);
 
+/**
+ * Attempts to align PE mates, along with a subset of adapter pairs, namely
+ * those adapter pairs whose (sorted) ids are listed in 'candidates'.
+ */
+alignment_info align_paired_ended_sequences(const fastq& read1,
+                                            const fastq& read2,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift,
+                                            const size_vec& candidates);
+
+
+/**
+ * Aligns the nth records of two batches of PE mates; equivalent to the
+ * functions above, for records with the same sequences.
+ */
+alignment_info align_paired_ended_sequences(const fastq_batch& mates1,
+                                            const fastq_batch& mates2,
+                                            size_t nth,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift);
+
+alignment_info align_paired_ended_sequences(const fastq_batch& mates1,
+                                            const fastq_batch& mates2,
+                                            size_t nth,
+                                            const fastq_pair_vec& adapters,
+                                            int max_shift,
+                                            const size_vec& candidates);
+
 
 /**
  * Truncates a SE read according to the alignment, such that the second read
@@ -173,6 +131,12 @@ size_t truncate_paired_ended_sequences(const alignment_info& alignment,
                                        fastq& read1,
                                        fastq& read2);
 
+/** Truncates the nth records of two batches of PE mates; see above. */
+size_t truncate_paired_ended_sequences(const alignment_info& alignment,
+                                       fastq_batch& mates1,
+                                       fastq_batch& mates2,
+                                       size_t nth);
+
 
 /**
  * Collapses two overlapping PE mates into a single sequence, recalculating the
@@ -192,6 +156,18 @@ fastq collapse_paired_ended_sequences(const alignment_info& alignment,
                                       const fastq& read1,
                                       const fastq& read2);
 
+/**
+ * Collapses the nth pair of mates in two batches; see above. The result is
+ * written to 'dst', re-using its buffers, while its header is left as is.
+ * Neither record may have been lazily reverse complemented; mate 2 records
+ * are instead expected to have been reverse complemented in place.
+ */
+void collapse_paired_ended_sequences(const alignment_info& alignment,
+                                     const fastq_batch& mates1,
+                                     const fastq_batch& mates2,
+                                     size_t nth,
+                                     fastq& dst);
+
 
 /**
  * Truncates reads such that only adapter sequence remains.
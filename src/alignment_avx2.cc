@@ -0,0 +1,94 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "alignment_simd.h"
+
+// Compiled with -mavx2 -mpopcnt; only called if supported by the CPU
+#if defined(AR_SIMD_X86)
+#include <immintrin.h>
+
+namespace ar
+{
+
+bool compare_subsequences_avx2(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr)
+{
+    const __m256i N_MASK_256 = _mm256_set1_epi8('N');
+    const __m128i N_MASK_128 = _mm_set1_epi8('N');
+
+    int remaining_bases = current.score = current.length;
+
+    while (remaining_bases >= 32 && current.score >= best.score) {
+        const __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq_1_ptr));
+        const __m256i s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq_2_ptr));
+
+        // Sets 0xFF for every byte where one or both nts is N
+        const __m256i ns_mask = _mm256_or_si256(_mm256_cmpeq_epi8(s1, N_MASK_256),
+                                                _mm256_cmpeq_epi8(s2, N_MASK_256));
+        // Sets 0xFF for every byte where the nts are identical or either is N
+        const __m256i eq_mask = _mm256_or_si256(_mm256_cmpeq_epi8(s1, s2), ns_mask);
+
+        // One bit per byte; bits not set in 'eq_mask' represent mismatches
+        const unsigned ns_bits = static_cast<unsigned>(_mm256_movemask_epi8(ns_mask));
+        const unsigned mm_bits = ~static_cast<unsigned>(_mm256_movemask_epi8(eq_mask));
+
+        current.n_ambiguous += _mm_popcnt_u32(ns_bits);
+        current.n_mismatches += _mm_popcnt_u32(mm_bits);
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        seq_1_ptr += 32;
+        seq_2_ptr += 32;
+        remaining_bases -= 32;
+    }
+
+    // A single 16-byte step, as up to 31 bases may remain at this point
+    if (remaining_bases >= 16 && current.score >= best.score) {
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1_ptr));
+        const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2_ptr));
+
+        const __m128i ns_mask = _mm_or_si128(_mm_cmpeq_epi8(s1, N_MASK_128),
+                                             _mm_cmpeq_epi8(s2, N_MASK_128));
+        const __m128i eq_mask = _mm_or_si128(_mm_cmpeq_epi8(s1, s2), ns_mask);
+
+        const unsigned ns_bits = static_cast<unsigned>(_mm_movemask_epi8(ns_mask));
+        const unsigned mm_bits = ~static_cast<unsigned>(_mm_movemask_epi8(eq_mask)) & 0xFFFFu;
+
+        current.n_ambiguous += _mm_popcnt_u32(ns_bits);
+        current.n_mismatches += _mm_popcnt_u32(mm_bits);
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        seq_1_ptr += 16;
+        seq_2_ptr += 16;
+        remaining_bases -= 16;
+    }
+
+    return compare_subsequences_std(best, current, seq_1_ptr, seq_2_ptr, remaining_bases);
+}
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,74 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "alignment_simd.h"
+
+// Compiled with -mavx512f -mavx512bw -mpopcnt; only called if supported
+#if defined(AR_SIMD_X86)
+#include <immintrin.h>
+
+namespace ar
+{
+
+bool compare_subsequences_avx512(const alignment_info& best,
+                                 alignment_info& current,
+                                 const char* seq_1_ptr,
+                                 const char* seq_2_ptr)
+{
+    const __m512i N_MASK_512 = _mm512_set1_epi8('N');
+    const __mmask64 ALL_LANES = ~static_cast<__mmask64>(0);
+
+    int remaining_bases = current.score = current.length;
+
+    // Partial blocks are handled using masked loads, which do not fault on
+    // the masked out bytes; there is therefore no need for a scalar tail.
+    while (remaining_bases > 0 && current.score >= best.score) {
+        const __mmask64 lanes = (remaining_bases >= 64) ? ALL_LANES
+            : ((static_cast<__mmask64>(1) << remaining_bases) - 1);
+
+        const __m512i s1 = _mm512_maskz_loadu_epi8(lanes, seq_1_ptr);
+        const __m512i s2 = _mm512_maskz_loadu_epi8(lanes, seq_2_ptr);
+
+        // Set for every byte where one or both nts is N
+        const __mmask64 ns_mask = _mm512_cmpeq_epi8_mask(s1, N_MASK_512)
+                                | _mm512_cmpeq_epi8_mask(s2, N_MASK_512);
+        // Set for every byte where bytes differ, but neither is N
+        const __mmask64 mm_mask = lanes & ~(_mm512_cmpeq_epi8_mask(s1, s2) | ns_mask);
+
+        current.n_ambiguous += _mm_popcnt_u64(ns_mask);
+        current.n_mismatches += _mm_popcnt_u64(mm_mask);
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        seq_1_ptr += 64;
+        seq_2_ptr += 64;
+        remaining_bases -= 64;
+    }
+
+    return current.is_better_than(best);
+}
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,72 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "alignment_simd.h"
+
+#if defined(AR_SIMD_NEON)
+#include <arm_neon.h>
+
+namespace ar
+{
+
+bool compare_subsequences_neon(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr)
+{
+    //! Mask representing the least significant bit in each byte
+    const uint8x16_t BIT_MASK_128 = vdupq_n_u8(1);
+    //! Mask of all Ns
+    const uint8x16_t N_MASK_128 = vdupq_n_u8('N');
+
+    int remaining_bases = current.score = current.length;
+
+    while (remaining_bases >= 16 && current.score >= best.score) {
+        const uint8x16_t s1 = vld1q_u8(reinterpret_cast<const uint8_t*>(seq_1_ptr));
+        const uint8x16_t s2 = vld1q_u8(reinterpret_cast<const uint8_t*>(seq_2_ptr));
+
+        // Sets 0xFF for every byte where one or both nts is N
+        const uint8x16_t ns_mask = vorrq_u8(vceqq_u8(s1, N_MASK_128),
+                                            vceqq_u8(s2, N_MASK_128));
+
+        // Sets 0xFF for every byte where bytes differ, but neither is N
+        const uint8x16_t mm_mask = vmvnq_u8(vorrq_u8(vceqq_u8(s1, s2), ns_mask));
+
+        // Horizontal sums of (at most) 16 set bits
+        current.n_ambiguous += vaddvq_u8(vandq_u8(ns_mask, BIT_MASK_128));
+        current.n_mismatches += vaddvq_u8(vandq_u8(mm_mask, BIT_MASK_128));
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        seq_1_ptr += 16;
+        seq_2_ptr += 16;
+        remaining_bases -= 16;
+    }
+
+    return compare_subsequences_std(best, current, seq_1_ptr, seq_2_ptr, remaining_bases);
+}
+
+} // namespace ar
+
+#endif
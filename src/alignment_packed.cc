@@ -0,0 +1,134 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <cstring>
+
+#include "alignment_packed.h"
+
+namespace ar
+{
+
+/**
+ * Table mapping characters to the bits set for the lo (1), hi (2), and ns (4)
+ * planes; bit 8 is set for characters other than 'ACGTN'.
+ */
+struct nucleotide_codes
+{
+    nucleotide_codes()
+    {
+        for (size_t i = 0; i <= UCHAR_MAX; ++i) {
+            codes[i] = 8;
+        }
+
+        codes[static_cast<unsigned char>('A')] = 0;
+        codes[static_cast<unsigned char>('C')] = 1;
+        codes[static_cast<unsigned char>('G')] = 2;
+        codes[static_cast<unsigned char>('T')] = 3;
+        codes[static_cast<unsigned char>('N')] = 4;
+    }
+
+    packed_word codes[UCHAR_MAX + 1];
+};
+
+
+//! Initialized before threads are started, unlike a function-local static
+const nucleotide_codes g_nucleotide_codes;
+
+
+packed_sequence::packed_sequence()
+  : m_length(0)
+{
+    std::memset(m_lo, 0, sizeof(m_lo));
+    std::memset(m_hi, 0, sizeof(m_hi));
+    std::memset(m_ns, 0, sizeof(m_ns));
+}
+
+
+void packed_sequence::clear()
+{
+    // Only words containing (or following) nucleotides may be non-zero
+    const size_t nwords = (m_length + PACKED_WORD_BITS - 1) / PACKED_WORD_BITS;
+
+    std::memset(m_lo, 0, sizeof(packed_word) * nwords);
+    std::memset(m_hi, 0, sizeof(packed_word) * nwords);
+    std::memset(m_ns, 0, sizeof(packed_word) * nwords);
+    m_length = 0;
+}
+
+
+bool packed_sequence::append(const std::string& sequence)
+{
+    return append(sequence.data(), sequence.length());
+}
+
+
+bool packed_sequence::append(const char* sequence, size_t length)
+{
+    if (m_length + length > MAX_LENGTH) {
+        return false;
+    }
+
+    const packed_word* const codes = g_nucleotide_codes.codes;
+
+    // Bits are accumulated per word, to avoid unpredictable branches
+    unsigned char invalid = 0;
+    for (const char* it = sequence; it != sequence + length; ++it, ++m_length) {
+        const size_t idx = m_length / PACKED_WORD_BITS;
+        const size_t shift = m_length % PACKED_WORD_BITS;
+        const packed_word code = codes[static_cast<unsigned char>(*it)];
+
+        m_lo[idx] |= (code & 1) << shift;
+        m_hi[idx] |= ((code >> 1) & 1) << shift;
+        m_ns[idx] |= ((code >> 2) & 1) << shift;
+        invalid |= code >> 3;
+    }
+
+    return !invalid;
+}
+
+
+/** Portable implementation, using the compiler's popcount fallback. */
+alignment_info pairwise_align_packed_none(const alignment_info& best,
+                                          const packed_sequence& seq1,
+                                          const packed_sequence& seq2,
+                                          int start_offset,
+                                          int end_offset)
+{
+    return pairwise_align_packed_std(best, seq1, seq2, start_offset, end_offset);
+}
+
+
+pairwise_align_packed_func select_pairwise_align_packed(bool hardware_popcnt)
+{
+#if defined(AR_SIMD_X86)
+    if (hardware_popcnt) {
+        return &pairwise_align_packed_popcnt;
+    }
+#else
+    (void)hardware_popcnt;
+#endif
+
+    return &pairwise_align_packed_none;
+}
+
+} // namespace ar
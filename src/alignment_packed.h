@@ -0,0 +1,249 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_ALIGNMENT_PACKED_H
+#define AR_ALIGNMENT_PACKED_H
+
+#include <climits>
+#include <string>
+
+// Included by a kernel built with -mpopcnt; see alignment_simd.h
+#include "alignment_info.h"
+#include "simd.h"
+
+namespace ar
+{
+
+//! Machine word used to store bit-sliced nucleotides
+typedef unsigned long packed_word;
+
+//! The number of nucleotides stored in each packed_word
+const size_t PACKED_WORD_BITS = sizeof(packed_word) * CHAR_BIT;
+
+
+/**
+ * Bit-sliced representation of a nucleotide sequence.
+ *
+ * Each nucleotide is represented by a single bit in each of 3 bit-planes;
+ * A, C, G, and T are encoded using 2 bits (lo/hi), while Ns are encoded in
+ * a separate plane (with lo/hi bits unset). This allows PACKED_WORD_BITS
+ * nucleotides to be compared using a handful of bitwise operations:
+ *   mismatch = ((lo1 ^ lo2) | (hi1 ^ hi2)) & ~(ns1 | ns2)
+ *
+ * Storage is fixed-size, so that no allocations are required for the
+ * typical read-lengths; longer sequences, or sequences containing other
+ * characters than 'ACGTN', are rejected by 'append'.
+ */
+class packed_sequence
+{
+public:
+    //! Maximum number of nucleotides that can be stored
+    static const size_t MAX_LENGTH = 1024;
+
+    /** Creates an empty sequence. */
+    packed_sequence();
+
+    /** Removes all nucleotides. */
+    void clear();
+
+    /**
+     * Appends nucleotides to the sequence. Returns false if the sequence
+     * contains characters other than 'ACGTN', or if the resulting sequence
+     * would exceed MAX_LENGTH; the packed sequence is undefined in that case
+     * and should be cleared before being re-used.
+     */
+    bool append(const std::string& sequence);
+    /** Appends 'length' nucleotides starting at 'sequence'; see above. */
+    bool append(const char* sequence, size_t length);
+
+    /** Returns the number of nucleotides in the sequence. */
+    size_t length() const { return m_length; }
+
+    /** Returns the bit-planes; see class description. */
+    const packed_word* lo() const { return m_lo; }
+    const packed_word* hi() const { return m_hi; }
+    const packed_word* ns() const { return m_ns; }
+
+    /**
+     * Returns PACKED_WORD_BITS bits from a plane starting at word 'idx' and
+     * bit 'shift'; shift must be less than PACKED_WORD_BITS. Words past the
+     * end of the sequence are always zero, so that bits may be extracted for
+     * any nucleotide.
+     */
+    static packed_word extract(const packed_word* plane, size_t idx, size_t shift)
+    {
+        // The upper word is shifted in two steps, as "x << PACKED_WORD_BITS"
+        // is undefined when the shift is zero.
+        return (plane[idx] >> shift)
+            | ((plane[idx + 1] << 1) << (PACKED_WORD_BITS - 1 - shift));
+    }
+
+private:
+    //! Words per plane, including padding used by 'extract'
+    enum { N_WORDS = MAX_LENGTH / PACKED_WORD_BITS + 2 };
+
+    //! Number of nucleotides in sequence
+    size_t m_length;
+    //! Low bit of nucleotides: set for C and T
+    packed_word m_lo[N_WORDS];
+    //! High bit of nucleotides: set for G and T
+    packed_word m_hi[N_WORDS];
+    //! Set for Ns
+    packed_word m_ns[N_WORDS];
+};
+
+
+/**
+ * Aligns two packed sequences at every offset in the range [start_offset,
+ * end_offset], using the same scoring, early termination and tie-breaking
+ * as pairwise_align_sequences. Offsets must be valid for both sequences.
+ */
+typedef alignment_info (*pairwise_align_packed_func)(const alignment_info& best,
+                                                     const packed_sequence& seq1,
+                                                     const packed_sequence& seq2,
+                                                     int start_offset,
+                                                     int end_offset);
+
+/**
+ * Returns the packed alignment engine using hardware popcount, if
+ * 'hardware_popcnt' is set and the build supports it (see simd::has_popcnt),
+ * and the portable engine otherwise.
+ */
+pairwise_align_packed_func select_pairwise_align_packed(bool hardware_popcnt);
+
+
+/**
+ * Compares 'current.length' nucleotides of two packed sequences, starting at
+ * nucleotide 'pos' in 'shifted' and at nucleotide 0 in 'aligned'; since
+ * one sequence always starts at 0, only one side needs to be shifted.
+ * Scoring and early termination is identical to compare_subsequences_func,
+ * but counts are not reliable if current.score < best.score on return.
+ *
+ * Declared static, since it is built both with and without hardware popcount
+ * instructions enabled.
+ */
+static inline void compare_packed_subsequences(const alignment_info& best,
+                                               alignment_info& current,
+                                               const packed_sequence& shifted,
+                                               size_t pos,
+                                               const packed_sequence& aligned)
+{
+    const packed_word* lo_1 = shifted.lo() + pos / PACKED_WORD_BITS;
+    const packed_word* hi_1 = shifted.hi() + pos / PACKED_WORD_BITS;
+    const packed_word* ns_1 = shifted.ns() + pos / PACKED_WORD_BITS;
+    const size_t shift = pos % PACKED_WORD_BITS;
+
+    const packed_word* lo_2 = aligned.lo();
+    const packed_word* hi_2 = aligned.hi();
+    const packed_word* ns_2 = aligned.ns();
+
+    current.score = current.length;
+
+    size_t remaining_bases = current.length;
+    for (size_t idx = 0; remaining_bases && current.score >= best.score; ++idx) {
+        packed_word mask = ~static_cast<packed_word>(0);
+        if (remaining_bases >= PACKED_WORD_BITS) {
+            remaining_bases -= PACKED_WORD_BITS;
+        } else {
+            mask = (static_cast<packed_word>(1) << remaining_bases) - 1;
+            remaining_bases = 0;
+        }
+
+        // Set for every position where one or both nts is N
+        const packed_word ns_bits = (packed_sequence::extract(ns_1, idx, shift) | ns_2[idx]) & mask;
+        // Set for every position where nts differ, but neither is N
+        const packed_word mm_bits = ((packed_sequence::extract(lo_1, idx, shift) ^ lo_2[idx])
+                                   | (packed_sequence::extract(hi_1, idx, shift) ^ hi_2[idx]))
+                                  & ~ns_bits & mask;
+
+        current.n_ambiguous += __builtin_popcountl(ns_bits);
+        current.n_mismatches += __builtin_popcountl(mm_bits);
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+    }
+}
+
+
+/**
+ * Implementation of pairwise_align_packed_func; declared static for the same
+ * reasons as compare_packed_subsequences.
+ */
+static inline alignment_info pairwise_align_packed_std(const alignment_info& best_alignment,
+                                                       const packed_sequence& seq1,
+                                                       const packed_sequence& seq2,
+                                                       int start_offset,
+                                                       int end_offset)
+{
+    alignment_info best = best_alignment;
+    for (int offset = start_offset; offset <= end_offset; ++offset) {
+        const size_t seq1_pos = offset > 0 ? offset : 0;
+        const size_t seq2_pos = offset < 0 ? -offset : 0;
+        const size_t seq1_length = seq1.length() - seq1_pos;
+        const size_t seq2_length = seq2.length() - seq2_pos;
+        const size_t length = (seq1_length < seq2_length) ? seq1_length : seq2_length;
+
+        if (static_cast<int>(seq1_length) < best.score) {
+            // The overlap cannot exceed the remainder of seq1, which only
+            // shrinks as the offset increases
+            break;
+        } else if (static_cast<int>(length) >= best.score) {
+            alignment_info current;
+            current.offset = offset;
+            current.length = length;
+
+            if (offset >= 0) {
+                compare_packed_subsequences(best, current, seq1, seq1_pos, seq2);
+            } else {
+                compare_packed_subsequences(best, current, seq2, seq2_pos, seq1);
+            }
+
+            if (current.is_better_than(best)) {
+                best = current;
+            }
+        }
+    }
+
+    return best;
+}
+
+
+/** Packed alignment using the compiler's portable popcount. */
+alignment_info pairwise_align_packed_none(const alignment_info& best,
+                                          const packed_sequence& seq1,
+                                          const packed_sequence& seq2,
+                                          int start_offset,
+                                          int end_offset);
+
+#if defined(AR_SIMD_X86)
+/** Packed alignment using hardware popcount (built with -mpopcnt). */
+alignment_info pairwise_align_packed_popcnt(const alignment_info& best,
+                                            const packed_sequence& seq1,
+                                            const packed_sequence& seq2,
+                                            int start_offset,
+                                            int end_offset);
+#endif
+
+} // namespace ar
+
+#endif
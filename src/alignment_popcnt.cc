@@ -0,0 +1,43 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "alignment_packed.h"
+
+// Compiled with -mpopcnt; only called if supported by the CPU
+#if defined(AR_SIMD_X86)
+
+namespace ar
+{
+
+alignment_info pairwise_align_packed_popcnt(const alignment_info& best,
+                                            const packed_sequence& seq1,
+                                            const packed_sequence& seq2,
+                                            int start_offset,
+                                            int end_offset)
+{
+    return pairwise_align_packed_std(best, seq1, seq2, start_offset, end_offset);
+}
+
+} // namespace ar
+
+#endif
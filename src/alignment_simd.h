@@ -0,0 +1,121 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_ALIGNMENT_SIMD_H
+#define AR_ALIGNMENT_SIMD_H
+
+// Kernels are built with e.g. -mavx2 (see Makefile); headers with inline or
+// virtual members, such as fastq.h, must not be included in their translation
+// units, as those members are emitted as weak copies using the extra
+// instructions, and the linker may select these copies for every caller.
+#include "alignment_info.h"
+#include "simd.h"
+
+namespace ar
+{
+
+/**
+ * Compares two subsequences in an alignment to a previous (best) alignment.
+ *
+ * @param best The currently best alignment, used for evaluating this alignment
+ * @param current The current alignment to be evaluated (counts are assumed to be zero'd!)
+ * @param seq_1_ptr Pointer to the first base in the first sequence in the alignment.
+ * @param seq_2_ptr Pointer to the first base in the second sequence in the alignment.
+ * @return True if the current alignment is at least as good as the best alignment, false otherwise.
+ *
+ * If the function returns false, the current alignment cannot be assumed to
+ * have been completely evaluated (due to early termination), and hence counts
+ * and scores are not reliable. The function assumes uppercase nucleotides.
+ *
+ * Every implementation must give identical results; since the score can only
+ * decrease as more bases are compared, this holds regardless of how often a
+ * kernel checks for early termination.
+ */
+typedef bool (*compare_subsequences_func)(const alignment_info& best,
+                                          alignment_info& current,
+                                          const char* seq_1_ptr,
+                                          const char* seq_2_ptr);
+
+
+/** Returns the compare_subsequences kernel for a given instruction set. */
+compare_subsequences_func select_compare_subsequences(simd::instruction_set is);
+
+
+/**
+ * Portable comparison of the last 'remaining_bases' bases of an alignment;
+ * used by the SIMD kernels for bases that do not fill a full register, with
+ * 'current.score' reflecting the bases compared up to this point.
+ *
+ * Declared static, since the kernels are built with different instruction
+ * sets; a shared inline definition could pick up e.g. AVX2 instructions.
+ */
+static inline bool compare_subsequences_std(const alignment_info& best,
+                                            alignment_info& current,
+                                            const char* seq_1_ptr,
+                                            const char* seq_2_ptr,
+                                            int remaining_bases)
+{
+    for (; remaining_bases && current.score >= best.score; --remaining_bases) {
+        const char nt_1 = *seq_1_ptr++;
+        const char nt_2 = *seq_2_ptr++;
+
+        if (nt_1 == 'N' || nt_2 == 'N') {
+            current.n_ambiguous++;
+            current.score--;
+        } else if (nt_1 != nt_2) {
+            current.n_mismatches++;
+            current.score -= 2;
+        }
+    }
+
+    return current.is_better_than(best);
+}
+
+
+#if defined(AR_SIMD_X86)
+bool compare_subsequences_sse2(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr);
+
+bool compare_subsequences_avx2(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr);
+
+bool compare_subsequences_avx512(const alignment_info& best,
+                                 alignment_info& current,
+                                 const char* seq_1_ptr,
+                                 const char* seq_2_ptr);
+#endif
+
+#if defined(AR_SIMD_NEON)
+bool compare_subsequences_neon(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr);
+#endif
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,84 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "alignment_simd.h"
+
+#if defined(AR_SIMD_X86)
+#include <emmintrin.h>
+
+namespace ar
+{
+
+/** Counts the number of bits set in a __m128i. **/
+inline size_t COUNT_BITS_128(__m128i value)
+{
+    // Calculates the abs. difference between each pair of bytes in the upper
+    // and lower 64bit integers, and places the sum of these differences in
+    // the 0th and 4th shorts (16b).
+    value = _mm_sad_epu8(_mm_setzero_si128(), value);
+    // Return the 0th and 4th shorts containing the sums calculated above
+    return _mm_extract_epi16(value, 0) + _mm_extract_epi16(value, 4);
+}
+
+
+bool compare_subsequences_sse2(const alignment_info& best,
+                               alignment_info& current,
+                               const char* seq_1_ptr,
+                               const char* seq_2_ptr)
+{
+    //! Mask representing those (sparse) bits used when comparing multiple
+    //! nucleotides. These are simply the least significant bit in each byte.
+    const __m128i BIT_MASK_128 = _mm_set1_epi8(1);
+    //! Mask of all Ns
+    const __m128i N_MASK_128 = _mm_set1_epi8('N');
+
+    int remaining_bases = current.score = current.length;
+
+    while (remaining_bases >= 16 && current.score >= best.score) {
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_1_ptr));
+        const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq_2_ptr));
+
+        // Sets 0xFF for every byte where one or both nts is N
+        const __m128i ns_mask = _mm_or_si128(_mm_cmpeq_epi8(s1, N_MASK_128),
+                                             _mm_cmpeq_epi8(s2, N_MASK_128));
+
+        // Sets 0xFF for every byte where bytes differ, but neither is N
+        const __m128i mm_mask = ~_mm_or_si128(_mm_cmpeq_epi8(s1, s2), ns_mask);
+
+        current.n_ambiguous += COUNT_BITS_128(_mm_and_si128(ns_mask, BIT_MASK_128));
+        current.n_mismatches += COUNT_BITS_128(_mm_and_si128(mm_mask, BIT_MASK_128));
+
+        // Matches count for 1, Ns for 0, and mismatches for -1
+        current.score = current.length - current.n_ambiguous - (current.n_mismatches * 2);
+
+        seq_1_ptr += 16;
+        seq_2_ptr += 16;
+        remaining_bases -= 16;
+    }
+
+    return compare_subsequences_std(best, current, seq_1_ptr, seq_2_ptr, remaining_bases);
+}
+
+} // namespace ar
+
+#endif
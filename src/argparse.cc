@@ -411,6 +411,53 @@ std::string any::to_str() const
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+many::many(string_vec* value, const std::string& metavar, const std::string& help)
+    : consumer_base(metavar, help)
+    , m_ptr(value)
+{
+    AR_DEBUG_ASSERT(m_ptr);
+}
+
+
+size_t many::consume(string_vec_citer start, const string_vec_citer& end)
+{
+    string_vec values;
+    for (; start != end && start->substr(0, 2) != "--"; ++start) {
+        values.push_back(*start);
+    }
+
+    if (values.empty()) {
+        return static_cast<size_t>(-1);
+    }
+
+    m_value_set = true;
+    m_ptr->swap(values);
+
+    return m_ptr->size();
+}
+
+
+std::string many::to_str() const
+{
+    if (m_ptr->empty()) {
+        return "<not set>";
+    }
+
+    std::string result;
+    for (string_vec_citer it = m_ptr->begin(); it != m_ptr->end(); ++it) {
+        if (!result.empty()) {
+            result.push_back(' ');
+        }
+
+        result.append(*it);
+    }
+
+    return result;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 knob::knob(unsigned* value, const std::string& metavar, const std::string& help)
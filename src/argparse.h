@@ -307,6 +307,35 @@ private:
 };
 
 
+/**
+ * Consumer for one or more string values (filenames, etc.); values are
+ * consumed until the next argument starting with "--".
+ */
+class many : public consumer_base
+{
+public:
+    /**
+     * See consumer_base::consumer_base; a sink must be set.
+     */
+    many(string_vec* sink, const std::string& metavar = "", const std::string& help = "");
+
+    /** See consumer_base::consume */
+    virtual size_t consume(string_vec_citer start, const string_vec_citer& end);
+
+    /** See consumer_base::to_str */
+    virtual std::string to_str() const;
+
+private:
+    //! Not implemented
+    many(const many&);
+    //! Not implemented
+    many& operator=(const many&);
+
+    //! Pointer to storage for string values (required).
+    string_vec* m_ptr;
+};
+
+
 /**
  * Consumer for unsigned integer values.
  *
@@ -0,0 +1,595 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <ios>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "async_writer.h"
+#include "linereader.h"
+
+namespace ar
+{
+
+//! Alignment of buffers, offsets and sizes used for O_DIRECT writes
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+//! Space reserved ahead of the current offset when preallocating
+const size_t PREALLOCATE_SIZE = 64 * 1024 * 1024;
+
+
+/** Throws an std::ios_base::failure describing the current errno. */
+void throw_io_error(const std::string& message)
+{
+    throw std::ios_base::failure(message + ": " + std::strerror(errno));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'writer_pool'
+
+#ifdef AR_PTHREAD_SUPPORT
+
+writer_pool::writer_pool(size_t nthreads)
+  : m_lock()
+  , m_queue()
+  , m_queued()
+  , m_stop(false)
+  , m_threads()
+{
+    try {
+        for (size_t i = 0; i < nthreads; ++i) {
+            m_threads.push_back(pthread_t());
+            if (pthread_create(&m_threads.back(), NULL, &run_wrapper, this)) {
+                m_threads.pop_back();
+                throw thread_error("writer_pool: failed to create thread");
+            }
+        }
+    } catch (...) {
+        stop_threads();
+        throw;
+    }
+}
+
+
+writer_pool::~writer_pool()
+{
+    stop_threads();
+}
+
+
+bool writer_pool::is_async() const
+{
+    return !m_threads.empty();
+}
+
+
+void writer_pool::schedule(async_writer* writer)
+{
+    {
+        mutex_locker lock(m_lock);
+        m_queue.push_back(writer);
+    }
+
+    m_queued.signal();
+}
+
+
+void writer_pool::stop_threads()
+{
+    {
+        mutex_locker lock(m_lock);
+        m_stop = true;
+    }
+
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_queued.signal();
+    }
+
+    for (thread_vector::iterator it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if (pthread_join(*it, NULL)) {
+            print_locker lock;
+            std::cerr << "writer_pool: error joining thread" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    m_threads.clear();
+}
+
+
+void* writer_pool::run_wrapper(void* ptr)
+{
+    static_cast<writer_pool*>(ptr)->do_write();
+
+    return NULL;
+}
+
+
+void writer_pool::do_write()
+{
+    while (true) {
+        async_writer* writer = NULL;
+        while (true) {
+            {
+                mutex_locker lock(m_lock);
+                if (!m_queue.empty()) {
+                    writer = m_queue.front();
+                    m_queue.pop_front();
+                    break;
+                } else if (m_stop) {
+                    return;
+                }
+            }
+
+            m_queued.wait();
+        }
+
+        writer->write_pending();
+    }
+}
+
+#else
+
+writer_pool::writer_pool(size_t)
+{
+}
+
+
+writer_pool::~writer_pool()
+{
+}
+
+
+bool writer_pool::is_async() const
+{
+    return false;
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'async_writer'
+
+async_writer::async_writer(const std::string& filename,
+                           writer_pool* pool,
+                           bool direct_io,
+                           bool preallocate,
+                           bool resume)
+  : m_filename(filename)
+  , m_pool(pool)
+  , m_fd(-1)
+  , m_current()
+  , m_direct_io(false)
+  , m_aligned(NULL)
+  , m_aligned_length(0)
+  , m_preallocate(preallocate)
+  , m_offset(0)
+  , m_allocated(0)
+  , m_lock()
+  , m_pending()
+  , m_free()
+  , m_scheduled(false)
+  , m_written()
+  , m_error()
+{
+    const int flags = O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC);
+    const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+    if (filename == "-") {
+        // Duplicated, so that STDOUT can be closed like any other file
+        m_fd = ::dup(STDOUT_FILENO);
+        if (m_fd < 0) {
+            throw_io_error("Failed to open STDOUT");
+        }
+
+        m_preallocate = false;
+        enlarge_pipe_buffer(m_fd);
+        return;
+    }
+
+#ifdef O_DIRECT
+    if (direct_io) {
+        m_fd = ::open(filename.c_str(), flags | O_DIRECT, mode);
+        if (m_fd >= 0) {
+            void* buffer = NULL;
+            if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, WRITER_BLOCK_SIZE)) {
+                ::close(m_fd);
+                throw std::bad_alloc();
+            }
+
+            m_aligned = static_cast<char*>(buffer);
+            m_direct_io = true;
+        }
+    }
+#endif
+
+    if (m_fd < 0) {
+        // O_DIRECT is not supported by all file-systems (e.g. tmpfs) or files
+        m_fd = ::open(filename.c_str(), flags, mode);
+        if (m_fd < 0) {
+            throw_io_error("Failed to open file '" + filename + "'");
+        }
+    }
+
+    // Output may be written to a named pipe (FIFO) read by another program
+    enlarge_pipe_buffer(m_fd);
+}
+
+
+async_writer::~async_writer()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+        // Errors are only reported by explicit calls to 'close'
+    }
+
+    for (std::deque<std::string*>::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+        delete *it;
+    }
+
+    for (std::vector<std::string*>::iterator it = m_free.begin(); it != m_free.end(); ++it) {
+        delete *it;
+    }
+
+    std::free(m_aligned);
+}
+
+
+void async_writer::write(const char* data, size_t length)
+{
+    m_current.append(data, length);
+    if (m_current.size() >= WRITER_BLOCK_SIZE) {
+        submit();
+    }
+}
+
+
+void async_writer::write(std::string& data)
+{
+    if (m_current.empty()) {
+        // Avoids copying large blocks of (uncompressed) reads
+        m_current.swap(data);
+    } else {
+        m_current.append(data);
+        data.clear();
+    }
+
+    if (m_current.size() >= WRITER_BLOCK_SIZE) {
+        submit();
+    }
+}
+
+
+void async_writer::close()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    try {
+        if (!m_current.empty()) {
+            submit();
+        }
+
+        check_error();
+    } catch (...) {
+        wait_for_writes();
+        ::close(m_fd);
+        m_fd = -1;
+
+        throw;
+    }
+
+    const std::string error = wait_for_writes();
+    if (!error.empty()) {
+        ::close(m_fd);
+        m_fd = -1;
+
+        throw std::ios_base::failure(error);
+    }
+
+    close_file();
+}
+
+
+void async_writer::resume_at(size_t offset)
+{
+    struct stat info;
+    if (::fstat(m_fd, &info)) {
+        throw_io_error("Failed to stat '" + m_filename + "'");
+    } else if (static_cast<size_t>(info.st_size) < offset) {
+        throw std::ios_base::failure("Output file '" + m_filename + "' is "
+                                     "smaller than recorded in checkpoint");
+    } else if (::ftruncate(m_fd, static_cast<off_t>(offset))) {
+        throw_io_error("Failed to truncate '" + m_filename + "'");
+    } else if (::lseek(m_fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        throw_io_error("Failed to seek in '" + m_filename + "'");
+    }
+
+    m_offset = offset;
+    m_allocated = offset;
+}
+
+
+void async_writer::flush()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    if (!m_current.empty()) {
+        submit();
+    }
+
+    const std::string error = wait_for_writes();
+    if (!error.empty()) {
+        throw std::ios_base::failure(error);
+    } else if (::fsync(m_fd) && errno != EINVAL) {
+        // EINVAL is returned for files that do not support syncing (pipes)
+        throw_io_error("Failed to sync '" + m_filename + "'");
+    }
+}
+
+
+size_t async_writer::offset() const
+{
+    return m_offset;
+}
+
+
+void async_writer::submit()
+{
+#ifdef AR_PTHREAD_SUPPORT
+    if (m_pool && m_pool->is_async()) {
+        std::string* block = NULL;
+        while (true) {
+            {
+                mutex_locker lock(m_lock);
+                if (!m_error.empty()) {
+                    throw std::ios_base::failure(m_error);
+                } else if (m_pending.size() < WRITER_MAX_PENDING) {
+                    if (!m_free.empty()) {
+                        block = m_free.back();
+                        m_free.pop_back();
+                    }
+
+                    break;
+                }
+            }
+
+            m_written.wait();
+        }
+
+        std::auto_ptr<std::string> new_block(block ? block : new std::string());
+        new_block->swap(m_current);
+
+        bool schedule = false;
+        {
+            mutex_locker lock(m_lock);
+            m_pending.push_back(new_block.get());
+            new_block.release();
+
+            schedule = !m_scheduled;
+            m_scheduled = true;
+        }
+
+        if (schedule) {
+            m_pool->schedule(this);
+        }
+
+        return;
+    }
+#endif
+
+    write_block(m_current);
+    m_current.clear();
+}
+
+
+std::string async_writer::wait_for_writes()
+{
+    while (true) {
+        {
+            mutex_locker lock(m_lock);
+            if (!m_scheduled) {
+                return m_error;
+            }
+        }
+
+        m_written.wait();
+    }
+}
+
+
+void async_writer::check_error()
+{
+    mutex_locker lock(m_lock);
+    if (!m_error.empty()) {
+        throw std::ios_base::failure(m_error);
+    }
+}
+
+
+void async_writer::write_pending()
+{
+    std::string* block = NULL;
+    bool failed = false;
+    {
+        mutex_locker lock(m_lock);
+        block = m_pending.front();
+        failed = !m_error.empty();
+    }
+
+    if (!failed) {
+        try {
+            write_block(*block);
+        } catch (const std::exception& error) {
+            mutex_locker lock(m_lock);
+            m_error = error.what();
+        }
+    }
+
+    bool reschedule = false;
+    {
+        mutex_locker lock(m_lock);
+        m_pending.pop_front();
+        block->clear();
+        m_free.push_back(block);
+
+        // Once unscheduled, the owner may close and destroy the writer
+        reschedule = !m_pending.empty();
+        m_scheduled = reschedule;
+        m_written.signal();
+    }
+
+#ifdef AR_PTHREAD_SUPPORT
+    if (reschedule) {
+        // Other writers are given a turn before the next block is written
+        m_pool->schedule(this);
+    }
+#endif
+}
+
+
+void async_writer::write_block(const std::string& block)
+{
+    if (!m_aligned) {
+        write_raw(block.data(), block.size());
+        return;
+    }
+
+    // O_DIRECT requires aligned buffers, and sizes that are multiples of the
+    // block-size; data is therefore written in full buffers, except at close
+    for (size_t offset = 0; offset < block.size(); ) {
+        const size_t length = std::min(WRITER_BLOCK_SIZE - m_aligned_length,
+                                       block.size() - offset);
+
+        std::memcpy(m_aligned + m_aligned_length, block.data() + offset, length);
+        m_aligned_length += length;
+        offset += length;
+
+        if (m_aligned_length == WRITER_BLOCK_SIZE) {
+            write_raw(m_aligned, m_aligned_length);
+            m_aligned_length = 0;
+        }
+    }
+}
+
+
+void async_writer::write_raw(const char* data, size_t length)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (m_preallocate && m_offset + length > m_allocated) {
+        const size_t allocated = m_offset + length + PREALLOCATE_SIZE;
+        if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE,
+                      static_cast<off_t>(m_allocated),
+                      static_cast<off_t>(allocated - m_allocated))) {
+            // Not supported by the file-system or file; otherwise harmless
+            m_preallocate = false;
+        } else {
+            m_allocated = allocated;
+        }
+    }
+#endif
+
+    while (length) {
+        const ssize_t written = ::write(m_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+#ifdef O_DIRECT
+            if (errno == EINVAL && m_direct_io) {
+                // Unaligned offset following a short write; fall back to
+                // buffered IO for the remainder of the file
+                if (fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT)) {
+                    throw_io_error("Failed to disable O_DIRECT for '" + m_filename + "'");
+                }
+
+                m_direct_io = false;
+                continue;
+            }
+#endif
+
+            throw_io_error("Failed to write to '" + m_filename + "'");
+        }
+
+        data += written;
+        length -= static_cast<size_t>(written);
+        m_offset += static_cast<size_t>(written);
+    }
+}
+
+
+void async_writer::close_file()
+{
+    try {
+#ifdef O_DIRECT
+        if (m_aligned_length && m_direct_io) {
+            // The final, partial block cannot be written using O_DIRECT
+            if (fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT)) {
+                throw_io_error("Failed to disable O_DIRECT for '" + m_filename + "'");
+            }
+
+            m_direct_io = false;
+        }
+#endif
+
+        if (m_aligned_length) {
+            write_raw(m_aligned, m_aligned_length);
+            m_aligned_length = 0;
+        }
+    } catch (...) {
+        ::close(m_fd);
+        m_fd = -1;
+
+        throw;
+    }
+
+    if (m_allocated > m_offset) {
+        // Releases space preallocated past the end of the file; failure
+        // merely leaves the space allocated, and is therefore not an error
+        if (ftruncate(m_fd, static_cast<off_t>(m_offset))) {
+            m_allocated = 0;
+        }
+    }
+
+    const int fd = m_fd;
+    m_fd = -1;
+    if (::close(fd)) {
+        throw_io_error("Failed to close file '" + m_filename + "'");
+    }
+}
+
+} // namespace ar
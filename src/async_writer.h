@@ -0,0 +1,226 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_ASYNC_WRITER_H
+#define AR_ASYNC_WRITER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "threads.h"
+
+namespace ar
+{
+
+class async_writer;
+
+
+//! Size of blocks handed to writer threads
+const size_t WRITER_BLOCK_SIZE = 1024 * 1024;
+//! Max number of blocks waiting to be written per file
+const size_t WRITER_MAX_PENDING = 4;
+//! Number of writer threads used unless --io-threads is set
+const size_t WRITER_DEFAULT_THREADS = 2;
+
+
+/**
+ * Pool of threads writing blocks on behalf of a set of 'async_writer's.
+ *
+ * Each writer is handled by at most one thread at a time, so that blocks are
+ * written in order, while writers with pending blocks take turns, one block
+ * at a time. If the pool has no threads (or threads are not supported), the
+ * writers write blocks directly instead.
+ */
+class writer_pool
+{
+public:
+    /** Constructor; starts 'nthreads' writer threads. */
+    writer_pool(size_t nthreads);
+
+    /** Stops and joins threads; all writers must have been closed. */
+    ~writer_pool();
+
+    /** Returns true if writes are carried out by background threads. */
+    bool is_async() const;
+
+private:
+    //! Not implemented
+    writer_pool(const writer_pool&);
+    //! Not implemented
+    writer_pool& operator=(const writer_pool&);
+
+    friend class async_writer;
+
+#ifdef AR_PTHREAD_SUPPORT
+    typedef std::vector<pthread_t> thread_vector;
+
+    /** Queues a writer with pending blocks. */
+    void schedule(async_writer* writer);
+
+    /** Stops and joins all worker threads. */
+    void stop_threads();
+
+    /** Wrapper function which calls do_write on the provided pool. */
+    static void* run_wrapper(void* ptr);
+    /** Work function; writes blocks for queued writers until stopped. */
+    void do_write();
+
+    //! Lock used to control access to the queue and 'm_stop'
+    mutex m_lock;
+    //! Writers with pending blocks, in the order they were queued
+    std::deque<async_writer*> m_queue;
+    //! Signalled when a writer has been queued
+    conditional m_queued;
+    //! Set to terminate worker threads
+    bool m_stop;
+    //! Worker threads
+    thread_vector m_threads;
+#endif
+};
+
+
+/**
+ * Output file written in large blocks by a 'writer_pool'.
+ *
+ * Data is collected into blocks of WRITER_BLOCK_SIZE bytes, and up to
+ * WRITER_MAX_PENDING blocks may be waiting to be written, after which
+ * 'write' blocks until a block has been written. Errors encountered by the
+ * writer threads are reported (using std::ios_base::failure) by the next
+ * call to 'write' or 'close'.
+ *
+ * If 'direct_io' is set, the file is opened using O_DIRECT where supported,
+ * bypassing the page cache; blocks are then written via an aligned buffer,
+ * and the last partial block is written without O_DIRECT. If 'preallocate'
+ * is set, space is reserved ahead of writes using fallocate on Linux, and
+ * any unused space is released when the file is closed.
+ *
+ * If 'resume' is set, an existing file is not truncated when opened; instead
+ * 'resume_at' is used to discard data following the last checkpoint.
+ */
+class async_writer
+{
+public:
+    /**
+     * Opens the file for writing; throws std::ios_base::failure on error. The
+     * filename "-" denotes STDOUT, for which 'direct_io' and 'preallocate'
+     * are ignored.
+     */
+    async_writer(const std::string& filename,
+                 writer_pool* pool = NULL,
+                 bool direct_io = false,
+                 bool preallocate = false,
+                 bool resume = false);
+
+    /** Destructor; waits for pending writes and closes the file. */
+    ~async_writer();
+
+    /** Queues 'length' bytes for writing. */
+    void write(const char* data, size_t length);
+
+    /**
+     * Queues the contents of 'data' for writing; 'data' is left empty, but
+     * may receive the (allocated) buffer of a previously written block.
+     */
+    void write(std::string& data);
+
+    /** Writes all pending data and closes the file; errors are thrown. */
+    void close();
+
+    /**
+     * Truncates the file to 'offset' bytes, and continues writing from there;
+     * throws if the file is smaller than 'offset' bytes.
+     */
+    void resume_at(size_t offset);
+
+    /** Writes all pending data and syncs the file to disk; errors are thrown. */
+    void flush();
+
+    /** Returns the number of bytes written to the file so far. */
+    size_t offset() const;
+
+private:
+    //! Not implemented
+    async_writer(const async_writer&);
+    //! Not implemented
+    async_writer& operator=(const async_writer&);
+
+    friend class writer_pool;
+
+    /** Hands the current block to the pool, or writes it if not async. */
+    void submit();
+    /** Waits until no blocks are pending; returns the first error, if any. */
+    std::string wait_for_writes();
+    /** Throws if a previous write failed. */
+    void check_error();
+
+    /** Called by pool threads; writes a single pending block. */
+    void write_pending();
+    /** Writes a block, directly or via the aligned buffer (O_DIRECT). */
+    void write_block(const std::string& block);
+    /** Writes data at the current offset, preallocating space if enabled. */
+    void write_raw(const char* data, size_t length);
+    /** Writes buffered (O_DIRECT) data and closes the file descriptor. */
+    void close_file();
+
+    //! Name of the file; used for error messages
+    std::string m_filename;
+    //! Pool used to write blocks; may be NULL
+    writer_pool* m_pool;
+    //! File descriptor; -1 once the file has been closed
+    int m_fd;
+
+    //! Block being filled by 'write'
+    std::string m_current;
+
+    //! Indicates that the file was opened using O_DIRECT
+    bool m_direct_io;
+    //! Aligned buffer used for O_DIRECT writes
+    char* m_aligned;
+    //! Number of bytes stored in 'm_aligned'
+    size_t m_aligned_length;
+
+    //! Indicates that space is preallocated ahead of writes
+    bool m_preallocate;
+    //! Number of bytes written
+    size_t m_offset;
+    //! Number of bytes preallocated, counting from the start of the file
+    size_t m_allocated;
+
+    //! Lock used to control access to the members below
+    mutex m_lock;
+    //! Blocks waiting to be written, in order
+    std::deque<std::string*> m_pending;
+    //! Blocks that have been written, for re-use
+    std::vector<std::string*> m_free;
+    //! Indicates that the writer is queued in or being handled by the pool
+    bool m_scheduled;
+    //! Signalled whenever a block has been written
+    conditional m_written;
+    //! Description of the first error encountered by a writer thread
+    std::string m_error;
+};
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,668 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bam.h"
+#include "fastq_enc.h"
+
+namespace ar
+{
+
+//! Magic bytes at the start of (decompressed) BAM files
+const char BAM_MAGIC[] = "BAM\1";
+//! Size of the fixed-length fields of records, excluding 'block_size'
+const size_t BAM_FIXED_FIELDS = 32;
+//! Max length of read names, excluding the terminal NUL
+const size_t BAM_MAX_NAME_LENGTH = 254;
+//! Bin of unmapped reads without a position; reg2bin(-1, 0)
+const unsigned BAM_UNMAPPED_BIN = 4680;
+//! Bases used by AR for each 4-bit code in "=ACMGRSVTWYHKDBN"
+const char BAM_CODE_TO_BASE[] = "NACNGNNNTNNNNNNN";
+
+
+inline void append_u8(std::string& dst, unsigned value)
+{
+    dst.push_back(static_cast<char>(value & 0xff));
+}
+
+
+inline void append_u16(std::string& dst, unsigned value)
+{
+    append_u8(dst, value);
+    append_u8(dst, value >> 8);
+}
+
+
+inline void append_u32(std::string& dst, unsigned value)
+{
+    append_u16(dst, value);
+    append_u16(dst, value >> 16);
+}
+
+
+inline unsigned get_u8(const char* src)
+{
+    return static_cast<unsigned char>(*src);
+}
+
+
+inline unsigned get_u16(const char* src)
+{
+    return get_u8(src) | (get_u8(src + 1) << 8);
+}
+
+
+inline unsigned get_u32(const char* src)
+{
+    return get_u16(src) | (get_u16(src + 2) << 16);
+}
+
+
+/** Returns the 4-bit BAM code for a base; other bases are encoded as N. */
+inline unsigned encode_base(char nt)
+{
+    switch (nt) {
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 4;
+        case 'T': return 8;
+        default: return 15;
+    }
+}
+
+
+/**
+ * Parses a number for an integer ('is_float' is false) or float tag value,
+ * returning false if the value is not a valid number.
+ */
+bool parse_number(const std::string& value, bool is_float, double& dst)
+{
+    if (value.empty() || std::isspace(value[0])) {
+        return false;
+    }
+
+    if (!is_float) {
+        for (size_t i = (value[0] == '-' || value[0] == '+'); i < value.size(); ++i) {
+            if (value[i] < '0' || value[i] > '9') {
+                return false;
+            }
+        }
+    }
+
+    char* end = NULL;
+    errno = 0;
+    dst = std::strtod(value.c_str(), &end);
+
+    return !errno && end == value.c_str() + value.size();
+}
+
+
+/** Returns the number of bytes used for values of a 'B' array subtype; 0 if invalid. */
+inline size_t array_value_size(char type)
+{
+    switch (type) {
+        case 'c': case 'C': return 1;
+        case 's': case 'S': return 2;
+        case 'i': case 'I': case 'f': return 4;
+        default: return 0;
+    }
+}
+
+
+/** Appends a number of the given integer or float type; returns false if out of range. */
+bool append_typed_number(std::string& dst, char type, double value)
+{
+    double min_value = 0;
+    double max_value = 0;
+    switch (type) {
+        case 'c': min_value = -128; max_value = 127; break;
+        case 'C': max_value = 255; break;
+        case 's': min_value = -32768; max_value = 32767; break;
+        case 'S': max_value = 65535; break;
+        case 'i': min_value = -2147483648.0; max_value = 2147483647.0; break;
+        case 'I': max_value = 4294967295.0; break;
+        case 'f': {
+            const float float_value = static_cast<float>(value);
+            unsigned bits = 0;
+            std::memcpy(&bits, &float_value, sizeof(bits));
+            append_u32(dst, bits);
+            return true;
+        }
+        default: return false;
+    }
+
+    if (value < min_value || value > max_value) {
+        return false;
+    }
+
+    // Negative values are stored in two's complement
+    const unsigned bits = (value < 0)
+        ? static_cast<unsigned>(-static_cast<long>(-value))
+        : static_cast<unsigned>(value);
+    const size_t size = array_value_size(type);
+    for (size_t i = 0; i < size; ++i) {
+        append_u8(dst, bits >> (8 * i));
+    }
+
+    return true;
+}
+
+
+/** Returns the smallest integer type that can store the value, as done by samtools. */
+inline char select_integer_type(double value)
+{
+    if (value < 0) {
+        return (value >= -128) ? 'c' : ((value >= -32768) ? 's' : 'i');
+    }
+
+    return (value <= 255) ? 'C' : ((value <= 65535) ? 'S' : 'I');
+}
+
+
+/** Appends an array tag value ("type,value,value,..."); returns false if invalid. */
+bool append_array_tag(std::string& dst, const std::string& value)
+{
+    if (value.empty() || !array_value_size(value[0])
+        || (value.size() > 1 && value[1] != ',')) {
+        return false;
+    }
+
+    const char type = value[0];
+    const size_t count_offset = dst.size() + 1;
+    dst.push_back('B');
+    dst.push_back(type);
+    append_u32(dst, 0);
+
+    unsigned count = 0;
+    for (size_t start = 2; start <= value.size() && value.size() > 1; ++count) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+
+        double number = 0;
+        if (!parse_number(value.substr(start, end - start), type == 'f', number)
+            || !append_typed_number(dst, type, number)) {
+            return false;
+        }
+
+        start = end + 1;
+    }
+
+    for (size_t i = 0; i < 4; ++i) {
+        dst.at(count_offset + 1 + i) = static_cast<char>((count >> (8 * i)) & 0xff);
+    }
+
+    return true;
+}
+
+
+/**
+ * Appends a SAM field ("XX:T:VALUE") to 'dst' as a binary tag, returning true;
+ * if the field is not a valid tag, 'dst' is left unchanged and false returned.
+ */
+bool append_bam_tag(std::string& dst, const std::string& field)
+{
+    if (field.size() < 5 || !std::isalpha(field[0]) || !std::isalnum(field[1])
+        || field[2] != ':' || field[4] != ':') {
+        return false;
+    }
+
+    const size_t offset = dst.size();
+    const std::string value = field.substr(5);
+    dst.append(field, 0, 2);
+
+    double number = 0;
+    bool is_valid = false;
+    switch (field[3]) {
+        case 'A':
+            is_valid = (value.size() == 1);
+            dst.push_back('A');
+            dst.append(value);
+            break;
+
+        case 'i':
+            if (parse_number(value, false, number)) {
+                const char type = select_integer_type(number);
+                dst.push_back(type);
+                is_valid = append_typed_number(dst, type, number);
+            }
+            break;
+
+        case 'f':
+            if (parse_number(value, true, number)) {
+                dst.push_back('f');
+                is_valid = append_typed_number(dst, 'f', number);
+            }
+            break;
+
+        case 'Z':
+        case 'H':
+            is_valid = true;
+            dst.push_back(field[3]);
+            dst.append(value);
+            dst.push_back('\0');
+            break;
+
+        case 'B':
+            is_valid = append_array_tag(dst, value);
+            break;
+
+        default:
+            break;
+    }
+
+    if (!is_valid) {
+        dst.resize(offset);
+    }
+
+    return is_valid;
+}
+
+
+/** Appends a number in text form to 'dst'. */
+inline void append_number(std::string& dst, long value)
+{
+    char buffer[32];
+    dst.append(buffer, static_cast<size_t>(std::sprintf(buffer, "%ld", value)));
+}
+
+
+/** Appends a number in text form to 'dst'. */
+inline void append_number(std::string& dst, unsigned long value)
+{
+    char buffer[32];
+    dst.append(buffer, static_cast<size_t>(std::sprintf(buffer, "%lu", value)));
+}
+
+
+/** Appends a number in text form to 'dst'. */
+inline void append_number(std::string& dst, double value)
+{
+    char buffer[64];
+    dst.append(buffer, static_cast<size_t>(std::sprintf(buffer, "%g", value)));
+}
+
+
+/** Returns the integer value of an integer of a given type. */
+long get_typed_integer(const char* src, char type)
+{
+    switch (type) {
+        case 'c': return static_cast<signed char>(*src);
+        case 'C': return get_u8(src);
+        case 's': return static_cast<short>(get_u16(src));
+        case 'S': return get_u16(src);
+        case 'i': return static_cast<int>(get_u32(src));
+        default: throw fastq_error("invalid integer type in BAM record");
+    }
+}
+
+
+/** Appends a number of the given type ('I' and 'f' are handled separately). */
+void append_typed_value(std::string& dst, const char* src, char type)
+{
+    if (type == 'f') {
+        const unsigned bits = get_u32(src);
+        float value = 0;
+        std::memcpy(&value, &bits, sizeof(value));
+        append_number(dst, static_cast<double>(value));
+    } else if (type == 'I') {
+        append_number(dst, static_cast<unsigned long>(get_u32(src)));
+    } else {
+        append_number(dst, get_typed_integer(src, type));
+    }
+}
+
+
+/** Appends the binary tags in [it, end) as tab-separated SAM fields. */
+void append_sam_tags(std::string& dst, const char* it, const char* end)
+{
+    while (it < end) {
+        if (end - it < 4) {
+            throw fastq_error("truncated tag in BAM record");
+        }
+
+        const char type = it[2];
+        dst.push_back('\t');
+        dst.append(it, 2);
+        dst.push_back(':');
+        it += 3;
+
+        if (type == 'A') {
+            dst.append("A:");
+            dst.push_back(*it++);
+        } else if (type == 'Z' || type == 'H') {
+            const char* value_end = static_cast<const char*>(std::memchr(it, '\0', end - it));
+            if (!value_end) {
+                throw fastq_error("unterminated string tag in BAM record");
+            }
+
+            dst.push_back(type);
+            dst.push_back(':');
+            dst.append(it, value_end);
+            it = value_end + 1;
+        } else if (type == 'B') {
+            const char subtype = *it;
+            const size_t size = array_value_size(subtype);
+            if (!size || end - it < 5) {
+                throw fastq_error("invalid array tag in BAM record");
+            }
+
+            const size_t count = get_u32(it + 1);
+            it += 5;
+            if (static_cast<size_t>(end - it) / size < count) {
+                throw fastq_error("truncated array tag in BAM record");
+            }
+
+            dst.append("B:");
+            dst.push_back(subtype);
+            for (size_t i = 0; i < count; ++i, it += size) {
+                dst.push_back(',');
+                append_typed_value(dst, it, subtype);
+            }
+        } else {
+            const size_t size = array_value_size(type);
+            if (!size || static_cast<size_t>(end - it) < size) {
+                throw fastq_error("invalid tag in BAM record");
+            }
+
+            dst.append(type == 'f' ? "f:" : "i:");
+            append_typed_value(dst, it, type);
+            it += size;
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+void append_bam_header(std::string& dst, const std::string& text)
+{
+    dst.append(BAM_MAGIC, 4);
+    append_u32(dst, static_cast<unsigned>(text.size()));
+    dst.append(text);
+    // No reference sequences
+    append_u32(dst, 0);
+}
+
+
+std::string build_sam_header(const std::string& text,
+                             const std::string& name,
+                             const std::string& version)
+{
+    std::string header;
+    if (text.compare(0, 4, "@HD\t")) {
+        header = "@HD\tVN:1.6\tSO:unknown\n";
+    }
+
+    header += text;
+    if (!header.empty() && header.at(header.size() - 1) != '\n') {
+        header.push_back('\n');
+    }
+
+    // The ID of the last program (if any) is used as the previous program
+    std::string previous_id;
+    const size_t pg_pos = header.rfind("@PG\tID:");
+    if (pg_pos != std::string::npos) {
+        const size_t start = pg_pos + 7;
+        previous_id = header.substr(start, header.find_first_of("\t\n", start) - start);
+    }
+
+    // IDs must be unique, e.g. if AdapterRemoval is run more than once
+    std::string id = name;
+    for (size_t nth = 1; header.find("@PG\tID:" + id + "\t") != std::string::npos
+                         || header.find("@PG\tID:" + id + "\n") != std::string::npos; ++nth) {
+        id = name + ".";
+        append_number(id, static_cast<unsigned long>(nth));
+    }
+
+    header += "@PG\tID:" + id + "\tPN:" + name;
+    if (!previous_id.empty()) {
+        header += "\tPP:" + previous_id;
+    }
+    header += "\tVN:" + version + "\n";
+
+    return header;
+}
+
+
+void append_bam_record(std::string& dst,
+                       const std::string& header,
+                       const char* sequence,
+                       const char* qualities,
+                       size_t length,
+                       unsigned flags)
+{
+    size_t name_end = header.find_first_of(" \t");
+    if (name_end == std::string::npos) {
+        name_end = header.size();
+    }
+
+    // Mate numbers are given by the flags of paired records
+    size_t name_length = name_end;
+    if ((flags & BAM_FPAIRED) && name_length >= 2 && header.at(name_length - 2) == '/'
+        && (header.at(name_length - 1) == '1' || header.at(name_length - 1) == '2')) {
+        name_length -= 2;
+    }
+
+    if (name_length > BAM_MAX_NAME_LENGTH) {
+        throw fastq_error("read name too long for BAM record: " + header.substr(0, name_length));
+    }
+
+    const size_t offset = dst.size();
+    append_u32(dst, 0); // block_size; set below
+    append_u32(dst, static_cast<unsigned>(-1)); // refID
+    append_u32(dst, static_cast<unsigned>(-1)); // pos
+    append_u8(dst, static_cast<unsigned>(name_length ? name_length + 1 : 2));
+    append_u8(dst, 0); // mapq
+    append_u16(dst, BAM_UNMAPPED_BIN);
+    append_u16(dst, 0); // n_cigar_op
+    append_u16(dst, flags);
+    append_u32(dst, static_cast<unsigned>(length));
+    append_u32(dst, static_cast<unsigned>(-1)); // next_refID
+    append_u32(dst, static_cast<unsigned>(-1)); // next_pos
+    append_u32(dst, 0); // tlen
+
+    if (name_length) {
+        dst.append(header, 0, name_length);
+    } else {
+        dst.push_back('*');
+    }
+    dst.push_back('\0');
+
+    for (size_t i = 0; i < length; i += 2) {
+        const unsigned code_2 = (i + 1 < length) ? encode_base(sequence[i + 1]) : 0;
+        append_u8(dst, (encode_base(sequence[i]) << 4) | code_2);
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        append_u8(dst, static_cast<unsigned>(qualities[i] - PHRED_OFFSET_33));
+    }
+
+    // Fields following the name; SAM tags are kept, and other text is
+    // stored in a CO tag (e.g. the comments of FASTQ headers)
+    std::string comment;
+    for (size_t start = name_end + 1; start <= header.size(); ) {
+        size_t end = header.find('\t', start);
+        if (end == std::string::npos) {
+            end = header.size();
+        }
+
+        const std::string field = header.substr(start, end - start);
+        if (!field.empty() && !append_bam_tag(dst, field)) {
+            if (!comment.empty()) {
+                comment.push_back(' ');
+            }
+
+            comment += field;
+        }
+
+        start = end + 1;
+    }
+
+    if (!comment.empty()) {
+        dst.append("COZ");
+        dst.append(comment);
+        dst.push_back('\0');
+    }
+
+    const unsigned block_size = static_cast<unsigned>(dst.size() - offset - 4);
+    for (size_t i = 0; i < 4; ++i) {
+        dst.at(offset + i) = static_cast<char>((block_size >> (8 * i)) & 0xff);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+bam_reader::bam_reader(const std::string& filename, size_t inflate_threads,
+                       metrics_counter* bytes_read)
+  : m_reader(filename, inflate_threads, bytes_read)
+  , m_header()
+  , m_record()
+  , m_fastq_header()
+{
+    char buffer[8];
+    if (!read_bytes(buffer, 8) || std::memcmp(buffer, BAM_MAGIC, 4)) {
+        throw fastq_error("not a BAM file: " + filename);
+    }
+
+    m_record.resize(get_u32(buffer + 4));
+    if (!m_record.empty()) {
+        read_bytes(&m_record.front(), m_record.size());
+    }
+
+    // The header text may be padded with NULs
+    m_header.assign(m_record.begin(), m_record.end());
+    m_header.resize(std::strlen(m_header.c_str()));
+
+    read_bytes(buffer, 4);
+    for (size_t n_refs = get_u32(buffer); n_refs; --n_refs) {
+        // Names and lengths of reference sequences are not used
+        read_bytes(buffer, 4);
+        m_record.resize(get_u32(buffer) + 4);
+        read_bytes(&m_record.front(), m_record.size());
+    }
+}
+
+
+const std::string& bam_reader::header() const
+{
+    return m_header;
+}
+
+
+bool bam_reader::read(fastq& dst)
+{
+    for (;;) {
+        char buffer[4];
+        if (!read_bytes(buffer, 4)) {
+            return false;
+        }
+
+        const size_t block_size = get_u32(buffer);
+        if (block_size < BAM_FIXED_FIELDS) {
+            throw fastq_error("invalid BAM record; block is too small");
+        }
+
+        m_record.resize(block_size);
+        read_bytes(&m_record.front(), block_size);
+
+        const char* data = &m_record.front();
+        const size_t name_length = get_u8(data + 8);
+        const size_t n_cigar_ops = get_u16(data + 12);
+        const unsigned flags = get_u16(data + 14);
+        const size_t length = get_u32(data + 16);
+
+        const size_t seq_offset = BAM_FIXED_FIELDS + name_length + 4 * n_cigar_ops;
+        const size_t qual_offset = seq_offset + (length + 1) / 2;
+        const size_t tags_offset = qual_offset + length;
+        if (!name_length || tags_offset > block_size || tags_offset < qual_offset) {
+            throw fastq_error("invalid BAM record; fields exceed block size");
+        } else if (flags & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) {
+            continue;
+        }
+
+        m_fastq_header.assign(data + BAM_FIXED_FIELDS, name_length - 1);
+        if (flags & BAM_FPAIRED) {
+            if (flags & BAM_FREAD1) {
+                m_fastq_header.append("/1");
+            } else if (flags & BAM_FREAD2) {
+                m_fastq_header.append("/2");
+            }
+        }
+
+        append_sam_tags(m_fastq_header, data + tags_offset, data + block_size);
+        dst.set_header(m_fastq_header);
+
+        char* sequence = NULL;
+        char* qualities = NULL;
+        dst.resize(length, sequence, qualities);
+
+        const char* packed = data + seq_offset;
+        for (size_t i = 0; i < length; ++i) {
+            const unsigned code = get_u8(packed + i / 2) >> ((i % 2) ? 0 : 4);
+            sequence[i] = BAM_CODE_TO_BASE[code & 0xf];
+        }
+
+        const char* scores = data + qual_offset;
+        if (length && get_u8(scores) == 0xff) {
+            throw fastq_error("BAM record lacks quality scores: " + dst.name());
+        }
+
+        for (size_t i = 0; i < length; ++i) {
+            const unsigned score = get_u8(scores + i);
+            if (score > static_cast<unsigned>(MAX_PHRED_SCORE)) {
+                throw fastq_error("quality score out of range in BAM record: " + dst.name());
+            }
+
+            qualities[i] = static_cast<char>(score + PHRED_OFFSET_33);
+        }
+
+        if (flags & BAM_FREVERSE) {
+            dst.reverse_complement();
+        }
+
+        return true;
+    }
+}
+
+
+bool bam_reader::read_bytes(char* dst, size_t length)
+{
+    const size_t nread = m_reader.read(dst, length);
+    if (!nread && length) {
+        return false;
+    } else if (nread != length) {
+        throw fastq_error("truncated BAM file");
+    }
+
+    return true;
+}
+
+} // namespace ar
@@ -0,0 +1,139 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BAM_H
+#define AR_BAM_H
+
+#include <string>
+#include <vector>
+
+#include "fastq.h"
+#include "linereader.h"
+
+namespace ar
+{
+
+class metrics_counter;
+
+//! Read is paired in sequencing
+const unsigned BAM_FPAIRED = 0x1;
+//! Read is unmapped
+const unsigned BAM_FUNMAP = 0x4;
+//! Mate is unmapped
+const unsigned BAM_FMUNMAP = 0x8;
+//! Read is reverse complemented
+const unsigned BAM_FREVERSE = 0x10;
+//! Read is mate 1
+const unsigned BAM_FREAD1 = 0x40;
+//! Read is mate 2
+const unsigned BAM_FREAD2 = 0x80;
+//! Secondary alignment
+const unsigned BAM_FSECONDARY = 0x100;
+//! Supplementary alignment
+const unsigned BAM_FSUPPLEMENTARY = 0x800;
+
+
+/**
+ * Appends a BAM header, containing the SAM header 'text' and no reference
+ * sequences, to 'dst'; the header is not compressed.
+ */
+void append_bam_header(std::string& dst, const std::string& text);
+
+/**
+ * Returns the SAM header used for output files; header lines in 'text' (e.g.
+ * the header of an input BAM file) are kept, and a @PG line is added.
+ */
+std::string build_sam_header(const std::string& text,
+                             const std::string& name,
+                             const std::string& version);
+
+/**
+ * Appends an unaligned BAM record to 'dst', with sequence and Phred+33 encoded
+ * qualities of 'length' bases; the record is not compressed. The read name is
+ * taken from the header, excluding any "/1" or "/2" suffix for paired records
+ * (see BAM_FPAIRED). Fields in the header following the name (separated by
+ * tabs) are stored as tags if they are valid SAM tags (e.g. "BC:Z:ACGT"); all
+ * other fields are concatenated and stored in a CO tag. Throws fastq_error if
+ * the name is too long.
+ */
+void append_bam_record(std::string& dst,
+                       const std::string& header,
+                       const char* sequence,
+                       const char* qualities,
+                       size_t length,
+                       unsigned flags);
+
+
+/**
+ * Reader for unaligned BAM files; records are read as FASTQ records, with
+ * "/1" or "/2" added to the names of mates, and tags added to the header
+ * as tab-separated SAM fields (e.g. "name/1\tRG:Z:foo"), allowing the tags
+ * to be written to output files (see 'append_bam_record'). Qualities are
+ * read as binary Phred scores. Secondary and supplementary alignments are
+ * skipped, and reverse complemented reads are returned in the orientation
+ * in which they were sequenced.
+ *
+ * Errors are reported using 'fastq_error', or using 'io_error' / 'gzip_error'
+ * for errors raised when reading or decompressing the file.
+ */
+class bam_reader
+{
+public:
+    /**
+     * Opens a BAM file and reads the header; see line_reader for a
+     * description of the parameters.
+     */
+    bam_reader(const std::string& filename, size_t inflate_threads = 1,
+               metrics_counter* bytes_read = NULL);
+
+    /** Returns the SAM header text of the file. */
+    const std::string& header() const;
+
+    /** Reads the next record, returning false at EOF. */
+    bool read(fastq& dst);
+
+private:
+    //! Not implemented
+    bam_reader(const bam_reader&);
+    //! Not implemented
+    bam_reader& operator=(const bam_reader&);
+
+    /**
+     * Reads 'length' bytes into 'dst', returning false if EOF is reached
+     * before any bytes are read, and throwing if the file is truncated.
+     */
+    bool read_bytes(char* dst, size_t length);
+
+    //! Reader used to decompress (BGZF) data
+    line_reader m_reader;
+    //! SAM header text
+    std::string m_header;
+    //! Buffer containing the current BAM record
+    std::vector<char> m_record;
+    //! Buffer used to build the headers of FASTQ records
+    std::string m_fastq_header;
+};
+
+} // namespace ar
+
+#endif
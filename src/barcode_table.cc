@@ -0,0 +1,217 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+
+#include "barcode_table.h"
+#include "debug.h"
+
+namespace ar
+{
+
+typedef std::pair<barcode_key, barcode_table::candidate> key_candidate;
+typedef std::vector<key_candidate> key_candidate_vec;
+
+
+/** Encodes the first 'length' bases of 'sequence', 2 bits per base. */
+inline barcode_key encode_sequence(const std::string& sequence, size_t length)
+{
+    barcode_key key = 0;
+    for (size_t i = 0; i < length; ++i) {
+        key = (key << 2) | ACGT_TO_IDX(sequence[i]);
+    }
+
+    return key;
+}
+
+
+/** Scrambles a key, such that both low and high bits affect the low bits. */
+inline size_t hash_key(barcode_key key)
+{
+    key ^= key >> 31;
+    key *= 2654435769ul;
+    key ^= key >> 15;
+
+    return static_cast<size_t>(key);
+}
+
+
+/**
+ * Adds every key differing from 'key' by between 1 and 'max_mismatches'
+ * substitutions at positions 'pos' to 'length' - 1, each listed once.
+ */
+void add_neighborhood(key_candidate_vec& keys,
+                      barcode_key key,
+                      size_t length,
+                      size_t pos,
+                      size_t max_mismatches,
+                      barcode_table::candidate current)
+{
+    if (current.second >= max_mismatches) {
+        return;
+    }
+
+    current.second += 1;
+    for (; pos < length; ++pos) {
+        const size_t shift = 2 * (length - pos - 1);
+        const barcode_key original = (key >> shift) & 0x3;
+
+        for (barcode_key nt_idx = 0; nt_idx < 4; ++nt_idx) {
+            if (nt_idx != original) {
+                const barcode_key neighbor = (key & ~(static_cast<barcode_key>(0x3) << shift))
+                                             | (nt_idx << shift);
+
+                keys.push_back(key_candidate(neighbor, current));
+                add_neighborhood(keys, neighbor, length, pos + 1,
+                                 max_mismatches, current);
+            }
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+barcode_table::slot::slot()
+    : key(0)
+    , offset(0)
+    , count(0)
+{
+}
+
+
+barcode_table::barcode_table(const fastq_pair_vec& barcodes,
+                             size_t max_mismatches)
+    : m_key_length(0)
+    , m_mask(0)
+    , m_slots()
+    , m_candidates()
+{
+    if (!is_supported(barcodes, max_mismatches)) {
+        return;
+    }
+
+    m_key_length = barcodes.front().first.length();
+
+    key_candidate_vec keys;
+    for (size_t nth = 0; nth < barcodes.size(); ++nth) {
+        const barcode_key key = encode_sequence(barcodes.at(nth).first.sequence(),
+                                                m_key_length);
+        const candidate current(static_cast<int>(nth), 0);
+
+        keys.push_back(key_candidate(key, current));
+        add_neighborhood(keys, key, m_key_length, 0, max_mismatches, current);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    size_t unique_keys = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        unique_keys += (!i || keys.at(i - 1).first != keys.at(i).first);
+    }
+
+    // At most half of all slots are used, to keep probe sequences short
+    size_t n_slots = 2;
+    while (n_slots < 2 * unique_keys) {
+        n_slots *= 2;
+    }
+
+    m_mask = n_slots - 1;
+    m_slots.resize(n_slots);
+    m_candidates.reserve(keys.size());
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const barcode_key key = keys.at(i).first;
+        slot& dst = m_slots.at(find_slot(key));
+
+        if (!dst.count) {
+            dst.key = key;
+            dst.offset = m_candidates.size();
+        }
+
+        AR_DEBUG_ASSERT(dst.key == key);
+        AR_DEBUG_ASSERT(dst.offset + dst.count == m_candidates.size());
+
+        dst.count += 1;
+        m_candidates.push_back(keys.at(i).second);
+    }
+}
+
+
+bool barcode_table::is_supported(const fastq_pair_vec& barcodes,
+                                 size_t max_mismatches)
+{
+    if (barcodes.empty() || max_mismatches > BARCODE_TABLE_MAX_MISMATCHES) {
+        return false;
+    }
+
+    const size_t length = barcodes.front().first.length();
+    if (!length || length > BARCODE_TABLE_MAX_LENGTH) {
+        return false;
+    }
+
+    for (fastq_pair_vec::const_iterator it = barcodes.begin(); it != barcodes.end(); ++it) {
+        if (it->first.length() != length) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool barcode_table::empty() const
+{
+    return m_slots.empty();
+}
+
+
+void barcode_table::lookup(const std::string& sequence,
+                           const candidate*& begin,
+                           const candidate*& end) const
+{
+    begin = end = NULL;
+
+    if (m_slots.empty() || sequence.length() < m_key_length) {
+        return;
+    }
+
+    const slot& current = m_slots[find_slot(encode_sequence(sequence, m_key_length))];
+    if (current.count) {
+        begin = &m_candidates[current.offset];
+        end = begin + current.count;
+    }
+}
+
+
+size_t barcode_table::find_slot(barcode_key key) const
+{
+    size_t index = hash_key(key) & m_mask;
+    while (m_slots[index].count && m_slots[index].key != key) {
+        index = (index + 1) & m_mask;
+    }
+
+    return index;
+}
+
+} // namespace ar
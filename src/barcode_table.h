@@ -0,0 +1,119 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BARCODE_TABLE_H
+#define AR_BARCODE_TABLE_H
+
+#include <climits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fastq.h"
+
+namespace ar
+{
+
+//! Machine word used to store 2-bit encoded barcodes
+typedef unsigned long barcode_key;
+
+//! Max number of mismatches for which neighborhoods are precomputed
+const size_t BARCODE_TABLE_MAX_MISMATCHES = 2;
+//! Max length of (mate 1) barcodes stored in a barcode_key
+const size_t BARCODE_TABLE_MAX_LENGTH = sizeof(barcode_key) * CHAR_BIT / 2;
+
+
+/**
+ * Hash table mapping every sequence within N mismatches of a mate 1 barcode
+ * to the barcode(s) in question, for O(1) lookups during demultiplexing.
+ *
+ * Sequences are encoded using ACGT_TO_IDX, 2 bits per base, and the table
+ * therefore yields exactly the same candidates as a search of the quadtree
+ * built by 'demultiplex_reads', including for reads containing Ns. The
+ * neighborhoods of all barcodes are computed once, and stored in a single
+ * array sorted by key, which is indexed by an open-addressing hash table.
+ */
+class barcode_table
+{
+public:
+    //! Barcode (pair) index and number of mismatches for the mate 1 barcode
+    typedef std::pair<int, size_t> candidate;
+
+    /**
+     * Builds the table for the mate 1 barcodes in 'barcodes', allowing up to
+     * 'max_mismatches' mismatches. If 'is_supported' returns false for these
+     * arguments, the table is left empty, see 'empty'.
+     */
+    barcode_table(const fastq_pair_vec& barcodes, size_t max_mismatches);
+
+    /**
+     * Returns true if barcodes of this length and mismatch threshold can be
+     * stored in a table; all (mate 1) barcodes must be of the same length.
+     */
+    static bool is_supported(const fastq_pair_vec& barcodes,
+                             size_t max_mismatches);
+
+    /** Returns true if the table was not built; see 'is_supported'. */
+    bool empty() const;
+
+    /**
+     * Sets 'begin' and 'end' to the candidate barcodes matching the start of
+     * 'sequence'; the range is empty if there are no candidates. Candidates
+     * are listed in no particular order, one per matching barcode (pair).
+     */
+    void lookup(const std::string& sequence,
+                const candidate*& begin,
+                const candidate*& end) const;
+
+private:
+    struct slot
+    {
+        slot();
+
+        //! Encoded sequence stored in this slot
+        barcode_key key;
+        //! Index of the first candidate for this key in 'm_candidates'
+        size_t offset;
+        //! Number of candidates for this key; 0 for unused slots
+        size_t count;
+    };
+
+    typedef std::vector<slot> slot_vec;
+    typedef std::vector<candidate> candidate_vec;
+
+    /** Returns the index of the slot for 'key', or of the first empty slot. */
+    size_t find_slot(barcode_key key) const;
+
+    //! Length of (mate 1) barcodes
+    size_t m_key_length;
+    //! Bit-mask used to map hashes onto slots
+    size_t m_mask;
+    //! Open-addressing hash table; the size of this vector is a power of 2
+    slot_vec m_slots;
+    //! Candidates for all keys, stored contiguously for each key
+    candidate_vec m_candidates;
+};
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,635 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+#include "bgzf.h"
+#include "debug.h"
+#include "linereader.h"
+
+namespace ar
+{
+
+//! Size of the fixed part of gzip headers, up to and including XLEN
+const size_t GZIP_HEADER_SIZE = 12;
+//! Size of the gzip footer (CRC32 and ISIZE)
+const size_t GZIP_FOOTER_SIZE = 8;
+
+
+/** Reads an unsigned little-endian integer of 'size' bytes. */
+inline size_t read_le(const char* data, size_t size)
+{
+    size_t value = 0;
+    for (size_t i = size; i; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[i - 1]);
+    }
+
+    return value;
+}
+
+
+/**
+ * Returns the total size of the BGZF block starting with the given header,
+ * or 0 if the header is incomplete or is not a BGZF header.
+ */
+size_t bgzf_block_size(const char* data, size_t length)
+{
+    if (length < GZIP_HEADER_SIZE) {
+        return 0;
+    } else if (data[0] != '\x1f' || data[1] != '\x8b' || data[2] != '\x08') {
+        // Not a gzip header, or not using deflate compression
+        return 0;
+    } else if (!(data[3] & 0x04)) {
+        // The FEXTRA flag must be set
+        return 0;
+    }
+
+    const size_t extra_end = GZIP_HEADER_SIZE + read_le(data + 10, 2);
+    if (extra_end > length) {
+        return 0;
+    }
+
+    for (size_t offset = GZIP_HEADER_SIZE; offset + 4 <= extra_end;) {
+        const size_t subfield_length = read_le(data + offset + 2, 2);
+
+        if (data[offset] == 'B' && data[offset + 1] == 'C' && subfield_length == 2) {
+            if (offset + 6 > extra_end) {
+                return 0;
+            }
+
+            return read_le(data + offset + 4, 2) + 1;
+        }
+
+        offset += 4 + subfield_length;
+    }
+
+    return 0;
+}
+
+
+bool is_bgzf_header(const char* data, size_t length)
+{
+    return bgzf_block_size(data, length);
+}
+
+
+/** Writes an unsigned little-endian integer of 'size' bytes. */
+inline void write_le(unsigned char* dst, size_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i, value >>= 8) {
+        dst[i] = static_cast<unsigned char>(value & 0xff);
+    }
+}
+
+
+const unsigned char BGZF_EOF_BLOCK[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+
+#ifdef AR_GZIP_SUPPORT
+
+//! Size of BGZF headers, including the 'BC' extra subfield
+const size_t BGZF_HEADER_SIZE = 18;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bgzf_deflater'
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+
+bgzf_deflater::bgzf_deflater(int level)
+  : m_compressor(libdeflate_alloc_compressor(level))
+{
+    if (!m_compressor) {
+        throw thread_error("bgzf_deflater: failed to allocate compressor");
+    }
+}
+
+
+bgzf_deflater::~bgzf_deflater()
+{
+    libdeflate_free_compressor(m_compressor);
+}
+
+#else
+
+bgzf_deflater::bgzf_deflater(int level)
+  : m_stream()
+{
+    m_stream.zalloc = Z_NULL;
+    m_stream.zfree = Z_NULL;
+    m_stream.opaque = Z_NULL;
+
+    const int errorcode = deflateInit2(/* strm       = */ &m_stream,
+                                       /* level      = */ level,
+                                       /* method     = */ Z_DEFLATED,
+                                       /* windowBits = */ -15,
+                                       /* memLevel   = */ 8,
+                                       /* strategy   = */ Z_DEFAULT_STRATEGY);
+
+    switch (errorcode) {
+        case Z_OK:
+            break;
+
+        case Z_MEM_ERROR:
+            throw thread_error("bgzf_deflater: not enough memory");
+
+        case Z_STREAM_ERROR:
+            throw thread_error("bgzf_deflater: invalid parameters");
+
+        case Z_VERSION_ERROR:
+            throw thread_error("bgzf_deflater: incompatible zlib version");
+
+        default:
+            throw thread_error("bgzf_deflater: unknown error");
+    }
+}
+
+
+bgzf_deflater::~bgzf_deflater()
+{
+    deflateEnd(&m_stream);
+}
+
+#endif
+
+
+size_t bgzf_deflater::compress(const unsigned char* data, size_t length,
+                               unsigned char* block)
+{
+    AR_DEBUG_ASSERT(length <= BGZF_MAX_BLOCK_INPUT);
+
+    unsigned char* payload = block + BGZF_HEADER_SIZE;
+    const size_t capacity = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - GZIP_FOOTER_SIZE;
+
+    size_t payload_length = 0;
+    size_t crc = 0;
+#ifdef AR_LIBDEFLATE_SUPPORT
+    payload_length = libdeflate_deflate_compress(m_compressor, data, length,
+                                                 payload, capacity);
+    crc = libdeflate_crc32(0, data, length);
+
+    if (!payload_length) {
+        throw thread_error("bgzf_deflater::compress: compression failed");
+    }
+#else
+    m_stream.next_in = const_cast<Bytef*>(data);
+    m_stream.avail_in = length;
+    m_stream.next_out = payload;
+    m_stream.avail_out = capacity;
+
+    const int result = deflate(&m_stream, Z_FINISH);
+    payload_length = capacity - m_stream.avail_out;
+    crc = crc32(crc32(0, Z_NULL, 0), data, length);
+
+    if (result != Z_STREAM_END || deflateReset(&m_stream) != Z_OK) {
+        throw thread_error("bgzf_deflater::compress: compression failed");
+    }
+#endif
+
+    const size_t block_size = BGZF_HEADER_SIZE + payload_length + GZIP_FOOTER_SIZE;
+
+    // The header is identical to that of the EOF block, except for BSIZE
+    std::copy(BGZF_EOF_BLOCK, BGZF_EOF_BLOCK + BGZF_HEADER_SIZE, block);
+    write_le(block + 16, block_size - 1, 2);
+    write_le(payload + payload_length, crc, 4);
+    write_le(payload + payload_length + 4, length, 4);
+
+    return block_size;
+}
+
+
+void bgzf_compress(std::string& dst, const std::string& data, int level)
+{
+    bgzf_deflater deflater(level);
+    std::vector<unsigned char> block(BGZF_MAX_BLOCK_SIZE);
+    const unsigned char* input = reinterpret_cast<const unsigned char*>(data.data());
+
+    for (size_t offset = 0; offset < data.size(); offset += BGZF_MAX_BLOCK_INPUT) {
+        const size_t length = std::min(BGZF_MAX_BLOCK_INPUT, data.size() - offset);
+        const size_t block_size = deflater.compress(input + offset, length, &block.front());
+
+        dst.append(reinterpret_cast<const char*>(&block.front()), block_size);
+    }
+}
+
+#endif
+
+
+#ifdef AR_BGZF_SUPPORT
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-thread inflation of raw deflate streams
+
+/** Inflates raw deflate streams using libdeflate or zlib. */
+class raw_inflater
+{
+public:
+    raw_inflater();
+    ~raw_inflater();
+
+    /**
+     * Inflates 'src' into 'dst', setting 'dst_length' to the size of the
+     * inflated data; returns an error message on failure.
+     */
+    std::string inflate(const char* src, size_t src_length,
+                        char* dst, size_t dst_capacity, size_t& dst_length);
+
+    /** Returns the CRC32 of a buffer. */
+    static size_t crc32(const char* data, size_t length);
+
+private:
+    //! Not implemented
+    raw_inflater(const raw_inflater&);
+    //! Not implemented
+    raw_inflater& operator=(const raw_inflater&);
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+    //! libdeflate decompressor; NULL if allocation failed
+    libdeflate_decompressor* m_decompressor;
+#else
+    //! Raw deflate stream
+    z_stream m_stream;
+    //! Result of inflateInit2; the stream is only usable if Z_OK
+    int m_init_result;
+#endif
+};
+
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+
+raw_inflater::raw_inflater()
+  : m_decompressor(libdeflate_alloc_decompressor())
+{
+}
+
+
+raw_inflater::~raw_inflater()
+{
+    libdeflate_free_decompressor(m_decompressor);
+}
+
+
+std::string raw_inflater::inflate(const char* src, size_t src_length,
+                                  char* dst, size_t dst_capacity,
+                                  size_t& dst_length)
+{
+    if (!m_decompressor) {
+        return "failed to allocate decompressor";
+    } else if (libdeflate_deflate_decompress(m_decompressor, src, src_length,
+                                             dst, dst_capacity, &dst_length)) {
+        return "invalid or corrupt BGZF block";
+    }
+
+    return std::string();
+}
+
+
+size_t raw_inflater::crc32(const char* data, size_t length)
+{
+    return libdeflate_crc32(0, data, length);
+}
+
+#else
+
+raw_inflater::raw_inflater()
+  : m_stream()
+  , m_init_result(inflateInit2(&m_stream, -15))
+{
+}
+
+
+raw_inflater::~raw_inflater()
+{
+    if (m_init_result == Z_OK) {
+        inflateEnd(&m_stream);
+    }
+}
+
+
+std::string raw_inflater::inflate(const char* src, size_t src_length,
+                                  char* dst, size_t dst_capacity,
+                                  size_t& dst_length)
+{
+    if (m_init_result != Z_OK) {
+        return "failed to initialize gzip stream";
+    } else if (inflateReset(&m_stream) != Z_OK) {
+        return "failed to reset gzip stream";
+    }
+
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src));
+    m_stream.avail_in = src_length;
+    m_stream.next_out = reinterpret_cast<Bytef*>(dst);
+    m_stream.avail_out = dst_capacity;
+
+    if (::inflate(&m_stream, Z_FINISH) != Z_STREAM_END) {
+        return "invalid or corrupt BGZF block";
+    }
+
+    dst_length = dst_capacity - m_stream.avail_out;
+
+    return std::string();
+}
+
+
+size_t raw_inflater::crc32(const char* data, size_t length)
+{
+    return ::crc32(::crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), length);
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bgzf_inflater'
+
+bgzf_inflater::block::block()
+  : raw(BGZF_MAX_BLOCK_SIZE)
+  , raw_length(0)
+  , data(BGZF_MAX_BLOCK_SIZE)
+  , data_length(0)
+  , state(block_empty)
+  , error()
+{
+}
+
+
+bgzf_inflater::bgzf_inflater(FILE* file, const char* head, size_t head_length,
+                             size_t nthreads)
+  : m_file(file)
+  , m_head(head, head_length)
+  , m_head_offset(0)
+  , m_blocks()
+  , m_next_block(0)
+  , m_initialized(false)
+  , m_returned_block(false)
+  , m_lock()
+  , m_queue()
+  , m_queued()
+  , m_inflated()
+  , m_stop(false)
+  , m_threads()
+{
+    AR_DEBUG_ASSERT(nthreads > 0);
+
+    try {
+        // Enough blocks to keep all threads busy while blocks are consumed
+        for (size_t i = 0; i < 4 * nthreads; ++i) {
+            m_blocks.push_back(new block());
+        }
+
+        for (size_t i = 0; i < nthreads; ++i) {
+            m_threads.push_back(pthread_t());
+            if (pthread_create(&m_threads.back(), NULL, &run_wrapper, this)) {
+                m_threads.pop_back();
+                throw thread_error("bgzf_inflater: failed to create thread");
+            }
+        }
+    } catch (...) {
+        stop_threads();
+        for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+            delete *it;
+        }
+
+        throw;
+    }
+}
+
+
+bgzf_inflater::~bgzf_inflater()
+{
+    stop_threads();
+
+    for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+        delete *it;
+    }
+}
+
+
+bool bgzf_inflater::read(char*& begin, char*& end)
+{
+    if (!m_initialized) {
+        for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+            fill_block(*it);
+        }
+
+        m_initialized = true;
+    } else if (m_returned_block) {
+        // The previously returned block is re-used for the next unread block
+        fill_block(m_blocks.at(m_next_block));
+        m_next_block = (m_next_block + 1) % m_blocks.size();
+        m_returned_block = false;
+    }
+
+    while (true) {
+        block* current = m_blocks.at(m_next_block);
+
+        block_state state = block_queued;
+        while (true) {
+            {
+                mutex_locker lock(m_lock);
+                state = current->state;
+            }
+
+            if (state != block_queued) {
+                break;
+            }
+
+            m_inflated.wait();
+        }
+
+        if (state == block_empty) {
+            return false;
+        } else if (state == block_failed) {
+            throw gzip_error("bgzf_inflater::read: " + current->error);
+        } else if (current->data_length) {
+            begin = &current->data.front();
+            end = begin + current->data_length;
+            m_returned_block = true;
+
+            return true;
+        }
+
+        // Empty blocks, including the EOF marker block, are skipped
+        fill_block(current);
+        m_next_block = (m_next_block + 1) % m_blocks.size();
+    }
+}
+
+
+void bgzf_inflater::stop_threads()
+{
+    {
+        mutex_locker lock(m_lock);
+        m_stop = true;
+    }
+
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_queued.signal();
+    }
+
+    for (thread_vector::iterator it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if (pthread_join(*it, NULL)) {
+            print_locker lock;
+            std::cerr << "bgzf_inflater: error joining thread" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    m_threads.clear();
+}
+
+
+void bgzf_inflater::fill_block(block* dst)
+{
+    char* raw = &dst->raw.front();
+    const size_t header_read = read_raw(raw, GZIP_HEADER_SIZE);
+
+    dst->state = block_empty;
+    if (!header_read) {
+        // EOF reached at a block boundary
+        return;
+    } else if (header_read != GZIP_HEADER_SIZE) {
+        throw gzip_error("bgzf_inflater: truncated BGZF block header");
+    }
+
+    const size_t extra_length = read_le(raw + 10, 2);
+    if (read_raw(raw + GZIP_HEADER_SIZE, extra_length) != extra_length) {
+        throw gzip_error("bgzf_inflater: truncated BGZF block header");
+    }
+
+    const size_t header_length = GZIP_HEADER_SIZE + extra_length;
+    const size_t block_size = bgzf_block_size(raw, header_length);
+    if (!block_size) {
+        throw gzip_error("bgzf_inflater: invalid BGZF block; file may "
+                         "contain both BGZF and regular gzip members");
+    } else if (block_size < header_length + GZIP_FOOTER_SIZE) {
+        throw gzip_error("bgzf_inflater: invalid BGZF block size");
+    }
+
+    const size_t remaining = block_size - header_length;
+    if (read_raw(raw + header_length, remaining) != remaining) {
+        throw gzip_error("bgzf_inflater: truncated BGZF block");
+    }
+
+    dst->raw_length = block_size;
+    dst->data_length = 0;
+    dst->state = block_queued;
+
+    {
+        mutex_locker lock(m_lock);
+        m_queue.push_back(dst);
+    }
+
+    m_queued.signal();
+}
+
+
+size_t bgzf_inflater::read_raw(char* dst, size_t length)
+{
+    const size_t from_head = std::min(length, m_head.size() - m_head_offset);
+    std::copy(m_head.begin() + m_head_offset,
+              m_head.begin() + m_head_offset + from_head,
+              dst);
+    m_head_offset += from_head;
+
+    size_t nread = from_head;
+    if (nread < length) {
+        nread += fread(dst + nread, 1, length - nread, m_file);
+
+        if (ferror(m_file)) {
+            throw io_error("bgzf_inflater: error reading file", errno);
+        }
+    }
+
+    return nread;
+}
+
+
+void* bgzf_inflater::run_wrapper(void* ptr)
+{
+    reinterpret_cast<bgzf_inflater*>(ptr)->do_inflate();
+
+    return NULL;
+}
+
+
+void bgzf_inflater::do_inflate()
+{
+    raw_inflater inflater;
+
+    while (true) {
+        m_queued.wait();
+
+        block* current = NULL;
+        {
+            mutex_locker lock(m_lock);
+            if (m_stop) {
+                break;
+            } else if (m_queue.empty()) {
+                continue;
+            }
+
+            current = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        // Blocks are raw deflate streams, located between header and footer
+        const char* raw = &current->raw.front();
+        const char* payload = raw + GZIP_HEADER_SIZE + read_le(raw + 10, 2);
+        const char* footer = raw + current->raw_length - GZIP_FOOTER_SIZE;
+
+        size_t data_length = 0;
+        std::string error = inflater.inflate(payload, footer - payload,
+                                             &current->data.front(),
+                                             current->data.size(),
+                                             data_length);
+
+        if (!error.empty()) {
+            // Error already set
+        } else if (read_le(footer + 4, 4) != data_length) {
+            error = "BGZF block size does not match header";
+        } else if (read_le(footer, 4) != raw_inflater::crc32(&current->data.front(), data_length)) {
+            error = "BGZF block CRC32 mismatch";
+        }
+
+        {
+            mutex_locker lock(m_lock);
+            current->data_length = data_length;
+            current->error = error;
+            current->state = error.empty() ? block_done : block_failed;
+        }
+
+        m_inflated.signal();
+    }
+}
+
+#endif
+
+} // namespace ar
@@ -0,0 +1,236 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BGZF_H
+#define AR_BGZF_H
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef AR_GZIP_SUPPORT
+#include <zlib.h>
+#endif
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+#include <libdeflate.h>
+#endif
+
+#include "threads.h"
+
+#if defined(AR_GZIP_SUPPORT) && defined(AR_PTHREAD_SUPPORT)
+//! Parallel decompression of BGZF files requires both zlib and pthreads
+#define AR_BGZF_SUPPORT
+#endif
+
+namespace ar
+{
+
+//! Max size of a BGZF block, and of the data contained in a BGZF block
+const size_t BGZF_MAX_BLOCK_SIZE = 64 * 1024;
+//! Max data per block written by AR; ensures that compressed blocks fit
+const size_t BGZF_MAX_BLOCK_INPUT = 0xff00;
+
+//! Empty BGZF block used to mark the end of BGZF files
+extern const unsigned char BGZF_EOF_BLOCK[28];
+
+
+/**
+ * Returns true if the buffer starts with a BGZF header, that is, a gzip
+ * header containing a 'BC' extra subfield with the size of the block.
+ */
+bool is_bgzf_header(const char* data, size_t length);
+
+
+#ifdef AR_GZIP_SUPPORT
+
+/**
+ * Compression of data into BGZF blocks, using either zlib or libdeflate;
+ * each block is a complete gzip member, and blocks are therefore compressed
+ * independently of each other.
+ */
+class bgzf_deflater
+{
+public:
+    /** Constructor; 'level' is the (gzip) compression level used. */
+    bgzf_deflater(int level);
+    /** Destructor; frees compression state. */
+    ~bgzf_deflater();
+
+    /**
+     * Compresses up to BGZF_MAX_BLOCK_INPUT bytes into a single BGZF block,
+     * written to 'block', which must have room for BGZF_MAX_BLOCK_SIZE bytes;
+     * returns the size of the block.
+     */
+    size_t compress(const unsigned char* data, size_t length,
+                    unsigned char* block);
+
+private:
+    //! Not implemented
+    bgzf_deflater(const bgzf_deflater&);
+    //! Not implemented
+    bgzf_deflater& operator=(const bgzf_deflater&);
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+    //! libdeflate compressor object
+    libdeflate_compressor* m_compressor;
+#else
+    //! Raw deflate stream, reset for each block
+    z_stream m_stream;
+#endif
+};
+
+
+/**
+ * Compresses 'data' into one or more BGZF blocks, which are appended to
+ * 'dst'; no EOF block is added.
+ */
+void bgzf_compress(std::string& dst, const std::string& data, int level);
+
+#endif
+
+
+#ifdef AR_BGZF_SUPPORT
+
+/**
+ * Parallel decompression of BGZF files.
+ *
+ * BGZF files (as produced by e.g. 'bgzip') consist of independent gzip
+ * members, each of which contains up to 64kb of data, and store the size of
+ * each member in the gzip header. Blocks can therefore be located without
+ * decompressing the file, and are inflated by a set of worker threads, while
+ * the decompressed blocks are returned in the original order.
+ *
+ * Errors are reported using 'gzip_error' or 'io_error'.
+ */
+class bgzf_inflater
+{
+public:
+    /**
+     * Constructor; starts worker threads.
+     *
+     * @param file Open file positioned after the data in 'head'; not closed.
+     * @param head Data already read from the start of the file.
+     * @param head_length Number of bytes in 'head'.
+     * @param nthreads Number of worker threads used for decompression.
+     */
+    bgzf_inflater(FILE* file, const char* head, size_t head_length,
+                  size_t nthreads);
+
+    /** Stops and joins worker threads. */
+    ~bgzf_inflater();
+
+    /**
+     * Sets 'begin' and 'end' to the decompressed data of the next block,
+     * returning false at EOF; data is valid until the next call.
+     */
+    bool read(char*& begin, char*& end);
+
+private:
+    //! Not implemented
+    bgzf_inflater(const bgzf_inflater&);
+    //! Not implemented
+    bgzf_inflater& operator=(const bgzf_inflater&);
+
+    enum block_state {
+        //! No data assigned to block; only follows the last block of the file
+        block_empty,
+        //! Compressed data is waiting to be inflated
+        block_queued,
+        //! Data has been inflated
+        block_done,
+        //! Data could not be inflated; see 'error'
+        block_failed
+    };
+
+    struct block
+    {
+        block();
+
+        //! Compressed BGZF block, including header and footer
+        std::vector<char> raw;
+        //! Size of the compressed BGZF block
+        size_t raw_length;
+        //! Buffer containing the inflated data
+        std::vector<char> data;
+        //! Number of bytes of inflated data
+        size_t data_length;
+        //! Current state; access controlled using 'm_lock'
+        block_state state;
+        //! Description of errors for failed blocks
+        std::string error;
+    };
+
+    typedef std::vector<block*> block_vec;
+    typedef std::vector<pthread_t> thread_vector;
+
+    /** Stops and joins all worker threads. */
+    void stop_threads();
+    /** Reads the next BGZF block from the file and queues it (if any). */
+    void fill_block(block* dst);
+    /** Reads up to 'length' bytes into 'dst'; returns the number read. */
+    size_t read_raw(char* dst, size_t length);
+
+    /** Wrapper function which calls do_inflate on the provided inflater. */
+    static void* run_wrapper(void* ptr);
+    /** Work function; inflates queued blocks until the inflater stops. */
+    void do_inflate();
+
+    //! Input file; not owned by this object
+    FILE* m_file;
+    //! Data read from the file before the inflater was created
+    std::string m_head;
+    //! Number of bytes in 'm_head' which have been consumed
+    size_t m_head_offset;
+
+    //! Blocks used in a circular manner, in the order they are read
+    block_vec m_blocks;
+    //! Index of the next block to be returned by 'read'
+    size_t m_next_block;
+    //! Indicates if blocks have been filled by the first call to 'read'
+    bool m_initialized;
+    //! Indicates if the previous call to 'read' returned the next block
+    bool m_returned_block;
+
+    //! Lock used to control access to queue and block states
+    mutex m_lock;
+    //! Blocks waiting to be inflated
+    std::deque<block*> m_queue;
+    //! Signalled when a block has been queued
+    conditional m_queued;
+    //! Signalled when a block has been inflated
+    conditional m_inflated;
+    //! Set to terminate worker threads
+    bool m_stop;
+
+    //! Worker threads
+    thread_vector m_threads;
+};
+
+#endif
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,436 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef AR_BZIP2_SUPPORT
+#include <bzlib.h>
+#endif
+
+#include "bzip2.h"
+#include "debug.h"
+#include "linereader.h"
+
+namespace ar
+{
+
+size_t bzip2_block_input(int level)
+{
+    // Max block size used by libbz2 (see 'nblockMAX' in bzlib.c)
+    return 100000 * static_cast<size_t>(level) - 19;
+}
+
+
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+
+//! Magic number of bzip2 blocks, following the "BZh" + size stream header
+const char BZIP2_BLOCK_MAGIC[] = "\x31\x41\x59\x26\x53\x59";
+//! Size of stream headers, up to and including the magic number of block 1
+const size_t BZIP2_HEADER_SIZE = 10;
+//! Number of bytes inspected for additional streams by is_multistream_bzip2
+const size_t BZIP2_PROBE_SIZE = 4 * 1024 * 1024;
+//! Number of bytes read from the file at a time
+const size_t BZIP2_READ_SIZE = 1024 * 1024;
+//! Initial size of buffers for inflated data
+const size_t BZIP2_INITIAL_DATA_SIZE = 1024 * 1024;
+
+
+/**
+ * Returns the offset of the first bzip2 stream header (containing at least
+ * one block) in 'buffer' at or after 'offset', or the size of the buffer if
+ * there is none.
+ */
+size_t find_bzip2_stream(const std::vector<char>& buffer, size_t offset)
+{
+    const size_t length = buffer.size();
+    const char* data = length ? &buffer.front() : NULL;
+
+    while (offset + BZIP2_HEADER_SIZE <= length) {
+        const void* ptr = std::memchr(data + offset, 'B',
+                                      length - BZIP2_HEADER_SIZE + 1 - offset);
+        if (!ptr) {
+            break;
+        }
+
+        const char* header = static_cast<const char*>(ptr);
+        if (header[1] == 'Z' && header[2] == 'h'
+            && header[3] >= '1' && header[3] <= '9'
+            && !std::memcmp(header + 4, BZIP2_BLOCK_MAGIC, 6)) {
+            return header - data;
+        }
+
+        offset = header - data + 1;
+    }
+
+    return length;
+}
+
+
+/**
+ * Inflates one or more concatenated bzip2 streams into 'data', which is grown
+ * as needed; returns a description of the error on failure.
+ */
+std::string inflate_bzip2_streams(std::vector<char>& raw,
+                                  std::vector<char>& data,
+                                  size_t& data_length)
+{
+    data_length = 0;
+    if (raw.empty()) {
+        return std::string();
+    } else if (data.empty()) {
+        data.resize(BZIP2_INITIAL_DATA_SIZE);
+    }
+
+    bz_stream stream = bz_stream();
+    if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+        return "failed to initialize bzip2 stream";
+    }
+
+    stream.next_in = &raw.front();
+    stream.avail_in = static_cast<unsigned int>(raw.size());
+
+    std::string error;
+    while (error.empty()) {
+        if (data_length == data.size()) {
+            data.resize(2 * data.size());
+        }
+
+        stream.next_out = &data.front() + data_length;
+        stream.avail_out = static_cast<unsigned int>(data.size() - data_length);
+
+        const int errorcode = BZ2_bzDecompress(&stream);
+        data_length = data.size() - stream.avail_out;
+
+        if (errorcode == BZ_STREAM_END) {
+            if (!stream.avail_in) {
+                break;
+            }
+
+            // Restart stream, to handle any further streams in the block
+            char* const next_in = stream.next_in;
+            const unsigned int avail_in = stream.avail_in;
+
+            BZ2_bzDecompressEnd(&stream);
+            stream = bz_stream();
+            if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+                return "failed to initialize bzip2 stream";
+            }
+
+            stream.next_in = next_in;
+            stream.avail_in = avail_in;
+        } else if (errorcode == BZ_OK) {
+            if (!stream.avail_in && stream.avail_out) {
+                error = "truncated bzip2 stream";
+            }
+        } else if (errorcode == BZ_DATA_ERROR || errorcode == BZ_DATA_ERROR_MAGIC) {
+            error = "malformed bzip2 file";
+        } else if (errorcode == BZ_MEM_ERROR) {
+            error = "insufficient memory to inflate bzip2 stream";
+        } else {
+            error = "unknown bzip2 error";
+        }
+    }
+
+    BZ2_bzDecompressEnd(&stream);
+
+    return error;
+}
+
+
+bool is_multistream_bzip2(FILE* file, const char* head, size_t head_length)
+{
+    const off_t position = ftello(file);
+    if (position < 0) {
+        // Non-seekable files, e.g. STDIN
+        return false;
+    }
+
+    std::vector<char> buffer(head, head + head_length);
+    buffer.resize(head_length + BZIP2_PROBE_SIZE);
+
+    const size_t nread = fread(&buffer.front() + head_length, 1,
+                               BZIP2_PROBE_SIZE, file);
+    if (ferror(file)) {
+        throw io_error("is_multistream_bzip2: error reading file", errno);
+    } else if (fseeko(file, position, SEEK_SET)) {
+        throw io_error("is_multistream_bzip2: error seeking in file", errno);
+    }
+
+    buffer.resize(head_length + nread);
+
+    return find_bzip2_stream(buffer, 1) < buffer.size();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bzip2_inflater'
+
+bzip2_inflater::block::block()
+  : raw()
+  , data()
+  , data_length(0)
+  , state(block_empty)
+  , error()
+{
+}
+
+
+bzip2_inflater::bzip2_inflater(FILE* file, const char* head, size_t head_length,
+                               size_t nthreads)
+  : m_file(file)
+  , m_pending(head, head + head_length)
+  , m_pending_offset(0)
+  , m_blocks()
+  , m_next_block(0)
+  , m_initialized(false)
+  , m_returned_block(false)
+  , m_lock()
+  , m_queue()
+  , m_queued()
+  , m_inflated()
+  , m_stop(false)
+  , m_threads()
+{
+    AR_DEBUG_ASSERT(nthreads > 0);
+
+    try {
+        // Streams are large, so fewer blocks are needed than for BGZF files
+        for (size_t i = 0; i < 2 * nthreads; ++i) {
+            m_blocks.push_back(new block());
+        }
+
+        for (size_t i = 0; i < nthreads; ++i) {
+            m_threads.push_back(pthread_t());
+            if (pthread_create(&m_threads.back(), NULL, &run_wrapper, this)) {
+                m_threads.pop_back();
+                throw thread_error("bzip2_inflater: failed to create thread");
+            }
+        }
+    } catch (...) {
+        stop_threads();
+        for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+            delete *it;
+        }
+
+        throw;
+    }
+}
+
+
+bzip2_inflater::~bzip2_inflater()
+{
+    stop_threads();
+
+    for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+        delete *it;
+    }
+}
+
+
+bool bzip2_inflater::read(char*& begin, char*& end)
+{
+    if (!m_initialized) {
+        for (block_vec::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+            fill_block(*it);
+        }
+
+        m_initialized = true;
+    } else if (m_returned_block) {
+        // The previously returned block is re-used for the next unread block
+        fill_block(m_blocks.at(m_next_block));
+        m_next_block = (m_next_block + 1) % m_blocks.size();
+        m_returned_block = false;
+    }
+
+    while (true) {
+        block* current = m_blocks.at(m_next_block);
+
+        block_state state = block_queued;
+        while (true) {
+            {
+                mutex_locker lock(m_lock);
+                state = current->state;
+            }
+
+            if (state != block_queued) {
+                break;
+            }
+
+            m_inflated.wait();
+        }
+
+        if (state == block_empty) {
+            return false;
+        } else if (state == block_failed) {
+            throw bzip2_error("bzip2_inflater::read: " + current->error);
+        } else if (current->data_length) {
+            begin = &current->data.front();
+            end = begin + current->data_length;
+            m_returned_block = true;
+
+            return true;
+        }
+
+        // Empty streams are skipped
+        fill_block(current);
+        m_next_block = (m_next_block + 1) % m_blocks.size();
+    }
+}
+
+
+void bzip2_inflater::stop_threads()
+{
+    {
+        mutex_locker lock(m_lock);
+        m_stop = true;
+    }
+
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        m_queued.signal();
+    }
+
+    for (thread_vector::iterator it = m_threads.begin(); it != m_threads.end(); ++it) {
+        if (pthread_join(*it, NULL)) {
+            print_locker lock;
+            std::cerr << "bzip2_inflater: error joining thread" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    m_threads.clear();
+}
+
+
+void bzip2_inflater::fill_block(block* dst)
+{
+    dst->state = block_empty;
+
+    // Data assigned to earlier blocks is discarded
+    m_pending.erase(m_pending.begin(), m_pending.begin() + m_pending_offset);
+    m_pending_offset = 0;
+
+    // The block ends at the header of the next stream, or at EOF; the header
+    // of the current stream is skipped when searching
+    size_t searched = 1;
+    size_t stream_end = 0;
+    while (true) {
+        stream_end = find_bzip2_stream(m_pending, searched);
+        if (stream_end < m_pending.size()) {
+            break;
+        }
+
+        // Headers may be split across reads
+        if (stream_end >= BZIP2_HEADER_SIZE) {
+            searched = std::max(searched, stream_end - BZIP2_HEADER_SIZE + 1);
+        }
+
+        if (!read_pending()) {
+            stream_end = m_pending.size();
+            break;
+        }
+    }
+
+    if (!stream_end) {
+        // EOF reached at a stream boundary
+        return;
+    }
+
+    dst->raw.assign(m_pending.begin(), m_pending.begin() + stream_end);
+    dst->data_length = 0;
+    dst->state = block_queued;
+    m_pending_offset = stream_end;
+
+    {
+        mutex_locker lock(m_lock);
+        m_queue.push_back(dst);
+    }
+
+    m_queued.signal();
+}
+
+
+bool bzip2_inflater::read_pending()
+{
+    const size_t offset = m_pending.size();
+    m_pending.resize(offset + BZIP2_READ_SIZE);
+
+    const size_t nread = fread(&m_pending.front() + offset, 1, BZIP2_READ_SIZE, m_file);
+    m_pending.resize(offset + nread);
+
+    if (ferror(m_file)) {
+        throw io_error("bzip2_inflater: error reading file", errno);
+    }
+
+    return nread;
+}
+
+
+void* bzip2_inflater::run_wrapper(void* ptr)
+{
+    reinterpret_cast<bzip2_inflater*>(ptr)->do_inflate();
+
+    return NULL;
+}
+
+
+void bzip2_inflater::do_inflate()
+{
+    while (true) {
+        m_queued.wait();
+
+        block* current = NULL;
+        {
+            mutex_locker lock(m_lock);
+            if (m_stop) {
+                break;
+            } else if (m_queue.empty()) {
+                continue;
+            }
+
+            current = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        size_t data_length = 0;
+        const std::string error = inflate_bzip2_streams(current->raw,
+                                                        current->data,
+                                                        data_length);
+
+        {
+            mutex_locker lock(m_lock);
+            current->data_length = data_length;
+            current->error = error;
+            current->state = error.empty() ? block_done : block_failed;
+        }
+
+        m_inflated.signal();
+    }
+}
+
+#endif
+
+} // namespace ar
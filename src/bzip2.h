@@ -0,0 +1,181 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_BZIP2_H
+#define AR_BZIP2_H
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "threads.h"
+
+#if defined(AR_BZIP2_SUPPORT) && defined(AR_PTHREAD_SUPPORT)
+//! Parallel decompression of bzip2 files requires both libbz2 and pthreads
+#define AR_PARALLEL_BZIP2_SUPPORT
+#endif
+
+namespace ar
+{
+
+/**
+ * Returns the max number of bytes of (uncompressed) data that fit in a single
+ * bzip2 block, for the given block size (1 - 9, in units of 100 kB).
+ */
+size_t bzip2_block_input(int level);
+
+
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+
+/**
+ * Returns true if the bzip2 file contains more than one stream, as is the
+ * case for files written by AdapterRemoval, pbzip2, or lbzip2, judging by
+ * the first few MB of the file. Data is read from the current position, which
+ * is restored afterwards; false is returned for non-seekable files (pipes).
+ *
+ * @param file Open file positioned after the data in 'head'.
+ * @param head Data already read from the start of the file.
+ * @param head_length Number of bytes in 'head'.
+ */
+bool is_multistream_bzip2(FILE* file, const char* head, size_t head_length);
+
+
+/**
+ * Parallel decompression of multi-stream bzip2 files.
+ *
+ * Files consisting of multiple concatenated bzip2 streams are split at the
+ * byte-aligned stream headers ("BZh" followed by the block size and the magic
+ * number of the first block), and the streams are inflated by a set of worker
+ * threads, while the decompressed data is returned in the original order.
+ * Single-stream files are not split, and should be read serially instead.
+ *
+ * Errors are reported using 'bzip2_error' or 'io_error'.
+ */
+class bzip2_inflater
+{
+public:
+    /**
+     * Constructor; starts worker threads.
+     *
+     * @param file Open file positioned after the data in 'head'; not closed.
+     * @param head Data already read from the start of the file.
+     * @param head_length Number of bytes in 'head'.
+     * @param nthreads Number of worker threads used for decompression.
+     */
+    bzip2_inflater(FILE* file, const char* head, size_t head_length,
+                   size_t nthreads);
+
+    /** Stops and joins worker threads. */
+    ~bzip2_inflater();
+
+    /**
+     * Sets 'begin' and 'end' to the decompressed data of the next stream,
+     * returning false at EOF; data is valid until the next call.
+     */
+    bool read(char*& begin, char*& end);
+
+private:
+    //! Not implemented
+    bzip2_inflater(const bzip2_inflater&);
+    //! Not implemented
+    bzip2_inflater& operator=(const bzip2_inflater&);
+
+    enum block_state {
+        //! No data assigned to block; only follows the last block of the file
+        block_empty,
+        //! Compressed data is waiting to be inflated
+        block_queued,
+        //! Data has been inflated
+        block_done,
+        //! Data could not be inflated; see 'error'
+        block_failed
+    };
+
+    struct block
+    {
+        block();
+
+        //! One or more complete bzip2 streams
+        std::vector<char> raw;
+        //! Buffer containing the inflated data; grown as needed
+        std::vector<char> data;
+        //! Number of bytes of inflated data
+        size_t data_length;
+        //! Current state; access controlled using 'm_lock'
+        block_state state;
+        //! Description of errors for failed blocks
+        std::string error;
+    };
+
+    typedef std::vector<block*> block_vec;
+    typedef std::vector<pthread_t> thread_vector;
+
+    /** Stops and joins all worker threads. */
+    void stop_threads();
+    /** Assigns the next stream in the file to the block and queues it. */
+    void fill_block(block* dst);
+    /** Appends data from the file to 'm_pending'; returns false at EOF. */
+    bool read_pending();
+
+    /** Wrapper function which calls do_inflate on the provided inflater. */
+    static void* run_wrapper(void* ptr);
+    /** Work function; inflates queued blocks until the inflater stops. */
+    void do_inflate();
+
+    //! Input file; not owned by this object
+    FILE* m_file;
+    //! Data read from the file, starting at the first unassigned stream
+    std::vector<char> m_pending;
+    //! Number of bytes at the start of 'm_pending' assigned to blocks
+    size_t m_pending_offset;
+
+    //! Blocks used in a circular manner, in the order they are read
+    block_vec m_blocks;
+    //! Index of the next block to be returned by 'read'
+    size_t m_next_block;
+    //! Indicates if blocks have been filled by the first call to 'read'
+    bool m_initialized;
+    //! Indicates if the previous call to 'read' returned the next block
+    bool m_returned_block;
+
+    //! Lock used to control access to queue and block states
+    mutex m_lock;
+    //! Blocks waiting to be inflated
+    std::deque<block*> m_queue;
+    //! Signalled when a block has been queued
+    conditional m_queued;
+    //! Signalled when a block has been inflated
+    conditional m_inflated;
+    //! Set to terminate worker threads
+    bool m_stop;
+
+    //! Worker threads
+    thread_vector m_threads;
+};
+
+#endif
+
+} // namespace ar
+
+#endif
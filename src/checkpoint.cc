@@ -0,0 +1,365 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "linereader.h"
+#include "timer.h"
+
+namespace ar
+{
+
+//! First line of checkpoint files; changed if the format changes
+const char* const CHECKPOINT_HEADER = "#AdapterRemoval checkpoint v1";
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'checkpoint_error'
+
+checkpoint_error::checkpoint_error(const std::string& message)
+    : std::exception()
+    , m_message(message)
+{
+}
+
+
+checkpoint_error::~checkpoint_error() throw()
+{
+}
+
+
+const char* checkpoint_error::what() const throw()
+{
+    return m_message.c_str();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'checkpoint_data'
+
+checkpoint_data::checkpoint_data()
+  : m_values()
+{
+}
+
+
+void checkpoint_data::set(const std::string& key, size_t value)
+{
+    std::stringstream stream;
+    stream << value;
+
+    m_values[key] = stream.str();
+}
+
+
+void checkpoint_data::set(const std::string& key, const std::vector<size_t>& values)
+{
+    std::stringstream stream;
+    for (std::vector<size_t>::const_iterator it = values.begin(); it != values.end(); ++it) {
+        if (it != values.begin()) {
+            stream << ' ';
+        }
+
+        stream << *it;
+    }
+
+    m_values[key] = stream.str();
+}
+
+
+bool checkpoint_data::contains(const std::string& key) const
+{
+    return m_values.count(key);
+}
+
+
+size_t checkpoint_data::get(const std::string& key) const
+{
+    const std::vector<size_t> values = get_vector(key);
+    if (values.size() != 1) {
+        throw checkpoint_error("expected a single value for '" + key
+                               + "' in checkpoint");
+    }
+
+    return values.front();
+}
+
+
+std::vector<size_t> checkpoint_data::get_vector(const std::string& key) const
+{
+    std::istringstream stream(get_value(key));
+    std::vector<size_t> values;
+
+    size_t value = 0;
+    while (stream >> value) {
+        values.push_back(value);
+    }
+
+    if (!stream.eof()) {
+        throw checkpoint_error("invalid value for '" + key + "' in checkpoint");
+    }
+
+    return values;
+}
+
+
+void checkpoint_data::read(const std::string& filename)
+{
+    std::ifstream input(filename.c_str());
+    if (!input.is_open()) {
+        throw io_error("failed to open checkpoint '" + filename + "'", errno);
+    }
+
+    std::string line;
+    if (!std::getline(input, line) || line != CHECKPOINT_HEADER) {
+        throw checkpoint_error("'" + filename + "' is not a checkpoint "
+                               "written by this version of AdapterRemoval");
+    }
+
+    value_map values;
+    while (std::getline(input, line)) {
+        const size_t pos = line.rfind('\t');
+        if (pos == std::string::npos) {
+            throw checkpoint_error("malformed line in checkpoint '" + filename + "'");
+        }
+
+        values[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+
+    if (input.bad()) {
+        throw io_error("error reading checkpoint '" + filename + "'", errno);
+    }
+
+    m_values.swap(values);
+}
+
+
+void checkpoint_data::write(const std::string& filename) const
+{
+    const std::string tmp_filename = filename + ".tmp";
+    std::ofstream output(tmp_filename.c_str(), std::ios::out | std::ios::trunc);
+
+    output << CHECKPOINT_HEADER << "\n";
+    for (value_map::const_iterator it = m_values.begin(); it != m_values.end(); ++it) {
+        output << it->first << "\t" << it->second << "\n";
+    }
+
+    output.close();
+    if (!output) {
+        throw io_error("error writing checkpoint to '" + tmp_filename + "'", errno);
+    }
+
+    // The checkpoint must not replace the previous checkpoint before it is
+    // on disk, since outputs have already been flushed past that checkpoint
+    const int fd = ::open(tmp_filename.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd)) {
+        const int error_number = errno;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+
+        throw io_error("error syncing checkpoint '" + tmp_filename + "'", error_number);
+    }
+
+    ::close(fd);
+
+    if (std::rename(tmp_filename.c_str(), filename.c_str())) {
+        throw io_error("error renaming checkpoint to '" + filename + "'", errno);
+    }
+}
+
+
+const std::string& checkpoint_data::get_value(const std::string& key) const
+{
+    const value_map::const_iterator it = m_values.find(key);
+    if (it == m_values.end()) {
+        throw checkpoint_error("'" + key + "' not found; was the file "
+                               "written using the same input files and "
+                               "options?");
+    }
+
+    return it->second;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Serialization of statistics
+
+void save_statistics(checkpoint_data& data, const std::string& prefix,
+                     const statistics& stats)
+{
+    data.set(prefix + ".full_length_collapsed", stats.number_of_full_length_collapsed);
+    data.set(prefix + ".truncated_collapsed", stats.number_of_truncated_collapsed);
+    data.set(prefix + ".retained_nucleotides", stats.total_number_of_nucleotides);
+    data.set(prefix + ".retained_reads", stats.total_number_of_good_reads);
+    data.set(prefix + ".reads_with_adapter", stats.number_of_reads_with_adapter);
+    data.set(prefix + ".unaligned_reads", stats.unaligned_reads);
+    data.set(prefix + ".well_aligned_reads", stats.well_aligned_reads);
+    data.set(prefix + ".poorly_aligned_reads", stats.poorly_aligned_reads);
+    data.set(prefix + ".keep1", stats.keep1);
+    data.set(prefix + ".discard1", stats.discard1);
+    data.set(prefix + ".keep2", stats.keep2);
+    data.set(prefix + ".discard2", stats.discard2);
+    data.set(prefix + ".records", stats.records);
+    data.set(prefix + ".read_lengths", stats.read_lengths);
+    data.set(prefix + ".length_rows", stats.length_rows);
+}
+
+
+void load_statistics(const checkpoint_data& data, const std::string& prefix,
+                     statistics& stats)
+{
+    stats.number_of_full_length_collapsed = data.get(prefix + ".full_length_collapsed");
+    stats.number_of_truncated_collapsed = data.get(prefix + ".truncated_collapsed");
+    stats.total_number_of_nucleotides = data.get(prefix + ".retained_nucleotides");
+    stats.total_number_of_good_reads = data.get(prefix + ".retained_reads");
+    stats.number_of_reads_with_adapter = data.get_vector(prefix + ".reads_with_adapter");
+    stats.unaligned_reads = data.get(prefix + ".unaligned_reads");
+    stats.well_aligned_reads = data.get(prefix + ".well_aligned_reads");
+    stats.poorly_aligned_reads = data.get(prefix + ".poorly_aligned_reads");
+    stats.keep1 = data.get(prefix + ".keep1");
+    stats.discard1 = data.get(prefix + ".discard1");
+    stats.keep2 = data.get(prefix + ".keep2");
+    stats.discard2 = data.get(prefix + ".discard2");
+    stats.records = data.get(prefix + ".records");
+    stats.read_lengths = data.get_vector(prefix + ".read_lengths");
+    stats.length_rows = data.get(prefix + ".length_rows");
+
+    if (stats.read_lengths.size() % rt_max
+        || stats.length_rows * rt_max > stats.read_lengths.size()) {
+        throw checkpoint_error("invalid read length distribution in checkpoint");
+    }
+}
+
+
+void save_statistics(checkpoint_data& data, const std::string& prefix,
+                     const demux_statistics& stats)
+{
+    data.set(prefix + ".barcodes", stats.barcodes);
+    data.set(prefix + ".unidentified", stats.unidentified);
+    data.set(prefix + ".ambiguous", stats.ambiguous);
+}
+
+
+void load_statistics(const checkpoint_data& data, const std::string& prefix,
+                     demux_statistics& stats)
+{
+    const std::vector<size_t> barcodes = data.get_vector(prefix + ".barcodes");
+    if (barcodes.size() != stats.barcodes.size()) {
+        throw checkpoint_error("number of barcodes in checkpoint does not "
+                               "match the current --barcode-list");
+    }
+
+    stats.barcodes = barcodes;
+    stats.unidentified = data.get(prefix + ".unidentified");
+    stats.ambiguous = data.get(prefix + ".ambiguous");
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'checkpoint_state'
+
+checkpoint_state::~checkpoint_state()
+{
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'checkpointer'
+
+checkpointer::checkpointer(const std::string& filename, double interval, bool resume)
+  : pipeline_barrier()
+  , m_filename(filename)
+  , m_interval(interval)
+  , m_last_checkpoint(get_current_time())
+  , m_resumed()
+  , m_states()
+{
+    // A missing checkpoint means that the run was interrupted before the
+    // first checkpoint, in which case the run is simply restarted
+    if (resume && ::access(filename.c_str(), F_OK) == 0) {
+        m_resumed.reset(new checkpoint_data());
+        m_resumed->read(filename);
+    }
+}
+
+
+checkpointer::~checkpointer()
+{
+}
+
+
+const checkpoint_data* checkpointer::resumed() const
+{
+    return m_resumed.get();
+}
+
+
+void checkpointer::add_state(checkpoint_state* state)
+{
+    m_states.push_back(state);
+}
+
+
+bool checkpointer::request_if_due()
+{
+    if (get_current_time() - m_last_checkpoint < m_interval) {
+        return false;
+    }
+
+    request();
+
+    return true;
+}
+
+
+void checkpointer::run()
+{
+    checkpoint_data data;
+    for (std::vector<checkpoint_state*>::iterator it = m_states.begin(); it != m_states.end(); ++it) {
+        (*it)->save_checkpoint(data);
+    }
+
+    data.write(m_filename);
+
+    // The interval is counted from the end of the checkpoint, since syncing
+    // large outputs to disk may take some time
+    m_last_checkpoint = get_current_time();
+}
+
+
+void checkpointer::remove()
+{
+    if (std::remove(m_filename.c_str()) && errno != ENOENT) {
+        throw io_error("error removing checkpoint '" + m_filename + "'", errno);
+    }
+}
+
+} // namespace ar
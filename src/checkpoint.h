@@ -0,0 +1,198 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_CHECKPOINT_H
+#define AR_CHECKPOINT_H
+
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "commontypes.h"
+#include "scheduler.h"
+#include "statistics.h"
+
+namespace ar
+{
+
+//! Default number of seconds between checkpoints
+const double CHECKPOINT_DEFAULT_INTERVAL = 300.0;
+
+
+/** Exception raised for invalid or mismatching checkpoint files. */
+class checkpoint_error : public std::exception
+{
+public:
+    checkpoint_error(const std::string& message);
+    ~checkpoint_error() throw();
+
+    /** Returns error message; string is owned by exception. */
+    virtual const char* what() const throw();
+
+private:
+    //! Error message assosiated with exception.
+    std::string m_message;
+};
+
+
+/**
+ * Key / value store representing the state of a run at a checkpoint. Keys
+ * must not contain newlines or tabs, except for the last tab, which seperates
+ * the key from the value in the text format written by 'write'.
+ */
+class checkpoint_data
+{
+public:
+    /** Constructor; creates empty store. */
+    checkpoint_data();
+
+    /** Sets a single value. */
+    void set(const std::string& key, size_t value);
+    /** Sets a list of values. */
+    void set(const std::string& key, const std::vector<size_t>& values);
+
+    /** Returns true if the key has been set. */
+    bool contains(const std::string& key) const;
+    /** Returns a single value; throws checkpoint_error if not set. */
+    size_t get(const std::string& key) const;
+    /** Returns a list of values; throws checkpoint_error if not set. */
+    std::vector<size_t> get_vector(const std::string& key) const;
+
+    /** Reads a file written by 'write'; throws io_error or checkpoint_error. */
+    void read(const std::string& filename);
+
+    /**
+     * Writes the values to a file, which is synced to disk and then used to
+     * replace 'filename', so that the file is never partially written.
+     */
+    void write(const std::string& filename) const;
+
+private:
+    typedef std::map<std::string, std::string> value_map;
+
+    /** Returns the value of 'key'; throws checkpoint_error if not set. */
+    const std::string& get_value(const std::string& key) const;
+
+    //! Values in the text format used by 'read' and 'write'
+    value_map m_values;
+};
+
+
+/** Saves trimming statistics using keys starting with 'prefix'. */
+void save_statistics(checkpoint_data& data, const std::string& prefix,
+                     const statistics& stats);
+
+/** Loads trimming statistics saved using 'save_statistics'. */
+void load_statistics(const checkpoint_data& data, const std::string& prefix,
+                     statistics& stats);
+
+/** Saves demultiplexing statistics using keys starting with 'prefix'. */
+void save_statistics(checkpoint_data& data, const std::string& prefix,
+                     const demux_statistics& stats);
+
+/** Loads demultiplexing statistics saved using 'save_statistics'. */
+void load_statistics(const checkpoint_data& data, const std::string& prefix,
+                     demux_statistics& stats);
+
+
+/** Interface for steps (or other objects) with state saved at checkpoints. */
+class checkpoint_state
+{
+public:
+    /** Destructor; does nothing. */
+    virtual ~checkpoint_state();
+
+    /**
+     * Saves the current state; called while the pipeline is drained, and the
+     * state must therefore account for exactly the reads read so far.
+     */
+    virtual void save_checkpoint(checkpoint_data& data) = 0;
+};
+
+
+/**
+ * Barrier writing checkpoints of a run at regular intervals.
+ *
+ * Checkpoints are requested by the step reading the input files (see
+ * 'request_if_due'), which marks the current chunk, so that steps buffering
+ * reads or compressed data forward these once the marked chunk is seen.
+ * Once the pipeline has been drained, the state of every registered object
+ * is saved and the checkpoint file is (atomically) replaced.
+ *
+ * When resuming, the state saved in the last checkpoint is made available
+ * via 'resumed', and is used by each object to continue where it left off.
+ */
+class checkpointer : public pipeline_barrier
+{
+public:
+    /**
+     * Constructor; if 'resume' is set and 'filename' exists, the file is read
+     * and made available via 'resumed'. Throws on invalid files.
+     */
+    checkpointer(const std::string& filename, double interval, bool resume);
+
+    /** Destructor; does nothing. */
+    virtual ~checkpointer();
+
+    /** Returns the state to resume from, or NULL if starting a new run. */
+    const checkpoint_data* resumed() const;
+
+    /** Adds an object whose state is saved at checkpoints. */
+    void add_state(checkpoint_state* state);
+
+    /**
+     * Requests a checkpoint if 'interval' seconds have passed since the last
+     * checkpoint, returning true if so; must only be called by the first
+     * step of the pipeline (see 'pipeline_barrier::request').
+     */
+    bool request_if_due();
+
+    /** Saves the state of all objects and writes the checkpoint file. */
+    virtual void run();
+
+    /** Removes the checkpoint file; called once the run has completed. */
+    void remove();
+
+private:
+    //! Not implemented
+    checkpointer(const checkpointer&);
+    //! Not implemented
+    checkpointer& operator=(const checkpointer&);
+
+    //! Path of the checkpoint file
+    const std::string m_filename;
+    //! Min number of seconds between checkpoints
+    const double m_interval;
+    //! Time at which the last checkpoint was written (or the run started)
+    double m_last_checkpoint;
+    //! State loaded from an existing checkpoint; NULL if not resuming
+    std::auto_ptr<checkpoint_data> m_resumed;
+    //! Objects whose state is saved at checkpoints; not owned
+    std::vector<checkpoint_state*> m_states;
+};
+
+} // namespace ar
+
+#endif
@@ -33,6 +33,8 @@ namespace ar
 
 class fastq;
 
+typedef std::vector<size_t> size_vec;
+
 typedef std::vector<std::string> string_vec;
 typedef string_vec::const_iterator string_vec_citer;
 typedef std::pair<std::string, std::string> string_pair;
@@ -62,14 +64,43 @@ enum read_type
 };
 
 
+/** Formats of records written to output files. */
+enum output_format
+{
+    //! FASTQ records, using the quality encoding chosen by the user
+    of_fastq = 0,
+    //! Unaligned BAM records for SE reads, singletons, collapsed reads, etc.
+    of_bam,
+    //! Unaligned BAM records for pairs of mates, each mate 1 record followed
+    //! by the mate 2 record
+    of_bam_pairs
+};
+
+
+/** Storage of reads waiting to be processed; see 'packed_reads'. */
+enum read_packing
+{
+    //! Reads are stored as FASTQ records
+    rp_none = 0,
+    //! Nucleotides are packed, and quality scores are kept as is
+    rp_lossless,
+    //! Nucleotides are packed, and quality scores are binned (lossy)
+    rp_binned
+};
+
+
 /** Unique IDs for analytical steps. */
 enum analyses_id
 {
     //! Step for reading of SE or PE reads
     ai_read_fastq = 0,
+    //! Step for parsing memory mapped SE or PE reads
+    ai_parse_fastq,
 
     //! Step for demultiplexing SE or PE reads
     ai_demultiplex,
+    //! Step for collecting demultiplexed reads into per-barcode chunks
+    ai_demultiplex_cache,
 
     //! Step for writing mate 1 reads which were not identified
     ai_write_unidentified_1,
@@ -80,25 +111,27 @@ enum analyses_id
     //! If enabled, the demultiplexing step will forward reads to the
     //! nth * ai_analyses_offset analytical step, corresponding to the
     //! barcode number.
-    ai_analyses_offset = 20,
+    ai_analyses_offset = 30,
 
     //! Step for reading adapter identification
-    ai_identify_adapters = 20,
+    ai_identify_adapters = 30,
     //! Step for trimming of PE reads
-    ai_trim_pe = 20,
+    ai_trim_pe = 30,
     //! Step for trimming of SE reads
-    ai_trim_se = 20,
+    ai_trim_se = 30,
 
-    //! Offset added to write steps when zipping
+    //! Offset added to write steps when zipping; bzip2 compression uses two
+    //! steps (collecting blocks and compressing them), and is written at
+    //! twice this offset
     ai_zip_offset = 10,
 
     //! Steps for writing of trimmed reads
-    ai_write_mate_1 = 21,
-    ai_write_mate_2 = 22,
-    ai_write_singleton = 23,
-    ai_write_collapsed = 24,
-    ai_write_collapsed_truncated = 25,
-    ai_write_discarded = 26
+    ai_write_mate_1 = 31,
+    ai_write_mate_2 = 32,
+    ai_write_singleton = 33,
+    ai_write_collapsed = 34,
+    ai_write_collapsed_truncated = 35,
+    ai_write_discarded = 36
 };
 
 } // namespace ar
@@ -58,17 +58,6 @@ public:
         children[3] = -1;
     }
 
-    bool has_children() const
-    {
-        for (size_t nt_idx = 0; nt_idx < 4; ++nt_idx) {
-            if (children[nt_idx] != -1) {
-                 return true;
-            }
-        }
-
-        return false;
-    }
-
     int children[4];
     int_vec barcodes;
 };
@@ -76,87 +65,28 @@ public:
 
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Fills a quadtree with nodes representing keys of len 'max_key_len' */
-void fill_demux_tree(demux_node_vec& tree, const size_t max_key_len)
-{
-    const size_t n_keys = (1 - (1 << (2 * (max_key_len + 1)))) / (1 - 4);
-    const size_t n_internal = n_keys - (1 << (2 * max_key_len));
-
-    tree.resize(n_keys);
-
-    for (size_t index = 0; index < n_keys; ++index) {
-        demultiplexer_node& node = tree.at(index);
-
-        for (size_t nt_idx = 0; nt_idx < 4; ++nt_idx) {
-            node.children[nt_idx] = (index < n_internal) ? 4 * index + nt_idx + 1 : -1;
-        }
-    }
-}
-
-
-/** Adds a nucleotide sequence with a given ID to a quadtree. */
+/**
+ * Adds a nucleotide sequence with a given ID to a quadtree; nodes are only
+ * appended to the tree as they are needed, so that the tree is kept sparse.
+ */
 void add_sequence_to_tree(demux_node_vec& tree,
                           const std::string& sequence,
                           const size_t barcode_id)
 {
-    demultiplexer_node* parent = &tree.at(0);
+    size_t parent = 0;
     for (std::string::const_iterator it = sequence.begin(); it != sequence.end(); ++it) {
-        const int child = parent->children[ACGT_TO_IDX(*it)];
-        AR_DEBUG_ASSERT(child != -1);
-
-        parent = &tree.at(child);
-    }
-
-    parent->barcodes.push_back(barcode_id);
-}
-
-
-/**
- * Converts a full quad-tree to a sparse quad-tree, by removing any nodes
- * which does not contain any barcodes and which does not have any children.
- * Once these have been removed, the resulting list is compressed such that
- * only populated parts of the tree are included in the vector.
- */
-void prune_tree(demux_node_vec& tree)
-{
-    if (tree.empty()) {
-        return;
-    }
-
-    for (size_t idx = tree.size() - 1; idx; --idx) {
-        const demultiplexer_node& node = tree.at(0);
-
-        if (node.barcodes.empty() && !node.has_children()) {
-            tree.at((idx - 1) / 4).children[(idx - 1) % 4] = -1;
+        int child = tree.at(parent).children[ACGT_TO_IDX(*it)];
+        if (child == -1) {
+            // Note that this may invalidate references to nodes in the tree
+            child = static_cast<int>(tree.size());
+            tree.push_back(demultiplexer_node());
+            tree.at(parent).children[ACGT_TO_IDX(*it)] = child;
         }
-    }
 
-    size_t last_index = 0;
-    std::vector<int> new_indices(tree.size(), -1);
-    for (size_t idx = 0; idx < tree.size(); ++idx) {
-        const demultiplexer_node& node = tree.at(0);
-
-        if (!node.barcodes.empty() || node.has_children()) {
-            if (idx != last_index) {
-                tree.at(last_index) = node;
-            }
-
-            new_indices.at(idx) = last_index;
-            last_index++;
-        }
+        parent = child;
     }
 
-    tree.resize(last_index);
-
-    for (size_t idx = 0; idx < tree.size(); ++idx) {
-        demultiplexer_node& node = tree.at(0);
-
-        for (size_t nt_idx = 0; nt_idx < 4; ++nt_idx) {
-            if (node.children[nt_idx] != -1) {
-                node.children[nt_idx] = new_indices.at(node.children[nt_idx]);
-            }
-        }
-    }
+    tree.at(parent).barcodes.push_back(barcode_id);
 }
 
 
@@ -180,21 +110,19 @@ demux_node_vec build_demux_tree(const fastq_pair_vec& barcodes)
         AR_DEBUG_ASSERT(it->second.length() == max_key_2_len);
     }
 
-    fill_demux_tree(tree, max_key_1_len);
-
+    tree.push_back(demultiplexer_node());
     for (fastq_pair_vec::const_iterator it = barcodes.begin(); it != barcodes.end(); ++it) {
         add_sequence_to_tree(tree, it->first.sequence(), it - barcodes.begin());
     }
 
-    prune_tree(tree);
-
     return tree;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
-typedef std::vector<std::pair<int, size_t> > candidate_vec;
+typedef barcode_table::candidate candidate;
+typedef std::vector<candidate> candidate_vec;
 
 
 void rec_lookup_sequence_no_mm(candidate_vec& candidates,
@@ -254,39 +182,49 @@ void rec_lookup_sequence(candidate_vec& candidates,
 ///////////////////////////////////////////////////////////////////////////////
 
 
-demultiplex_reads::demultiplex_reads(const userconfig* config)
-    : analytical_step(analytical_step::ordered)
+demultiplex_reads::stats_sink::stats_sink(size_t n_barcodes)
+    : statistics_sink<demux_statistics>()
+    , m_n_barcodes(n_barcodes)
+{
+}
+
+
+demux_statistics* demultiplex_reads::stats_sink::new_sink() const
+{
+    return new demux_statistics(m_n_barcodes);
+}
+
+
+demultiplex_reads::demultiplex_reads(const userconfig* config,
+                                     checkpointer* checkpoints)
+    : analytical_step(analytical_step::unordered)
     , m_barcodes(config->adapters.get_barcodes())
-    , m_tree(build_demux_tree(m_barcodes))
+    , m_table(m_barcodes, std::min<size_t>(config->barcode_mm, config->barcode_mm_r1))
+    , m_tree(m_table.empty() ? build_demux_tree(m_barcodes) : demux_node_vec())
     , m_max_mismatches(config->barcode_mm)
     , m_max_mismatches_r1(std::min<size_t>(config->barcode_mm, config->barcode_mm_r1))
     , m_max_mismatches_r2(std::min<size_t>(config->barcode_mm, config->barcode_mm_r2))
     , m_config(config)
-    , m_cache(m_barcodes.size(), NULL)
-    , m_unidentified_1(new fastq_output_chunk())
-    , m_unidentified_2(new fastq_output_chunk())
+    , m_stats(m_barcodes.size())
     , m_statistics(m_barcodes.size())
 {
     AR_DEBUG_ASSERT(!m_barcodes.empty());
 
-    for (demultiplexed_cache::iterator it = m_cache.begin(); it != m_cache.end(); ++it) {
-        *it = new fastq_read_chunk();
+    if (checkpoints) {
+        if (checkpoints->resumed()) {
+            load_statistics(*checkpoints->resumed(), "demux", *m_stats.get_sink());
+        }
+
+        checkpoints->add_state(this);
     }
 }
 
 
 demultiplex_reads::~demultiplex_reads()
 {
-    for (demultiplexed_cache::iterator it = m_cache.begin(); it != m_cache.end(); ++it) {
-        delete *it;
-    }
-
-    delete m_unidentified_1;
-    delete m_unidentified_2;
 }
 
 
-
 size_t count_mismatches(const std::string& barcode,
                         const std::string& sequence,
                         const size_t max_mismatches)
@@ -315,18 +253,32 @@ size_t count_mismatches(const std::string& barcode,
  * Returns the best matching barcode (pair) for sequences read_r1 and read_r2
  *
  */
-int demultiplex_reads::select_barcode(const fastq& read_r1, const fastq& read_r2)
+int demultiplex_reads::select_barcode(const fastq& read_r1, const fastq& read_r2) const
 {
+    const candidate* begin = NULL;
+    const candidate* end = NULL;
     candidate_vec candidates;
-    if (m_max_mismatches_r1) {
-        rec_lookup_sequence(candidates, m_tree, read_r1.sequence(), m_max_mismatches_r1);
+
+    if (!m_table.empty()) {
+        m_table.lookup(read_r1.sequence(), begin, end);
     } else {
-        rec_lookup_sequence_no_mm(candidates, m_tree, read_r1.sequence());
+        if (m_max_mismatches_r1) {
+            rec_lookup_sequence(candidates, m_tree, read_r1.sequence(), m_max_mismatches_r1);
+        } else {
+            rec_lookup_sequence_no_mm(candidates, m_tree, read_r1.sequence());
+        }
+
+        if (!candidates.empty()) {
+            begin = &candidates.front();
+            end = begin + candidates.size();
+        }
     }
 
     int best_barcode = -1;
     size_t min_mismatches = m_max_mismatches + 1;
-    for (candidate_vec::iterator it = candidates.begin(); it != candidates.end(); ++it) {
+    for (const candidate* it = begin; it != end; ++it) {
+        size_t total_mismatches = it->second;
+
         if (m_config->paired_ended_mode) {
             const std::string& barcode = m_barcodes.at(it->first).second.sequence();
             const size_t max_mismatches_r2 = std::min(m_max_mismatches - it->second,
@@ -340,13 +292,13 @@ int demultiplex_reads::select_barcode(const fastq& read_r1, const fastq& read_r2
                 continue;
             }
 
-            it->second += mismatches;
+            total_mismatches += mismatches;
         }
 
-        if (it->second < min_mismatches) {
+        if (total_mismatches < min_mismatches) {
             best_barcode = it->first;
-            min_mismatches = it->second;
-        } else if (it->second == min_mismatches) {
+            min_mismatches = total_mismatches;
+        } else if (total_mismatches == min_mismatches) {
             // Ambiguous results; multiple best matches
             best_barcode = -1;
         }
@@ -364,34 +316,32 @@ int demultiplex_reads::select_barcode(const fastq& read_r1, const fastq& read_r2
 }
 
 
-chunk_vec demultiplex_reads::flush_cache(bool eof)
+bool demultiplex_reads::count_barcode(demux_statistics& stats, int barcode)
 {
-    chunk_vec output;
-
-    if (eof || m_unidentified_1->count >= FASTQ_CHUNK_SIZE) {
-        output.push_back(chunk_pair(ai_write_unidentified_1, m_unidentified_1));
-        m_unidentified_1->eof = eof;
-        m_unidentified_1 = new fastq_output_chunk();
+    if (barcode >= 0) {
+        stats.barcodes.at(barcode) += 1;
+        return true;
+    } else if (barcode == -1) {
+        stats.unidentified += 1;
+    } else {
+        stats.ambiguous += 1;
     }
 
-    if (m_config->paired_ended_mode && (eof || m_unidentified_2->count >= FASTQ_CHUNK_SIZE)) {
-        output.push_back(chunk_pair(ai_write_unidentified_2, m_unidentified_2));
-        m_unidentified_2->eof = eof;
-        m_unidentified_2 = new fastq_output_chunk();
-    }
+    return false;
+}
 
-    for (size_t nth = 0; nth < m_cache.size(); ++nth) {
-        fastq_read_chunk* chunk = m_cache.at(nth);
-        if (eof || chunk->reads_1.size() >= FASTQ_CHUNK_SIZE) {
-            chunk->eof = eof;
 
-            const size_t step_id = (nth + 1) * ai_analyses_offset;
-            output.push_back(chunk_pair(step_id, chunk));
-            m_cache.at(nth) = new fastq_read_chunk();
-        }
-    }
+void demultiplex_reads::finalize()
+{
+    const std::auto_ptr<demux_statistics> stats(m_stats.finalize());
+    m_statistics = *stats;
+}
 
-    return output;
+
+void demultiplex_reads::save_checkpoint(checkpoint_data& data)
+{
+    const std::auto_ptr<demux_statistics> stats(m_stats.snapshot());
+    save_statistics(data, "demux", *stats);
 }
 
 
@@ -403,8 +353,9 @@ demux_statistics demultiplex_reads::statistics() const
 
 ///////////////////////////////////////////////////////////////////////////////
 
-demultiplex_se_reads::demultiplex_se_reads(const userconfig* config)
-    : demultiplex_reads(config)
+demultiplex_se_reads::demultiplex_se_reads(const userconfig* config,
+                                           checkpointer* checkpoints)
+    : demultiplex_reads(config, checkpoints)
 {
 }
 
@@ -412,36 +363,35 @@ demultiplex_se_reads::demultiplex_se_reads(const userconfig* config)
 chunk_vec demultiplex_se_reads::process(analytical_chunk* chunk)
 {
     std::auto_ptr<fastq_read_chunk> read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    demux_statistics* const stats = m_stats.get_sink();
 
-    const fastq empty_read;
-    for (fastq_vec::iterator it = read_chunk->reads_1.begin(); it != read_chunk->reads_1.end(); ++it) {
-        const int best_barcode = select_barcode(*it, empty_read);
+    read_chunk->unpack();
+    read_chunk->barcodes.resize(read_chunk->reads_1.size());
 
-        if (best_barcode < 0) {
-            m_unidentified_1->add(*m_config->quality_output_fmt, *it);
-
-            if (best_barcode == -1) {
-                m_statistics.unidentified += 1;
-            } else {
-                m_statistics.ambiguous += 1;
-            }
-        } else {
-            fastq_read_chunk* dst = m_cache.at(best_barcode);
-            dst->reads_1.push_back(*it);
-            dst->reads_1.back().truncate(m_barcodes.at(best_barcode).first.length());
+    const fastq empty_read;
+    for (size_t nth = 0; nth < read_chunk->reads_1.size(); ++nth) {
+        fastq& read = read_chunk->reads_1.at(nth);
+        const int best_barcode = select_barcode(read, empty_read);
 
-           m_statistics.barcodes.at(best_barcode) += 1;
+        if (count_barcode(*stats, best_barcode)) {
+            read.truncate(m_barcodes.at(best_barcode).first.length());
         }
+
+        read_chunk->barcodes.at(nth) = best_barcode;
     }
 
-    return flush_cache(read_chunk->eof);
+    chunk_vec output;
+    output.push_back(chunk_pair(ai_demultiplex_cache, read_chunk.release()));
+
+    return output;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
-demultiplex_pe_reads::demultiplex_pe_reads(const userconfig* config)
-    : demultiplex_reads(config)
+demultiplex_pe_reads::demultiplex_pe_reads(const userconfig* config,
+                                           checkpointer* checkpoints)
+    : demultiplex_reads(config, checkpoints)
 {
 }
 
@@ -449,35 +399,149 @@ demultiplex_pe_reads::demultiplex_pe_reads(const userconfig* config)
 chunk_vec demultiplex_pe_reads::process(analytical_chunk* chunk)
 {
     std::auto_ptr<fastq_read_chunk> read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    read_chunk->unpack();
     AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
+    demux_statistics* const stats = m_stats.get_sink();
 
-    fastq_vec::iterator it_1 = read_chunk->reads_1.begin();
-    fastq_vec::iterator it_2 = read_chunk->reads_2.begin();
-    for (; it_1 != read_chunk->reads_1.end(); ++it_1, ++it_2) {
-        const int best_barcode = select_barcode(*it_1, *it_2);
+    read_chunk->barcodes.resize(read_chunk->reads_1.size());
 
-        if (best_barcode < 0) {
-            m_unidentified_1->add(*m_config->quality_output_fmt, *it_1);
-            m_unidentified_2->add(*m_config->quality_output_fmt, *it_2);
+    for (size_t nth = 0; nth < read_chunk->reads_1.size(); ++nth) {
+        fastq& read_1 = read_chunk->reads_1.at(nth);
+        fastq& read_2 = read_chunk->reads_2.at(nth);
+        const int best_barcode = select_barcode(read_1, read_2);
 
-            if (best_barcode == -1) {
-                m_statistics.unidentified += 1;
-            } else {
-                m_statistics.ambiguous += 1;
+        if (count_barcode(*stats, best_barcode)) {
+            read_1.truncate(m_barcodes.at(best_barcode).first.length());
+            read_2.truncate(m_barcodes.at(best_barcode).second.length());
+        }
+
+        read_chunk->barcodes.at(nth) = best_barcode;
+    }
+
+    chunk_vec output;
+    output.push_back(chunk_pair(ai_demultiplex_cache, read_chunk.release()));
+
+    return output;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+/** Returns the format of unidentified mate 1 reads, which may include mate 2. */
+inline output_format get_unidentified_1_format(const userconfig* config)
+{
+    return config->get_output_format(config->paired_ended_mode
+                                     && config->interleaved_output);
+}
+
+
+demultiplex_cache::demultiplex_cache(const userconfig* config)
+    : analytical_step(analytical_step::ordered)
+    , m_config(config)
+    , m_chunk_size(config->chunk_size ? config->chunk_size : FASTQ_CHUNK_SIZE)
+    , m_cache(config->adapters.barcode_count(), NULL)
+    , m_unidentified_1(fastq_output_chunk::acquire(false, get_unidentified_1_format(config)))
+    , m_unidentified_2(fastq_output_chunk::acquire(false, config->get_output_format()))
+{
+    for (demultiplexed_cache::iterator it = m_cache.begin(); it != m_cache.end(); ++it) {
+        *it = fastq_read_chunk::acquire();
+    }
+}
+
+
+demultiplex_cache::~demultiplex_cache()
+{
+    for (demultiplexed_cache::iterator it = m_cache.begin(); it != m_cache.end(); ++it) {
+        delete *it;
+    }
+
+    delete m_unidentified_1;
+    delete m_unidentified_2;
+}
+
+
+chunk_vec demultiplex_cache::process(analytical_chunk* chunk)
+{
+    std::auto_ptr<fastq_read_chunk> read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    AR_DEBUG_ASSERT(read_chunk->barcodes.size() == read_chunk->reads_1.size());
+
+    const fastq_encoding& encoding = *m_config->quality_output_fmt;
+    const bool paired_ended_mode = m_config->paired_ended_mode;
+    // Reads may wait in the cache for a long time when using many barcodes
+    const read_packing packing = m_config->get_read_packing();
+    fastq_output_chunk& unidentified_2 = m_config->interleaved_output
+                                         ? *m_unidentified_1 : *m_unidentified_2;
+
+    for (size_t nth = 0; nth < read_chunk->reads_1.size(); ++nth) {
+        const int barcode = read_chunk->barcodes.at(nth);
+
+        if (barcode < 0) {
+            m_unidentified_1->add(encoding, read_chunk->reads_1.at(nth));
+            if (paired_ended_mode) {
+                unidentified_2.add(encoding, read_chunk->reads_2.at(nth));
             }
         } else {
-            fastq_read_chunk* dst = m_cache.at(best_barcode);
+            fastq_read_chunk* dst = m_cache.at(barcode);
+            if (packing != rp_none) {
+                dst->packed_1.add(read_chunk->reads_1.at(nth), packing);
+                if (paired_ended_mode) {
+                    dst->packed_2.add(read_chunk->reads_2.at(nth), packing);
+                }
+            } else {
+                dst->reads_1.push_back(read_chunk->reads_1.at(nth));
+                if (paired_ended_mode) {
+                    dst->reads_2.push_back(read_chunk->reads_2.at(nth));
+                }
+            }
+        }
+    }
 
-            it_1->truncate(m_barcodes.at(best_barcode).first.length());
-            dst->reads_1.push_back(*it_1);
-            it_2->truncate(m_barcodes.at(best_barcode).second.length());
-            dst->reads_2.push_back(*it_2);
+    const bool eof = read_chunk->eof;
+    const bool checkpoint = read_chunk->checkpoint;
+    fastq_read_chunk::recycle(read_chunk.release());
 
-            m_statistics.barcodes.at(best_barcode) += 1;
+    return flush_cache(eof, checkpoint);
+}
+
+
+chunk_vec demultiplex_cache::flush_cache(bool eof, bool checkpoint)
+{
+    chunk_vec output;
+    // All reads must be forwarded before a checkpoint is written
+    const bool flush = eof || checkpoint;
+
+    if (flush || m_unidentified_1->count >= m_chunk_size) {
+        output.push_back(chunk_pair(ai_write_unidentified_1, m_unidentified_1));
+        m_unidentified_1->eof = eof;
+        m_unidentified_1->checkpoint = checkpoint;
+        m_unidentified_1 = fastq_output_chunk::acquire(false,
+                                                       get_unidentified_1_format(m_config));
+    }
+
+    if (m_config->paired_ended_mode && !m_config->interleaved_output
+        && (flush || m_unidentified_2->count >= m_chunk_size)) {
+        output.push_back(chunk_pair(ai_write_unidentified_2, m_unidentified_2));
+        m_unidentified_2->eof = eof;
+        m_unidentified_2->checkpoint = checkpoint;
+        m_unidentified_2 = fastq_output_chunk::acquire(false,
+                                                       m_config->get_output_format());
+    }
+
+    for (size_t nth = 0; nth < m_cache.size(); ++nth) {
+        fastq_read_chunk* chunk = m_cache.at(nth);
+        if (flush || chunk->reads_1.size() + chunk->packed_1.size() >= m_chunk_size) {
+            chunk->eof = eof;
+            chunk->checkpoint = checkpoint;
+
+            const size_t step_id = (nth + 1) * ai_analyses_offset;
+            output.push_back(chunk_pair(step_id, chunk));
+            m_cache.at(nth) = fastq_read_chunk::acquire();
+            // Frees spare records from earlier uses, if reads are packed
+            m_cache.at(nth)->pack(m_config->get_read_packing());
         }
     }
 
-    return flush_cache(read_chunk->eof);
+    return output;
 }
 
 } // namespace ar
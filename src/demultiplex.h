@@ -25,7 +25,9 @@
 #ifndef DEMULTIPLEX_H
 #define DEMULTIPLEX_H
 
+#include "barcode_table.h"
 #include "fastq.h"
+#include "checkpoint.h"
 #include "scheduler.h"
 #include "statistics.h"
 
@@ -42,32 +44,65 @@ typedef std::vector<demultiplexer_node> demux_node_vec;
 
 
 /**
- * Baseclass for demultiplexing of reads; responsible for building the quadtree
- * representing the set of adapter sequences, and for maintaining the cache of
- * demultiplexed reads.
+ * Baseclass for demultiplexing of reads; responsible for building the hash
+ * table or quadtree representing the set of adapter sequences, and for
+ * selecting the barcode (pair) matching each read (pair).
+ *
+ * Demultiplexing is an unordered step: Each chunk is annotated with the
+ * barcode selected for each read (see fastq_read_chunk::barcodes), barcodes
+ * are trimmed from identified reads, and the chunk is then forwarded to the
+ * (ordered) 'demultiplex_cache' step at ai_demultiplex_cache.
  */
-class demultiplex_reads : public analytical_step
+class demultiplex_reads : public analytical_step, public checkpoint_state
 {
 public:
-    /** Setup demultiplexer; keeps pointer to config object. */
-    demultiplex_reads(const userconfig* config);
+    /**
+     * Setup demultiplexer; keeps pointer to config object. If 'checkpoints'
+     * is set, statistics are saved at checkpoints, and resumed if resuming.
+     */
+    demultiplex_reads(const userconfig* config, checkpointer* checkpoints = NULL);
 
-    /** Frees any unflushed caches. */
+    /** Destructor; does nothing. */
     virtual ~demultiplex_reads();
 
-    /** Returns a statistics object summarizing the results up till now. */
+    /** Combines the statistics collected by individual threads. */
+    virtual void finalize();
+
+    /** Saves the statistics collected so far; see 'checkpointer'. */
+    virtual void save_checkpoint(checkpoint_data& data);
+
+    /** Returns a statistics object summarizing the results; see 'finalize'. */
     demux_statistics statistics() const;
 
 protected:
     /**
      * Returns the id of the best matching barcode(s), or -1 if no matches were
-     * found or if no single best match was found.
+     * found or -2 if no single best match was found.
      */
-    int select_barcode(const fastq& read_r1, const fastq& read_r2);
+    int select_barcode(const fastq& read_r1, const fastq& read_r2) const;
+
+    /** Updates statistics; returns true if the read (pair) was identified. */
+    static bool count_barcode(demux_statistics& stats, int barcode);
+
+    class stats_sink : public statistics_sink<demux_statistics>
+    {
+    public:
+        stats_sink(size_t n_barcodes);
+
+    protected:
+        virtual demux_statistics* new_sink() const;
+
+    private:
+        //! Number of barcodes (pairs)
+        const size_t m_n_barcodes;
+    };
 
     //! List of barcode (pairs) supplied by caller
     const fastq_pair_vec& m_barcodes;
+    //! Hash table of mate 1 barcode neighborhoods; used if supported
+    const barcode_table m_table;
     //! Quadtree representing all mate 1 adapters; for search with n mismatches
+    //! Only built if the barcodes cannot be stored in 'm_table'.
     const demux_node_vec m_tree;
     //! Maximum number of mismatches allowed between the mate 1 and mate 2 read
     const size_t m_max_mismatches;
@@ -78,23 +113,9 @@ protected:
     //! Pointer to user settings used for output format for unidentified reads
     const userconfig* m_config;
 
-    //! Returns a chunk-list with any set of reads exceeding the max cache size
-    //! If 'eof' is true, all chunks are returned, and the 'eof' values in the
-    //! chunks are set to true.
-    chunk_vec flush_cache(bool eof = false);
-
-    typedef std::vector<fastq_read_chunk*> demultiplexed_cache;
-
-    //! Cache of demultiplex reads; used to reduce the number of output chunks
-    //! generated from each processed chunk, which would otherwise increase
-    //! linearly with the number of barcodes.
-    demultiplexed_cache m_cache;
-    //! Cache of unidentified mate 1 reads
-    fastq_output_chunk* m_unidentified_1;
-    //! Cache of unidentified mate 2 reads
-    fastq_output_chunk* m_unidentified_2;
-
-    //! Sink for demultiplexing statistics; used by subclasses.
+    //! Per-thread demultiplexing statistics; used by subclasses.
+    stats_sink m_stats;
+    //! Combined statistics; set by 'finalize'
     demux_statistics m_statistics;
 
 private:
@@ -110,13 +131,9 @@ class demultiplex_se_reads : public demultiplex_reads
 {
 public:
     /** See demultiplex_reads::demultiplex_reads. */
-    demultiplex_se_reads(const userconfig* config);
+    demultiplex_se_reads(const userconfig* config, checkpointer* checkpoints = NULL);
 
-    /**
-     * Processes a read chunk, and forwards chunks to downstream steps, with
-     * the IDs corresponding to ai_analyses_offset * (nth + 1) for the nth
-     * barcode (pair). Unidentified reads are sent to ai_write_unidentified_1.
-     */
+    /** Selects barcodes for a read chunk; see demultiplex_reads. */
     chunk_vec process(analytical_chunk* chunk);
 };
 
@@ -126,17 +143,61 @@ class demultiplex_pe_reads : public demultiplex_reads
 {
 public:
     /** See demultiplex_reads::demultiplex_reads. */
-    demultiplex_pe_reads(const userconfig* config);
+    demultiplex_pe_reads(const userconfig* config, checkpointer* checkpoints = NULL);
 
-    /**
-     * Processes a read chunk, and forwards chunks to downstream steps, with
-     * the IDs corresponding to ai_analyses_offset * (nth + 1) for the nth
-     * barcode (pair). Unidentified reads are sent to ai_write_unidentified_1
-     * and ai_write_unidentified_2.
-     */
+    /** Selects barcode pairs for a read chunk; see demultiplex_reads. */
     chunk_vec process(analytical_chunk* chunk);
 };
 
+
+/**
+ * Ordered step which collects demultiplexed reads into per-barcode chunks,
+ * in the input order, and forwards these to the downstream steps with the
+ * IDs corresponding to ai_analyses_offset * (nth + 1) for the nth barcode
+ * (pair). Unidentified reads are sent to ai_write_unidentified_1 and (for
+ * paired-end reads) ai_write_unidentified_2.
+ */
+class demultiplex_cache : public analytical_step
+{
+public:
+    /** Constructor; keeps pointer to config object. */
+    demultiplex_cache(const userconfig* config);
+
+    /** Frees any unflushed caches. */
+    virtual ~demultiplex_cache();
+
+    /** Distributes reads from a chunk processed by 'demultiplex_reads'. */
+    chunk_vec process(analytical_chunk* chunk);
+
+private:
+    //! Not implemented
+    demultiplex_cache(const demultiplex_cache&);
+    //! Not implemented
+    demultiplex_cache& operator=(const demultiplex_cache&);
+
+    //! Returns a chunk-list with any set of reads exceeding the max cache size
+    //! If 'eof' is true, all chunks are returned, and the 'eof' values in the
+    //! chunks are set to true. Likewise, all chunks are returned (with the
+    //! 'checkpoint' values set) if 'checkpoint' is true.
+    chunk_vec flush_cache(bool eof = false, bool checkpoint = false);
+
+    typedef std::vector<fastq_read_chunk*> demultiplexed_cache;
+
+    //! Pointer to user settings used for output format for unidentified reads
+    const userconfig* m_config;
+    //! Number of reads collected for a barcode before they are forwarded
+    const size_t m_chunk_size;
+
+    //! Cache of demultiplex reads; used to reduce the number of output chunks
+    //! generated from each processed chunk, which would otherwise increase
+    //! linearly with the number of barcodes.
+    demultiplexed_cache m_cache;
+    //! Cache of unidentified mate 1 reads
+    fastq_output_chunk* m_unidentified_1;
+    //! Cache of unidentified mate 2 reads
+    fastq_output_chunk* m_unidentified_2;
+};
+
 } // namespace ar
 
 #endif
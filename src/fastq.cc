@@ -24,10 +24,13 @@
 \*************************************************************************/
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <sstream>
+#include <vector>
 
 #include "fastq.h"
+#include "fastq_simd.h"
 #include "linereader.h"
 
 namespace ar
@@ -36,7 +39,7 @@ namespace ar
 struct mate_info
 {
     mate_info()
-      : name()
+      : name_length(0)
       , mate(unknown)
     {}
 
@@ -51,7 +54,9 @@ struct mate_info
         }
     }
 
-    std::string name;
+    //! Length of the read name, excluding any mate number; the name itself
+    //! is not copied, as this is called for every pair of reads
+    size_t name_length;
     enum { unknown, mate1, mate2 } mate;
 };
 
@@ -60,28 +65,283 @@ inline mate_info get_mate_information(const fastq& read)
 {
     mate_info info;
     const std::string& header = read.header();
+    const char* name = header.data();
 
-    size_t pos = header.find_first_of(' ');
-    if (pos == std::string::npos) {
-        pos = header.length();
+    // Names end at the first space or tab; the latter precede SAM style tags
+    size_t pos = 0;
+    while (pos < header.size() && name[pos] != ' ' && name[pos] != '\t') {
+        ++pos;
     }
 
-    if (pos >= 2) {
-        const std::string substr = header.substr(0, pos);
-        if (substr.substr(pos - 2) == "/1") {
+    if (pos >= 2 && name[pos - 2] == '/') {
+        if (name[pos - 1] == '1') {
             info.mate = mate_info::mate1;
             pos -= 2;
-        } else if (substr.substr(pos - 2) == "/2") {
+        } else if (name[pos - 1] == '2') {
             info.mate = mate_info::mate2;
             pos -= 2;
         }
     }
 
-    info.name = header.substr(0, pos);
+    info.name_length = pos;
     return info;
 }
 
 
+//! Lookup table for complementary bases based only on the last 4 bits
+const char NT_COMPLEMENTS[] = "-T-GA--C------N-";
+
+
+/** Complements a sequence of (uppercase) nucleotides in place. */
+inline void complement_sequence(char* it, char* end)
+{
+    for (; it != end; ++it) {
+        *it = NT_COMPLEMENTS[*it & 0xf];
+    }
+}
+
+
+/**
+ * Reverse complements a sequence of (uppercase) nucleotides and reverses the
+ * qualities in place, using the SIMD kernel for the blocks at either end.
+ */
+inline void reverse_complement_record(char* sequence, char* qualities, size_t length)
+{
+    const size_t n = g_fastq_kernels.reverse_complement(sequence, qualities, length);
+
+    std::reverse(sequence + n, sequence + length - n);
+    std::reverse(qualities + n, qualities + length - n);
+    complement_sequence(sequence + n, sequence + length - n);
+}
+
+
+/**
+ * Returns the number of low quality bases at the 5' and 3' ends of a sequence;
+ * see fastq::trim_low_quality_bases.
+ */
+/** Returns true if a base is neither low quality nor (optionally) an N. */
+inline bool is_good_base(char nuc, char qual, bool trim_ns, char low_quality)
+{
+    return (!trim_ns || nuc != 'N') && (qual > low_quality);
+}
+
+
+fastq::ntrimmed find_low_quality_bases(const char* sequence,
+                                       const char* qualities,
+                                       size_t length,
+                                       bool trim_ns,
+                                       char low_quality)
+{
+    low_quality += PHRED_OFFSET_33;
+
+    // Most reads end in good bases, in which case the kernels are not used
+    size_t right_exclusive = 0;
+    if (length && is_good_base(sequence[length - 1], qualities[length - 1], trim_ns, low_quality)) {
+        right_exclusive = length;
+    } else {
+        // Blocks consisting only of low quality bases are skipped by the kernel
+        const size_t suffix = g_fastq_kernels.low_quality_suffix(sequence, qualities, length,
+                                                                  low_quality, trim_ns);
+
+        for (size_t i = length - suffix; i; --i) {
+            if (is_good_base(sequence[i - 1], qualities[i - 1], trim_ns, low_quality)) {
+                right_exclusive = i;
+                break;
+            }
+        }
+    }
+
+    size_t left_inclusive = 0;
+    if (right_exclusive && !is_good_base(sequence[0], qualities[0], trim_ns, low_quality)) {
+        const size_t prefix = g_fastq_kernels.low_quality_prefix(sequence, qualities,
+                                                                 right_exclusive,
+                                                                 low_quality, trim_ns);
+
+        for (size_t i = prefix; i < right_exclusive; ++i) {
+            if (is_good_base(sequence[i], qualities[i], trim_ns, low_quality)) {
+                left_inclusive = i;
+                break;
+            }
+        }
+    }
+
+    return fastq::ntrimmed(left_inclusive, length - right_exclusive);
+}
+
+
+/**
+ * Returns the number of bases to trim from either end using a sliding window;
+ * see fastq::trim_windowed_bases.
+ */
+fastq::ntrimmed find_low_quality_windows(const char* sequence,
+                                         const char* qualities,
+                                         size_t length,
+                                         bool trim_ns,
+                                         char low_quality,
+                                         double window_size)
+{
+    size_t window = static_cast<size_t>(window_size >= 1.0 ? window_size : window_size * length);
+    window = std::max<size_t>(1, std::min(window, length));
+
+    // Means are compared using sums of Phred+33 scores, avoiding divisions
+    const char threshold = low_quality + PHRED_OFFSET_33;
+    const int threshold_sum = threshold * static_cast<int>(window);
+
+    int window_sum = 0;
+    for (size_t i = 0; i < window && i < length; ++i) {
+        window_sum += qualities[i];
+    }
+
+    size_t left_inclusive = std::string::npos;
+    size_t right_exclusive = length;
+    for (size_t offset = 0; offset + window <= length; ++offset) {
+        if (left_inclusive == std::string::npos) {
+            if (window_sum > threshold_sum) {
+                const fastq::ntrimmed trimmed = find_low_quality_bases(sequence + offset,
+                                                                       qualities + offset,
+                                                                       window,
+                                                                       trim_ns,
+                                                                       low_quality);
+
+                // Windows may consist entirely of Ns with high quality scores
+                if (trimmed.first + trimmed.second < window) {
+                    left_inclusive = offset + trimmed.first;
+                }
+            }
+        } else if (window_sum <= threshold_sum) {
+            // Good bases at the start of the first low quality window are kept
+            right_exclusive = std::max(offset, left_inclusive);
+            while (right_exclusive < length
+                   && is_good_base(sequence[right_exclusive], qualities[right_exclusive],
+                                   trim_ns, threshold)) {
+                ++right_exclusive;
+            }
+
+            // Remaining low quality bases are trimmed from the 3' end
+            const fastq::ntrimmed trimmed = find_low_quality_bases(sequence + left_inclusive,
+                                                                   qualities + left_inclusive,
+                                                                   right_exclusive - left_inclusive,
+                                                                   trim_ns,
+                                                                   low_quality);
+
+            return fastq::ntrimmed(left_inclusive, length - right_exclusive + trimmed.second);
+        }
+
+        if (offset + window < length) {
+            window_sum += qualities[offset + window] - qualities[offset];
+        }
+    }
+
+    if (left_inclusive == std::string::npos) {
+        return fastq::ntrimmed(0, length);
+    }
+
+    // No low quality windows following the first good window
+    const fastq::ntrimmed trimmed = find_low_quality_bases(sequence + left_inclusive,
+                                                           qualities + left_inclusive,
+                                                           length - left_inclusive,
+                                                           trim_ns,
+                                                           low_quality);
+
+    return fastq::ntrimmed(left_inclusive, trimmed.second);
+}
+
+
+/** Returns a table of error probabilities for Phred scores 0 .. MAX_PHRED_SCORE. */
+std::vector<double> calc_phred_to_p()
+{
+    std::vector<double> table(MAX_PHRED_SCORE + 1);
+    for (int i = 0; i <= MAX_PHRED_SCORE; ++i) {
+        table.at(i) = std::pow(10.0, i / -10.0);
+    }
+
+    return table;
+}
+
+
+/**
+ * Returns the number of bases to trim from either end using the modified
+ * Mott algorithm; see fastq::trim_mott_bases.
+ */
+fastq::ntrimmed find_mott_trimmed_bases(const char* sequence,
+                                        const char* qualities,
+                                        size_t length,
+                                        bool trim_ns,
+                                        double error_limit)
+{
+    static const std::vector<double> phred_to_p = calc_phred_to_p();
+
+    // Maximum-sum subsequence (Kadane); the first such subsequence is used
+    double current_sum = 0.0;
+    double best_sum = 0.0;
+    size_t current_start = 0;
+    size_t best_start = 0;
+    size_t best_end = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const double p_error = (trim_ns && sequence[i] == 'N')
+            ? 1.0 : phred_to_p[qualities[i] - PHRED_OFFSET_33];
+
+        current_sum += error_limit - p_error;
+        if (current_sum <= 0.0) {
+            current_sum = 0.0;
+            current_start = i + 1;
+        } else if (current_sum > best_sum) {
+            best_sum = current_sum;
+            best_start = current_start;
+            best_end = i + 1;
+        }
+    }
+
+    if (!best_end) {
+        return fastq::ntrimmed(0, length);
+    }
+
+    return fastq::ntrimmed(best_start, length - best_end);
+}
+
+
+/**
+ * Appends a record to 'result'; see fastq::to_str. If 'reverse' is set, the
+ * record is reverse complemented after being copied to 'result'.
+ */
+void append_record(std::string& result,
+                   const std::string& header,
+                   const char* sequence,
+                   const char* qualities,
+                   size_t length,
+                   const fastq_encoding& encoding,
+                   bool reverse = false)
+{
+    // Size of header, sequence, qualities, 4 new-lines, '@' and '+'
+    const size_t record_start = result.size();
+    const size_t record_size = header.size() + length * 2 + 6;
+    if (result.capacity() < record_start + record_size) {
+        // Grow geometrically, as records are appended one at a time
+        result.reserve(std::max(record_start + record_size, 2 * result.capacity()));
+    }
+
+    result.push_back('@');
+    result.append(header);
+    result.push_back('\n');
+    result.append(sequence, length);
+    result.append("\n+\n", 3);
+    result.append(qualities, length);
+    result.push_back('\n');
+
+    // Encode quality-scores in place
+    size_t quality_start = record_start + header.size() + length + 5;
+    size_t quality_end = quality_start + length;
+
+    if (reverse && length) {
+        reverse_complement_record(&result[record_start + header.size() + 2],
+                                  &result[quality_start],
+                                  length);
+    }
+    encoding.encode_string(result.begin() + quality_start,
+                           result.begin() + quality_end);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // fastq
 
@@ -136,30 +396,50 @@ size_t fastq::count_ns() const
 
 fastq::ntrimmed fastq::trim_low_quality_bases(bool trim_ns, char low_quality)
 {
-    low_quality += PHRED_OFFSET_33;
+    const ntrimmed summary = find_low_quality_bases(m_sequence.data(),
+                                                    m_qualities.data(),
+                                                    m_sequence.length(),
+                                                    trim_ns,
+                                                    low_quality);
 
-    size_t right_exclusive = 0;
-    for (size_t i = m_sequence.length(); i; --i) {
-        if ((!trim_ns || m_sequence.at(i - 1) != 'N') && (m_qualities.at(i - 1) > low_quality)) {
-            right_exclusive = i;
-            break;
-        }
+    if (summary.first || summary.second) {
+        const size_t retained = m_sequence.length() - summary.first - summary.second;
+        truncate(summary.first, retained);
+    }
+
+    return summary;
+}
+
+
+fastq::ntrimmed fastq::trim_windowed_bases(bool trim_ns,
+                                           char low_quality,
+                                           double window_size)
+{
+    const ntrimmed summary = find_low_quality_windows(m_sequence.data(),
+                                                      m_qualities.data(),
+                                                      m_sequence.length(),
+                                                      trim_ns,
+                                                      low_quality,
+                                                      window_size);
+
+    if (summary.first || summary.second) {
+        truncate(summary.first, m_sequence.length() - summary.first - summary.second);
     }
 
-	size_t left_inclusive = 0;
-	for (size_t i = 0; i < right_exclusive; ++i) {
-		if ((!trim_ns || m_sequence.at(i) != 'N') && (m_qualities.at(i) > low_quality)) {
-			left_inclusive = i;
-			break;
-		}
-	}
+    return summary;
+}
+
 
-    const ntrimmed summary(left_inclusive, m_sequence.length() - right_exclusive);
+fastq::ntrimmed fastq::trim_mott_bases(bool trim_ns, double error_limit)
+{
+    const ntrimmed summary = find_mott_trimmed_bases(m_sequence.data(),
+                                                     m_qualities.data(),
+                                                     m_sequence.length(),
+                                                     trim_ns,
+                                                     error_limit);
 
     if (summary.first || summary.second) {
-        const size_t retained = right_exclusive - left_inclusive;
-        m_sequence = m_sequence.substr(left_inclusive, retained);
-        m_qualities = m_qualities.substr(left_inclusive, retained);
+        truncate(summary.first, m_sequence.length() - summary.first - summary.second);
     }
 
     return summary;
@@ -168,26 +448,57 @@ fastq::ntrimmed fastq::trim_low_quality_bases(bool trim_ns, char low_quality)
 
 void fastq::truncate(size_t pos, size_t len)
 {
-    if (pos || len < length()) {
-        m_sequence = m_sequence.substr(pos, len);
-        m_qualities = m_qualities.substr(pos, len);
+    if (pos > length()) {
+        throw std::out_of_range("fastq::truncate");
+    }
+
+    // Bases are moved within the existing buffers, to avoid reallocations
+    if (pos) {
+        m_sequence.erase(0, pos);
+        m_qualities.erase(0, pos);
+    }
+
+    if (len < length()) {
+        m_sequence.resize(len);
+        m_qualities.resize(len);
     }
 }
 
 
 void fastq::reverse_complement()
 {
-    std::reverse(m_sequence.begin(), m_sequence.end());
-    std::reverse(m_qualities.begin(), m_qualities.end());
+    if (!m_sequence.empty()) {
+        reverse_complement_record(&m_sequence[0], &m_qualities[0], m_sequence.size());
+    }
+}
+
 
-    // Lookup table for complementary bases based only on the last 4 bits
-    static const char complements[] = "-T-GA--C------N-";
-    for(std::string::iterator it = m_sequence.begin(); it != m_sequence.end(); ++it) {
-        *it = complements[*it & 0xf];
+void fastq::resize(size_t length, char*& sequence, char*& qualities)
+{
+    m_sequence.resize(length);
+    m_qualities.resize(length);
+
+    if (length) {
+        sequence = &m_sequence[0];
+        qualities = &m_qualities[0];
+    } else {
+        sequence = qualities = NULL;
     }
 }
 
 
+void fastq::set_header(const std::string& header)
+{
+    m_header.assign(header);
+}
+
+
+void fastq::set_header(const char* header, size_t length)
+{
+    m_header.assign(header, length);
+}
+
+
 void fastq::add_prefix_to_header(const std::string& prefix)
 {
     m_header.insert(0, prefix);
@@ -196,35 +507,37 @@ void fastq::add_prefix_to_header(const std::string& prefix)
 
 bool fastq::read(line_reader_base& reader, const fastq_encoding& encoding)
 {
-    std::string line;
-    if (!reader.getline(line)) {
+    // Lines are copied straight from the buffers of the reader
+    line_view line;
+    if (!reader.next_line(line)) {
         // End of file; terminate gracefully
         return false;
-    }
-
-    m_header = line.substr(1);
-    if (m_header.empty() || line.at(0) != '@') {
+    } else if (line.length < 2 || line.data[0] != '@') {
         throw fastq_error("Malformed or empty FASTQ header");
     }
 
-    if (!reader.getline(m_sequence)) {
+    m_header.assign(line.data + 1, line.length - 1);
+
+    if (!reader.next_line(line)) {
         throw fastq_error("partial FASTQ record; cut off after header");
-    } else if (m_sequence.empty()) {
+    } else if (!line.length) {
         throw fastq_error("sequence is empty");
     }
 
-    if (!reader.getline(line)) {
+    m_sequence.assign(line.data, line.length);
+
+    if (!reader.next_line(line)) {
         throw fastq_error("partial FASTQ record; cut off after sequence");
-    } else if (line.empty() || line.at(0) != '+') {
+    } else if (!line.length || line.data[0] != '+') {
         throw fastq_error("FASTQ record lacks seperator character (+)");
     }
 
-    if (!reader.getline(m_qualities)) {
+    if (!reader.next_line(line)) {
         throw fastq_error("partial FASTQ record; cut off after separator");
-    } else if (m_sequence.empty()) {
-        throw fastq_error("sequence is empty");
     }
 
+    m_qualities.assign(line.data, line.length);
+
     process_record(encoding);
     return true;
 }
@@ -233,24 +546,16 @@ bool fastq::read(line_reader_base& reader, const fastq_encoding& encoding)
 std::string fastq::to_str(const fastq_encoding& encoding) const
 {
     std::string result;
-    // Size of header, sequence, qualities, 4 new-lines, '@' and '+'
-    result.reserve(m_header.size() + m_sequence.size() * 2 + 6);
+    to_str(result, encoding);
 
-    result.push_back('@');
-    result.append(m_header);
-    result.push_back('\n');
-    result.append(m_sequence);
-    result.append("\n+\n", 3);
-    result.append(m_qualities);
-    result.push_back('\n');
+    return result;
+}
 
-    // Encode quality-scores in place
-    size_t quality_start = m_header.size() + m_sequence.size() + 5;
-    size_t quality_end = quality_start + m_sequence.size();
-    encoding.encode_string(result.begin() + quality_start,
-                           result.begin() + quality_end);
 
-    return result;
+void fastq::to_str(std::string& result, const fastq_encoding& encoding) const
+{
+    append_record(result, m_header, m_sequence.data(), m_qualities.data(),
+                  m_sequence.length(), encoding);
 }
 
 
@@ -260,7 +565,13 @@ std::string fastq::to_str(const fastq_encoding& encoding) const
 
 void fastq::clean_sequence(std::string& sequence)
 {
-    for (std::string::iterator it = sequence.begin(); it != sequence.end(); ++it) {
+    // Blocks containing invalid characters are left for the loop below to report
+    std::string::iterator it = sequence.begin();
+    if (it != sequence.end()) {
+        it += g_fastq_kernels.clean_sequence(&*it, sequence.size());
+    }
+
+    for (; it != sequence.end(); ++it) {
         switch (*it) {
             case 'A':
             case 'C':
@@ -305,10 +616,13 @@ void fastq::validate_paired_reads(const fastq& mate1, const fastq& mate2)
     const mate_info info1 = get_mate_information(mate1);
     const mate_info info2 = get_mate_information(mate2);
 
-    if (info1.name != info2.name) {
+    if (info1.name_length != info2.name_length
+        || mate1.header().compare(0, info1.name_length, mate2.header(),
+                                  0, info2.name_length)) {
         std::stringstream error;
         error << "Pair contains reads with mismatching names: '"
-              << info1.name << "' and '" << info2.name;
+              << mate1.header().substr(0, info1.name_length) << "' and '"
+              << mate2.header().substr(0, info2.name_length);
 
         throw fastq_error(error.str());
     }
@@ -339,4 +653,220 @@ void fastq::process_record(const fastq_encoding& encoding)
     encoding.decode_string(m_qualities.begin(), m_qualities.end());
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// fastq_batch
+
+fastq_batch::fastq_batch()
+    : m_sequences()
+    , m_qualities()
+    , m_offsets()
+    , m_lengths()
+    , m_reversed()
+{
+}
+
+
+void fastq_batch::assign(const fastq_vec& reads, bool reverse_complement)
+{
+    clear();
+
+    size_t total = 0;
+    for (fastq_vec::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        total += it->length();
+    }
+
+    m_sequences.reserve(total);
+    m_qualities.reserve(total);
+    m_offsets.reserve(reads.size());
+    m_lengths.reserve(reads.size());
+    m_reversed.assign(reads.size(), false);
+
+    for (fastq_vec::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        const size_t offset = m_sequences.size();
+        m_offsets.push_back(offset);
+        m_lengths.push_back(it->length());
+        m_sequences.append(it->sequence());
+        m_qualities.append(it->qualities());
+
+        // Done while the copied bases are still cached, rather than in a
+        // separate pass over the entire batch
+        if (reverse_complement && it->length()) {
+            reverse_complement_record(&m_sequences[offset],
+                                      &m_qualities[offset],
+                                      it->length());
+        }
+    }
+}
+
+
+void fastq_batch::clear()
+{
+    m_sequences.clear();
+    m_qualities.clear();
+    m_offsets.clear();
+    m_lengths.clear();
+    m_reversed.clear();
+}
+
+
+size_t fastq_batch::count_ns(size_t nth) const
+{
+    const char* seq = sequence(nth);
+
+    return static_cast<size_t>(std::count(seq, seq + length(nth), 'N'));
+}
+
+
+void fastq_batch::truncate(size_t nth, size_t pos, size_t len)
+{
+    if (pos > m_lengths.at(nth)) {
+        throw std::out_of_range("fastq_batch::truncate");
+    }
+
+    const size_t length = std::min(len, m_lengths[nth] - pos);
+    if (m_reversed[nth]) {
+        // Positions are relative to the record, not to the stored bases
+        m_offsets[nth] += m_lengths[nth] - pos - length;
+    } else {
+        m_offsets[nth] += pos;
+    }
+
+    m_lengths[nth] = length;
+}
+
+
+void fastq_batch::reverse_complement()
+{
+    // Stored bases are reverse complemented, whether or not the orientation
+    // of the record differs from that of the stored bases
+    for (size_t nth = 0; nth < size(); ++nth) {
+        if (m_lengths[nth]) {
+            reverse_complement_record(&m_sequences[0] + m_offsets[nth],
+                                      &m_qualities[0] + m_offsets[nth],
+                                      m_lengths[nth]);
+        }
+    }
+}
+
+
+void fastq_batch::reverse_complement(size_t nth)
+{
+    m_reversed.at(nth) = !m_reversed.at(nth);
+}
+
+
+bool fastq_batch::is_reversed(size_t nth) const
+{
+    return m_reversed.at(nth);
+}
+
+
+void fastq_batch::trim_low_quality_bases(bool trim_ns, char low_quality)
+{
+    for (size_t nth = 0; nth < size(); ++nth) {
+        trim_low_quality_bases(nth, trim_ns, low_quality);
+    }
+}
+
+
+fastq::ntrimmed fastq_batch::trim_low_quality_bases(size_t nth,
+                                                    bool trim_ns,
+                                                    char low_quality)
+{
+    // Bases are trimmed relative to the stored bases, not to the record
+    fastq::ntrimmed trimmed = find_low_quality_bases(sequence(nth),
+                                                     qualities(nth),
+                                                     m_lengths[nth],
+                                                     trim_ns,
+                                                     low_quality);
+
+    apply_trimming(nth, trimmed);
+    if (m_reversed[nth]) {
+        std::swap(trimmed.first, trimmed.second);
+    }
+
+    return trimmed;
+}
+
+
+fastq::ntrimmed fastq_batch::trim_windowed_bases(size_t nth,
+                                                 bool trim_ns,
+                                                 char low_quality,
+                                                 double window_size)
+{
+    // Windows are evaluated 5' to 3', and so depend on the orientation
+    unflip(nth);
+
+    const fastq::ntrimmed trimmed = find_low_quality_windows(sequence(nth),
+                                                             qualities(nth),
+                                                             m_lengths[nth],
+                                                             trim_ns,
+                                                             low_quality,
+                                                             window_size);
+    apply_trimming(nth, trimmed);
+
+    return trimmed;
+}
+
+
+fastq::ntrimmed fastq_batch::trim_mott_bases(size_t nth, bool trim_ns, double error_limit)
+{
+    // Ties between subsequences are resolved in favor of the 5'-most
+    unflip(nth);
+
+    const fastq::ntrimmed trimmed = find_mott_trimmed_bases(sequence(nth),
+                                                            qualities(nth),
+                                                            m_lengths[nth],
+                                                            trim_ns,
+                                                            error_limit);
+    apply_trimming(nth, trimmed);
+
+    return trimmed;
+}
+
+
+void fastq_batch::unflip(size_t nth)
+{
+    if (m_reversed.at(nth)) {
+        if (m_lengths[nth]) {
+            reverse_complement_record(&m_sequences[0] + m_offsets[nth],
+                                      &m_qualities[0] + m_offsets[nth],
+                                      m_lengths[nth]);
+        }
+
+        m_reversed[nth] = false;
+    }
+}
+
+
+void fastq_batch::apply_trimming(size_t nth, const fastq::ntrimmed& trimmed)
+{
+    m_offsets[nth] += trimmed.first;
+    m_lengths[nth] -= trimmed.first + trimmed.second;
+}
+
+
+fastq fastq_batch::get(size_t nth, const std::string& header) const
+{
+    std::string seq(sequence(nth), length(nth));
+    std::string quals(qualities(nth), length(nth));
+    if (m_reversed.at(nth) && !seq.empty()) {
+        reverse_complement_record(&seq[0], &quals[0], seq.size());
+    }
+
+    // Qualities are already Phred+33 encoded, and kept as is by this encoding
+    return fastq(header, seq, quals, FASTQ_ENCODING_SAM);
+}
+
+
+void fastq_batch::to_str(std::string& dst,
+                         size_t nth,
+                         const std::string& header,
+                         const fastq_encoding& encoding) const
+{
+    append_record(dst, header, sequence(nth), qualities(nth), length(nth),
+                  encoding, m_reversed.at(nth));
+}
+
 } // namespace ar
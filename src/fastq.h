@@ -112,6 +112,31 @@ public:
      */
 	ntrimmed trim_low_quality_bases(bool trim_ns = true, char low_quality = -1);
 
+    /**
+     * Trims the sequence using a sliding window, starting from the first
+     * window with a mean quality above 'low_quality', and ending with the
+     * first subsequent window with a mean quality at or below 'low_quality'.
+     * Low-quality bases (and Ns, if 'trim_ns' is set) are trimmed from the
+     * ends of the retained bases as for trim_low_quality_bases.
+     *
+     * @param trim_ns If true, ambiguous bases ('N') are trimmed.
+     * @param low_quality Windows with a mean at or below this value are trimmed.
+     * @param window_size Window size; if < 1, the size is this fraction of the
+     *                    length of the read (at least 1 base).
+     * @return A pair containing the number of bases trimmed from either end.
+     */
+    ntrimmed trim_windowed_bases(bool trim_ns, char low_quality, double window_size);
+
+    /**
+     * Trims the sequence using the modified Mott algorithm, retaining the
+     * subsequence with the maximum sum of ('error_limit' - P(error)) over all
+     * bases, where P(error) is calculated from the quality score of each
+     * base, and is 1 for Ns if 'trim_ns' is set.
+     *
+     * @return A pair containing the number of bases trimmed from either end.
+     */
+    ntrimmed trim_mott_bases(bool trim_ns, double error_limit);
+
     /**
      * Truncates the record in place.
      *
@@ -123,6 +148,20 @@ public:
     /** Reverse complements the record in place. */
     void reverse_complement();
 
+    /**
+     * Resizes the sequence and qualities to 'length' bases, re-using any
+     * allocated buffers, and returns pointers to the (writable) contents via
+     * 'sequence' and 'qualities', or NULL if 'length' is 0. The caller must
+     * fill these with uppercase "ACGTN" bases and Phred+33 scores, as the
+     * contents are not validated.
+     */
+    void resize(size_t length, char*& sequence, char*& qualities);
+
+    /** Replaces the header, re-using the allocated buffer. */
+    void set_header(const std::string& header);
+    /** Replaces the header with 'length' characters starting at 'header'. */
+    void set_header(const char* header, size_t length);
+
     /** Adds a prefix to the header. */
     void add_prefix_to_header(const std::string& prefix);
 
@@ -148,6 +187,10 @@ public:
      */
     std::string to_str(const fastq_encoding& encoding = FASTQ_ENCODING_33) const;
 
+    /** As 'to_str', but appends the FASTQ record to 'dst'. */
+    void to_str(std::string& dst,
+                const fastq_encoding& encoding = FASTQ_ENCODING_33) const;
+
     /** Converts an error-probability to a Phred+33 encoded quality score. **/
     static char p_to_phred_33(double p);
 
@@ -175,6 +218,115 @@ private:
 };
 
 
+/**
+ * Structure-of-arrays representation of the sequences and qualities of a set
+ * of FASTQ records (e.g. the mate 1 reads of a chunk).
+ *
+ * Sequences and qualities are stored back-to-back in two contiguous buffers,
+ * with per-record offsets and lengths; truncating a record therefore only
+ * updates its offset and length, and passes over all records access memory
+ * linearly. Headers are not stored, and must be supplied when records are
+ * converted back to FASTQ records or strings.
+ *
+ * Reverse complementing a single record only flips its orientation, and the
+ * stored bases are reverse complemented once the record is retrieved using
+ * 'get' or 'to_str'. This avoids reversing mate 2 reads back and forth, when
+ * they are only reverse complemented for the purpose of alignment.
+ */
+class fastq_batch
+{
+public:
+    /** Constructs an empty batch. */
+    fastq_batch();
+
+    /**
+     * Replaces the contents of the batch with the records in 'reads'; if
+     * 'reverse_complement' is set, the stored bases are reverse complemented
+     * (see 'reverse_complement()').
+     */
+    void assign(const fastq_vec& reads, bool reverse_complement = false);
+
+    /** Removes all records, but retains allocated buffers. */
+    void clear();
+
+    /** Returns the number of records in the batch. */
+    size_t size() const;
+
+    /**
+     * Returns the sequence of the nth record; not NUL terminated. This is the
+     * reverse complement of the record, if its orientation has been flipped
+     * using 'reverse_complement(nth)'.
+     */
+    const char* sequence(size_t nth) const;
+    /** Returns the Phred+33 encoded scores of the nth record; see 'sequence'. */
+    const char* qualities(size_t nth) const;
+    /** Returns the length of the nth record. */
+    size_t length(size_t nth) const;
+
+    /** Returns the number of ambiguous nucleotides in the nth record. */
+    size_t count_ns(size_t nth) const;
+
+    /** Truncates the nth record; see fastq::truncate. */
+    void truncate(size_t nth, size_t pos = 0, size_t len = std::string::npos);
+
+    /** Reverse complements all records in place. */
+    void reverse_complement();
+    /** Lazily reverse complements the nth record, by flipping its orientation. */
+    void reverse_complement(size_t nth);
+    /** Returns true if the orientation of the nth record has been flipped. */
+    bool is_reversed(size_t nth) const;
+
+    /** Trims the ends of all records; see fastq::trim_low_quality_bases. */
+    void trim_low_quality_bases(bool trim_ns = true, char low_quality = -1);
+    /**
+     * Trims the ends of the nth record; see fastq::trim_low_quality_bases.
+     * The number of bases trimmed is relative to the orientation of the
+     * record.
+     */
+    fastq::ntrimmed trim_low_quality_bases(size_t nth,
+                                           bool trim_ns = true,
+                                           char low_quality = -1);
+    /** Trims the nth record; see fastq::trim_windowed_bases. */
+    fastq::ntrimmed trim_windowed_bases(size_t nth,
+                                        bool trim_ns,
+                                        char low_quality,
+                                        double window_size);
+    /** Trims the nth record; see fastq::trim_mott_bases. */
+    fastq::ntrimmed trim_mott_bases(size_t nth, bool trim_ns, double error_limit);
+
+    /** Returns the nth record as a FASTQ record with the given header. */
+    fastq get(size_t nth, const std::string& header) const;
+
+    /** Appends the nth record to 'dst'; see fastq::to_str. */
+    void to_str(std::string& dst,
+                size_t nth,
+                const std::string& header,
+                const fastq_encoding& encoding = FASTQ_ENCODING_33) const;
+
+private:
+    /**
+     * Reverse complements the stored bases of the nth record, if its
+     * orientation has been flipped, so that trimming algorithms which are
+     * not symmetric can be applied to the stored bases.
+     */
+    void unflip(size_t nth);
+
+    /** Removes bases trimmed from the stored bases of the nth record. */
+    void apply_trimming(size_t nth, const fastq::ntrimmed& trimmed);
+
+    //! Concatenated nucleotide sequences of all records
+    std::string m_sequences;
+    //! Concatenated Phred+33 encoded quality scores of all records
+    std::string m_qualities;
+    //! Offset of the first base of each record in m_sequences / m_qualities
+    size_vec m_offsets;
+    //! Current length of each record
+    size_vec m_lengths;
+    //! Indicates that a record is the reverse complement of the stored bases
+    std::vector<bool> m_reversed;
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 
@@ -205,7 +357,7 @@ inline const std::string& fastq::header() const
 
 inline std::string fastq::name() const
 {
-    const size_t pos = m_header.find_first_of(' ');
+    const size_t pos = m_header.find_first_of(" \t");
     if (pos != std::string::npos) {
         return m_header.substr(0, pos);
     }
@@ -225,6 +377,30 @@ inline const std::string& fastq::qualities() const
     return m_qualities;
 }
 
+
+inline size_t fastq_batch::size() const
+{
+    return m_lengths.size();
+}
+
+
+inline const char* fastq_batch::sequence(size_t nth) const
+{
+    return m_sequences.data() + m_offsets[nth];
+}
+
+
+inline const char* fastq_batch::qualities(size_t nth) const
+{
+    return m_qualities.data() + m_offsets[nth];
+}
+
+
+inline size_t fastq_batch::length(size_t nth) const
+{
+    return m_lengths[nth];
+}
+
 } // namespace ar
 
 #endif
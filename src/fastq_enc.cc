@@ -29,6 +29,7 @@
 #include <sstream>
 
 #include "fastq_enc.h"
+#include "fastq_simd.h"
 
 namespace ar
 {
@@ -92,6 +93,90 @@ const std::string g_solexa_to_phred = calc_solexa_to_phred();
 const std::string g_phred_to_solexa = calc_phred_to_solexa();
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Selection of SIMD kernels
+
+/** Portable kernels; these process no bytes, leaving all to the caller. */
+size_t decode_phred_none(char*, size_t, char, char)
+{
+    return 0;
+}
+
+
+size_t encode_phred_none(char*, size_t, char, char)
+{
+    return 0;
+}
+
+
+size_t clean_sequence_none(char*, size_t)
+{
+    return 0;
+}
+
+
+size_t reverse_complement_none(char*, char*, size_t)
+{
+    return 0;
+}
+
+
+size_t low_quality_scan_none(const char*, const char*, size_t, char, bool)
+{
+    return 0;
+}
+
+
+fastq_kernels select_fastq_kernels(simd::instruction_set is)
+{
+    fastq_kernels kernels;
+
+    switch (is) {
+        case simd::none:
+            kernels.decode_phred = &decode_phred_none;
+            kernels.encode_phred = &encode_phred_none;
+            kernels.clean_sequence = &clean_sequence_none;
+            kernels.reverse_complement = &reverse_complement_none;
+            kernels.low_quality_prefix = &low_quality_scan_none;
+            kernels.low_quality_suffix = &low_quality_scan_none;
+            break;
+#if defined(AR_SIMD_X86)
+        case simd::sse2:
+            kernels.decode_phred = &decode_phred_sse2;
+            kernels.encode_phred = &encode_phred_sse2;
+            kernels.clean_sequence = &clean_sequence_sse2;
+            kernels.reverse_complement = &reverse_complement_sse2;
+            kernels.low_quality_prefix = &low_quality_prefix_sse2;
+            kernels.low_quality_suffix = &low_quality_suffix_sse2;
+            break;
+        // Records are rarely long enough to benefit from 64-byte registers
+        case simd::avx2:
+        case simd::avx512:
+            kernels.decode_phred = &decode_phred_avx2;
+            kernels.encode_phred = &encode_phred_avx2;
+            kernels.clean_sequence = &clean_sequence_avx2;
+            kernels.reverse_complement = &reverse_complement_avx2;
+            kernels.low_quality_prefix = &low_quality_prefix_avx2;
+            kernels.low_quality_suffix = &low_quality_suffix_avx2;
+            break;
+#endif
+#if defined(AR_SIMD_NEON)
+        // No NEON kernels; the portable implementation is used
+        case simd::neon:
+            return select_fastq_kernels(simd::none);
+#endif
+        default:
+            throw std::invalid_argument("instruction set not supported by build: "
+                                        + simd::name(is));
+    }
+
+    return kernels;
+}
+
+
+const fastq_kernels g_fastq_kernels = select_fastq_kernels(simd::best_supported());
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 void invalid_phred(const char offset, const char max_score, const char raw)
@@ -236,6 +321,10 @@ void fastq_encoding::encode_string(std::string::iterator it,
     const char ascii_max = m_offset + m_max_score;
     const char offset = m_offset - '!';
 
+    if (it != end) {
+        it += g_fastq_kernels.encode_phred(&*it, end - it, m_offset, ascii_max);
+    }
+
     for (; it != end; ++it) {
         *it = std::min<int>(ascii_max, *it + offset);
     }
@@ -246,6 +335,12 @@ void fastq_encoding::decode_string(std::string::iterator it,
                                    const std::string::iterator& end) const
 {
     const char max_score = m_offset + m_max_score;
+
+    // Blocks containing invalid scores are left for the loop below to report
+    if (it != end) {
+        it += g_fastq_kernels.decode_phred(&*it, end - it, m_offset, max_score);
+    }
+
     for (; it != end; ++it) {
         const char raw = *it;
 
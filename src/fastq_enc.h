@@ -27,30 +27,11 @@
 
 #include <string>
 
+#include "fastq_scores.h"
+
 namespace ar
 {
 
-//! Offset used by Phred+33 and SAM encodings
-const int PHRED_OFFSET_33 = '!';
-//! Offset used by Phred+64 and Solexa encodings
-const int PHRED_OFFSET_64 = '@';
-
-//! Minimum Phred score allowed; encodes to '!'
-const int MIN_PHRED_SCORE = 0;
-//! Maximum Phred score allowed by default, to ensure backwards compatibility
-//! with AdapterRemoval v1.x.
-const int MAX_PHRED_SCORE_DEFAULT = 41;
-//! Maximum Phred score allowed, as this encodes to the last printable
-//! character '~', when using an offset of 33.
-const int MAX_PHRED_SCORE = 93;
-
-
-//! Minimum Solexa score allowed; encodes to ';' with an offset of 64
-const int MIN_SOLEXA_SCORE = -5;
-//! Maximum Solexa score allowed; encodes to 'h' with an offset of 64
-const int MAX_SOLEXA_SCORE = 40;
-
-
 /** Exception raised for FASTQ parsing and validation errors. */
 class fastq_error : public std::exception
 {
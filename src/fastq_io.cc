@@ -21,11 +21,14 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <cerrno>
 #include <cstring>
 
+#include "bgzf.h"
+#include "bzip2.h"
 #include "debug.h"
 #include "fastq_io.h"
 #include "userconfig.h"
@@ -36,21 +39,35 @@ namespace ar
 typedef std::auto_ptr<fastq_read_chunk> chunk_ptr;
 
 
-bool read_fastq_reads(fastq_vec& dst, line_reader& reader, size_t offset,
-                      const fastq_encoding& encoding)
+/**
+ * Reads up to 'nrecords' records into 'dst', which must be empty; records in
+ * 'spare' (left by earlier uses of a chunk) are overwritten in place, so that
+ * the memory used by these may be re-used. Returns the number of records read.
+ */
+size_t read_fastq_reads(fastq_vec& dst, fastq_vec& spare, line_reader_base& reader,
+                        size_t offset, const fastq_encoding& encoding,
+                        size_t nrecords)
 {
-    dst.reserve(FASTQ_CHUNK_SIZE);
+    AR_DEBUG_ASSERT(dst.empty());
+    dst.swap(spare);
+    dst.reserve(nrecords);
 
+    // Records are read in place, to avoid copying every record
+    size_t nread = 0;
     try {
-        fastq record;
-        for (size_t i = 0; i < FASTQ_CHUNK_SIZE; ++i) {
-            if (record.read(reader, encoding)) {
-                dst.push_back(record);
-            } else {
+        for (; nread < nrecords; ++nread) {
+            if (nread == dst.size()) {
+                dst.push_back(fastq());
+            }
+
+            if (!dst.at(nread).read(reader, encoding)) {
                 break;
             }
         }
     } catch (const fastq_error& error) {
+        // Partially read record
+        dst.resize(nread);
+
         print_locker lock;
         std::cerr << "Error reading FASTQ record at line "
                   << offset + dst.size()
@@ -60,19 +77,316 @@ bool read_fastq_reads(fastq_vec& dst, line_reader& reader, size_t offset,
         throw thread_abort();
     }
 
+    dst.resize(nread);
+
     return dst.size();
 }
 
 
+/**
+ * As 'read_fastq_reads', but reads up to 'nrecords' pairs of records from an
+ * interleaved file, alternating between 'dst_1' and 'dst_2'. The number of
+ * records read into 'dst_2' may be one less than 'dst_1' for truncated files.
+ */
+void read_interleaved_fastq_reads(fastq_vec& dst_1, fastq_vec& dst_2,
+                                  fastq_vec& spare_1, fastq_vec& spare_2,
+                                  line_reader_base& reader,
+                                  size_t offset, const fastq_encoding& encoding,
+                                  size_t nrecords)
+{
+    AR_DEBUG_ASSERT(dst_1.empty() && dst_2.empty());
+    dst_1.swap(spare_1);
+    dst_2.swap(spare_2);
+    dst_1.reserve(nrecords);
+    dst_2.reserve(nrecords);
+
+    size_t nread = 0;
+    try {
+        for (; nread < 2 * nrecords; ++nread) {
+            fastq_vec& dst = (nread % 2) ? dst_2 : dst_1;
+            if (nread / 2 == dst.size()) {
+                dst.push_back(fastq());
+            }
+
+            if (!dst.at(nread / 2).read(reader, encoding)) {
+                break;
+            }
+        }
+    } catch (const fastq_error& error) {
+        print_locker lock;
+        std::cerr << "Error reading FASTQ record at line "
+                  << offset + nread
+                  << "; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+
+        throw thread_abort();
+    }
+
+    dst_1.resize((nread + 1) / 2);
+    dst_2.resize(nread / 2);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'chunk_sizer'
+
+chunk_sizer::chunk_sizer(size_t size)
+  : m_lock()
+  , m_adaptive(!size)
+  , m_size(size ? size : FASTQ_CHUNK_SIZE)
+  , m_records(0)
+  , m_seconds(0)
+{
+}
+
+
+size_t chunk_sizer::chunk_size() const
+{
+    mutex_locker lock(m_lock);
+
+    return m_size;
+}
+
+
+void chunk_sizer::add_time(size_t records, double seconds)
+{
+    if (!m_adaptive || !records) {
+        return;
+    }
+
+    mutex_locker lock(m_lock);
+    m_records += records;
+    m_seconds += seconds;
+
+    // Timings are collected for several chunks, to smooth out noisy timings
+    if (m_records >= 4 * m_size) {
+        const double records_per_second = m_records / std::max(m_seconds, 1e-6);
+        const double target = records_per_second * FASTQ_CHUNK_SECONDS;
+
+        size_t size = m_size;
+        if (target >= 2.0 * m_size) {
+            size = 2 * m_size;
+        } else if (target <= 0.5 * m_size) {
+            size = m_size / 2;
+        } else {
+            size = static_cast<size_t>(target);
+        }
+
+        m_size = std::max(FASTQ_MIN_CHUNK_SIZE, std::min(FASTQ_MAX_CHUNK_SIZE, size));
+        m_records = 0;
+        m_seconds = 0;
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Pools of unused chunks and buffers
+
+//! Max number of unused chunks kept for re-use, per type of chunk
+const size_t FASTQ_POOL_SIZE = 256;
+
+
+/**
+ * Pool of unused buffers of FASTQ_COMPRESSED_CHUNK bytes; all buffers in
+ * 'fastq_output_chunk::buffers' are allocated using this pool. Like
+ * 'object_pool', unused buffers are kept per NUMA node.
+ */
+class buffer_pool
+{
+public:
+    buffer_pool()
+      : m_lock()
+      , m_buffers()
+    {
+    }
+
+    ~buffer_pool()
+    {
+        for (size_t node = 0; node < m_buffers.size(); ++node) {
+            for (size_t i = 0; i < m_buffers.at(node).size(); ++i) {
+                delete[] m_buffers.at(node).at(i);
+            }
+        }
+    }
+
+    /** Returns an unused buffer, or a new buffer if none are available. */
+    unsigned char* acquire()
+    {
+        const size_t node = get_thread_node();
+
+        {
+            mutex_locker lock(m_lock);
+            if (node < m_buffers.size() && !m_buffers.at(node).empty()) {
+                unsigned char* buffer = m_buffers.at(node).back();
+                m_buffers.at(node).pop_back();
+
+                return buffer;
+            }
+        }
+
+        return new unsigned char[FASTQ_COMPRESSED_CHUNK];
+    }
+
+    /** Returns a buffer to the pool, or frees it if the pool is full. */
+    void release(unsigned char* buffer)
+    {
+        if (buffer) {
+            const size_t node = get_thread_node();
+
+            {
+                mutex_locker lock(m_lock);
+                if (node >= m_buffers.size()) {
+                    m_buffers.resize(node + 1);
+                }
+
+                if (m_buffers.at(node).size() < FASTQ_POOL_SIZE * 4) {
+                    m_buffers.at(node).push_back(buffer);
+                    return;
+                }
+            }
+
+            delete[] buffer;
+        }
+    }
+
+private:
+    //! Not implemented
+    buffer_pool(const buffer_pool&);
+    //! Not implemented
+    buffer_pool& operator=(const buffer_pool&);
+
+    //! Lock used to control access to the list of buffers
+    mutex m_lock;
+    //! Unused buffers for each NUMA node
+    std::vector<std::vector<unsigned char*> > m_buffers;
+};
+
+
+//! Unused buffers for compressed data
+static buffer_pool s_buffers;
+//! Unused chunks of input reads
+static object_pool<fastq_read_chunk> s_read_chunks(FASTQ_POOL_SIZE);
+//! Unused chunks of output reads
+static object_pool<fastq_output_chunk> s_output_chunks(FASTQ_POOL_SIZE * 4);
+
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'fastq_read_chunk'
 
 fastq_read_chunk::fastq_read_chunk(bool eof_)
   : eof(eof_)
+  , checkpoint(false)
   , reads_1()
   , reads_2()
+  , raw_1()
+  , raw_2()
+  , raw_offset(0)
+  , raw_records(0)
+  , spare_1()
+  , spare_2()
+  , packed_1()
+  , packed_2()
+  , batch_1()
+  , batch_2()
+  , barcodes()
+{
+}
+
+
+fastq_read_chunk* fastq_read_chunk::acquire(bool eof_)
+{
+    fastq_read_chunk* chunk = s_read_chunks.acquire();
+    if (!chunk) {
+        return new fastq_read_chunk(eof_);
+    }
+
+    chunk->eof = eof_;
+
+    return chunk;
+}
+
+
+/** Moves records to 'spare', unless it already contains more records. */
+void keep_records(fastq_vec& reads, fastq_vec& spare)
+{
+    if (reads.size() > spare.size()) {
+        reads.swap(spare);
+    }
+
+    reads.clear();
+}
+
+
+void fastq_read_chunk::recycle(fastq_read_chunk* chunk)
 {
+    keep_records(chunk->reads_1, chunk->spare_1);
+    keep_records(chunk->reads_2, chunk->spare_2);
+    chunk->packed_1.clear();
+    chunk->packed_2.clear();
+    chunk->batch_1.clear();
+    chunk->batch_2.clear();
+    chunk->barcodes.clear();
+
+    chunk->eof = false;
+    chunk->checkpoint = false;
+    chunk->raw_1 = line_view();
+    chunk->raw_2 = line_view();
+    chunk->raw_offset = 0;
+    chunk->raw_records = 0;
+
+    s_read_chunks.release(chunk);
+}
+
+
+size_t fastq_reads_bytes(const fastq_vec& reads)
+{
+    size_t nbytes = reads.size() * sizeof(fastq);
+    for (fastq_vec::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        nbytes += it->header().size() + it->sequence().size() + it->qualities().size();
+    }
+
+    return nbytes;
+}
+
+
+size_t fastq_read_chunk::bytes() const
+{
+    // Unparsed (memory mapped) reads are not counted
+    return fastq_reads_bytes(reads_1) + fastq_reads_bytes(reads_2)
+        + packed_1.bytes() + packed_2.bytes();
+}
+
+
+void fastq_read_chunk::pack(read_packing packing)
+{
+    if (packing != rp_none) {
+        packed_1.add(reads_1, packing);
+        packed_2.add(reads_2, packing);
+
+        // Records are freed, including spare records, as the chunk may have
+        // to wait for a long time before it is processed
+        fastq_vec().swap(reads_1);
+        fastq_vec().swap(reads_2);
+        fastq_vec().swap(spare_1);
+        fastq_vec().swap(spare_2);
+    }
+}
+
+
+void fastq_read_chunk::unpack()
+{
+    if (!packed_1.empty()) {
+        AR_DEBUG_ASSERT(reads_1.empty());
+        packed_1.unpack(reads_1, spare_1);
+        packed_1.clear();
+    }
+
+    if (!packed_2.empty()) {
+        AR_DEBUG_ASSERT(reads_2.empty());
+        packed_2.unpack(reads_2, spare_2);
+        packed_2.clear();
+    }
 }
 
 
@@ -81,11 +395,13 @@ fastq_read_chunk::fastq_read_chunk(bool eof_)
 
 fastq_output_chunk::fastq_output_chunk(bool eof_)
   : eof(eof_)
+  , checkpoint(false)
   , count(0)
   , reads()
+  , format(of_fastq)
+  , next_is_mate_2(false)
   , buffers()
 {
-    reads.reserve(FASTQ_CHUNK_SIZE);
 }
 
 
@@ -97,50 +413,284 @@ fastq_output_chunk::~fastq_output_chunk()
 }
 
 
+fastq_output_chunk* fastq_output_chunk::acquire(bool eof_, output_format format_)
+{
+    fastq_output_chunk* chunk = s_output_chunks.acquire();
+    if (!chunk) {
+        chunk = new fastq_output_chunk(eof_);
+    }
+
+    chunk->eof = eof_;
+    chunk->format = format_;
+    chunk->next_is_mate_2 = false;
+
+    return chunk;
+}
+
+
+void fastq_output_chunk::recycle(fastq_output_chunk* chunk)
+{
+    // Clearing the string keeps the memory allocated for re-use by 'add'
+    chunk->reads.clear();
+
+    buffer_vec& buffers = chunk->buffers;
+    for (buffer_vec::iterator it = buffers.begin(); it != buffers.end(); ++it) {
+        s_buffers.release(it->second);
+    }
+
+    buffers.clear();
+    chunk->eof = false;
+    chunk->checkpoint = false;
+    chunk->count = 0;
+    chunk->format = of_fastq;
+    chunk->next_is_mate_2 = false;
+
+    s_output_chunks.release(chunk);
+}
+
+
+size_t fastq_output_chunk::bytes() const
+{
+    size_t nbytes = reads.size();
+    for (buffer_vec::const_iterator it = buffers.begin(); it != buffers.end(); ++it) {
+        nbytes += it->first;
+    }
+
+    return nbytes;
+}
+
+
 void fastq_output_chunk::add(const fastq_encoding& encoding,
                              const fastq& read, size_t count_)
 {
     count += count_;
-    reads.push_back(read.to_str(encoding));
+    if (format == of_fastq) {
+        read.to_str(reads, encoding);
+    } else {
+        unsigned mate_flag = 0;
+        if (format == of_bam_pairs) {
+            mate_flag = next_is_mate_2 ? BAM_FREAD2 : BAM_FREAD1;
+            next_is_mate_2 = !next_is_mate_2;
+        }
+
+        add_bam(read.header(), read.sequence().data(), read.qualities().data(),
+                read.length(), mate_flag);
+    }
+}
+
+
+void fastq_output_chunk::add(const fastq_encoding& encoding,
+                             const fastq_batch& batch,
+                             size_t nth,
+                             const std::string& header,
+                             read_type mate)
+{
+    count += 1;
+    if (format == of_fastq) {
+        batch.to_str(reads, nth, header, encoding);
+    } else {
+        // Records are copied, to restore the orientation of reversed reads
+        const fastq read = batch.get(nth, header);
+        add_bam(read.header(), read.sequence().data(), read.qualities().data(),
+                read.length(), (mate == rt_mate_2) ? BAM_FREAD2 : BAM_FREAD1);
+    }
+}
+
+
+void fastq_output_chunk::add_bam(const std::string& header,
+                                 const char* sequence,
+                                 const char* qualities,
+                                 size_t length,
+                                 unsigned mate_flag)
+{
+    // Singletons and discarded mates are flagged like pairs, since the other
+    // mate is (also) unmapped; this also strips the /1 and /2 name suffixes
+    unsigned flags = BAM_FUNMAP;
+    if (mate_flag) {
+        flags |= BAM_FPAIRED | BAM_FMUNMAP | mate_flag;
+    }
+
+    append_bam_record(reads, header, sequence, qualities, length, flags);
+}
+
+
+
+/**
+ * Memory maps the file if requested and if the file is a regular file that is
+ * not compressed; returns NULL otherwise, in which case the file should be
+ * read using a line_reader.
+ */
+mapped_file* open_mapped_file(const std::string& filename, bool mmap_input,
+                              metrics_counter* bytes_read,
+                              const file_range& range)
+{
+    if (mmap_input && mapped_file::can_map(filename)) {
+        std::auto_ptr<mapped_file> file(new mapped_file(filename, bytes_read,
+                                                        range));
+        if (!file->is_compressed()) {
+            return file.release();
+        }
+    }
+
+    return NULL;
+}
+
+
+/** Returns a counter of the (decompressed) bytes read from an input file. */
+metrics_counter* new_bytes_read_counter(const std::string& filename)
+{
+    return new metrics_counter("adapterremoval_input_bytes_total",
+                               "Number of (decompressed) bytes read from an input file.",
+                               metrics_label("file", filename));
+}
+
+
+/** Reads the lines of up to 'nrecords' records from a mapped file. */
+size_t read_mapped_lines(mapped_file& file, line_view& dst, size_t nrecords)
+{
+    return file.next_lines(nrecords * 4, dst);
+}
+
+
+/** Returns the key used to save the number of records read from a file. */
+std::string checkpoint_input_key(const std::string& filename)
+{
+    return "input:" + filename;
 }
 
 
+/** Returns the number of records to skip in a file when resuming. */
+size_t resumed_records(const checkpointer* checkpoints, const std::string& filename)
+{
+    const checkpoint_data* data = checkpoints ? checkpoints->resumed() : NULL;
+
+    return data ? data->get(checkpoint_input_key(filename)) : 0;
+}
+
+
+/** Skips the lines of 'nrecords' records, returning false on early EOF. */
+bool skip_records(line_reader_base& reader, size_t nrecords)
+{
+    line_view line;
+    for (size_t nlines = 4 * nrecords; nlines; --nlines) {
+        if (!reader.next_line(line)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/** Skips the lines of 'nrecords' records, returning false on early EOF. */
+bool skip_records(mapped_file& file, size_t nrecords)
+{
+    line_view lines;
+
+    return file.next_lines(4 * nrecords, lines) == 4 * nrecords;
+}
+
+
+/** Prints an error for input files shorter than the resumed checkpoint. */
+void throw_truncated_resume()
+{
+    print_locker lock;
+    std::cerr << "ERROR: Input file(s) contain fewer reads than had been "
+              << "processed when the checkpoint was written; the same input "
+              << "files must be used when resuming!" << std::endl;
+
+    throw thread_abort();
+}
+
+
+/** Returns the number of records to read for the next chunk. */
+size_t next_chunk_size(const chunk_sizer* sizer)
+{
+    return sizer ? sizer->chunk_size() : FASTQ_CHUNK_SIZE;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'read_single_fastq'
 
 read_single_fastq::read_single_fastq(const fastq_encoding* encoding,
                                      const std::string& filename,
-                                     size_t next_step)
+                                     size_t next_step,
+                                     size_t inflate_threads,
+                                     bool mmap_input,
+                                     const chunk_sizer* sizer,
+                                     read_packing packing,
+                                     checkpointer* checkpoints,
+                                     const file_range& range)
   : analytical_step(analytical_step::ordered, true)
+  , m_filename(filename)
+  , m_bytes_read(new_bytes_read_counter(filename))
   , m_encoding(encoding)
   , m_line_offset(1)
-  , m_io_input(filename)
+  , m_mapped_input(open_mapped_file(filename, mmap_input, m_bytes_read.get(),
+                                    range))
+  , m_io_input()
+  , m_eof(false)
   , m_next_step(next_step)
+  , m_sizer(sizer)
+  , m_packing(packing)
+  , m_checkpoints(checkpoints)
+  , m_skip_records(resumed_records(checkpoints, filename))
 {
+    if (!m_mapped_input.get()) {
+        m_io_input.reset(new line_reader(filename, inflate_threads,
+                                         m_bytes_read.get(), range));
+    }
+
+    if (checkpoints) {
+        checkpoints->add_state(this);
+    }
 }
 
 
 chunk_vec read_single_fastq::process(analytical_chunk* chunk)
 {
     AR_DEBUG_ASSERT(chunk == NULL);
-    if (!m_io_input.is_open()) {
+    if (m_eof) {
         return chunk_vec();
+    } else if (m_skip_records) {
+        // Records processed before the checkpoint are skipped without parsing
+        if (m_mapped_input.get() ? !skip_records(*m_mapped_input, m_skip_records)
+                                 : !skip_records(*m_io_input, m_skip_records)) {
+            throw_truncated_resume();
+        }
+
+        m_line_offset += m_skip_records;
+        m_skip_records = 0;
     }
 
-    chunk_ptr file_chunk(new fastq_read_chunk());
+    chunk_ptr file_chunk(fastq_read_chunk::acquire());
+    const size_t nrecords = next_chunk_size(m_sizer);
 
-    const size_t n_read = read_fastq_reads(file_chunk->reads_1, m_io_input,
-                                           m_line_offset, *m_encoding);
+    size_t n_read = 0;
+    if (m_mapped_input.get()) {
+        // Records are counted and parsed in the 'parse_fastq' step
+        file_chunk->raw_offset = m_line_offset;
+        n_read = read_mapped_lines(*m_mapped_input, file_chunk->raw_1, nrecords);
+        n_read = (n_read + 3) / 4;
+        file_chunk->raw_records = n_read;
+    } else {
+        n_read = read_fastq_reads(file_chunk->reads_1, file_chunk->spare_1,
+                                  *m_io_input, m_line_offset, *m_encoding,
+                                  nrecords);
+    }
 
     if (!n_read) {
         // EOF is detected by failure to read any lines, not line_reader::eof,
         // so that unbalanced files can be caught in all cases.
-        m_io_input.close();
+        m_io_input.reset();
+        m_eof = true;
         file_chunk->eof = true;
     }
 
     m_line_offset += n_read;
+    file_chunk->pack(m_packing);
+    file_chunk->checkpoint = !m_eof && m_checkpoints && m_checkpoints->request_if_due();
 
     chunk_vec chunks;
     chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
@@ -149,54 +699,161 @@ chunk_vec read_single_fastq::process(analytical_chunk* chunk)
 }
 
 
+void read_single_fastq::save_checkpoint(checkpoint_data& data)
+{
+    data.set(checkpoint_input_key(m_filename), m_line_offset - 1);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'read_paired_fastq'
 
 read_paired_fastq::read_paired_fastq(const fastq_encoding* encoding,
                                      const std::string& filename_1,
                                      const std::string& filename_2,
-                                     size_t next_step)
+                                     size_t next_step,
+                                     size_t inflate_threads,
+                                     bool mmap_input,
+                                     const chunk_sizer* sizer,
+                                     read_packing packing,
+                                     checkpointer* checkpoints,
+                                     const file_range& range_1,
+                                     const file_range& range_2)
   : analytical_step(analytical_step::ordered, true)
+  , m_filename_1(filename_1)
+  , m_filename_2(filename_2)
+  , m_bytes_read_1(new_bytes_read_counter(filename_1))
+  , m_bytes_read_2(filename_2.empty() ? NULL : new_bytes_read_counter(filename_2))
   , m_encoding(encoding)
   , m_line_offset(1)
-  , m_io_input_1(filename_1)
-  , m_io_input_2(filename_2)
+  , m_mapped_input_1()
+  , m_mapped_input_2()
+  , m_io_input_1()
+  , m_io_input_2()
+  , m_interleaved(filename_2.empty())
+  , m_eof(false)
+  , m_stop()
   , m_next_step(next_step)
+  , m_sizer(sizer)
+  , m_packing(packing)
+  , m_checkpoints(checkpoints)
+  , m_skip_records(resumed_records(checkpoints, filename_1))
 {
+    if (!m_interleaved && m_skip_records != resumed_records(checkpoints, filename_2)) {
+        throw checkpoint_error("checkpoint records different numbers of "
+                               "reads for --file1 and --file2");
+    } else if (checkpoints) {
+        checkpoints->add_state(this);
+    }
+
+    if (m_interleaved) {
+        // Pairs are split while reading, so the file cannot simply be mapped
+        m_io_input_1.reset(new line_reader(filename_1, inflate_threads,
+                                           m_bytes_read_1.get(), range_1));
+        return;
+    }
+
+    m_mapped_input_1.reset(open_mapped_file(filename_1, mmap_input,
+                                            m_bytes_read_1.get(), range_1));
+    m_mapped_input_2.reset(open_mapped_file(filename_2, mmap_input,
+                                            m_bytes_read_2.get(), range_2));
+
+    if (!m_mapped_input_1.get() || !m_mapped_input_2.get()) {
+        // Mates are read in lock-step, requiring the same type of reader
+        m_mapped_input_1.reset();
+        m_mapped_input_2.reset();
+
+        m_io_input_1.reset(new line_reader(filename_1, inflate_threads,
+                                           m_bytes_read_1.get(), range_1));
+        m_io_input_2.reset(new line_reader(filename_2, inflate_threads,
+                                           m_bytes_read_2.get(), range_2));
+    }
 }
 
 
 chunk_vec read_paired_fastq::process(analytical_chunk* chunk)
 {
     AR_DEBUG_ASSERT(chunk == NULL);
-    if (!m_io_input_1.is_open()) {
+    if (m_eof) {
         return chunk_vec();
-    }
+    } else if (m_skip_records) {
+        // Records processed before the checkpoint are skipped without parsing
+        bool skipped = false;
+        if (m_mapped_input_1.get()) {
+            skipped = skip_records(*m_mapped_input_1, m_skip_records)
+                      && skip_records(*m_mapped_input_2, m_skip_records);
+        } else {
+            skipped = skip_records(*m_io_input_1, m_skip_records)
+                      && (m_interleaved || skip_records(*m_io_input_2, m_skip_records));
+        }
 
-    chunk_ptr file_chunk(new fastq_read_chunk());
+        if (!skipped) {
+            throw_truncated_resume();
+        }
+
+        m_line_offset += m_skip_records;
+        m_skip_records = 0;
+    }
 
-    const size_t n_read_1 = read_fastq_reads(file_chunk->reads_1, m_io_input_1,
-                                             m_line_offset, *m_encoding);
-    const size_t n_read_2 = read_fastq_reads(file_chunk->reads_2, m_io_input_2,
-                                             m_line_offset, *m_encoding);
+    chunk_ptr file_chunk(fastq_read_chunk::acquire());
+    const size_t nrecords = next_chunk_size(m_sizer);
+
+    size_t n_read_1 = 0;
+    size_t n_read_2 = 0;
+    if (m_stop.current()) {
+        // Handled like EOF below, without reading any records
+    } else if (m_mapped_input_1.get()) {
+        // Records are counted and parsed in the 'parse_fastq' step
+        file_chunk->raw_offset = m_line_offset;
+        n_read_1 = read_mapped_lines(*m_mapped_input_1, file_chunk->raw_1, nrecords);
+        n_read_1 = (n_read_1 + 3) / 4;
+        n_read_2 = read_mapped_lines(*m_mapped_input_2, file_chunk->raw_2, nrecords);
+        n_read_2 = (n_read_2 + 3) / 4;
+        file_chunk->raw_records = std::max(n_read_1, n_read_2);
+    } else if (m_interleaved) {
+        read_interleaved_fastq_reads(file_chunk->reads_1, file_chunk->reads_2,
+                                     file_chunk->spare_1, file_chunk->spare_2,
+                                     *m_io_input_1, m_line_offset, *m_encoding,
+                                     nrecords);
+
+        n_read_1 = file_chunk->reads_1.size();
+        n_read_2 = file_chunk->reads_2.size();
+    } else {
+        n_read_1 = read_fastq_reads(file_chunk->reads_1, file_chunk->spare_1,
+                                    *m_io_input_1, m_line_offset, *m_encoding,
+                                    nrecords);
+        n_read_2 = read_fastq_reads(file_chunk->reads_2, file_chunk->spare_2,
+                                    *m_io_input_2, m_line_offset, *m_encoding,
+                                    nrecords);
+    }
 
     if (n_read_1 != n_read_2) {
         print_locker lock;
-        std::cerr << "ERROR: Input --file1 and --file2 contains different "
-                  << "numbers of lines; one or the other file may have been "
-                  << "truncated. Please correct before continuing!"
-                  << std::endl;
+        if (m_interleaved) {
+            std::cerr << "ERROR: Interleaved input file contains an odd "
+                      << "number of records; the file may have been "
+                      << "truncated. Please correct before continuing!"
+                      << std::endl;
+        } else {
+            std::cerr << "ERROR: Input --file1 and --file2 contains different "
+                      << "numbers of lines; one or the other file may have been "
+                      << "truncated. Please correct before continuing!"
+                      << std::endl;
+        }
 
         throw thread_abort();
     } else if (!n_read_1) {
         // EOF is detected by failure to read any lines, not line_reader::eof,
         // so that unbalanced files can be caught in all cases.
-        m_io_input_1.close();
-        m_io_input_2.close();
+        m_io_input_1.reset();
+        m_io_input_2.reset();
+        m_eof = true;
         file_chunk->eof = true;
     }
 
-    m_line_offset += n_read_1;
+    m_line_offset += m_interleaved ? 2 * n_read_1 : n_read_1;
+    file_chunk->pack(m_packing);
+    file_chunk->checkpoint = !m_eof && m_checkpoints && m_checkpoints->request_if_due();
 
     chunk_vec chunks;
     chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
@@ -205,87 +862,261 @@ chunk_vec read_paired_fastq::process(analytical_chunk* chunk)
 }
 
 
+void read_paired_fastq::stop()
+{
+    m_stop.increment();
+}
+
+
+void read_paired_fastq::save_checkpoint(checkpoint_data& data)
+{
+    // Interleaved files contain two records per pair
+    data.set(checkpoint_input_key(m_filename_1), m_line_offset - 1);
+    if (!m_interleaved) {
+        data.set(checkpoint_input_key(m_filename_2), m_line_offset - 1);
+    }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
-// Utility function used by both gzip and bzip compression steps
+// Implementations for 'read_bam'
+
+read_bam::read_bam(const std::string& filename,
+                   bool paired_end,
+                   size_t next_step,
+                   size_t inflate_threads,
+                   const chunk_sizer* sizer,
+                   read_packing packing)
+  : analytical_step(analytical_step::ordered, true)
+  , m_bytes_read(new_bytes_read_counter(filename))
+  , m_reader(new bam_reader(filename, inflate_threads, m_bytes_read.get()))
+  , m_header(m_reader->header())
+  , m_paired_end(paired_end)
+  , m_records(0)
+  , m_eof(false)
+  , m_next_step(next_step)
+  , m_sizer(sizer)
+  , m_packing(packing)
+{
+}
 
-/**
- * Writes a set of lines into a buffer, and returns the size of the buffer and
- * the buffer itself as a pair. */
-std::pair<size_t, unsigned char*> build_input_buffer(const string_vec& lines)
+
+const std::string& read_bam::header() const
+{
+    return m_header;
+}
+
+
+chunk_vec read_bam::process(analytical_chunk* chunk)
 {
-    size_t buffer_size = 0;
-    for (string_vec::const_iterator it = lines.begin(); it != lines.end(); ++it) {
-        buffer_size += it->size();
+    AR_DEBUG_ASSERT(chunk == NULL);
+    if (m_eof) {
+        return chunk_vec();
+    }
+
+    chunk_ptr file_chunk(fastq_read_chunk::acquire());
+    const size_t nrecords = next_chunk_size(m_sizer);
+
+    size_t n_read = 0;
+    if (m_paired_end) {
+        fastq_vec& reads_1 = file_chunk->reads_1;
+        fastq_vec& reads_2 = file_chunk->reads_2;
+        reads_1.swap(file_chunk->spare_1);
+        reads_2.swap(file_chunk->spare_2);
+
+        // Spare records are re-used to avoid re-allocating buffers
+        for (; n_read < 2 * nrecords; ++n_read) {
+            fastq_vec& dst = (n_read % 2) ? reads_2 : reads_1;
+            if (n_read / 2 == dst.size()) {
+                dst.push_back(fastq());
+            }
+
+            if (!read_record(dst.at(n_read / 2))) {
+                break;
+            }
+        }
+
+        reads_1.resize((n_read + 1) / 2);
+        reads_2.resize(n_read / 2);
+
+        if (n_read % 2) {
+            print_locker lock;
+            std::cerr << "ERROR: Interleaved input BAM file contains an odd "
+                      << "number of records; the file may have been "
+                      << "truncated. Please correct before continuing!"
+                      << std::endl;
+
+            throw thread_abort();
+        }
+    } else {
+        fastq_vec& reads = file_chunk->reads_1;
+        reads.swap(file_chunk->spare_1);
+
+        for (; n_read < nrecords; ++n_read) {
+            if (n_read == reads.size()) {
+                reads.push_back(fastq());
+            }
+
+            if (!read_record(reads.at(n_read))) {
+                break;
+            }
+        }
+
+        reads.resize(n_read);
     }
 
-    unsigned char* input_buffer = new unsigned char[buffer_size];
-    unsigned char* input_buffer_ptr = input_buffer;
-    for (string_vec::const_iterator it = lines.begin(); it != lines.end(); ++it) {
-        std::memcpy(input_buffer_ptr, it->data(), it->size());
-        input_buffer_ptr += it->size();
+    if (!n_read) {
+        m_reader.reset();
+        m_eof = true;
+        file_chunk->eof = true;
     }
 
-    return std::pair<size_t, unsigned char*>(buffer_size, input_buffer);
+    file_chunk->pack(m_packing);
+
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
+
+    return chunks;
 }
 
 
-#ifdef AR_BZIP2_SUPPORT
+bool read_bam::read_record(fastq& dst)
+{
+    try {
+        if (m_reader->read(dst)) {
+            ++m_records;
+            return true;
+        }
+    } catch (const fastq_error& error) {
+        print_locker lock;
+        std::cerr << "Error reading BAM record " << m_records + 1
+                  << "; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+
+        throw thread_abort();
+    }
+
+    return false;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
-// Implementations for 'gzip_paired_fastq'
+// Implementations for 'parse_fastq'
 
+parse_fastq::parse_fastq(const fastq_encoding* encoding, size_t next_step,
+                         read_packing packing)
+  : analytical_step(analytical_step::unordered, false)
+  , m_encoding(encoding)
+  , m_next_step(next_step)
+  , m_packing(packing)
+{
+}
 
-bzip2_paired_fastq::bzip2_paired_fastq(const userconfig& config, size_t next_step)
+
+chunk_vec parse_fastq::process(analytical_chunk* chunk)
+{
+    fastq_read_chunk* file_chunk = dynamic_cast<fastq_read_chunk*>(chunk);
+
+    const line_view* raw[2] = {&file_chunk->raw_1, &file_chunk->raw_2};
+    fastq_vec* reads[2] = {&file_chunk->reads_1, &file_chunk->reads_2};
+    fastq_vec* spare[2] = {&file_chunk->spare_1, &file_chunk->spare_2};
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (raw[i]->length) {
+            buffer_reader reader(raw[i]->data, raw[i]->data + raw[i]->length);
+            read_fastq_reads(*reads[i], *spare[i], reader,
+                             file_chunk->raw_offset, *m_encoding,
+                             file_chunk->raw_records);
+        }
+    }
+
+    file_chunk->raw_1 = line_view();
+    file_chunk->raw_2 = line_view();
+    file_chunk->pack(m_packing);
+
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, chunk));
+
+    return chunks;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility function used by compression steps
+
+/** Returns the serialized reads of a chunk, as input for compression. */
+inline unsigned char* input_data(const std::string& reads)
+{
+    return reinterpret_cast<unsigned char*>(const_cast<char*>(reads.data()));
+}
+
+
+#ifdef AR_BZIP2_SUPPORT
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bzip2_block_paired_fastq'
+
+bzip2_block_paired_fastq::bzip2_block_paired_fastq(const userconfig& config,
+                                                   size_t next_step)
   : analytical_step(analytical_step::ordered, false)
+  , m_block_size(bzip2_block_input(config.bzip2_level))
+  , m_buffer()
   , m_buffered_reads(0)
   , m_next_step(next_step)
-  , m_stream()
 {
-    m_stream.bzalloc = NULL;
-    m_stream.bzfree = NULL;
-    m_stream.opaque = NULL;
+}
+
+
+chunk_vec bzip2_block_paired_fastq::process(analytical_chunk* chunk)
+{
+    std::auto_ptr<fastq_output_chunk> file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
 
-    const int errorcode = BZ2_bzCompressInit(/* strm          = */ &m_stream,
-                                             /* blockSize100k = */ config.bzip2_level,
-                                             /* verbosity     = */ 0,
-                                             /* workFactor    = */ 0);
+    if (m_buffer.empty() && file_chunk->reads.size() < m_block_size) {
+        // Avoids copying small amounts of remaining data at EOF
+        m_buffer.swap(file_chunk->reads);
+    } else {
+        m_buffer.append(file_chunk->reads);
+    }
 
-    switch (errorcode) {
-        case BZ_OK:
-            break;
+    m_buffered_reads += file_chunk->count;
+    file_chunk->reads.clear();
+    file_chunk->count = 0;
 
-        case BZ_MEM_ERROR:
-            throw thread_error("bzip2_paired_fastq: not enough memory");
+    chunk_vec chunks;
+    size_t offset = 0;
+    for (; m_buffer.size() - offset >= m_block_size; offset += m_block_size) {
+        fastq_output_chunk* block = fastq_output_chunk::acquire();
+        block->reads.assign(m_buffer, offset, m_block_size);
+        block->count = m_buffered_reads;
+        m_buffered_reads = 0;
 
-        case BZ_CONFIG_ERROR:
-            throw thread_error("bzip2_paired_fastq: miscompiled bzip2 library");
+        chunks.push_back(chunk_pair(m_next_step, block));
+    }
 
-        case BZ_PARAM_ERROR:
-            throw thread_error("bzip2_paired_fastq: invalid parameters");
+    m_buffer.erase(0, offset);
 
-        default:
-            throw thread_error("bzip2_paired_fastq: unknown error");
+    // Partial blocks are compressed at checkpoints, so that no data is buffered
+    if (file_chunk->eof || (file_chunk->checkpoint && !m_buffer.empty())) {
+        file_chunk->reads.swap(m_buffer);
+        file_chunk->count = m_buffered_reads;
+        m_buffered_reads = 0;
+        chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
+    } else {
+        fastq_output_chunk::recycle(file_chunk.release());
     }
-}
 
+    return chunks;
+}
 
-bzip2_paired_fastq::~bzip2_paired_fastq()
-{
-    const int errorcode = BZ2_bzCompressEnd(&m_stream);
-    if (errorcode != BZ_OK) {
-        print_locker lock;
-        switch (errorcode) {
-            case BZ_PARAM_ERROR:
-                std::cerr << "bzip2_paired_fastq::~bzip2_paired_fastq: parameter error" << std::endl;
-                break;
 
-            default:
-                std::cerr << "Unknown error in bzip2_paired_fastq::~bzip2_paired_fastq: " << errorcode << std::endl;
-                break;
-        }
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bzip2_paired_fastq'
 
-        std::abort();
-    }
+bzip2_paired_fastq::bzip2_paired_fastq(const userconfig& config, size_t next_step)
+  : analytical_step(analytical_step::unordered, false)
+  , m_level(static_cast<int>(config.bzip2_level))
+  , m_next_step(next_step)
+{
 }
 
 
@@ -294,32 +1125,49 @@ chunk_vec bzip2_paired_fastq::process(analytical_chunk* chunk)
     std::auto_ptr<fastq_output_chunk> file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
     buffer_vec& buffers = file_chunk->buffers;
 
-    if (file_chunk->reads.empty() && !file_chunk->eof) {
-        // The empty chunk must still be forwarded, to ensure that tracking of
-        // ordered chunks does not break.
-        chunk_vec chunks;
-        chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
-        return chunks;
-    }
+    // Empty streams are only written for empty files, or when the amount of
+    // data written is an exact multiple of the block size
+    if (!file_chunk->reads.empty() || file_chunk->eof) {
+        // Compression state is not shared, as chunks are compressed in parallel
+        bz_stream stream = bz_stream();
 
-    std::pair<size_t, unsigned char*> input_buffer;
-    std::pair<size_t, unsigned char*> output_buffer;
-    try {
-        input_buffer = build_input_buffer(file_chunk->reads);
+        const int errorcode = BZ2_bzCompressInit(/* strm          = */ &stream,
+                                                 /* blockSize100k = */ m_level,
+                                                 /* verbosity     = */ 0,
+                                                 /* workFactor    = */ 0);
 
-        m_stream.avail_in = input_buffer.first;
-        m_stream.next_in = reinterpret_cast<char*>(input_buffer.second);
+        switch (errorcode) {
+            case BZ_OK:
+                break;
 
-        if (m_stream.avail_in || file_chunk->eof) {
-            do {
+            case BZ_MEM_ERROR:
+                throw thread_error("bzip2_paired_fastq: not enough memory");
+
+            case BZ_CONFIG_ERROR:
+                throw thread_error("bzip2_paired_fastq: miscompiled bzip2 library");
+
+            case BZ_PARAM_ERROR:
+                throw thread_error("bzip2_paired_fastq: invalid parameters");
+
+            default:
+                throw thread_error("bzip2_paired_fastq: unknown error");
+        }
+
+        std::pair<size_t, unsigned char*> output_buffer;
+        try {
+            stream.avail_in = file_chunk->reads.size();
+            stream.next_in = reinterpret_cast<char*>(input_data(file_chunk->reads));
+
+            int status = BZ_FINISH_OK;
+            while (status != BZ_STREAM_END) {
                 output_buffer.first = FASTQ_COMPRESSED_CHUNK;
-                output_buffer.second = new unsigned char[FASTQ_COMPRESSED_CHUNK];
+                output_buffer.second = s_buffers.acquire();
 
-                m_stream.avail_out = output_buffer.first;
-                m_stream.next_out = reinterpret_cast<char*>(output_buffer.second);
+                stream.avail_out = output_buffer.first;
+                stream.next_out = reinterpret_cast<char*>(output_buffer.second);
 
-                switch (BZ2_bzCompress(&m_stream, file_chunk->eof ? BZ_FINISH : BZ_RUN)) {
-                    case BZ_RUN_OK:
+                status = BZ2_bzCompress(&stream, BZ_FINISH);
+                switch (status) {
                     case BZ_FINISH_OK:
                     case BZ_STREAM_END:
                         break;
@@ -331,32 +1179,31 @@ chunk_vec bzip2_paired_fastq::process(analytical_chunk* chunk)
                         throw thread_error("bzip2_paired_fastq::process: unknown error");
                 }
 
-                output_buffer.first = FASTQ_COMPRESSED_CHUNK - m_stream.avail_out;
+                output_buffer.first = FASTQ_COMPRESSED_CHUNK - stream.avail_out;
                 if (output_buffer.first) {
                     buffers.push_back(output_buffer);
                 } else {
-                    delete[] output_buffer.second;
+                    s_buffers.release(output_buffer.second);
                 }
 
                 output_buffer.second = NULL;
-            } while (m_stream.avail_out == 0);
+            }
+        } catch (...) {
+            s_buffers.release(output_buffer.second);
+            BZ2_bzCompressEnd(&stream);
+            throw;
         }
 
-        delete[] input_buffer.second;
-    } catch (...) {
-        delete[] input_buffer.second;
-        delete[] output_buffer.second;
-        throw;
+        if (BZ2_bzCompressEnd(&stream) != BZ_OK) {
+            throw thread_error("bzip2_paired_fastq::process: parameter error");
+        }
+
+        file_chunk->reads.clear();
     }
 
+    // Every chunk is forwarded, since the following step is ordered
     chunk_vec chunks;
-    if (!file_chunk->buffers.empty() || file_chunk->eof) {
-        file_chunk->count += m_buffered_reads;
-        chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
-        m_buffered_reads = 0;
-    } else {
-        m_buffered_reads += file_chunk->count;
-    }
+    chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
 
     return chunks;
 }
@@ -369,6 +1216,28 @@ chunk_vec bzip2_paired_fastq::process(analytical_chunk* chunk)
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'gzip_paired_fastq'
 
+#ifdef AR_LIBDEFLATE_SUPPORT
+
+gzip_paired_fastq::gzip_paired_fastq(const userconfig& config, size_t next_step)
+  : analytical_step(analytical_step::ordered, false)
+  , m_buffered_reads(0)
+  , m_next_step(next_step)
+  , m_output_buffer()
+  , m_compressor(libdeflate_alloc_compressor(config.gzip_level))
+{
+    if (!m_compressor) {
+        throw thread_error("gzip_paired_fastq: failed to allocate compressor");
+    }
+}
+
+
+gzip_paired_fastq::~gzip_paired_fastq()
+{
+    libdeflate_free_compressor(m_compressor);
+}
+
+#else
+
 gzip_paired_fastq::gzip_paired_fastq(const userconfig& config, size_t next_step)
   : analytical_step(analytical_step::ordered, false)
   , m_buffered_reads(0)
@@ -428,13 +1297,17 @@ gzip_paired_fastq::~gzip_paired_fastq()
     }
 }
 
+#endif
+
 
 chunk_vec gzip_paired_fastq::process(analytical_chunk* chunk)
 {
     std::auto_ptr<fastq_output_chunk> file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
     buffer_vec& buffers = file_chunk->buffers;
 
-    if (file_chunk->reads.empty() && !file_chunk->eof) {
+    // The gzip member is ended at checkpoints, so that no data is buffered
+    const bool finish = file_chunk->eof || file_chunk->checkpoint;
+    if (file_chunk->reads.empty() && !finish) {
         // The empty chunk must still be forwarded, to ensure that tracking of
         // ordered chunks does not break.
         chunk_vec chunks;
@@ -442,24 +1315,48 @@ chunk_vec gzip_paired_fastq::process(analytical_chunk* chunk)
         return chunks;
     }
 
-    std::pair<size_t, unsigned char*> input_buffer;
     std::pair<size_t, unsigned char*> output_buffer;
     try {
-        input_buffer = build_input_buffer(file_chunk->reads);
-        file_chunk->reads.clear();
+        const size_t input_size = file_chunk->reads.size();
+
+#ifdef AR_LIBDEFLATE_SUPPORT
+        if (input_size || file_chunk->eof) {
+            m_output_buffer.resize(libdeflate_gzip_compress_bound(m_compressor, input_size));
 
-        if (input_buffer.first || file_chunk->eof) {
-            m_stream.avail_in = input_buffer.first;
-            m_stream.next_in = input_buffer.second;
+            const size_t output_size = libdeflate_gzip_compress(m_compressor,
+                                                                input_data(file_chunk->reads),
+                                                                input_size,
+                                                                &m_output_buffer.at(0),
+                                                                m_output_buffer.size());
+
+            if (!output_size) {
+                throw thread_error("gzip_paired_fastq::process: compression failed");
+            }
+
+            // The gzip member is split across buffers of a fixed size
+            for (size_t offset = 0; offset < output_size; offset += FASTQ_COMPRESSED_CHUNK) {
+                output_buffer.first = std::min(FASTQ_COMPRESSED_CHUNK, output_size - offset);
+                output_buffer.second = s_buffers.acquire();
+                std::memcpy(output_buffer.second, &m_output_buffer.at(offset),
+                            output_buffer.first);
+
+                buffers.push_back(output_buffer);
+                output_buffer.second = NULL;
+            }
+        }
+#else
+        if (input_size || finish) {
+            m_stream.avail_in = input_size;
+            m_stream.next_in = input_data(file_chunk->reads);
 
             do {
                 output_buffer.first = FASTQ_COMPRESSED_CHUNK;
-                output_buffer.second = new unsigned char[FASTQ_COMPRESSED_CHUNK];
+                output_buffer.second = s_buffers.acquire();
 
                 m_stream.avail_out = output_buffer.first;
                 m_stream.next_out = output_buffer.second;
 
-                switch (deflate(&m_stream, file_chunk->eof ? Z_FINISH : Z_NO_FLUSH)) {
+                switch (deflate(&m_stream, finish ? Z_FINISH : Z_NO_FLUSH)) {
                     case Z_OK:
                     case Z_STREAM_END:
                     case Z_BUF_ERROR: /* End of out / in buffer reached. */
@@ -476,17 +1373,22 @@ chunk_vec gzip_paired_fastq::process(analytical_chunk* chunk)
                 if (output_buffer.first) {
                     buffers.push_back(output_buffer);
                 } else {
-                    delete[] output_buffer.second;
+                    s_buffers.release(output_buffer.second);
                 }
 
                 output_buffer.second = NULL;
             } while (m_stream.avail_out == 0);
+
+            if (finish && !file_chunk->eof && deflateReset(&m_stream) != Z_OK) {
+                // Following a checkpoint, reads are written as a new member
+                throw thread_error("gzip_paired_fastq::process: reset failed");
+            }
         }
+#endif
 
-        delete[] input_buffer.second;
+        file_chunk->reads.clear();
     } catch (...) {
-        delete[] input_buffer.second;
-        delete[] output_buffer.second;
+        s_buffers.release(output_buffer.second);
         throw;
     }
 
@@ -497,8 +1399,69 @@ chunk_vec gzip_paired_fastq::process(analytical_chunk* chunk)
         m_buffered_reads = 0;
     } else {
         m_buffered_reads += file_chunk->count;
+        fastq_output_chunk::recycle(file_chunk.release());
+    }
+
+    return chunks;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'bgzf_paired_fastq'
+
+bgzf_paired_fastq::bgzf_paired_fastq(const userconfig& config, size_t next_step)
+  : analytical_step(analytical_step::unordered, false)
+  , m_level(config.gzip_level)
+  , m_next_step(next_step)
+  , m_deflaters(FASTQ_POOL_SIZE)
+{
+}
+
+
+chunk_vec bgzf_paired_fastq::process(analytical_chunk* chunk)
+{
+    std::auto_ptr<fastq_output_chunk> file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
+    buffer_vec& buffers = file_chunk->buffers;
+
+    if (!file_chunk->reads.empty()) {
+        // Compression state is not shared, as chunks are compressed in parallel
+        std::auto_ptr<bgzf_deflater> deflater(m_deflaters.acquire());
+        if (!deflater.get()) {
+            deflater.reset(new bgzf_deflater(m_level));
+        }
+
+        const unsigned char* data = input_data(file_chunk->reads);
+        const size_t input_size = file_chunk->reads.size();
+        for (size_t offset = 0; offset < input_size; offset += BGZF_MAX_BLOCK_INPUT) {
+            const size_t length = std::min(BGZF_MAX_BLOCK_INPUT, input_size - offset);
+
+            buffer_pair block(0, s_buffers.acquire());
+            try {
+                block.first = deflater->compress(data + offset, length, block.second);
+            } catch (...) {
+                s_buffers.release(block.second);
+                throw;
+            }
+
+            buffers.push_back(block);
+        }
+
+        m_deflaters.release(deflater.release());
+        file_chunk->reads.clear();
     }
 
+    if (file_chunk->eof) {
+        unsigned char* eof_block = s_buffers.acquire();
+        std::copy(BGZF_EOF_BLOCK, BGZF_EOF_BLOCK + sizeof(BGZF_EOF_BLOCK), eof_block);
+
+        buffers.push_back(buffer_pair(sizeof(BGZF_EOF_BLOCK), eof_block));
+    }
+
+    // Every chunk is forwarded, since the following step is ordered
+    chunk_vec chunks;
+    chunks.push_back(chunk_pair(m_next_step, file_chunk.release()));
+
     return chunks;
 }
 
@@ -516,16 +1479,37 @@ static timer s_timer = timer("reads");
 static bool s_finalized = false;
 
 
-write_paired_fastq::write_paired_fastq(const std::string& filename)
+write_paired_fastq::write_paired_fastq(const std::string& filename,
+                                       writer_pool* pool,
+                                       bool direct_io,
+                                       bool preallocate,
+                                       const std::string& header,
+                                       checkpointer* checkpoints)
   : analytical_step(analytical_step::ordered, true)
-  , m_output(filename.c_str(), std::ofstream::out)
+  , m_checkpoint_key("output:" + filename)
+  , m_records_key("output_records:" + filename)
+  , m_records(0)
+  , m_output(filename, pool, direct_io, preallocate,
+             checkpoints && checkpoints->resumed())
+  , m_bytes_written("adapterremoval_output_bytes_total",
+                    "Number of (compressed) bytes written to an output file.",
+                    metrics_label("file", filename))
 {
-    if (!m_output.is_open()) {
-        std::string message = std::string("Failed to open file '") + filename + "': ";
-        throw std::ofstream::failure(message + std::strerror(errno));
+    if (checkpoints) {
+        checkpoints->add_state(this);
     }
 
-    m_output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    if (checkpoints && checkpoints->resumed()) {
+        // The header (if any) was written before the checkpoint
+        m_output.resume_at(checkpoints->resumed()->get(m_checkpoint_key));
+        m_records = checkpoints->resumed()->get(m_records_key);
+
+        mutex_locker lock(s_timer_lock);
+        s_timer.resume(m_records);
+    } else if (!header.empty()) {
+        m_bytes_written.increment(header.size());
+        m_output.write(header.data(), header.size());
+    }
 }
 
 
@@ -537,32 +1521,47 @@ write_paired_fastq::~write_paired_fastq()
 chunk_vec write_paired_fastq::process(analytical_chunk* chunk)
 {
     std::auto_ptr<fastq_output_chunk> file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
-    const string_vec& lines = file_chunk->reads;
+    // Uncompressed reads are handed over as is; compressed reads are cleared
+    std::string& reads = file_chunk->reads;
+    if (!reads.empty()) {
+        m_bytes_written.increment(reads.size());
+        m_output.write(reads);
+    }
 
-    if (file_chunk->buffers.empty()) {
-        for (string_vec::const_iterator it = lines.begin(); it != lines.end(); ++it) {
-            m_output << *it;
-        }
-    } else {
-        buffer_vec& buffers = file_chunk->buffers;
-        for (buffer_vec::iterator it = buffers.begin(); it != buffers.end(); ++it) {
-            if (it->first) {
-                m_output.write(reinterpret_cast<char*>(it->second), it->first);
-            }
+    buffer_vec& buffers = file_chunk->buffers;
+    for (buffer_vec::iterator it = buffers.begin(); it != buffers.end(); ++it) {
+        if (it->first) {
+            m_bytes_written.increment(it->first);
+            m_output.write(reinterpret_cast<char*>(it->second), it->first);
         }
     }
 
     if (file_chunk->eof) {
-        m_output.flush();
+        // Waits for pending writes, so that errors are reported here
+        m_output.close();
     }
 
-    mutex_locker lock(s_timer_lock);
-    s_timer.increment(file_chunk->count);
+    m_records += file_chunk->count;
+    {
+        mutex_locker lock(s_timer_lock);
+        s_timer.increment(file_chunk->count);
+        get_reads_counter().increment(file_chunk->count);
+    }
+
+    fastq_output_chunk::recycle(file_chunk.release());
 
     return chunk_vec();
 }
 
 
+void write_paired_fastq::save_checkpoint(checkpoint_data& data)
+{
+    m_output.flush();
+    data.set(m_checkpoint_key, m_output.offset());
+    data.set(m_records_key, m_records);
+}
+
+
 void write_paired_fastq::finalize()
 {
     mutex_locker lock(s_timer_lock);
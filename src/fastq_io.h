@@ -26,41 +26,103 @@
 
 #include <vector>
 #include <fstream>
+#include <memory>
 
 #include <zlib.h>
 
+#ifdef AR_LIBDEFLATE_SUPPORT
+#include <libdeflate.h>
+#endif
+
 #ifdef AR_BZIP2_SUPPORT
 #include <bzlib.h>
 #endif
 
 
+#include "async_writer.h"
+#include "bam.h"
+#include "checkpoint.h"
 #include "commontypes.h"
 #include "fastq.h"
 #include "scheduler.h"
 #include "timer.h"
 #include "linereader.h"
+#include "metrics.h"
+#include "packed_reads.h"
 #include "strutils.h"
 
 namespace ar
 {
 
 class userconfig;
+class bgzf_deflater;
 
 typedef std::pair<size_t, unsigned char*> buffer_pair;
 typedef std::vector<buffer_pair> buffer_vec;
+typedef std::vector<unsigned char> byte_vec;
 
 
-//! Number of FASTQ records to read for each data-chunk
+//! Default number of FASTQ records to read for each data-chunk
 const size_t FASTQ_CHUNK_SIZE = 2 * 1024;
+//! Min number of FASTQ records per chunk, when the size is adjusted at runtime
+const size_t FASTQ_MIN_CHUNK_SIZE = 256;
+//! Max number of FASTQ records per chunk, when the size is adjusted at runtime
+const size_t FASTQ_MAX_CHUNK_SIZE = 16 * 1024;
+//! Processing time per chunk (in seconds) targeted by 'chunk_sizer'
+const double FASTQ_CHUNK_SECONDS = 0.02;
 
 #if defined(AR_GZIP_SUPPORT) || defined(AR_BZIP2_SUPPORT)
-//! Size of compressed chunks used to transport compressed data
-const size_t FASTQ_COMPRESSED_CHUNK = 40 * 1024;
+//! Size of compressed chunks used to transport compressed data; large enough
+//! to contain a single BGZF block (see BGZF_MAX_BLOCK_SIZE).
+const size_t FASTQ_COMPRESSED_CHUNK = 64 * 1024;
 #endif
 
 
 
 
+/**
+ * Selects the number of records read for each chunk.
+ *
+ * If a fixed size is not used, the size starts at FASTQ_CHUNK_SIZE and is
+ * adjusted so that processing a chunk takes about FASTQ_CHUNK_SECONDS, based
+ * on the time taken by the steps processing reads, as reported via 'add_time'.
+ * Small chunks for slow (e.g. long) reads keep all threads busy and limit the
+ * memory used by chunks in flight, while large chunks for fast (e.g. short)
+ * reads reduce the overhead of scheduling chunks. The size is kept between
+ * FASTQ_MIN_CHUNK_SIZE and FASTQ_MAX_CHUNK_SIZE, and changes by at most a
+ * factor of two at a time.
+ */
+class chunk_sizer
+{
+public:
+    /** Constructor; uses a fixed number of records unless 'size' is 0. */
+    chunk_sizer(size_t size = 0);
+
+    /** Returns the number of records to read for the next chunk. */
+    size_t chunk_size() const;
+
+    /** Records the time taken to process a chunk containing 'records' records. */
+    void add_time(size_t records, double seconds);
+
+private:
+    //! Not implemented
+    chunk_sizer(const chunk_sizer&);
+    //! Not implemented
+    chunk_sizer& operator=(const chunk_sizer&);
+
+    //! Lock used to control access to timings and the current size
+    mutable mutex m_lock;
+    //! Indicates if the chunk size is adjusted at runtime
+    const bool m_adaptive;
+    //! Current number of records per chunk
+    size_t m_size;
+    //! Records processed since the size was last adjusted
+    size_t m_records;
+    //! Seconds spent processing 'm_records' records
+    double m_seconds;
+};
+
+
 /**
  * Container object for (demultiplexed) reads.
  */
@@ -70,13 +132,62 @@ public:
     /** Create chunk representing lines starting at line offset (1-based). */
     fastq_read_chunk(bool eof_ = false);
 
+    /**
+     * Returns a recycled chunk if available, and a new chunk otherwise; the
+     * chunk is empty, except for any records in 'spare_1' and 'spare_2'.
+     */
+    static fastq_read_chunk* acquire(bool eof_ = false);
+    /** Returns a chunk to the pool of unused chunks, or deletes it. */
+    static void recycle(fastq_read_chunk* chunk);
+
+    /** Returns the approximate number of bytes used by parsed reads. */
+    virtual size_t bytes() const;
+
+    /**
+     * Moves the records in reads_1 / reads_2 into packed_1 / packed_2, unless
+     * 'packing' is rp_none, and frees the memory used by the (spare) records;
+     * see 'packed_reads'.
+     */
+    void pack(read_packing packing);
+    /** Restores packed records (if any) to reads_1 and reads_2. */
+    void unpack();
+
     //! Indicates that EOF has been reached.
     bool eof;
+    //! Indicates that a checkpoint follows this chunk; see 'checkpointer'
+    bool checkpoint;
 
     //! Lines read from the mate 1 files
     fastq_vec reads_1;
     //! Lines read from the mate 2 files
     fastq_vec reads_2;
+
+    //! Unparsed lines from the mate 1 file, when using memory mapped input
+    line_view raw_1;
+    //! Unparsed lines from the mate 2 file, when using memory mapped input
+    line_view raw_2;
+    //! Number of the first unparsed record (1-based); used for error messages
+    size_t raw_offset;
+    //! Max number of unparsed records in raw_1 and raw_2
+    size_t raw_records;
+
+    //! Records from earlier uses of the chunk; overwritten when reading reads_1
+    fastq_vec spare_1;
+    //! Records from earlier uses of the chunk; overwritten when reading reads_2
+    fastq_vec spare_2;
+
+    //! Packed records of reads_1 / reads_2, while waiting to be processed
+    packed_reads packed_1;
+    packed_reads packed_2;
+
+    //! Sequences and qualities of reads_1 / reads_2, as used for processing;
+    //! kept with the chunk so that buffers are re-used when recycled
+    fastq_batch batch_1;
+    fastq_batch batch_2;
+
+    //! Barcode (pair) selected for each read (pair) when demultiplexing;
+    //! negative values are used for unidentified / ambiguous reads
+    std::vector<int> barcodes;
 };
 
 
@@ -92,11 +203,33 @@ public:
     /** Destructor; frees buffers. */
     ~fastq_output_chunk();
 
+    /**
+     * Returns a recycled (empty) chunk if available, or a new chunk; records
+     * added to the chunk are serialized using the given format.
+     */
+    static fastq_output_chunk* acquire(bool eof_ = false,
+                                       output_format format = of_fastq);
+    /** Returns a chunk to the pool of unused chunks, or deletes it. */
+    static void recycle(fastq_output_chunk* chunk);
+
     /** Add FASTQ read, accounting for one or more input reads. */
     void add(const fastq_encoding& encoding, const fastq& read, size_t count = 1);
+    /**
+     * Add the nth record in a batch, using the header of the original read;
+     * 'mate' is either rt_mate_1 or rt_mate_2, and determines the BAM flags
+     * of the record, regardless of the file it is written to.
+     */
+    void add(const fastq_encoding& encoding, const fastq_batch& batch,
+             size_t nth, const std::string& header, read_type mate);
+
+    /** Returns the approximate number of bytes used by reads and buffers. */
+    virtual size_t bytes() const;
 
     //! Indicates that EOF has been reached.
     bool eof;
+    //! Indicates that a checkpoint follows this chunk; steps buffering data
+    //! must forward all buffered data along with this chunk
+    bool checkpoint;
 
     //! The number of reads used to generate this chunk; may differ from the
     //! the number of reads, in the case of collapsed reads.
@@ -104,11 +237,25 @@ public:
 
 private:
     friend class gzip_paired_fastq;
+    friend class bgzf_paired_fastq;
+    friend class bzip2_block_paired_fastq;
     friend class bzip2_paired_fastq;
     friend class write_paired_fastq;
 
-    //! Lines read from the mate 1 and mate 2 files
-    string_vec reads;
+    /**
+     * Appends a BAM record with the given header, sequence and qualities;
+     * 'mate_flag' is BAM_FREAD1 or BAM_FREAD2 for mates, and 0 otherwise.
+     */
+    void add_bam(const std::string& header, const char* sequence,
+                 const char* qualities, size_t length, unsigned mate_flag);
+
+    //! Serialized FASTQ records, written (and compressed) as a single block
+    std::string reads;
+    //! Format used to serialize records
+    output_format format;
+    //! Indicates that the next record is mate 2 (of_bam_pairs); only used for
+    //! records added without an explicit mate
+    bool next_is_mate_2;
 
     //! Buffers of compressed lines
     buffer_vec buffers;
@@ -121,8 +268,11 @@ private:
  * Reads from the mate 1 and the mate 2 files, storing the reads in a
  * fastq_file_chunk. Once the EOF has been reached, a single empty of lines
  * will be returned.
+ *
+ * If 'mmap_input' is set, uncompressed files are memory mapped and split
+ * into blocks of records, which are left for a 'parse_fastq' step to parse.
  */
-class read_single_fastq : public analytical_step
+class read_single_fastq : public analytical_step, public checkpoint_state
 {
 public:
     /**
@@ -130,30 +280,62 @@ public:
      *
      * @param filename Path to FASTQ file containing mate 1 / 2 reads.
      * @param mate Either rt_mate_1 or rt_mate_2; other values throw.
+     * @param inflate_threads Number of threads used to decompress BGZF files.
+     * @param mmap_input Memory map uncompressed files; see 'parse_fastq'.
+     * @param sizer Selects the size of chunks; FASTQ_CHUNK_SIZE if NULL.
+     * @param packing Storage of reads passed to the next step; see packed_reads.
+     * @param checkpoints Requests checkpoints; records read before the last
+     *                    checkpoint are skipped if resuming. May be NULL.
+     * @param range Bytes of the file that are read; see 'find_shard_ranges'.
      *
      * Opens the input file corresponding to the specified mate.
      */
     read_single_fastq(const fastq_encoding* encoding,
                       const std::string& filename,
-                      size_t next_step);
+                      size_t next_step,
+                      size_t inflate_threads = 1,
+                      bool mmap_input = false,
+                      const chunk_sizer* sizer = NULL,
+                      read_packing packing = rp_none,
+                      checkpointer* checkpoints = NULL,
+                      const file_range& range = file_range());
 
     /** Reads N lines from the input file and saves them in an fastq_read_chunk. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
+    /** Saves the number of records read; see 'checkpointer'. */
+    virtual void save_checkpoint(checkpoint_data& data);
+
 private:
     //! Not implemented
     read_single_fastq(const read_single_fastq&);
     //! Not implemented
     read_single_fastq& operator=(const read_single_fastq&);
 
+    //! Name of the input file; used to save checkpoints
+    const std::string m_filename;
+    //! Counter of bytes read from the input file; see 'metrics_writer'.
+    std::auto_ptr<metrics_counter> m_bytes_read;
     //! Encoding used to parse FASTQ reads.
     const fastq_encoding* m_encoding;
     //! Current line in the input file (1-based)
     size_t m_line_offset;
+    //! Memory mapped input file; used for uncompressed files if requested.
+    std::auto_ptr<mapped_file> m_mapped_input;
     //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    line_reader m_io_input;
+    std::auto_ptr<line_reader> m_io_input;
+    //! Indicates that EOF has been reached.
+    bool m_eof;
     //! The analytical step following this step
     const size_t m_next_step;
+    //! Selects the number of records per chunk; may be NULL
+    const chunk_sizer* m_sizer;
+    //! Storage of reads passed to the next step
+    const read_packing m_packing;
+    //! Used to request checkpoints; may be NULL
+    checkpointer* m_checkpoints;
+    //! Number of records to skip before reading, when resuming
+    size_t m_skip_records;
 };
 
 
@@ -163,53 +345,230 @@ private:
  * Reads from the mate 1 and the mate 2 files, storing the reads in a
  * fastq_file_chunk. Once the EOF has been reached, a single empty of lines
  * will be returned.
+ *
+ * If 'mmap_input' is set, uncompressed files are memory mapped and split
+ * into blocks of records, which are left for a 'parse_fastq' step to parse.
  */
-class read_paired_fastq : public analytical_step
+class read_paired_fastq : public analytical_step, public checkpoint_state
 {
 public:
     /**
-     * Constructor.
+     * Constructor; BGZF files are decompressed using 'inflate_threads'
+     * threads per file. See 'read_single_fastq' for other parameters.
+     *
+     * If 'filename_2' is empty, 'filename_1' is read as an interleaved file,
+     * in which each mate 1 record is followed by the mate 2 record; such
+     * files are never memory mapped.
      */
     read_paired_fastq(const fastq_encoding* encoding,
                       const std::string& filename_1,
                       const std::string& filename_2,
-                      size_t next_step);
+                      size_t next_step,
+                      size_t inflate_threads = 1,
+                      bool mmap_input = false,
+                      const chunk_sizer* sizer = NULL,
+                      read_packing packing = rp_none,
+                      checkpointer* checkpoints = NULL,
+                      const file_range& range_1 = file_range(),
+                      const file_range& range_2 = file_range());
 
     /** Reads N lines from the input file and saves them in an fastq_file_chunk. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
+    /** Saves the number of records read; see 'checkpointer'. */
+    virtual void save_checkpoint(checkpoint_data& data);
+
+    /**
+     * Requests that no further reads are read; may be called from any thread.
+     * The next call to 'process' forwards an EOF chunk, as if the end of the
+     * input files had been reached.
+     */
+    void stop();
+
 private:
     //! Not implemented
     read_paired_fastq(const read_paired_fastq&);
     //! Not implemented
     read_paired_fastq& operator=(const read_paired_fastq&);
 
+    //! Names of the input files; used to save checkpoints
+    const std::string m_filename_1;
+    const std::string m_filename_2;
+    //! Counters of bytes read from the input files; see 'metrics_writer'.
+    std::auto_ptr<metrics_counter> m_bytes_read_1;
+    //! Counters of bytes read from the input files; NULL if interleaved.
+    std::auto_ptr<metrics_counter> m_bytes_read_2;
     //! Encoding used to parse FASTQ reads.
     const fastq_encoding* m_encoding;
     //! Current line in the input file (1-based)
     size_t m_line_offset;
+    //! Memory mapped input files; used if both files are uncompressed.
+    std::auto_ptr<mapped_file> m_mapped_input_1;
+    //! Memory mapped input files; used if both files are uncompressed.
+    std::auto_ptr<mapped_file> m_mapped_input_2;
     //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    line_reader m_io_input_1;
+    std::auto_ptr<line_reader> m_io_input_1;
     //! Line reader used to read raw / gzip'd / bzip2'd FASTQ files.
-    line_reader m_io_input_2;
+    std::auto_ptr<line_reader> m_io_input_2;
+    //! Indicates that both mates are read from 'm_io_input_1'.
+    const bool m_interleaved;
+    //! Indicates that EOF has been reached.
+    bool m_eof;
+    //! Non-zero if 'stop' has been called.
+    atomic_counter m_stop;
+    //! The analytical step following this step
+    const size_t m_next_step;
+    //! Selects the number of records per chunk; may be NULL
+    const chunk_sizer* m_sizer;
+    //! Storage of reads passed to the next step
+    const read_packing m_packing;
+    //! Used to request checkpoints; may be NULL
+    checkpointer* m_checkpoints;
+    //! Number of records to skip in each file before reading, when resuming
+    size_t m_skip_records;
+};
+
+
+/**
+ * Reading step for unaligned BAM files; see 'bam_reader'. For PE data, the
+ * file must contain interleaved mates, each mate 1 record followed by the
+ * mate 2 record, as written by AdapterRemoval or e.g. 'samtools import'.
+ */
+class read_bam : public analytical_step
+{
+public:
+    /**
+     * Constructor; opens the file and reads the header. BGZF blocks are
+     * decompressed using 'inflate_threads' threads. See 'read_single_fastq'
+     * for other parameters.
+     */
+    read_bam(const std::string& filename,
+             bool paired_end,
+             size_t next_step,
+             size_t inflate_threads = 1,
+             const chunk_sizer* sizer = NULL,
+             read_packing packing = rp_none);
+
+    /** Returns the SAM header text of the file. */
+    const std::string& header() const;
+
+    /** Reads N records from the input file and saves them in an fastq_read_chunk. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+private:
+    //! Not implemented
+    read_bam(const read_bam&);
+    //! Not implemented
+    read_bam& operator=(const read_bam&);
+
+    /** Reads a record, returning false at EOF; errors abort the run. */
+    bool read_record(fastq& dst);
+
+    //! Counter of bytes read from the input file; see 'metrics_writer'.
+    std::auto_ptr<metrics_counter> m_bytes_read;
+    //! Reader used to parse the BAM file
+    std::auto_ptr<bam_reader> m_reader;
+    //! SAM header text of the file
+    const std::string m_header;
+    //! Indicates that records are read as interleaved pairs
+    const bool m_paired_end;
+    //! Number of records read so far
+    size_t m_records;
+    //! Indicates that EOF has been reached.
+    bool m_eof;
+    //! The analytical step following this step
+    const size_t m_next_step;
+    //! Selects the number of records per chunk; may be NULL
+    const chunk_sizer* m_sizer;
+    //! Storage of reads passed to the next step
+    const read_packing m_packing;
+};
+
+
+/**
+ * Parsing step for memory mapped input; parses the blocks of records left by
+ * the reading steps, allowing records to be parsed by multiple threads. As a
+ * file reading step must precede this step, the order of chunks passed on to
+ * the next step is preserved. Chunks without unparsed records are forwarded
+ * as is.
+ */
+class parse_fastq : public analytical_step
+{
+public:
+    /**
+     * Constructor; 'next_step' sets the destination of parsed chunks, and
+     * 'packing' the storage of parsed reads (see 'packed_reads').
+     */
+    parse_fastq(const fastq_encoding* encoding, size_t next_step,
+                read_packing packing = rp_none);
+
+    /** Parses records in chunk->raw_1 and chunk->raw_2. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+private:
+    //! Not implemented
+    parse_fastq(const parse_fastq&);
+    //! Not implemented
+    parse_fastq& operator=(const parse_fastq&);
+
+    //! Encoding used to parse FASTQ reads.
+    const fastq_encoding* m_encoding;
     //! The analytical step following this step
     const size_t m_next_step;
+    //! Storage of reads passed to the next step
+    const read_packing m_packing;
 };
 
 
 #ifdef AR_BZIP2_SUPPORT
 /**
- * BZip2 compression step; takes any lines in the input chunk, compresses them,
- * and adds them to the buffer list of the chunk, before forwarding it. */
+ * BZip2 block collection step; collects the lines in input chunks into blocks
+ * of data filling exactly one bzip2 block (see 'bzip2_block_input'), which
+ * are forwarded for compression in the input order. Blocks are cut without
+ * regard for record boundaries, since they are concatenated after being
+ * compressed. Any remaining data is forwarded once EOF is reached.
+ */
+class bzip2_block_paired_fastq : public analytical_step
+{
+public:
+    /** Constructor; 'next_step' sets the destination of collected blocks. */
+    bzip2_block_paired_fastq(const userconfig& config, size_t next_step);
+
+    /** Collects input lines, forwarding full blocks in chunk->reads. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+private:
+    //! Not implemented
+    bzip2_block_paired_fastq(const bzip2_block_paired_fastq&);
+    //! Not implemented
+    bzip2_block_paired_fastq& operator=(const bzip2_block_paired_fastq&);
+
+    //! Number of bytes of input per block
+    const size_t m_block_size;
+    //! Lines not yet forwarded
+    std::string m_buffer;
+    //! N reads which did not result in an output chunk
+    size_t m_buffered_reads;
+
+    //! The analytical step following this step
+    const size_t m_next_step;
+};
+
+
+/**
+ * BZip2 compression step; takes any lines in the input chunk, compresses them
+ * into a complete bzip2 stream, and adds this to the buffer list of the chunk,
+ * before forwarding it. Since streams do not depend on each other, this step
+ * is unordered, producing a multi-stream bzip2 file when the streams are
+ * concatenated; input is expected to be collected using the step
+ * 'bzip2_block_paired_fastq', so that each stream contains a full block.
+ */
 class bzip2_paired_fastq : public analytical_step
 {
 public:
     /** Constructor; 'next_step' sets the destination of compressed chunks. */
     bzip2_paired_fastq(const userconfig& config, size_t next_step);
 
-    /** Destructor; frees BZip2 stream. */
-    virtual ~bzip2_paired_fastq();
-
     /** Compresses input lines, saving compressed chunks to chunk->buffers. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
@@ -219,14 +578,10 @@ private:
     //! Not implemented
     bzip2_paired_fastq& operator=(const bzip2_paired_fastq&);
 
-    //! N reads which did not result in an output chunk
-    size_t m_buffered_reads;
-
+    //! BZip2 block size (1 - 9) used for streams
+    const int m_level;
     //! The analytical step following this step
     const size_t m_next_step;
-
-    //! BZip2 stream object
-    bz_stream m_stream;
 };
 
 #endif
@@ -235,7 +590,10 @@ private:
 #ifdef AR_GZIP_SUPPORT
 /**
  * GZip compression step; takes any lines in the input chunk, compresses them,
- * and adds them to the buffer list of the chunk, before forwarding it. */
+ * and adds them to the buffer list of the chunk, before forwarding it.
+ *
+ * If built with libdeflate, each chunk is compressed into a separate gzip
+ * member; otherwise a single gzip stream is produced using zlib. */
 class gzip_paired_fastq : public analytical_step
 {
 public:
@@ -260,8 +618,45 @@ private:
     //! The analytical step following this step
     const size_t m_next_step;
 
+#ifdef AR_LIBDEFLATE_SUPPORT
+    //! Compressed data, prior to being split into buffers of fixed size
+    byte_vec m_output_buffer;
+    //! libdeflate compressor object
+    libdeflate_compressor* m_compressor;
+#else
     //! GZip stream object
     z_stream m_stream;
+#endif
+};
+
+/**
+ * BGZF compression step; takes any lines in the input chunk, compresses them
+ * into independent BGZF blocks, and adds these to the buffer list of the
+ * chunk, before forwarding it. Since blocks do not depend on each other, this
+ * step is unordered; the EOF marker block is added to the last chunk.
+ */
+class bgzf_paired_fastq : public analytical_step
+{
+public:
+    /** Constructor; 'next_step' sets the destination of compressed chunks. */
+    bgzf_paired_fastq(const userconfig& config, size_t next_step);
+
+    /** Compresses input lines, saving compressed chunks to chunk->buffers. */
+    virtual chunk_vec process(analytical_chunk* chunk);
+
+private:
+    //! Not implemented
+    bgzf_paired_fastq(const bgzf_paired_fastq&);
+    //! Not implemented
+    bgzf_paired_fastq& operator=(const bgzf_paired_fastq&);
+
+    //! GZip compression level used for blocks
+    const int m_level;
+    //! The analytical step following this step
+    const size_t m_next_step;
+
+    //! Unused compressors, re-used since chunks are compressed in parallel
+    object_pool<bgzf_deflater> m_deflaters;
 };
 #endif
 
@@ -273,32 +668,60 @@ private:
  * at the offset corresponding to the 'type' argument to the corresponding
  * output file. The list of lines is cleared upon writing.
  */
-class write_paired_fastq : public analytical_step
+class write_paired_fastq : public analytical_step, public checkpoint_state
 {
 public:
     /**
      * Constructor.
      *
-     * @param config User settings.
-     * @param read_type The type of reads to write.
-     *
-     * Based on the read-type specified, and SE / PE mode, the corresponding
-     * output file is opened
+     * @param filename Path of the output file, which is opened (truncated).
+     * @param pool Threads used to write the file; written directly if NULL.
+     * @param direct_io Write the file using O_DIRECT; see async_writer.
+     * @param preallocate Preallocate space for the file; see async_writer.
+     * @param header Data written before any records, e.g. a BAM header.
+     * @param checkpoints If resuming, the file is instead truncated to the
+     *                    size at the last checkpoint. May be NULL.
      */
-    write_paired_fastq(const std::string& filename);
+    write_paired_fastq(const std::string& filename,
+                       writer_pool* pool = NULL,
+                       bool direct_io = false,
+                       bool preallocate = false,
+                       const std::string& header = std::string(),
+                       checkpointer* checkpoints = NULL);
 
     /** Destructor; closes output file. */
     ~write_paired_fastq();
 
-    /** Writes the reads of the type specified in the constructor. */
+    /** Queues reads for writing; the file is closed once EOF is reached. */
     virtual chunk_vec process(analytical_chunk* chunk);
 
-    /** Flushes the output file and prints progress report (if enabled). */
+    /** Prints progress report (if enabled). */
     virtual void finalize();
 
+    /**
+     * Flushes the file to disk and saves its size, as well as the number of
+     * reads written, so that progress reports include these if the run is
+     * resumed; see 'checkpointer'.
+     */
+    virtual void save_checkpoint(checkpoint_data& data);
+
 private:
-    //! Pointer to output file opened using userconfig::open_with_default_filename.
-    std::ofstream m_output;
+    //! Not implemented
+    write_paired_fastq(const write_paired_fastq&);
+    //! Not implemented
+    write_paired_fastq& operator=(const write_paired_fastq&);
+
+    //! Key used to save the size of the file at checkpoints
+    const std::string m_checkpoint_key;
+    //! Key used to save the number of reads written at checkpoints
+    const std::string m_records_key;
+    //! Number of reads written to the file, including those written before
+    //! the run was resumed
+    size_t m_records;
+    //! Output file, written in large blocks by the writer pool
+    async_writer m_output;
+    //! Number of bytes written to the file; reported via 'metrics_writer'
+    metrics_counter m_bytes_written;
 };
 
 } // namespace ar
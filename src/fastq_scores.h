@@ -0,0 +1,56 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_FASTQ_SCORES_H
+#define AR_FASTQ_SCORES_H
+
+// Kept separate from fastq_enc.h, so that SIMD kernels can use these constants
+// without the (virtual) encoding classes; see alignment_simd.h.
+
+namespace ar
+{
+
+//! Offset used by Phred+33 and SAM encodings
+const int PHRED_OFFSET_33 = '!';
+//! Offset used by Phred+64 and Solexa encodings
+const int PHRED_OFFSET_64 = '@';
+
+//! Minimum Phred score allowed; encodes to '!'
+const int MIN_PHRED_SCORE = 0;
+//! Maximum Phred score allowed by default, to ensure backwards compatibility
+//! with AdapterRemoval v1.x.
+const int MAX_PHRED_SCORE_DEFAULT = 41;
+//! Maximum Phred score allowed, as this encodes to the last printable
+//! character '~', when using an offset of 33.
+const int MAX_PHRED_SCORE = 93;
+
+
+//! Minimum Solexa score allowed; encodes to ';' with an offset of 64
+const int MIN_SOLEXA_SCORE = -5;
+//! Maximum Solexa score allowed; encodes to 'h' with an offset of 64
+const int MAX_SOLEXA_SCORE = 40;
+
+} // namespace ar
+
+#endif
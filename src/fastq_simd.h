@@ -0,0 +1,142 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_FASTQ_SIMD_H
+#define AR_FASTQ_SIMD_H
+
+#include <cstddef>
+
+#include "simd.h"
+
+namespace ar
+{
+
+/**
+ * Kernels used to translate and validate quality scores and sequences. Each
+ * kernel processes whole blocks of bytes (e.g. 16 bytes for SSE2) in place,
+ * and stops before the first block which contains an invalid value, leaving
+ * that block unchanged. The kernels return the number of leading bytes that
+ * were processed; the remaining bytes must be processed by the portable code,
+ * which is also responsible for reporting errors.
+ */
+
+/**
+ * Decodes scores in the range [offset; max_ascii] to Phred+33, by subtracting
+ * (offset - 33) from each value; corresponds to fastq_encoding::decode_string.
+ */
+typedef size_t (*decode_phred_func)(char* data, size_t length,
+                                    char offset, char max_ascii);
+
+/**
+ * Encodes Phred+33 scores using the given offset, truncating values greater
+ * than 'max_ascii'; corresponds to fastq_encoding::encode_string.
+ */
+typedef size_t (*encode_phred_func)(char* data, size_t length,
+                                    char offset, char max_ascii);
+
+/**
+ * Uppercases sequences and replaces '.' with 'N', stopping at blocks which
+ * contain characters other than ACGTN; corresponds to fastq::clean_sequence.
+ */
+typedef size_t (*clean_sequence_func)(char* data, size_t length);
+
+/**
+ * Reverse complements a sequence of uppercase nucleotides (ACGTN) and
+ * reverses the corresponding qualities in place, by swapping blocks taken
+ * from both ends; returns the number of bytes processed at each end, leaving
+ * the bytes in the range [n; length - n) to be reversed by the caller.
+ */
+typedef size_t (*reverse_complement_func)(char* sequence, char* qualities,
+                                          size_t length);
+
+/**
+ * Counts leading low-quality bases, i.e. bases with a Phred+33 score less
+ * than or equal to 'threshold' (or Ns, if 'trim_ns' is set), stopping before
+ * the first block containing any other base; the bases are not modified.
+ * Corresponds to the scans performed by fastq::trim_low_quality_bases.
+ */
+typedef size_t (*low_quality_prefix_func)(const char* sequence,
+                                          const char* qualities,
+                                          size_t length,
+                                          char threshold,
+                                          bool trim_ns);
+
+/**
+ * Counts trailing low-quality bases in blocks taken from the end of the
+ * sequence; see 'low_quality_prefix_func'.
+ */
+typedef size_t (*low_quality_suffix_func)(const char* sequence,
+                                          const char* qualities,
+                                          size_t length,
+                                          char threshold,
+                                          bool trim_ns);
+
+
+/** Set of FASTQ kernels for a given instruction set. */
+struct fastq_kernels
+{
+    //! See 'decode_phred_func'
+    decode_phred_func decode_phred;
+    //! See 'encode_phred_func'
+    encode_phred_func encode_phred;
+    //! See 'clean_sequence_func'
+    clean_sequence_func clean_sequence;
+    //! See 'reverse_complement_func'
+    reverse_complement_func reverse_complement;
+    //! See 'low_quality_prefix_func'
+    low_quality_prefix_func low_quality_prefix;
+    //! See 'low_quality_suffix_func'
+    low_quality_suffix_func low_quality_suffix;
+};
+
+
+/** Returns the FASTQ kernels for a given instruction set. */
+fastq_kernels select_fastq_kernels(simd::instruction_set is);
+
+//! Fastest FASTQ kernels supported by the current CPU
+extern const fastq_kernels g_fastq_kernels;
+
+
+#if defined(AR_SIMD_X86)
+size_t decode_phred_sse2(char* data, size_t length, char offset, char max_ascii);
+size_t encode_phred_sse2(char* data, size_t length, char offset, char max_ascii);
+size_t clean_sequence_sse2(char* data, size_t length);
+size_t reverse_complement_sse2(char* sequence, char* qualities, size_t length);
+size_t low_quality_prefix_sse2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns);
+size_t low_quality_suffix_sse2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns);
+
+size_t decode_phred_avx2(char* data, size_t length, char offset, char max_ascii);
+size_t encode_phred_avx2(char* data, size_t length, char offset, char max_ascii);
+size_t clean_sequence_avx2(char* data, size_t length);
+size_t reverse_complement_avx2(char* sequence, char* qualities, size_t length);
+size_t low_quality_prefix_avx2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns);
+size_t low_quality_suffix_avx2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns);
+#endif
+
+} // namespace ar
+
+#endif
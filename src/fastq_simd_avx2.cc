@@ -0,0 +1,221 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "fastq_scores.h"
+#include "fastq_simd.h"
+
+// Compiled with -mavx2; only called if supported by the CPU
+#if defined(AR_SIMD_X86)
+#include <immintrin.h>
+
+namespace ar
+{
+
+size_t decode_phred_avx2(char* data, size_t length, char offset, char max_ascii)
+{
+    // Signed comparisons; values >= 128 are negative and therefore invalid
+    const __m256i lower = _mm256_set1_epi8(offset - 1);
+    const __m256i upper = _mm256_set1_epi8(max_ascii + 1);
+    const __m256i shift = _mm256_set1_epi8(offset - PHRED_OFFSET_33);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* ptr = reinterpret_cast<__m256i*>(data + i);
+        const __m256i raw = _mm256_loadu_si256(ptr);
+        const __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi8(raw, lower),
+                                               _mm256_cmpgt_epi8(upper, raw));
+
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+
+        _mm256_storeu_si256(ptr, _mm256_sub_epi8(raw, shift));
+    }
+
+    // The remaining bytes may still fill a 16 byte block
+    return i + decode_phred_sse2(data + i, length - i, offset, max_ascii);
+}
+
+
+size_t encode_phred_avx2(char* data, size_t length, char offset, char max_ascii)
+{
+    // Unsigned min, since encoded values may exceed 127 before truncation
+    const __m256i upper = _mm256_set1_epi8(max_ascii);
+    const __m256i shift = _mm256_set1_epi8(offset - PHRED_OFFSET_33);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* ptr = reinterpret_cast<__m256i*>(data + i);
+        const __m256i raw = _mm256_loadu_si256(ptr);
+
+        _mm256_storeu_si256(ptr, _mm256_min_epu8(_mm256_add_epi8(raw, shift), upper));
+    }
+
+    return i + encode_phred_sse2(data + i, length - i, offset, max_ascii);
+}
+
+
+size_t clean_sequence_avx2(char* data, size_t length)
+{
+    const __m256i lower_a = _mm256_set1_epi8('a' - 1);
+    const __m256i lower_z = _mm256_set1_epi8('z' + 1);
+    const __m256i case_bit = _mm256_set1_epi8('a' - 'A');
+    const __m256i dot = _mm256_set1_epi8('.');
+    const __m256i nt_a = _mm256_set1_epi8('A');
+    const __m256i nt_c = _mm256_set1_epi8('C');
+    const __m256i nt_g = _mm256_set1_epi8('G');
+    const __m256i nt_t = _mm256_set1_epi8('T');
+    const __m256i nt_n = _mm256_set1_epi8('N');
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* ptr = reinterpret_cast<__m256i*>(data + i);
+        __m256i raw = _mm256_loadu_si256(ptr);
+
+        // Uppercase letters; lowercase letters other than acgtn remain invalid
+        const __m256i is_lower = _mm256_and_si256(_mm256_cmpgt_epi8(raw, lower_a),
+                                                  _mm256_cmpgt_epi8(lower_z, raw));
+        raw = _mm256_sub_epi8(raw, _mm256_and_si256(is_lower, case_bit));
+        raw = _mm256_blendv_epi8(raw, nt_n, _mm256_cmpeq_epi8(raw, dot));
+
+        const __m256i valid = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(raw, nt_a), _mm256_cmpeq_epi8(raw, nt_c)),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(raw, nt_g),
+                                            _mm256_cmpeq_epi8(raw, nt_t)),
+                            _mm256_cmpeq_epi8(raw, nt_n)));
+
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+
+        _mm256_storeu_si256(ptr, raw);
+    }
+
+    return i + clean_sequence_sse2(data + i, length - i);
+}
+
+
+
+/** Reverses the order of the 32 bytes in a register. */
+inline __m256i reverse_avx2(__m256i value)
+{
+    const __m256i reverse_lanes = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                                   7, 6, 5, 4, 3, 2, 1, 0,
+                                                   15, 14, 13, 12, 11, 10, 9, 8,
+                                                   7, 6, 5, 4, 3, 2, 1, 0);
+
+    // Bytes are reversed within each 128 bit lane, after which lanes are swapped
+    value = _mm256_shuffle_epi8(value, reverse_lanes);
+
+    return _mm256_permute2x128_si256(value, value, 1);
+}
+
+
+size_t reverse_complement_avx2(char* sequence, char* qualities, size_t length)
+{
+    // Complements are looked up using the last 4 bits of each nucleotide, as
+    // in the portable implementation (see NT_COMPLEMENTS in fastq.cc)
+    const __m256i complements = _mm256_setr_epi8('-', 'T', '-', 'G', 'A', '-', '-', 'C',
+                                                 '-', '-', '-', '-', '-', '-', 'N', '-',
+                                                 '-', 'T', '-', 'G', 'A', '-', '-', 'C',
+                                                 '-', '-', '-', '-', '-', '-', 'N', '-');
+    const __m256i low_bits = _mm256_set1_epi8(0xf);
+
+    size_t i = 0;
+    for (; 2 * (i + 32) <= length; i += 32) {
+        __m256i* seq_head = reinterpret_cast<__m256i*>(sequence + i);
+        __m256i* seq_tail = reinterpret_cast<__m256i*>(sequence + length - i - 32);
+        __m256i* qual_head = reinterpret_cast<__m256i*>(qualities + i);
+        __m256i* qual_tail = reinterpret_cast<__m256i*>(qualities + length - i - 32);
+
+        const __m256i seq_1 = _mm256_loadu_si256(seq_head);
+        const __m256i seq_2 = _mm256_loadu_si256(seq_tail);
+        const __m256i qual_1 = _mm256_loadu_si256(qual_head);
+        const __m256i qual_2 = _mm256_loadu_si256(qual_tail);
+
+        const __m256i comp_1 = _mm256_shuffle_epi8(complements, _mm256_and_si256(seq_1, low_bits));
+        const __m256i comp_2 = _mm256_shuffle_epi8(complements, _mm256_and_si256(seq_2, low_bits));
+
+        _mm256_storeu_si256(seq_head, reverse_avx2(comp_2));
+        _mm256_storeu_si256(seq_tail, reverse_avx2(comp_1));
+        _mm256_storeu_si256(qual_head, reverse_avx2(qual_2));
+        _mm256_storeu_si256(qual_tail, reverse_avx2(qual_1));
+    }
+
+    // The remaining bytes may still fill a pair of 16 byte blocks
+    return i + reverse_complement_sse2(sequence + i, qualities + i, length - 2 * i);
+}
+
+
+/** Returns true if the 32 bases contain a base that is not low quality. */
+inline bool has_good_base_avx2(const char* sequence, const char* qualities,
+                               __m256i threshold, __m256i nt_n)
+{
+    const __m256i seq = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sequence));
+    const __m256i qual = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qualities));
+    const __m256i good = _mm256_andnot_si256(_mm256_cmpeq_epi8(seq, nt_n),
+                                             _mm256_cmpgt_epi8(qual, threshold));
+
+    return _mm256_movemask_epi8(good);
+}
+
+
+size_t low_quality_prefix_avx2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns)
+{
+    const __m256i limit = _mm256_set1_epi8(threshold);
+    const __m256i nt_n = _mm256_set1_epi8(trim_ns ? 'N' : '\0');
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        if (has_good_base_avx2(sequence + i, qualities + i, limit, nt_n)) {
+            break;
+        }
+    }
+
+    return i + low_quality_prefix_sse2(sequence + i, qualities + i, length - i,
+                                       threshold, trim_ns);
+}
+
+
+size_t low_quality_suffix_avx2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns)
+{
+    const __m256i limit = _mm256_set1_epi8(threshold);
+    const __m256i nt_n = _mm256_set1_epi8(trim_ns ? 'N' : '\0');
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const size_t offset = length - i - 32;
+        if (has_good_base_avx2(sequence + offset, qualities + offset, limit, nt_n)) {
+            break;
+        }
+    }
+
+    return i + low_quality_suffix_sse2(sequence, qualities, length - i,
+                                       threshold, trim_ns);
+}
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,225 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include "fastq_scores.h"
+#include "fastq_simd.h"
+
+#if defined(AR_SIMD_X86)
+#include <emmintrin.h>
+
+namespace ar
+{
+
+size_t decode_phred_sse2(char* data, size_t length, char offset, char max_ascii)
+{
+    // Signed comparisons; values >= 128 are negative and therefore invalid
+    const __m128i lower = _mm_set1_epi8(offset - 1);
+    const __m128i upper = _mm_set1_epi8(max_ascii + 1);
+    const __m128i shift = _mm_set1_epi8(offset - PHRED_OFFSET_33);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(data + i);
+        const __m128i raw = _mm_loadu_si128(ptr);
+        const __m128i valid = _mm_and_si128(_mm_cmpgt_epi8(raw, lower),
+                                            _mm_cmplt_epi8(raw, upper));
+
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            break;
+        }
+
+        _mm_storeu_si128(ptr, _mm_sub_epi8(raw, shift));
+    }
+
+    return i;
+}
+
+
+size_t encode_phred_sse2(char* data, size_t length, char offset, char max_ascii)
+{
+    // Unsigned min, since encoded values may exceed 127 before truncation
+    const __m128i upper = _mm_set1_epi8(max_ascii);
+    const __m128i shift = _mm_set1_epi8(offset - PHRED_OFFSET_33);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(data + i);
+        const __m128i raw = _mm_loadu_si128(ptr);
+
+        _mm_storeu_si128(ptr, _mm_min_epu8(_mm_add_epi8(raw, shift), upper));
+    }
+
+    return i;
+}
+
+
+size_t clean_sequence_sse2(char* data, size_t length)
+{
+    const __m128i lower_a = _mm_set1_epi8('a' - 1);
+    const __m128i lower_z = _mm_set1_epi8('z' + 1);
+    const __m128i case_bit = _mm_set1_epi8('a' - 'A');
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i nt_a = _mm_set1_epi8('A');
+    const __m128i nt_c = _mm_set1_epi8('C');
+    const __m128i nt_g = _mm_set1_epi8('G');
+    const __m128i nt_t = _mm_set1_epi8('T');
+    const __m128i nt_n = _mm_set1_epi8('N');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* ptr = reinterpret_cast<__m128i*>(data + i);
+        __m128i raw = _mm_loadu_si128(ptr);
+
+        // Uppercase letters; lowercase letters other than acgtn remain invalid
+        const __m128i is_lower = _mm_and_si128(_mm_cmpgt_epi8(raw, lower_a),
+                                               _mm_cmplt_epi8(raw, lower_z));
+        raw = _mm_sub_epi8(raw, _mm_and_si128(is_lower, case_bit));
+
+        const __m128i is_dot = _mm_cmpeq_epi8(raw, dot);
+        raw = _mm_or_si128(_mm_andnot_si128(is_dot, raw),
+                           _mm_and_si128(is_dot, nt_n));
+
+        const __m128i valid = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(raw, nt_a), _mm_cmpeq_epi8(raw, nt_c)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(raw, nt_g),
+                                      _mm_cmpeq_epi8(raw, nt_t)),
+                         _mm_cmpeq_epi8(raw, nt_n)));
+
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            break;
+        }
+
+        _mm_storeu_si128(ptr, raw);
+    }
+
+    return i;
+}
+
+
+
+/** Reverses the order of the 16 bytes in a register. */
+inline __m128i reverse_sse2(__m128i value)
+{
+    value = _mm_shuffle_epi32(value, _MM_SHUFFLE(0, 1, 2, 3));
+    value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+    value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+
+    return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+}
+
+
+size_t reverse_complement_sse2(char* sequence, char* qualities, size_t length)
+{
+    // SSE2 has no byte shuffle, so bases are complemented by flipping the
+    // bits that differ between A/T (0x41 / 0x54) and C/G (0x43 / 0x47)
+    const __m128i nt_a = _mm_set1_epi8('A');
+    const __m128i nt_c = _mm_set1_epi8('C');
+    const __m128i nt_g = _mm_set1_epi8('G');
+    const __m128i nt_t = _mm_set1_epi8('T');
+    const __m128i flip_at = _mm_set1_epi8('A' ^ 'T');
+    const __m128i flip_cg = _mm_set1_epi8('C' ^ 'G');
+
+    size_t i = 0;
+    for (; 2 * (i + 16) <= length; i += 16) {
+        __m128i* seq_head = reinterpret_cast<__m128i*>(sequence + i);
+        __m128i* seq_tail = reinterpret_cast<__m128i*>(sequence + length - i - 16);
+        __m128i* qual_head = reinterpret_cast<__m128i*>(qualities + i);
+        __m128i* qual_tail = reinterpret_cast<__m128i*>(qualities + length - i - 16);
+
+        __m128i seqs[2] = { _mm_loadu_si128(seq_head), _mm_loadu_si128(seq_tail) };
+        for (size_t j = 0; j < 2; ++j) {
+            const __m128i raw = seqs[j];
+            const __m128i is_at = _mm_or_si128(_mm_cmpeq_epi8(raw, nt_a),
+                                               _mm_cmpeq_epi8(raw, nt_t));
+            const __m128i is_cg = _mm_or_si128(_mm_cmpeq_epi8(raw, nt_c),
+                                               _mm_cmpeq_epi8(raw, nt_g));
+            const __m128i flip = _mm_or_si128(_mm_and_si128(is_at, flip_at),
+                                              _mm_and_si128(is_cg, flip_cg));
+
+            seqs[j] = reverse_sse2(_mm_xor_si128(raw, flip));
+        }
+
+        const __m128i qual_1 = _mm_loadu_si128(qual_head);
+        const __m128i qual_2 = _mm_loadu_si128(qual_tail);
+
+        _mm_storeu_si128(seq_head, seqs[1]);
+        _mm_storeu_si128(seq_tail, seqs[0]);
+        _mm_storeu_si128(qual_head, reverse_sse2(qual_2));
+        _mm_storeu_si128(qual_tail, reverse_sse2(qual_1));
+    }
+
+    return i;
+}
+
+
+/** Returns true if the 16 bases contain a base that is not low quality. */
+inline bool has_good_base_sse2(const char* sequence, const char* qualities,
+                               __m128i threshold, __m128i nt_n)
+{
+    const __m128i seq = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sequence));
+    const __m128i qual = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qualities));
+    const __m128i good = _mm_andnot_si128(_mm_cmpeq_epi8(seq, nt_n),
+                                          _mm_cmpgt_epi8(qual, threshold));
+
+    return _mm_movemask_epi8(good);
+}
+
+
+size_t low_quality_prefix_sse2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns)
+{
+    // Sequences never contain NUL bytes, so no bases match if !trim_ns
+    const __m128i limit = _mm_set1_epi8(threshold);
+    const __m128i nt_n = _mm_set1_epi8(trim_ns ? 'N' : '\0');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        if (has_good_base_sse2(sequence + i, qualities + i, limit, nt_n)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+
+size_t low_quality_suffix_sse2(const char* sequence, const char* qualities,
+                               size_t length, char threshold, bool trim_ns)
+{
+    const __m128i limit = _mm_set1_epi8(threshold);
+    const __m128i nt_n = _mm_set1_epi8(trim_ns ? 'N' : '\0');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const size_t offset = length - i - 16;
+        if (has_good_base_sse2(sequence + offset, qualities + offset, limit, nt_n)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+} // namespace ar
+
+#endif
@@ -21,6 +21,7 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
@@ -28,7 +29,13 @@
 #include <iostream>
 #include <sstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "linereader.h"
+#include "metrics.h"
 #include "threads.h"
 
 namespace ar
@@ -91,16 +98,213 @@ bzip2_error::bzip2_error(const std::string& message)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'buffer_reader'
+
+buffer_reader::buffer_reader(const char* begin, const char* end)
+  : line_reader_base()
+  , m_ptr(begin)
+  , m_end(end)
+{
+}
+
+
+bool buffer_reader::getline(std::string& dst)
+{
+    line_view line;
+    if (next_line(line)) {
+        dst.assign(line.data, line.length);
+        return true;
+    }
+
+    dst.clear();
+    return false;
+}
+
+
+bool buffer_reader::next_line(line_view& dst)
+{
+    if (m_ptr == m_end) {
+        return false;
+    }
+
+    const char* end = static_cast<const char*>(std::memchr(m_ptr, '\n', m_end - m_ptr));
+
+    dst.data = m_ptr;
+    if (end) {
+        // Excluding terminal \n
+        dst.length = end - m_ptr;
+        m_ptr = end + 1;
+    } else {
+        dst.length = m_end - m_ptr;
+        m_ptr = m_end;
+    }
+
+    return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Pipes and STDIN
+
+void enlarge_pipe_buffer(int fd)
+{
+#ifdef F_SETPIPE_SZ
+    struct stat info;
+    if (!fstat(fd, &info) && S_ISFIFO(info.st_mode)) {
+        // Limited to /proc/sys/fs/pipe-max-size for unprivileged users
+        fcntl(fd, F_SETPIPE_SZ, static_cast<int>(PIPE_BUFFER_SIZE));
+    }
+#else
+    (void)fd;
+#endif
+}
+
+
+/** Opens a file for reading; "-" denotes STDIN. */
+FILE* open_input_file(const std::string& fpath)
+{
+    FILE* file = (fpath == "-") ? stdin : fopen(fpath.c_str(), "rb");
+    if (file) {
+        enlarge_pipe_buffer(fileno(file));
+    }
+
+    return file;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'mapped_file'
+
+mapped_file::mapped_file(const std::string& fpath, metrics_counter* bytes_read,
+                         const file_range& range)
+  : m_data(NULL)
+  , m_size(0)
+  , m_offset(0)
+  , m_end(0)
+  , m_bytes_read(bytes_read)
+{
+    const int fd = open(fpath.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw io_error("mapped_file::open: failed to open file", errno);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info)) {
+        const int error_number = errno;
+        ::close(fd);
+
+        throw io_error("mapped_file::open: failed to stat file", error_number);
+    } else if (!S_ISREG(info.st_mode)) {
+        ::close(fd);
+
+        throw io_error("mapped_file::open: only regular files can be mapped");
+    }
+
+    m_size = info.st_size;
+    m_end = std::min(range.end, m_size);
+    m_offset = std::min(range.begin, m_end);
+    if (m_size) {
+        void* data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            const int error_number = errno;
+            ::close(fd);
+
+            throw io_error("mapped_file::open: failed to map file", error_number);
+        }
+
+        m_data = static_cast<char*>(data);
+        // Failure only means that the kernel does not read ahead as eagerly
+        madvise(m_data, m_size, MADV_SEQUENTIAL);
+    }
+
+    // The mapping remains valid after the file has been closed
+    if (::close(fd)) {
+        throw io_error("mapped_file::open: error closing file", errno);
+    }
+}
+
+
+mapped_file::~mapped_file()
+{
+    if (m_data) {
+        munmap(m_data, m_size);
+    }
+}
+
+
+bool mapped_file::is_compressed() const
+{
+    if (m_size >= 2 && m_data[0] == '\x1f' && m_data[1] == '\x8b') {
+        return true;
+    }
+
+    return m_size >= 3 && !std::memcmp(m_data, "BZh", 3);
+}
+
+
+bool mapped_file::can_map(const std::string& fpath)
+{
+    struct stat info;
+
+    return fpath != "-" && !stat(fpath.c_str(), &info) && S_ISREG(info.st_mode);
+}
+
+
+size_t mapped_file::next_lines(size_t nlines, line_view& dst)
+{
+    const char* start = m_data + m_offset;
+    const char* end = m_data + m_end;
+    const char* ptr = start;
+
+    size_t nread = 0;
+    for (; nread < nlines && ptr != end; ++nread) {
+        ptr = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr));
+        // The last line may not be terminated by a newline
+        ptr = ptr ? ptr + 1 : end;
+    }
+
+    dst.data = start;
+    dst.length = ptr - start;
+    m_offset += dst.length;
+    if (m_bytes_read) {
+        m_bytes_read->increment(dst.length);
+    }
+
+    return nread;
+}
+
+
+const char* mapped_file::data() const
+{
+    return m_data;
+}
+
+
+size_t mapped_file::size() const
+{
+    return m_size;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'line_reader'
 
-line_reader::line_reader(const std::string& fpath)
-  : m_file(fopen(fpath.c_str(), "rb"))
+line_reader::line_reader(const std::string& fpath, size_t inflate_threads,
+                         metrics_counter* bytes_read, const file_range& range)
+  : m_file(open_input_file(fpath))
 #ifdef AR_GZIP_SUPPORT
   , m_gzip_stream(NULL)
 #endif
+#ifdef AR_BGZF_SUPPORT
+  , m_bgzf_inflater(NULL)
+#endif
+  , m_inflate_threads(inflate_threads)
 #ifdef AR_BZIP2_SUPPORT
   , m_bzip2_stream(NULL)
+#endif
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+  , m_bzip2_inflater(NULL)
 #endif
   , m_buffer(NULL)
   , m_buffer_ptr(NULL)
@@ -108,9 +312,17 @@ line_reader::line_reader(const std::string& fpath)
   , m_raw_buffer(new char[BUF_SIZE])
   , m_raw_buffer_end(m_raw_buffer + BUF_SIZE)
   , m_eof(false)
+  , m_bytes_read(bytes_read)
+  , m_remaining(range.end - std::min(range.begin, range.end))
 {
     if (!m_file) {
         throw io_error("line_reader::open: failed to open file", errno);
+    } else if (range.begin && fseeko(m_file, static_cast<off_t>(range.begin), SEEK_SET)) {
+        const int error_number = errno;
+        fclose(m_file);
+        m_file = NULL;
+
+        throw io_error("line_reader::open: failed to seek in file", error_number);
     }
 }
 
@@ -129,27 +341,69 @@ line_reader::~line_reader()
 
 bool line_reader::getline(std::string& dst)
 {
+    line_view line;
+    if (next_line(line)) {
+        dst.assign(line.data, line.length);
+        return true;
+    }
+
     dst.clear();
+    return false;
+}
 
-    while (m_file && !m_eof) {
-        char* start = m_buffer_ptr;
-        char* end = m_buffer_ptr;
 
-        for (; end != m_buffer_end; ++end) {
-            if (*end == '\n') {
-                // Excluding terminal \n
-                dst.append(start, end - start);
+bool line_reader::next_line(line_view& dst)
+{
+    m_line.clear();
 
-                m_buffer_ptr = end + 1;
-                return true;
+    while (m_file && !m_eof) {
+        char* start = m_buffer_ptr;
+        const size_t available = m_buffer_end - m_buffer_ptr;
+        char* end = available ? static_cast<char*>(std::memchr(start, '\n', available)) : NULL;
+
+        if (end) {
+            // Excluding terminal \n
+            if (m_line.empty()) {
+                dst.data = start;
+                dst.length = end - start;
+            } else {
+                m_line.append(start, end - start);
+                dst.data = m_line.data();
+                dst.length = m_line.length();
             }
+
+            m_buffer_ptr = end + 1;
+            return true;
         }
 
-        dst.append(start, end - start);
+        // Line spans buffers; the current buffer is overwritten when refilled
+        m_line.append(start, available);
         refill_buffers();
     }
 
-    return !dst.empty();
+    dst.data = m_line.data();
+    dst.length = m_line.length();
+
+    return !m_line.empty();
+}
+
+
+size_t line_reader::read(char* dst, size_t length)
+{
+    size_t nread = 0;
+    while (nread < length && m_file && !m_eof) {
+        const size_t available = m_buffer_end - m_buffer_ptr;
+        if (available) {
+            const size_t count = std::min(available, length - nread);
+            std::memcpy(dst + nread, m_buffer_ptr, count);
+            m_buffer_ptr += count;
+            nread += count;
+        } else {
+            refill_buffers();
+        }
+    }
+
+    return nread;
 }
 
 
@@ -183,6 +437,18 @@ bool line_reader::is_open() const
 
 void line_reader::refill_buffers()
 {
+#ifdef AR_BGZF_SUPPORT
+    if (m_bgzf_inflater) {
+        refill_buffers_bgzf();
+    } else
+#endif
+
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+    if (m_bzip2_inflater) {
+        refill_buffers_bzip2();
+    } else
+#endif
+
     if (m_buffer) {
 #ifdef AR_GZIP_SUPPORT
         if (m_gzip_stream) {
@@ -203,7 +469,9 @@ void line_reader::refill_buffers()
     } else {
         refill_raw_buffer();
 
-        if (identify_gzip()) {
+        if (initialize_buffers_bgzf()) {
+            refill_buffers_bgzf();
+        } else if (identify_gzip()) {
             initialize_buffers_gzip();
         } else if (identify_bzip2()) {
             initialize_buffers_bzip2();
@@ -211,6 +479,10 @@ void line_reader::refill_buffers()
             refill_buffers_uncompressed();
         }
     }
+
+    if (m_bytes_read) {
+        m_bytes_read->increment(m_buffer_end - m_buffer_ptr);
+    }
 }
 
 
@@ -224,9 +496,12 @@ void line_reader::refill_buffers_uncompressed()
 
 void line_reader::refill_raw_buffer()
 {
-    const int nread = fread(m_raw_buffer, 1, BUF_SIZE, m_file);
+    // Reads are limited to the selected range of the file, if any
+    const size_t nwanted = std::min<size_t>(BUF_SIZE, m_remaining);
+    const size_t nread = nwanted ? fread(m_raw_buffer, 1, nwanted, m_file) : 0;
+    m_remaining -= nread;
 
-    if (nread == BUF_SIZE) {
+    if (nread == static_cast<size_t>(BUF_SIZE)) {
         m_raw_buffer_end = m_raw_buffer + BUF_SIZE;
     } else if (ferror(m_file)) {
         throw io_error("line_reader::refill_buffer: error reading file", errno);
@@ -332,6 +607,37 @@ void line_reader::refill_buffers_gzip()
 }
 
 
+bool line_reader::initialize_buffers_bgzf()
+{
+#ifdef AR_BGZF_SUPPORT
+    if (m_inflate_threads > 1 && is_bgzf_header(m_raw_buffer, m_raw_buffer_end - m_raw_buffer)) {
+        m_bgzf_inflater = new bgzf_inflater(m_file, m_raw_buffer,
+                                            m_raw_buffer_end - m_raw_buffer,
+                                            m_inflate_threads);
+
+        return true;
+    }
+#endif
+
+    // BGZF files are otherwise read as regular, multi-member gzip files
+    return false;
+}
+
+
+void line_reader::refill_buffers_bgzf()
+{
+#ifdef AR_BGZF_SUPPORT
+    if (m_bgzf_inflater->read(m_buffer, m_buffer_end)) {
+        m_buffer_ptr = m_buffer;
+    } else {
+        // EOF set only once all blocks have been consumed
+        m_eof = true;
+        m_buffer_ptr = m_buffer_end;
+    }
+#endif
+}
+
+
 void line_reader::close_buffers_gzip()
 {
 #ifdef AR_GZIP_SUPPORT
@@ -356,6 +662,15 @@ void line_reader::close_buffers_gzip()
         m_buffer = NULL;
     }
 #endif
+
+#ifdef AR_BGZF_SUPPORT
+    if (m_bgzf_inflater) {
+        // Buffers are owned by the inflater
+        delete m_bgzf_inflater;
+        m_bgzf_inflater = NULL;
+        m_buffer = NULL;
+    }
+#endif
 }
 
 
@@ -430,6 +745,18 @@ bool line_reader::identify_bzip2() const
 void line_reader::initialize_buffers_bzip2()
 {
 #ifdef AR_BZIP2_SUPPORT
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+    if (m_inflate_threads > 1 && is_multistream_bzip2(m_file, m_raw_buffer,
+                                                      m_raw_buffer_end - m_raw_buffer)) {
+        m_bzip2_inflater = new bzip2_inflater(m_file, m_raw_buffer,
+                                              m_raw_buffer_end - m_raw_buffer,
+                                              m_inflate_threads);
+        refill_buffers_bzip2();
+
+        return;
+    }
+#endif
+
     m_buffer = new char[BUF_SIZE];
     m_buffer_ptr = m_buffer + BUF_SIZE;
     m_buffer_end = m_buffer + BUF_SIZE;
@@ -454,6 +781,20 @@ void line_reader::initialize_buffers_bzip2()
 void line_reader::refill_buffers_bzip2()
 {
 #ifdef AR_BZIP2_SUPPORT
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+    if (m_bzip2_inflater) {
+        if (m_bzip2_inflater->read(m_buffer, m_buffer_end)) {
+            m_buffer_ptr = m_buffer;
+        } else {
+            // EOF set only once all streams have been consumed
+            m_eof = true;
+            m_buffer_ptr = m_buffer_end;
+        }
+
+        return;
+    }
+#endif
+
     if (!m_bzip2_stream->avail_in) {
         refill_raw_buffer();
         m_bzip2_stream->avail_in = m_raw_buffer_end - m_raw_buffer;
@@ -505,6 +846,15 @@ void line_reader::refill_buffers_bzip2()
 void line_reader::close_buffers_bzip2()
 {
 #ifdef AR_BZIP2_SUPPORT
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+    if (m_bzip2_inflater) {
+        // Buffers are owned by the inflater
+        delete m_bzip2_inflater;
+        m_bzip2_inflater = NULL;
+        m_buffer = NULL;
+    }
+#endif
+
     if (m_bzip2_stream) {
         bzip2_close_stream(m_bzip2_stream);
 
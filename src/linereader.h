@@ -24,8 +24,10 @@
 #ifndef GZFILE_H
 #define GZFILE_H
 
-#include <string>
 #include <cstdio>
+#include <ios>
+#include <limits>
+#include <string>
 
 #ifdef AR_GZIP_SUPPORT
 #include <zlib.h>
@@ -35,9 +37,15 @@
 #include <bzlib.h>
 #endif
 
+#include "bgzf.h"
+#include "bzip2.h"
+
 namespace ar
 {
 
+class metrics_counter;
+
+
 /** Represents errors during basic IO. */
 class io_error : public std::ios_base::failure
 {
@@ -62,6 +70,50 @@ public:
 };
 
 
+//! Size requested for the buffers of pipes used for input or output
+const size_t PIPE_BUFFER_SIZE = 1024 * 1024;
+
+/**
+ * Enlarges the buffer of 'fd' to PIPE_BUFFER_SIZE, if 'fd' is a pipe / FIFO
+ * and if supported by the OS (Linux); fewer and larger reads and writes are
+ * then needed when streaming reads to or from other programs. Failure only
+ * means that the default buffer size is kept, and is therefore ignored.
+ */
+void enlarge_pipe_buffer(int fd);
+
+
+/**
+ * Non-owning view of a line (excluding the terminal '\n'); the view is only
+ * valid until the next line is read from the reader which produced it. Also
+ * used to represent blocks of lines in memory mapped files.
+ */
+struct line_view
+{
+    /** Creates an empty view. */
+    line_view();
+
+    //! Pointer to the first character in the line.
+    const char* data;
+    //! Number of characters in the line.
+    size_t length;
+};
+
+
+/** Range of bytes [begin, end) read from a file; the whole file by default. */
+struct file_range
+{
+    /** Creates a range covering the entire file. */
+    file_range();
+    /** Creates a range covering bytes [begin, end), clamped to the file. */
+    file_range(size_t begin, size_t end);
+
+    //! Offset of the first byte in the range.
+    size_t begin;
+    //! Offset past the last byte in the range.
+    size_t end;
+};
+
+
 /** Base-class for line reading; used by recievers. */
 class line_reader_base
 {
@@ -74,6 +126,16 @@ public:
 
     /** Reads a lien into dst, returning false on EOF. */
     virtual bool getline(std::string& dst) = 0;
+
+    /**
+     * Reads a line and points dst at it, returning false on EOF; the default
+     * implementation uses 'getline' and an internal buffer.
+     */
+    virtual bool next_line(line_view& dst);
+
+protected:
+    //! Buffer for lines that cannot be viewed in place.
+    std::string m_line;
 };
 
 
@@ -83,14 +145,28 @@ public:
  * Currently reads
  *  - uncompressed files
  *  - gzip compressed files
+ *  - BGZF compressed files, using multiple threads if requested
+ *  - bzip2 compressed files, using multiple threads for multi-stream files
+ *    if requested
  *
  * Errors are reported using either 'io_error' or 'gzip_error'.
  */
 class line_reader : public line_reader_base
 {
 public:
-    /** Constructor; opens file and throws on errors. */
-    line_reader(const std::string& fpath);
+    /**
+     * Constructor; opens file and throws on errors. BGZF compressed files
+     * and multi-stream bzip2 files are decompressed using 'inflate_threads'
+     * threads, if more than one.
+     * The filename "-" denotes STDIN. If set, 'bytes_read' is incremented
+     * by the number of (decompressed) bytes read from the file.
+     *
+     * If a 'range' is specified, only those bytes are read; this requires
+     * that the file is seekable and uncompressed.
+     */
+    line_reader(const std::string& fpath, size_t inflate_threads = 1,
+                metrics_counter* bytes_read = NULL,
+                const file_range& range = file_range());
 
     /** Closes the file, if still open. */
     ~line_reader();
@@ -98,6 +174,18 @@ public:
     /** Reads a lien into dst, returning false on EOF. */
     bool getline(std::string& dst);
 
+    /**
+     * Reads a line, returning false on EOF; lines are viewed in place in the
+     * decompressed buffers, unless they span more than one buffer.
+     */
+    bool next_line(line_view& dst);
+
+    /**
+     * Reads up to 'length' (decompressed) bytes into 'dst', returning the
+     * number of bytes read; fewer than 'length' bytes are read only at EOF.
+     */
+    size_t read(char* dst, size_t length);
+
     /** Closes the file, if still open. */
     void close();
 
@@ -138,12 +226,29 @@ private:
     /** Closes gzip buffers and frees assosiated memory. */
     void close_buffers_gzip();
 
+#ifdef AR_BGZF_SUPPORT
+    //! Parallel BGZF decompressor; used if input is detected to be BGZF.
+    bgzf_inflater* m_bgzf_inflater;
+#endif
+    //! Number of threads used to decompress BGZF / multi-stream bzip2 files.
+    size_t m_inflate_threads;
+
+    /** Initializes BGZF decompression if the raw buffer contains BGZF data. */
+    bool initialize_buffers_bgzf();
+    /** Points 'm_buffer' and related pointers to the next BGZF block. */
+    void refill_buffers_bgzf();
+
 
 #ifdef AR_BZIP2_SUPPORT
     //! GZip stream pointer; used if input it detected to be gzip compressed.
     bz_stream* m_bzip2_stream;
 #endif
 
+#ifdef AR_PARALLEL_BZIP2_SUPPORT
+    //! Parallel bzip2 decompressor; used for seekable multi-stream files.
+    bzip2_inflater* m_bzip2_inflater;
+#endif
+
     /** Returns true if the raw buffer contains bzip2'd data. */
     bool identify_bzip2() const;
     /** Initializes bzip2 stream and output buffers. */
@@ -168,12 +273,127 @@ private:
 
     //! Indicates if a read across the EOF has been attempted.
     bool m_eof;
+    //! Counter of (decompressed) bytes read; may be NULL.
+    metrics_counter* m_bytes_read;
+    //! Number of raw bytes remaining in the range being read.
+    size_t m_remaining;
+};
+
+
+/**
+ * Line reader for a block of memory, e.g. part of a memory mapped file. Lines
+ * are viewed in place, and the memory is not owned by the reader.
+ */
+class buffer_reader : public line_reader_base
+{
+public:
+    /** Constructor; reads lines in the range [begin, end). */
+    buffer_reader(const char* begin, const char* end);
+
+    /** Reads a lien into dst, returning false on EOF. */
+    bool getline(std::string& dst);
+
+    /** Points dst at the next line in the buffer, returning false on EOF. */
+    bool next_line(line_view& dst);
+
+private:
+    //! Not implemented
+    buffer_reader(const buffer_reader&);
+    //! Not implemented
+    buffer_reader& operator=(const buffer_reader&);
+
+    //! Pointer to the start of the next line.
+    const char* m_ptr;
+    //! Pointer to the end of the buffer.
+    const char* m_end;
+};
+
+
+/**
+ * Read-only memory mapping of an (uncompressed) file, which is returned as
+ * blocks of whole lines. Blocks remain valid until the object is destroyed,
+ * and may therefore be parsed concurrently by multiple threads.
+ *
+ * Errors are reported using 'io_error'.
+ */
+class mapped_file
+{
+public:
+    /**
+     * Constructor; opens and maps the file and throws on errors. If set,
+     * 'bytes_read' is incremented by the size of blocks returned. Only lines
+     * in 'range' are returned by 'next_lines'.
+     */
+    mapped_file(const std::string& fpath, metrics_counter* bytes_read = NULL,
+                const file_range& range = file_range());
+
+    /** Unmaps the file. */
+    ~mapped_file();
+
+    /** Returns true if the file appears to be gzip or bzip2 compressed. */
+    bool is_compressed() const;
+
+    /**
+     * Returns true if the path is a regular file, and can therefore be mapped;
+     * false is returned for STDIN ("-"), pipes and other special files.
+     */
+    static bool can_map(const std::string& fpath);
+
+    /**
+     * Points 'dst' to the next block of (up to) 'nlines' lines, including
+     * the terminal '\n', and returns the number of lines in the block.
+     */
+    size_t next_lines(size_t nlines, line_view& dst);
+
+    /** Returns the start of the mapped file; NULL for empty files. */
+    const char* data() const;
+    /** Returns the size of the mapped file. */
+    size_t size() const;
+
+private:
+    //! Not implemented
+    mapped_file(const mapped_file&);
+    //! Not implemented
+    mapped_file& operator=(const mapped_file&);
+
+    //! Start of the mapped file; NULL for empty files.
+    char* m_data;
+    //! Size of the mapped file.
+    size_t m_size;
+    //! Offset of the first line not yet returned by 'next_lines'.
+    size_t m_offset;
+    //! Offset past the last line returned by 'next_lines'.
+    size_t m_end;
+    //! Counter of bytes returned by 'next_lines'; may be NULL.
+    metrics_counter* m_bytes_read;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
+inline line_view::line_view()
+  : data(NULL)
+  , length(0)
+{
+}
+
+
+inline file_range::file_range()
+  : begin(0)
+  , end(std::numeric_limits<size_t>::max())
+{
+}
+
+
+inline file_range::file_range(size_t begin_, size_t end_)
+  : begin(begin_)
+  , end(end_)
+{
+}
+
+
 inline line_reader_base::line_reader_base()
+  : m_line()
 {
 }
 
@@ -182,6 +402,19 @@ inline line_reader_base::~line_reader_base()
 {
 }
 
+
+inline bool line_reader_base::next_line(line_view& dst)
+{
+    if (!getline(m_line)) {
+        return false;
+    }
+
+    dst.data = m_line.data();
+    dst.length = m_line.length();
+
+    return true;
+}
+
 } // namespace ar
 
 #endif
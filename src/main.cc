@@ -34,6 +34,8 @@ namespace ar
 
 // See main_adapter_rm.cc
 int remove_adapter_sequences(const userconfig& config);
+// See main_adapter_rm.cc
+int merge_statistics(const userconfig& config);
 // See main_adapter_id.cc
 int identify_adapter_sequences(const userconfig& config);
 
@@ -60,6 +62,8 @@ int main(int argc, char *argv[])
 
     if (config.identify_adapters) {
         return identify_adapter_sequences(config);
+    } else if (!config.merge_stats.empty()) {
+        return merge_statistics(config);
     } else {
         return remove_adapter_sequences(config);
     }
@@ -26,6 +26,7 @@
 #include <iomanip>
 #include <iostream>
 #include <list>
+#include <map>
 #include <queue>
 #include <stdexcept>
 #include <vector>
@@ -33,6 +34,7 @@
 #include "alignment.h"
 #include "debug.h"
 #include "fastq_io.h"
+#include "metrics.h"
 #include "scheduler.h"
 #include "strutils.h"
 #include "timer.h"
@@ -46,10 +48,11 @@ namespace ar
 
 //! Length of kmers to collect to find common kmers
 const size_t KMER_LENGTH = 9;
-//! Size of vector needed for kmer counts
-const size_t N_KMERS = 2 << (2 * KMER_LENGTH);
 //! The N most common kmers to print
 const size_t TOP_N_KMERS = 5;
+//! Min. number of standard deviations by which the majority nucleotide must
+//! exceed the runner up at each position for --identify-adapters-stop
+const double CONVERGED_MIN_SIGMA = 5.0;
 
 
 /**
@@ -107,10 +110,20 @@ struct nt_counts
 
 
 typedef std::vector<nt_counts> nt_count_vec;
-typedef std::vector<unsigned> kmer_map;
+//! Sparse kmer counts; only few distinct 5' kmers are expected per adapter
+typedef std::map<size_t, unsigned> kmer_map;
 typedef std::pair<size_t, unsigned> nt_count;
 
 
+/** Merge sparse kmer counts. */
+void merge_kmers(kmer_map& dst, const kmer_map& src)
+{
+    for (kmer_map::const_iterator it = src.begin(); it != src.end(); ++it) {
+        dst[it->first] += it->second;
+    }
+}
+
+
 /** Functor for sorting kmers by frequency. */
 struct cmp_nt_count
 {
@@ -130,8 +143,8 @@ void print_most_common_kmers(const kmer_map& kmers, size_t print_n = TOP_N_KMERS
 {
     size_t total = 0;
     kmer_queue queue;
-    for (size_t i = 0; i < kmers.size(); ++i) {
-        nt_count value(i, kmers.at(i));
+    for (kmer_map::const_iterator it = kmers.begin(); it != kmers.end(); ++it) {
+        nt_count value(it->first, it->second);
         total += value.second;
 
         if (queue.size() >= print_n) {
@@ -230,6 +243,35 @@ std::pair<char, char> get_consensus_nt(const nt_counts& nts)
 }
 
 
+/**
+ * Returns true if the majority nucleotide at each of the first 'length'
+ * positions is more common than the second most common nucleotide by at least
+ * CONVERGED_MIN_SIGMA standard deviations (sign test). Unlike the quality
+ * scores printed for the consensus, this does not depend on the error rate,
+ * merely on whether additional reads could change the consensus.
+ */
+bool is_consensus_converged(const nt_count_vec& counts, size_t length)
+{
+    if (counts.size() < length) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        std::vector<size_t> nts = counts.at(i).counts;
+        std::sort(nts.begin(), nts.end());
+
+        const double best = nts.at(3);
+        const double second = nts.at(2);
+        const double diff = best - second;
+        if (diff * diff < CONVERGED_MIN_SIGMA * CONVERGED_MIN_SIGMA * (best + second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
 /**
  * Prints description of consensus adapter sequence.
  *
@@ -276,8 +318,9 @@ public:
     adapter_stats(const userconfig& config)
       : pcr1_counts()
       , pcr2_counts()
-      , pcr1_kmers(N_KMERS, 0)
-      , pcr2_kmers(N_KMERS, 0)
+      , pcr1_kmers()
+      , pcr2_kmers()
+      , pairs_seen(0)
       , stats(config.create_stats())
     {
     }
@@ -289,8 +332,9 @@ public:
 
         merge_vectors(pcr1_counts, other.pcr1_counts);
         merge_vectors(pcr2_counts, other.pcr2_counts);
-        merge_vectors(pcr1_kmers, other.pcr1_kmers);
-        merge_vectors(pcr2_kmers, other.pcr2_kmers);
+        merge_kmers(pcr1_kmers, other.pcr1_kmers);
+        merge_kmers(pcr2_kmers, other.pcr2_kmers);
+        pairs_seen += other.pairs_seen;
 
         return *this;
     }
@@ -303,6 +347,8 @@ public:
     kmer_map pcr1_kmers;
     //! 5' KMer frequencies of putative adapter 2 fragments
     kmer_map pcr2_kmers;
+    //! Number of pairs seen, used to select every Nth pair when sampling
+    size_t pairs_seen;
     //! Statistics object for (number of) processed reads
     std::auto_ptr<statistics> stats;
 
@@ -344,11 +390,23 @@ private:
 class adapter_identification : public analytical_step
 {
 public:
-    adapter_identification(const userconfig& config)
+    /**
+     * Constructor; if --identify-adapters-stop is set, 'reader' is stopped
+     * once the consensus adapter sequences have converged.
+     */
+    adapter_identification(const userconfig& config,
+                           chunk_sizer* sizer,
+                           read_paired_fastq* reader)
       : analytical_step(analytical_step::unordered)
       , m_config(config)
       , m_timer("reads")
       , m_sinks(config)
+      , m_sizer(sizer)
+      , m_reader(reader)
+      , m_lock()
+      , m_pcr1_counts()
+      , m_pcr2_counts()
+      , m_converged(false)
     {
     }
 
@@ -363,20 +421,40 @@ public:
         adapters.push_back(fastq_pair(empty_adapter, empty_adapter));
 
         std::auto_ptr<fastq_read_chunk> file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+        if (m_config.identify_adapters_stop && is_converged()) {
+            // Chunks read before the reading step was stopped are ignored
+            fastq_read_chunk::recycle(file_chunk.release());
+            return chunk_vec();
+        }
+
+        const double start_time = get_current_time();
 
-        std::auto_ptr<adapter_stats> sink(m_sinks.get_sink());
+        adapter_stats* const sink = m_sinks.get_sink();
         statistics& stats = *sink->stats;
 
+        // Nucleotide frequencies for this chunk, merged into 'sink' below
+        nt_count_vec pcr1_counts;
+        nt_count_vec pcr2_counts;
+
         AR_DEBUG_ASSERT(file_chunk->reads_1.size() == file_chunk->reads_2.size());
         fastq_vec::iterator read_1 = file_chunk->reads_1.begin();
         fastq_vec::iterator read_2 = file_chunk->reads_2.begin();
 
         while (read_1 != file_chunk->reads_1.end()) {
-            process_reads(adapters, stats, *sink, *read_1++, *read_2++);
+            process_reads(adapters, stats, *sink, pcr1_counts, pcr2_counts,
+                          *read_1++, *read_2++);
+        }
+
+        merge_vectors(sink->pcr1_counts, pcr1_counts);
+        merge_vectors(sink->pcr2_counts, pcr2_counts);
+        if (m_config.identify_adapters_stop) {
+            update_convergence(pcr1_counts, pcr2_counts);
         }
 
-        m_sinks.return_sink(sink.release());
         m_timer.increment(file_chunk->reads_1.size() * 2);
+        get_reads_counter().increment(file_chunk->reads_1.size() * 2);
+        m_sizer->add_time(file_chunk->reads_1.size(), get_current_time() - start_time);
+        fastq_read_chunk::recycle(file_chunk.release());
 
         return chunk_vec();
     }
@@ -388,6 +466,17 @@ public:
 
         std::auto_ptr<adapter_stats> sink(m_sinks.finalize());
 
+        if (m_config.identify_adapters_sample > 1) {
+            std::cout << "   Aligned every " << m_config.identify_adapters_sample
+                      << " pairs of reads ...\n";
+        }
+
+        if (m_converged) {
+            std::cout << "   Stopped after " << sink->pairs_seen << " pairs; the "
+                      << "consensus of the first " << m_config.identify_adapters_stop
+                      << " bases of both adapters had converged ...\n";
+        }
+
         std::cout << "   Found " << sink->stats->well_aligned_reads << " overlapping pairs ...\n"
                   << "   Of which " << sink->stats->number_of_reads_with_adapter.at(0) << " contained adapter sequence(s) ...\n\n"
                   << "Printing adapter sequences, including poly-A tails:"
@@ -406,12 +495,18 @@ private:
     void process_reads(const fastq_pair_vec& adapters,
                        statistics& stats,
                        adapter_stats& sink,
+                       nt_count_vec& pcr1_counts,
+                       nt_count_vec& pcr2_counts,
                        fastq& read1,
                        fastq& read2)
     {
         // Throws if read-names or mate numbering does not match
         fastq::validate_paired_reads(read1, read2);
 
+        if (sink.pairs_seen++ % m_config.identify_adapters_sample) {
+            return;
+        }
+
         // Reverse complement to match the orientation of read1
         read2.reverse_complement();
 
@@ -423,10 +518,10 @@ private:
                 if (extract_adapter_sequences(alignment, read1, read2)) {
                     stats.number_of_reads_with_adapter.at(0)++;
 
-                    process_adapter(read1.sequence(), sink.pcr1_counts, sink.pcr1_kmers);
+                    process_adapter(read1.sequence(), pcr1_counts, sink.pcr1_kmers);
 
                     read2.reverse_complement();
-                    process_adapter(read2.sequence(), sink.pcr2_counts, sink.pcr2_kmers);
+                    process_adapter(read2.sequence(), pcr2_counts, sink.pcr2_kmers);
                 }
             }
         } else if (aln_type == userconfig::poor_alignment) {
@@ -450,15 +545,64 @@ private:
         if (sequence.length() >= KMER_LENGTH) {
             const std::string kmer = sequence.substr(0, KMER_LENGTH);
             if (!std::count(kmer.begin(), kmer.end(), 'N')) {
-                kmers.at(kmer_to_size_t(kmer)) += 1;
+                kmers[kmer_to_size_t(kmer)] += 1;
             }
         }
     }
 
+
+    /** Returns true if the consensus sequences have converged. */
+    bool is_converged()
+    {
+        mutex_locker lock(m_lock);
+        return m_converged;
+    }
+
+
+    /**
+     * Adds the frequencies observed in a chunk to the totals for all threads,
+     * and stops the reading step once the consensus sequences of both
+     * adapters have converged (see --identify-adapters-stop).
+     */
+    void update_convergence(const nt_count_vec& pcr1_counts,
+                            const nt_count_vec& pcr2_counts)
+    {
+        mutex_locker lock(m_lock);
+
+        merge_vectors(m_pcr1_counts, pcr1_counts);
+        merge_vectors(m_pcr2_counts, pcr2_counts);
+
+        const size_t length = m_config.identify_adapters_stop;
+        if (!m_converged
+            && is_consensus_converged(m_pcr1_counts, length)
+            && is_consensus_converged(m_pcr2_counts, length)) {
+            m_converged = true;
+            m_reader->stop();
+        }
+    }
+
+    //! Not implemented
+    adapter_identification(const adapter_identification&);
+    //! Not implemented
+    adapter_identification& operator=(const adapter_identification&);
+
     const userconfig& m_config;
 
     timer m_timer;
     adapter_sink m_sinks;
+    //! Selects the size of chunks, based on the time taken to process them
+    chunk_sizer* m_sizer;
+    //! Reading step; stopped once the consensus sequences have converged
+    read_paired_fastq* m_reader;
+
+    //! Lock used to control access to the members below
+    mutex m_lock;
+    //! Nucleotide frequencies for all threads; used by --identify-adapters-stop
+    nt_count_vec m_pcr1_counts;
+    //! Nucleotide frequencies for all threads; used by --identify-adapters-stop
+    nt_count_vec m_pcr2_counts;
+    //! Set once the consensus sequences have converged
+    bool m_converged;
 };
 
 
@@ -466,21 +610,37 @@ int identify_adapter_sequences(const userconfig& config)
 {
     std::cout << "Attemping to identify adapter sequences ..." << std::endl;
 
+    chunk_sizer sizer(config.chunk_size);
     scheduler sch;
+    read_paired_fastq* reader = NULL;
     try {
-        sch.add_step(ai_read_fastq, new read_paired_fastq(config.quality_input_fmt.get(),
-                                                          config.input_file_1,
-                                                          config.input_file_2,
-                                                          ai_identify_adapters));
+        size_t next_step = ai_identify_adapters;
+        if (config.mmap_input) {
+            sch.add_step(ai_parse_fastq, "parse_fastq",
+                         new parse_fastq(config.quality_input_fmt.get(), next_step));
+            next_step = ai_parse_fastq;
+        }
+
+        // An empty filename for mate 2 indicates interleaved input
+        const std::string input_file_2 = config.interleaved_input ? std::string() : config.input_file_2;
+        reader = new read_paired_fastq(config.quality_input_fmt.get(),
+                                       config.input_file_1,
+                                       input_file_2,
+                                       next_step,
+                                       config.max_threads,
+                                       config.mmap_input,
+                                       &sizer);
+        sch.add_step(ai_read_fastq, "read_fastq", reader);
     } catch (const std::ios_base::failure& error) {
         std::cerr << "IO error opening file; aborting:\n"
                   << cli_formatter::fmt(error.what()) << std::endl;
         return 1;
     }
 
-    sch.add_step(ai_identify_adapters, new adapter_identification(config));
+    sch.add_step(ai_identify_adapters, "identify_adapters",
+                 new adapter_identification(config, &sizer, reader));
 
-    if (!sch.run(config.max_threads, config.seed)) {
+    if (!run_pipeline(config, sch)) {
         return 1;
     }
 
@@ -22,22 +22,31 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <numeric>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "adapterset.h"
 #include "alignment.h"
+#include "bam.h"
+#include "bgzf.h"
+#include "checkpoint.h"
 #include "debug.h"
 #include "demultiplex.h"
 #include "fastq.h"
 #include "fastq_io.h"
 #include "main.h"
+#include "metrics.h"
+#include "shard.h"
 #include "strutils.h"
+#include "trimming.h"
 #include "userconfig.h"
 
 namespace ar
@@ -46,10 +55,16 @@ namespace ar
 typedef std::auto_ptr<fastq_output_chunk> output_chunk_ptr;
 
 
-void add_chunk(chunk_vec& chunks, size_t target, std::auto_ptr<fastq_output_chunk> chunk)
+/**
+ * Adds an output chunk (if any) for the given step, marking it if the chunk
+ * of reads from which it was produced preceded a checkpoint.
+ */
+void add_chunk(chunk_vec& chunks, size_t target, std::auto_ptr<fastq_output_chunk> chunk,
+               bool checkpoint)
 {
     try {
         if (chunk.get()) {
+            chunk->checkpoint = checkpoint;
             chunks.push_back(chunk_pair(target, chunk.release()));
         }
     } catch (...) {
@@ -63,6 +78,24 @@ void add_chunk(chunk_vec& chunks, size_t target, std::auto_ptr<fastq_output_chun
 
 
 
+/**
+ * Adds a step for parsing memory mapped reads, if enabled, returning the next
+ * step to be used by the file reading step.
+ */
+size_t add_parse_step(const userconfig& config, scheduler& sch, size_t next_step)
+{
+    if (config.mmap_input) {
+        sch.add_step(ai_parse_fastq, "parse_fastq",
+                     new parse_fastq(config.quality_input_fmt.get(), next_step,
+                                     config.get_read_packing()));
+
+        return ai_parse_fastq;
+    }
+
+    return next_step;
+}
+
+
 void write_settings(const userconfig& config, std::ostream& output, int nth)
 {
     output << NAME << " " << VERSION
@@ -142,8 +175,17 @@ void write_settings(const userconfig& config, std::ostream& output, int nth)
            << "\nQuality score max (output): " << config.quality_output_fmt->max_score()
            << "\nTrimming Ns: " << ((config.trim_ambiguous_bases) ? "Yes" : "No")
            << "\nTrimming Phred scores <= " << config.low_quality_score
-           << ": " << (config.trim_by_quality ? "yes" : "no")
-           << "\nMinimum genomic length: " << config.min_genomic_length
+           << ": " << (config.trim_by_quality ? "yes" : "no");
+
+    if (config.trim_window_length >= 0) {
+        output << "\nTrimming using sliding windows of size: "
+               << config.trim_window_length;
+    } else if (config.trim_mott_rate >= 0) {
+        output << "\nTrimming using the modified Mott algorithm, limit: "
+               << config.trim_mott_rate;
+    }
+
+    output << "\nMinimum genomic length: " << config.min_genomic_length
            << "\nMaximum genomic length: " << config.max_genomic_length
            << "\nCollapse overlapping reads: " << ((config.collapse) ? "Yes" : "No")
            << "\nMinimum overlap (in case of collapse): " << config.min_alignment_length;
@@ -203,23 +245,23 @@ void write_trimming_settings(const userconfig& config,
 
     settings << "Discarded\tAll\n";
 
-    for (size_t length = 0; length < stats.read_lengths.size(); ++length) {
-        const std::vector<size_t>& lengths = stats.read_lengths.at(length);
-        const size_t total = std::accumulate(lengths.begin(), lengths.end(), 0);
+    for (size_t length = 0; length < stats.length_rows; ++length) {
+        const std::vector<size_t>::const_iterator lengths = stats.read_lengths.begin() + length * rt_max;
+        const size_t total = std::accumulate(lengths, lengths + rt_max, 0);
 
-        settings << length << '\t' << lengths.at(rt_mate_1);
+        settings << length << '\t' << lengths[rt_mate_1];
 
         if (config.paired_ended_mode) {
-            settings << '\t' << lengths.at(rt_mate_2)
-                     << '\t' << lengths.at(rt_singleton);
+            settings << '\t' << lengths[rt_mate_2]
+                     << '\t' << lengths[rt_singleton];
         }
 
         if (config.collapse) {
-            settings << '\t' << lengths.at(rt_collapsed)
-                     << '\t' << lengths.at(rt_collapsed_truncated);
+            settings << '\t' << lengths[rt_collapsed]
+                     << '\t' << lengths[rt_collapsed_truncated];
         }
 
-        settings << '\t' << lengths.at(rt_discarded)
+        settings << '\t' << lengths[rt_discarded]
                  << '\t' << total << '\n';
     }
 
@@ -229,14 +271,8 @@ void write_trimming_settings(const userconfig& config,
 
 
 bool write_demux_settings(const userconfig& config,
-                          const demultiplex_reads* step)
+                          const demux_statistics& stats)
 {
-    if (!step) {
-        // Demultiplexing not enabled; nothing to do
-        return true;
-    }
-
-    const demux_statistics stats = step->statistics();
     const std::string filename = config.get_output_filename("demux_stats");
 
     try {
@@ -289,63 +325,76 @@ bool write_demux_settings(const userconfig& config,
 }
 
 
-void process_collapsed_read(const userconfig& config, statistics& stats,
-                            fastq& collapsed_read,
-                            fastq_output_chunk& out_collapsed,
-                            fastq_output_chunk& out_collapsed_truncated,
-                            fastq_output_chunk& out_discarded)
+bool write_demux_settings(const userconfig& config,
+                          const demultiplex_reads* step)
 {
-    const fastq::ntrimmed trimmed = config.trim_sequence_by_quality_if_enabled(collapsed_read);
-
-    // If trimmed, the external coordinates are no longer reliable
-    // for determining the size of the original template.
-    const bool was_trimmed = trimmed.first || trimmed.second;
-    if (was_trimmed) {
-        collapsed_read.add_prefix_to_header("MT_");
-    } else {
-        collapsed_read.add_prefix_to_header("M_");
+    if (!step) {
+        // Demultiplexing not enabled; nothing to do
+        return true;
     }
 
-    const size_t read_count = config.paired_ended_mode ? 2 : 1;
-    if (config.is_acceptable_read(collapsed_read)) {
-        stats.total_number_of_nucleotides += collapsed_read.length();
-        stats.total_number_of_good_reads++;
-        stats.inc_length_count(was_trimmed ? rt_collapsed_truncated : rt_collapsed,
-                               collapsed_read.length());
+    return write_demux_settings(config, step->statistics());
+}
 
-        if (was_trimmed) {
-            out_collapsed_truncated.add(*config.quality_output_fmt, collapsed_read, read_count);
-            stats.number_of_truncated_collapsed++;
-        } else {
-            out_collapsed.add(*config.quality_output_fmt, collapsed_read, read_count);
-            stats.number_of_full_length_collapsed++;
-        }
-    } else {
-        stats.discard1++;
-        stats.discard2++;
-        stats.inc_length_count(rt_discarded, collapsed_read.length());
-        out_discarded.add(*config.quality_output_fmt, collapsed_read, read_count);
-    }
+
+/** Returns the prefix of keys used to save the statistics of a processor. */
+std::string statistics_key(size_t nth)
+{
+    std::stringstream key;
+    key << "statistics:" << nth;
+
+    return key.str();
 }
 
 
-class reads_processor : public analytical_step
+class reads_processor : public analytical_step, public checkpoint_state
 {
 public:
-    reads_processor(const userconfig& config, size_t nth)
+    reads_processor(const userconfig& config, size_t nth, chunk_sizer* sizer,
+                    checkpointer* checkpoints)
       : analytical_step(analytical_step::unordered)
       , m_config(config)
       , m_adapters(config.adapters.get_adapter_set(nth))
+      , m_index()
       , m_stats(config)
       , m_nth(nth)
+      , m_sizer(sizer)
     {
+        if (config.index_adapters) {
+            m_index.reset(new adapter_index(m_adapters, config.paired_ended_mode));
+        }
+
+        if (checkpoints) {
+            if (checkpoints->resumed()) {
+                // Added to the statistics collected by the current thread
+                load_statistics(*checkpoints->resumed(), checkpoint_key(),
+                                *m_stats.get_sink());
+            }
 
+            checkpoints->add_state(this);
+        }
     }
 
     statistics* get_final_statistics() {
         return m_stats.finalize();
     }
 
+    virtual void save_checkpoint(checkpoint_data& data) {
+        const std::auto_ptr<statistics> stats(m_stats.snapshot());
+        save_statistics(data, checkpoint_key(), *stats);
+    }
+
+private:
+    //! Not implemented
+    reads_processor(const reads_processor&);
+    //! Not implemented
+    reads_processor& operator=(const reads_processor&);
+
+    /** Returns the prefix of keys used to save statistics at checkpoints. */
+    std::string checkpoint_key() const {
+        return statistics_key(m_nth);
+    }
+
 protected:
     class stats_sink : public statistics_sink<statistics>
     {
@@ -365,235 +414,202 @@ protected:
 
     const userconfig& m_config;
     const fastq_pair_vec m_adapters;
+    //! Index used to select candidate adapters, if --index-adapters is set
+    std::auto_ptr<adapter_index> m_index;
     stats_sink m_stats;
     const size_t m_nth;
+    //! Selects the size of chunks, based on the time taken to process them
+    chunk_sizer* m_sizer;
 };
 
 
 
+/**
+ * Processor for SE reads; quality trimming (--trimns / --trimqualities) and
+ * collapsing (--collapse) are selected at compile time, so that the per-read
+ * loop does not test these options. See 'new_reads_processor'.
+ */
+template <bool TRIM, bool COLLAPSE>
 class se_reads_processor : public reads_processor
 {
 public:
-    se_reads_processor(const userconfig& config, size_t nth = 0)
-      : reads_processor(config, nth)
+    se_reads_processor(const userconfig& config, size_t nth, chunk_sizer* sizer,
+                       checkpointer* checkpoints)
+      : reads_processor(config, nth, sizer, checkpoints)
     {
     }
 
     chunk_vec process(analytical_chunk* chunk)
     {
         std::auto_ptr<fastq_read_chunk> read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+        const double start_time = get_current_time();
+        read_chunk->unpack();
 
-        std::auto_ptr<statistics> stats(m_stats.get_sink());
+        statistics* const stats = m_stats.get_sink();
+        const output_format format = m_config.get_output_format();
 
-        const fastq_encoding& encoding = *m_config.quality_output_fmt;
-        output_chunk_ptr out_mate_1(new fastq_output_chunk(read_chunk->eof));
+        output_chunk_ptr out_mate_1(fastq_output_chunk::acquire(read_chunk->eof, format));
         output_chunk_ptr out_collapsed;
         output_chunk_ptr out_collapsed_truncated;
-        output_chunk_ptr out_discarded(new fastq_output_chunk(read_chunk->eof));
+        output_chunk_ptr out_discarded(fastq_output_chunk::acquire(read_chunk->eof, format));
 
-        if (m_config.collapse) {
-            out_collapsed.reset(new fastq_output_chunk(read_chunk->eof));
-            out_collapsed_truncated.reset(new fastq_output_chunk(read_chunk->eof));
+        if (COLLAPSE) {
+            out_collapsed.reset(fastq_output_chunk::acquire(read_chunk->eof, format));
+            out_collapsed_truncated.reset(fastq_output_chunk::acquire(read_chunk->eof, format));
         }
 
-        for (fastq_vec::iterator it = read_chunk->reads_1.begin(); it != read_chunk->reads_1.end(); ++it) {
-            fastq& read = *it;
+        trimmed_destinations<fastq_output_chunk> dst;
+        dst.mate_1 = out_mate_1.get();
+        dst.collapsed = out_collapsed.get();
+        dst.collapsed_truncated = out_collapsed_truncated.get();
+        dst.discarded = out_discarded.get();
 
-            const alignment_info alignment = align_single_ended_sequence(read, m_adapters, m_config.shift);
-            const userconfig::alignment_type aln_type = m_config.evaluate_alignment(alignment);
+        trim_single_end_reads<TRIM, COLLAPSE>(m_config, m_adapters, m_index.get(),
+                                              *stats, read_chunk->reads_1, dst);
 
-            if (aln_type == userconfig::valid_alignment) {
-                truncate_single_ended_sequence(alignment, read);
-                stats->number_of_reads_with_adapter.at(alignment.adapter_id)++;
-                stats->well_aligned_reads++;
-
-                if (m_config.is_alignment_collapsible(alignment)) {
-                    process_collapsed_read(m_config, *stats, read,
-                                           *out_collapsed,
-                                           *out_collapsed_truncated,
-                                           *out_discarded);
-                    continue;
-                }
-            } else if (aln_type == userconfig::poor_alignment) {
-                stats->poorly_aligned_reads++;
-            } else {
-                stats->unaligned_reads++;
-            }
-
-            m_config.trim_sequence_by_quality_if_enabled(read);
-            if (m_config.is_acceptable_read(read)) {
-                stats->keep1++;
-                stats->total_number_of_good_reads++;
-                stats->total_number_of_nucleotides += read.length();
-
-                out_mate_1->add(encoding, read);
-                stats->inc_length_count(rt_mate_1, read.length());
-            } else {
-                stats->discard1++;
-                stats->inc_length_count(rt_discarded, read.length());
-
-                out_discarded->add(encoding, read);
-            }
-        }
-
-        stats->records += read_chunk->reads_1.size();
-        m_stats.return_sink(stats.release());
+        m_sizer->add_time(read_chunk->reads_1.size(), get_current_time() - start_time);
+        const bool checkpoint = read_chunk->checkpoint;
+        fastq_read_chunk::recycle(read_chunk.release());
 
         chunk_vec chunks;
         const size_t offset = m_nth * ai_analyses_offset;
-        add_chunk(chunks, offset + ai_write_mate_1, out_mate_1);
-        add_chunk(chunks, offset + ai_write_collapsed, out_collapsed);
-        add_chunk(chunks, offset + ai_write_collapsed_truncated, out_collapsed_truncated);
-        add_chunk(chunks, offset + ai_write_discarded, out_discarded);
+        add_chunk(chunks, offset + ai_write_mate_1, out_mate_1, checkpoint);
+        add_chunk(chunks, offset + ai_write_collapsed, out_collapsed, checkpoint);
+        add_chunk(chunks, offset + ai_write_collapsed_truncated, out_collapsed_truncated, checkpoint);
+        add_chunk(chunks, offset + ai_write_discarded, out_discarded, checkpoint);
 
         return chunks;
     }
 };
 
 
+/** Processor for PE reads; see 'se_reads_processor'. */
+template <bool TRIM, bool COLLAPSE>
 class pe_reads_processor : public reads_processor
 {
 public:
-    pe_reads_processor(const userconfig& config, size_t nth)
-      : reads_processor(config, nth)
+    pe_reads_processor(const userconfig& config, size_t nth, chunk_sizer* sizer,
+                       checkpointer* checkpoints)
+      : reads_processor(config, nth, sizer, checkpoints)
     {
     }
 
     chunk_vec process(analytical_chunk* chunk)
     {
         std::auto_ptr<fastq_read_chunk> read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+        const double start_time = get_current_time();
+        read_chunk->unpack();
+
+        statistics* const stats = m_stats.get_sink();
+        const output_format format = m_config.get_output_format();
+        // Pairs of mates are only written to the same file if interleaved
+        const output_format pairs_format = m_config.get_output_format(m_config.interleaved_output);
+
+        output_chunk_ptr out_mate_1(fastq_output_chunk::acquire(read_chunk->eof, pairs_format));
+        output_chunk_ptr out_mate_2;
+        if (!m_config.interleaved_output) {
+            out_mate_2.reset(fastq_output_chunk::acquire(read_chunk->eof, format));
+        }
 
-        std::auto_ptr<statistics> stats(m_stats.get_sink());
-
-        const fastq_encoding& encoding = *m_config.quality_output_fmt;
-        output_chunk_ptr out_mate_1(new fastq_output_chunk(read_chunk->eof));
-        output_chunk_ptr out_mate_2(new fastq_output_chunk(read_chunk->eof));
-        output_chunk_ptr out_singleton(new fastq_output_chunk(read_chunk->eof));
+        output_chunk_ptr out_singleton(fastq_output_chunk::acquire(read_chunk->eof, format));
         output_chunk_ptr out_collapsed;
         output_chunk_ptr out_collapsed_truncated;
-        output_chunk_ptr out_discarded(new fastq_output_chunk(read_chunk->eof));
-
-        if (m_config.collapse) {
-            out_collapsed.reset(new fastq_output_chunk(read_chunk->eof));
-            out_collapsed_truncated.reset(new fastq_output_chunk(read_chunk->eof));
-        }
-
-        AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
-
-        fastq_vec::iterator it_1 = read_chunk->reads_1.begin();
-        fastq_vec::iterator it_2 = read_chunk->reads_2.begin();
-        while (it_1 != read_chunk->reads_1.end()) {
-            fastq read1 = *it_1++;
-            fastq read2 = *it_2++;
-
-            // Throws if read-names or mate numbering does not match
-            fastq::validate_paired_reads(read1, read2);
-
-            // Reverse complement to match the orientation of read1
-            read2.reverse_complement();
-
-            const alignment_info alignment = align_paired_ended_sequences(read1, read2, m_adapters, m_config.shift);
-            const userconfig::alignment_type aln_type = m_config.evaluate_alignment(alignment);
-            if (aln_type == userconfig::valid_alignment) {
-                stats->well_aligned_reads++;
-                const size_t n_adapters = truncate_paired_ended_sequences(alignment, read1, read2);
-                stats->number_of_reads_with_adapter.at(alignment.adapter_id) += n_adapters;
-
-                if (m_config.is_alignment_collapsible(alignment)) {
-                    fastq collapsed_read = collapse_paired_ended_sequences(alignment, read1, read2);
-                    process_collapsed_read(m_config, *stats, collapsed_read,
-                                           *out_collapsed,
-                                           *out_collapsed_truncated,
-                                           *out_discarded);
-                    continue;
-                }
-            } else if (aln_type == userconfig::poor_alignment) {
-                stats->poorly_aligned_reads++;
-            } else {
-                stats->unaligned_reads++;
-            }
-
-            // Reads were not aligned or collapsing is not enabled
-            // Undo reverse complementation (post truncation of adapters)
-            read2.reverse_complement();
-
-            // Are the reads good enough? Not too many Ns?
-            m_config.trim_sequence_by_quality_if_enabled(read1);
-            m_config.trim_sequence_by_quality_if_enabled(read2);
-            const bool read_1_acceptable = m_config.is_acceptable_read(read1);
-            const bool read_2_acceptable = m_config.is_acceptable_read(read2);
+        output_chunk_ptr out_discarded(fastq_output_chunk::acquire(read_chunk->eof, format));
 
-            stats->total_number_of_nucleotides += read_1_acceptable ? read1.length() : 0u;
-            stats->total_number_of_nucleotides += read_1_acceptable ? read2.length() : 0u;
-            stats->total_number_of_good_reads += read_1_acceptable;
-            stats->total_number_of_good_reads += read_2_acceptable;
-
-            if (read_1_acceptable && read_2_acceptable) {
-                out_mate_1->add(encoding, read1);
-                out_mate_2->add(encoding, read2);
-
-                stats->inc_length_count(rt_mate_1, read1.length());
-                stats->inc_length_count(rt_mate_2, read2.length());
-            } else {
-                // Keep one or none of the reads ...
-                stats->keep1 += read_1_acceptable;
-                stats->keep2 += read_2_acceptable;
-                stats->discard1 += !read_1_acceptable;
-                stats->discard2 += !read_2_acceptable;
-                stats->inc_length_count(read_1_acceptable ? rt_mate_1 : rt_discarded, read1.length());
-                stats->inc_length_count(read_2_acceptable ? rt_mate_2 : rt_discarded, read2.length());
-
-                if (read_1_acceptable) {
-                    out_singleton->add(encoding, read1);
-                } else {
-                    out_discarded->add(encoding, read1);
-                }
-
-                if (read_2_acceptable) {
-                    out_singleton->add(encoding, read2);
-                } else {
-                    out_discarded->add(encoding, read2);
-                }
-            }
+        if (COLLAPSE) {
+            out_collapsed.reset(fastq_output_chunk::acquire(read_chunk->eof, format));
+            out_collapsed_truncated.reset(fastq_output_chunk::acquire(read_chunk->eof, format));
         }
 
-        stats->records += read_chunk->reads_1.size();
-        m_stats.return_sink(stats.release());
+        trimmed_destinations<fastq_output_chunk> dst;
+        dst.mate_1 = out_mate_1.get();
+        // Interleaved mate 2 reads are written directly following mate 1 reads
+        dst.mate_2 = out_mate_2.get() ? out_mate_2.get() : out_mate_1.get();
+        dst.singleton = out_singleton.get();
+        dst.collapsed = out_collapsed.get();
+        dst.collapsed_truncated = out_collapsed_truncated.get();
+        dst.discarded = out_discarded.get();
+
+        // Records are modified in place, as the chunk is not used afterwards
+        trim_paired_end_reads<TRIM, COLLAPSE>(m_config, m_adapters, m_index.get(), *stats,
+                                              read_chunk->reads_1, read_chunk->reads_2,
+                                              read_chunk->batch_1, read_chunk->batch_2,
+                                              dst);
+
+        m_sizer->add_time(read_chunk->reads_1.size(), get_current_time() - start_time);
+        const bool checkpoint = read_chunk->checkpoint;
+        fastq_read_chunk::recycle(read_chunk.release());
 
         chunk_vec chunks;
         const size_t offset = m_nth * ai_analyses_offset;
-        add_chunk(chunks, offset + ai_write_mate_1, out_mate_1);
-        add_chunk(chunks, offset + ai_write_mate_2, out_mate_2);
-        add_chunk(chunks, offset + ai_write_singleton, out_singleton);
-        add_chunk(chunks, offset + ai_write_collapsed, out_collapsed);
-        add_chunk(chunks, offset + ai_write_collapsed_truncated, out_collapsed_truncated);
-        add_chunk(chunks, offset + ai_write_discarded, out_discarded);
+        add_chunk(chunks, offset + ai_write_mate_1, out_mate_1, checkpoint);
+        add_chunk(chunks, offset + ai_write_mate_2, out_mate_2, checkpoint);
+        add_chunk(chunks, offset + ai_write_singleton, out_singleton, checkpoint);
+        add_chunk(chunks, offset + ai_write_collapsed, out_collapsed, checkpoint);
+        add_chunk(chunks, offset + ai_write_collapsed_truncated, out_collapsed_truncated, checkpoint);
+        add_chunk(chunks, offset + ai_write_discarded, out_discarded, checkpoint);
 
         return chunks;
     }
 };
 
 
-bool write_settings(const userconfig& config, const std::vector<reads_processor*>& processors)
+/**
+ * Returns a SE or PE processor specialized for the trimming and collapsing
+ * options in 'config'; these are selected once, rather than per read.
+ */
+template <template <bool, bool> class T>
+reads_processor* new_reads_processor(const userconfig& config, size_t nth,
+                                     chunk_sizer* sizer, checkpointer* checkpoints)
 {
-    for (size_t nth = 0; nth < processors.size(); ++nth) {
-        const std::string filename = config.get_output_filename("--settings", nth);
+    if (config.is_quality_trimming_enabled()) {
+        if (config.collapse) {
+            return new T<true, true>(config, nth, sizer, checkpoints);
+        }
 
-        const std::auto_ptr<statistics> stats(processors.at(nth)->get_final_statistics());
+        return new T<true, false>(config, nth, sizer, checkpoints);
+    } else if (config.collapse) {
+        return new T<false, true>(config, nth, sizer, checkpoints);
+    }
 
-        try {
-            std::ofstream output(filename.c_str(), std::ofstream::out);
+    return new T<false, false>(config, nth, sizer, checkpoints);
+}
 
-            if (!output.is_open()) {
-                std::string message = std::string("Failed to open file '") + filename + "': ";
-                throw std::ofstream::failure(message + std::strerror(errno));
-            }
 
-            output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-            write_trimming_settings(config, *stats, nth, output);
-        } catch (const std::ios_base::failure& error) {
-            std::cerr << "IO error writing settings file; aborting:\n"
-                      << cli_formatter::fmt(error.what()) << std::endl;
+bool write_settings(const userconfig& config, const statistics& stats, size_t nth)
+{
+    const std::string filename = config.get_output_filename("--settings", nth);
+
+    try {
+        if (filename == "-") {
+            write_trimming_settings(config, stats, nth, std::cout);
+            return true;
+        }
+
+        std::ofstream output(filename.c_str(), std::ofstream::out);
+
+        if (!output.is_open()) {
+            std::string message = std::string("Failed to open file '") + filename + "': ";
+            throw std::ofstream::failure(message + std::strerror(errno));
+        }
+
+        output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        write_trimming_settings(config, stats, nth, output);
+    } catch (const std::ios_base::failure& error) {
+        std::cerr << "IO error writing settings file; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool write_settings(const userconfig& config, const std::vector<reads_processor*>& processors)
+{
+    for (size_t nth = 0; nth < processors.size(); ++nth) {
+        const std::auto_ptr<statistics> stats(processors.at(nth)->get_final_statistics());
+        if (!write_settings(config, *stats, nth)) {
             return false;
         }
     }
@@ -602,85 +618,320 @@ bool write_settings(const userconfig& config, const std::vector<reads_processor*
 }
 
 
-void add_write_step(const userconfig& config, scheduler& sch, size_t offset,
-                    analytical_step* step)
+/**
+ * Writes the statistics of a run using --shard, in the format used for
+ * checkpoints, so that these may be combined using --merge-stats.
+ */
+bool write_shard_statistics(const userconfig& config,
+                            const std::vector<reads_processor*>& processors,
+                            const demultiplex_reads* demultiplexer)
+{
+    if (!config.shard_count) {
+        return true;
+    }
+
+    std::vector<size_t> shard;
+    shard.push_back(config.shard);
+    shard.push_back(config.shard_count);
+
+    checkpoint_data data;
+    data.set("shard", shard);
+    for (size_t nth = 0; nth < processors.size(); ++nth) {
+        processors.at(nth)->save_checkpoint(data);
+    }
+
+    if (demultiplexer) {
+        // Per-thread statistics are merged once the step has finished
+        save_statistics(data, "demux", demultiplexer->statistics());
+    }
+
+    try {
+        data.write(config.get_output_filename("shard_stats"));
+    } catch (const std::ios_base::failure& error) {
+        std::cerr << "IO error writing shard statistics; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/** Returns the mate 2 input file, or an empty string for interleaved input. */
+std::string get_input_file_2(const userconfig& config)
 {
+    return config.interleaved_input ? std::string() : config.input_file_2;
+}
+
+
+/**
+ * Adds the step reading the input file(s), preceded by a parsing step if
+ * enabled (see 'add_parse_step'), and forwarding reads to 'next_step';
+ * returns the SAM header of BAM input files, and an empty string otherwise.
+ */
+std::string add_read_step(const userconfig& config, scheduler& sch,
+                          chunk_sizer& sizer, size_t next_step,
+                          checkpointer* checkpoints)
+{
+    if (config.bam_input) {
+        read_bam* reader = new read_bam(config.input_file_1,
+                                        config.paired_ended_mode,
+                                        next_step,
+                                        config.max_threads,
+                                        &sizer,
+                                        config.get_read_packing());
+        sch.add_step(ai_read_fastq, "read_bam", reader);
+
+        return reader->header();
+    }
+
+    file_range range_1;
+    file_range range_2;
+    if (config.shard_count) {
+        find_shard_ranges(config.input_file_1, get_input_file_2(config),
+                          config.interleaved_input, config.shard,
+                          config.shard_count, range_1, range_2);
+    }
+
+    next_step = add_parse_step(config, sch, next_step);
+    if (config.paired_ended_mode) {
+        sch.add_step(ai_read_fastq, "read_fastq",
+                     new read_paired_fastq(config.quality_input_fmt.get(),
+                                           config.input_file_1,
+                                           get_input_file_2(config),
+                                           next_step,
+                                           config.max_threads,
+                                           config.mmap_input,
+                                           &sizer,
+                                           config.get_read_packing(),
+                                           checkpoints,
+                                           range_1,
+                                           range_2));
+    } else {
+        sch.add_step(ai_read_fastq, "read_fastq",
+                     new read_single_fastq(config.quality_input_fmt.get(),
+                                           config.input_file_1,
+                                           next_step,
+                                           config.max_threads,
+                                           config.mmap_input,
+                                           &sizer,
+                                           config.get_read_packing(),
+                                           checkpoints,
+                                           range_1));
+    }
+
+    return std::string();
+}
+
+
+/**
+ * Returns the (BGZF compressed) BAM header written to output files, if
+ * --bam-output is set, keeping the header lines of BAM input files.
+ */
+std::string get_bam_header(const userconfig& config, const std::string& input_header)
+{
+    std::string header;
+#ifdef AR_GZIP_SUPPORT
+    if (config.bam_output) {
+        // VERSION is of the form "ver. X.Y.Z"
+        const std::string version = VERSION.substr(VERSION.find_first_of("0123456789"));
+
+        std::string data;
+        append_bam_header(data, build_sam_header(input_header, NAME, version));
+        bgzf_compress(header, data, config.gzip_level);
+    }
+#endif
+
+    return header;
+}
+
+
+/** Returns the number of threads used to write output files. */
+size_t get_writer_threads(const userconfig& config)
+{
+    return config.max_io_threads ? config.max_io_threads : WRITER_DEFAULT_THREADS;
+}
+
+
+/** Returns the name of a per-sample step, for use when reporting metrics. */
+std::string get_step_name(const userconfig& config, const std::string& name, size_t nth)
+{
+    if (config.adapters.barcode_count()) {
+        return name + ":" + config.adapters.get_sample_name(nth);
+    }
+
+    return name;
+}
+
+
+void add_write_step(const userconfig& config, scheduler& sch, writer_pool& writers,
+                    size_t offset, const std::string& filename,
+                    const std::string& header, checkpointer* checkpoints)
+{
+    analytical_step* step = new write_paired_fastq(filename, &writers,
+                                                   config.direct_io,
+                                                   config.preallocate,
+                                                   header,
+                                                   checkpoints);
+
 #ifdef AR_GZIP_SUPPORT
-    if (config.gzip) {
-        sch.add_step(offset + ai_zip_offset, step);
-        sch.add_step(offset, new gzip_paired_fastq(config, offset + ai_zip_offset));
+    if (config.bgzf) {
+        sch.add_step(offset + ai_zip_offset, "write:" + filename, step);
+        sch.add_step(offset, "compress:" + filename,
+                     new bgzf_paired_fastq(config, offset + ai_zip_offset));
+    } else if (config.gzip) {
+        sch.add_step(offset + ai_zip_offset, "write:" + filename, step);
+        sch.add_step(offset, "compress:" + filename,
+                     new gzip_paired_fastq(config, offset + ai_zip_offset));
     } else
 #endif
 
 #ifdef AR_BZIP2_SUPPORT
     if (config.bzip2) {
-        sch.add_step(offset + ai_zip_offset, step);
-        sch.add_step(offset, new bzip2_paired_fastq(config, offset + ai_zip_offset));
+        // Blocks are collected in order, compressed in parallel, and written
+        // in order; see ai_zip_offset
+        sch.add_step(offset + 2 * ai_zip_offset, "write:" + filename, step);
+        sch.add_step(offset + ai_zip_offset, "compress:" + filename,
+                     new bzip2_paired_fastq(config, offset + 2 * ai_zip_offset));
+        sch.add_step(offset, "block:" + filename,
+                     new bzip2_block_paired_fastq(config, offset + ai_zip_offset));
     } else
 #endif
     {
-        sch.add_step(offset, step);
+        sch.add_step(offset, "write:" + filename, step);
     }
 }
 
 
+/** Returns a checkpointer if --checkpoint is set, and NULL otherwise. */
+checkpointer* new_checkpointer(const userconfig& config)
+{
+    if (config.checkpoint_file.empty()) {
+        return NULL;
+    }
+
+    std::auto_ptr<checkpointer> checkpoints(new checkpointer(config.checkpoint_file,
+                                                             config.checkpoint_interval,
+                                                             config.resume));
+
+    if (checkpoints->resumed()) {
+        std::cerr << "Resuming from checkpoint '" << config.checkpoint_file
+                  << "' ..." << std::endl;
+    }
+
+    return checkpoints.release();
+}
+
+
+/** Removes the checkpoint file (if any) once the run has completed. */
+bool remove_checkpoint(checkpointer* checkpoints)
+{
+    try {
+        if (checkpoints) {
+            checkpoints->remove();
+        }
+    } catch (const std::ios_base::failure& error) {
+        std::cerr << "IO error removing checkpoint; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
 int remove_adapter_sequences_se(const userconfig& config)
 {
     std::cerr << "Trimming single ended reads ..." << std::endl;
 
+    chunk_sizer sizer(config.chunk_size);
+    // Declared before the scheduler, as the steps use the checkpointer
+    std::auto_ptr<checkpointer> checkpoints;
+    // Declared before the scheduler, as the write steps use the pool
+    writer_pool writers(get_writer_threads(config));
     scheduler sch;
     std::vector<reads_processor*> processors;
     demultiplex_reads* demultiplexer = NULL;
+    // Written at the start of all output files, if writing BAM records
+    std::string bam_header;
 
     try {
+        checkpoints.reset(new_checkpointer(config));
+        if (checkpoints.get()) {
+            sch.set_barrier(checkpoints.get());
+        }
+
         if (config.adapters.barcode_count()) {
             // Step 1: Read input file
-            sch.add_step(ai_read_fastq, new read_single_fastq(config.quality_input_fmt.get(),
-                                                              config.input_file_1,
-                                                              ai_demultiplex));
-
-            // Step 2: Parse and demultiplex reads based on single or double indices
-            sch.add_step(ai_demultiplex, demultiplexer = new demultiplex_se_reads(&config));
-
-            add_write_step(config, sch, ai_write_unidentified_1,
-                           new write_paired_fastq(config.get_output_filename("demux_unknown")));
+            bam_header = get_bam_header(config, add_read_step(config, sch, sizer,
+                                                              ai_demultiplex,
+                                                              checkpoints.get()));
+
+            // Step 2: Demultiplex reads based on single or double indices, and
+            //         collect reads for each barcode in the input order
+            demultiplexer = new demultiplex_se_reads(&config, checkpoints.get());
+            sch.add_step(ai_demultiplex, "demultiplex", demultiplexer);
+            sch.add_step(ai_demultiplex_cache, "demultiplex_cache",
+                         new demultiplex_cache(&config));
+
+            add_write_step(config, sch, writers, ai_write_unidentified_1,
+                           config.get_output_filename("demux_unknown"), bam_header,
+                           checkpoints.get());
         } else {
-            sch.add_step(ai_read_fastq, new read_single_fastq(config.quality_input_fmt.get(),
-                                                              config.input_file_1,
-                                                              ai_analyses_offset));
+            bam_header = get_bam_header(config, add_read_step(config, sch, sizer,
+                                                              ai_analyses_offset,
+                                                              checkpoints.get()));
         }
 
         // Step 3 - N: Trim and write demultiplexed readss
         for (size_t nth = 0; nth < config.adapters.adapter_set_count(); ++nth) {
             const size_t offset = nth * ai_analyses_offset;
 
-            processors.push_back(new se_reads_processor(config, nth));
-            sch.add_step(offset + ai_trim_se, processors.back());
+            processors.push_back(new_reads_processor<se_reads_processor>(config, nth, &sizer,
+                                                                           checkpoints.get()));
+            sch.add_step(offset + ai_trim_se, get_step_name(config, "trim_se", nth),
+                         processors.back());
 
-            add_write_step(config, sch, offset + ai_write_mate_1,
-                           new write_paired_fastq(config.get_output_filename("--output1", nth)));
-            add_write_step(config, sch, offset + ai_write_discarded,
-                         new write_paired_fastq(config.get_output_filename("--discarded", nth)));
+            add_write_step(config, sch, writers, offset + ai_write_mate_1,
+                           config.get_output_filename("--output1", nth), bam_header,
+                           checkpoints.get());
+            add_write_step(config, sch, writers, offset + ai_write_discarded,
+                         config.get_output_filename("--discarded", nth), bam_header,
+                         checkpoints.get());
 
             if (config.collapse) {
-                add_write_step(config, sch, offset + ai_write_collapsed,
-                               new write_paired_fastq(config.get_output_filename("--outputcollapsed", nth)));
-                add_write_step(config, sch, offset + ai_write_collapsed_truncated,
-                               new write_paired_fastq(config.get_output_filename("--outputcollapsedtruncated", nth)));
+                add_write_step(config, sch, writers, offset + ai_write_collapsed,
+                               config.get_output_filename("--outputcollapsed", nth), bam_header,
+                               checkpoints.get());
+                add_write_step(config, sch, writers, offset + ai_write_collapsed_truncated,
+                               config.get_output_filename("--outputcollapsedtruncated", nth), bam_header,
+                               checkpoints.get());
             }
         }
     } catch (const std::ios_base::failure& error) {
         std::cerr << "IO error opening file; aborting:\n"
                   << cli_formatter::fmt(error.what()) << std::endl;
         return 1;
+    } catch (const fastq_error& error) {
+        std::cerr << "Error reading BAM header; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return 1;
+    } catch (const checkpoint_error& error) {
+        std::cerr << "Error resuming from checkpoint; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return 1;
     }
 
-    if (!sch.run(config.max_threads, config.seed)) {
+    if (!run_pipeline(config, sch)) {
+        return 1;
+    } else if (!write_shard_statistics(config, processors, demultiplexer)) {
         return 1;
     } else if (!write_settings(config, processors)) {
         return 1;
     } else if (!write_demux_settings(config, demultiplexer)) {
         return 1;
+    } else if (!remove_checkpoint(checkpoints.get())) {
+        return 1;
     }
 
     return 0;
@@ -691,67 +942,199 @@ int remove_adapter_sequences_pe(const userconfig& config)
 {
     std::cerr << "Trimming paired end reads ..." << std::endl;
 
+    chunk_sizer sizer(config.chunk_size);
+    // Declared before the scheduler, as the steps use the checkpointer
+    std::auto_ptr<checkpointer> checkpoints;
+    // Declared before the scheduler, as the write steps use the pool
+    writer_pool writers(get_writer_threads(config));
     scheduler sch;
     std::vector<reads_processor*> processors;
     demultiplex_reads* demultiplexer = NULL;
+    // Written at the start of all output files, if writing BAM records
+    std::string bam_header;
 
     try {
+        checkpoints.reset(new_checkpointer(config));
+        if (checkpoints.get()) {
+            sch.set_barrier(checkpoints.get());
+        }
+
         if (config.adapters.barcode_count()) {
             // Step 1: Read input file
-            sch.add_step(ai_read_fastq, new read_paired_fastq(config.quality_input_fmt.get(),
-                                                              config.input_file_1,
-                                                              config.input_file_2,
-                                                              ai_demultiplex));
-
-            // Step 2: Parse and demultiplex reads based on single or double indices
-            sch.add_step(ai_demultiplex, demultiplexer = new demultiplex_pe_reads(&config));
-
-            add_write_step(config, sch, ai_write_unidentified_1,
-                           new write_paired_fastq(config.get_output_filename("demux_unknown", 1)));
-            add_write_step(config, sch, ai_write_unidentified_2,
-                           new write_paired_fastq(config.get_output_filename("demux_unknown", 2)));
+            bam_header = get_bam_header(config, add_read_step(config, sch, sizer,
+                                                              ai_demultiplex,
+                                                              checkpoints.get()));
+
+            // Step 2: Demultiplex reads based on single or double indices, and
+            //         collect reads for each barcode in the input order
+            demultiplexer = new demultiplex_pe_reads(&config, checkpoints.get());
+            sch.add_step(ai_demultiplex, "demultiplex", demultiplexer);
+            sch.add_step(ai_demultiplex_cache, "demultiplex_cache",
+                         new demultiplex_cache(&config));
+
+            add_write_step(config, sch, writers, ai_write_unidentified_1,
+                           config.get_output_filename("demux_unknown", 1), bam_header,
+                           checkpoints.get());
+            if (!config.interleaved_output) {
+                add_write_step(config, sch, writers, ai_write_unidentified_2,
+                               config.get_output_filename("demux_unknown", 2), bam_header,
+                               checkpoints.get());
+            }
         } else {
-            sch.add_step(ai_read_fastq, new read_paired_fastq(config.quality_input_fmt.get(),
-                                                              config.input_file_1,
-                                                              config.input_file_2,
-                                                              ai_analyses_offset));
+            bam_header = get_bam_header(config, add_read_step(config, sch, sizer,
+                                                              ai_analyses_offset,
+                                                              checkpoints.get()));
         }
 
         // Step 3 - N: Trim and write demultiplexed reads
         for (size_t nth = 0; nth < config.adapters.adapter_set_count(); ++nth) {
             const size_t offset = nth * ai_analyses_offset;
 
-            processors.push_back(new pe_reads_processor(config, nth));
-            sch.add_step(offset + ai_trim_pe, processors.back());
-
-            add_write_step(config, sch, offset + ai_write_mate_1,
-                           new write_paired_fastq(config.get_output_filename("--output1", nth)));
-            add_write_step(config, sch, offset + ai_write_mate_2,
-                           new write_paired_fastq(config.get_output_filename("--output2", nth)));
-            add_write_step(config, sch, offset + ai_write_discarded,
-                           new write_paired_fastq(config.get_output_filename("--discarded", nth)));
-            add_write_step(config, sch, offset + ai_write_singleton,
-                           new write_paired_fastq(config.get_output_filename("--singleton", nth)));
+            processors.push_back(new_reads_processor<pe_reads_processor>(config, nth, &sizer,
+                                                                           checkpoints.get()));
+            sch.add_step(offset + ai_trim_pe, get_step_name(config, "trim_pe", nth),
+                         processors.back());
+
+            add_write_step(config, sch, writers, offset + ai_write_mate_1,
+                           config.get_output_filename("--output1", nth), bam_header,
+                           checkpoints.get());
+            if (!config.interleaved_output) {
+                add_write_step(config, sch, writers, offset + ai_write_mate_2,
+                               config.get_output_filename("--output2", nth), bam_header,
+                               checkpoints.get());
+            }
+            add_write_step(config, sch, writers, offset + ai_write_discarded,
+                           config.get_output_filename("--discarded", nth), bam_header,
+                           checkpoints.get());
+            add_write_step(config, sch, writers, offset + ai_write_singleton,
+                           config.get_output_filename("--singleton", nth), bam_header,
+                           checkpoints.get());
 
             if (config.collapse) {
-                add_write_step(config, sch, offset + ai_write_collapsed,
-                               new write_paired_fastq(config.get_output_filename("--outputcollapsed", nth)));
-                add_write_step(config, sch, offset + ai_write_collapsed_truncated,
-                               new write_paired_fastq(config.get_output_filename("--outputcollapsedtruncated", nth)));
+                add_write_step(config, sch, writers, offset + ai_write_collapsed,
+                               config.get_output_filename("--outputcollapsed", nth), bam_header,
+                               checkpoints.get());
+                add_write_step(config, sch, writers, offset + ai_write_collapsed_truncated,
+                               config.get_output_filename("--outputcollapsedtruncated", nth), bam_header,
+                               checkpoints.get());
             }
         }
     } catch (const std::ios_base::failure& error) {
         std::cerr << "IO error opening file; aborting:\n"
                   << cli_formatter::fmt(error.what()) << std::endl;
         return 1;
+    } catch (const fastq_error& error) {
+        std::cerr << "Error reading BAM header; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return 1;
+    } catch (const checkpoint_error& error) {
+        std::cerr << "Error resuming from checkpoint; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+        return 1;
     }
 
-    if (!sch.run(config.max_threads, config.seed)) {
+    if (!run_pipeline(config, sch)) {
+        return 1;
+    } else if (!write_shard_statistics(config, processors, demultiplexer)) {
         return 1;
     } else if (!write_settings(config, processors)) {
         return 1;
     } else if (!write_demux_settings(config, demultiplexer)) {
         return 1;
+    } else if (!remove_checkpoint(checkpoints.get())) {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/** Adds the statistics of one shard (see --shard) to the merged statistics. */
+void merge_shard_statistics(const userconfig& config,
+                            const std::string& filename,
+                            std::vector<statistics>& stats,
+                            demux_statistics& demux_stats,
+                            std::vector<bool>& shards)
+{
+    checkpoint_data data;
+    data.read(filename);
+
+    const std::vector<size_t> shard = data.get_vector("shard");
+    if (shard.size() != 2 || shard.front() >= shard.back()) {
+        throw checkpoint_error("invalid shard in '" + filename + "'");
+    } else if (shards.empty()) {
+        shards.resize(shard.back());
+    } else if (shards.size() != shard.back()) {
+        throw checkpoint_error("'" + filename + "' was written using a "
+                               "different number of shards than other files");
+    }
+
+    if (shards.at(shard.front())) {
+        std::stringstream message;
+        message << "statistics for shard " << shard.front() + 1 << "/"
+                << shard.back() << " are specified more than once";
+
+        throw checkpoint_error(message.str());
+    }
+
+    shards.at(shard.front()) = true;
+
+    for (size_t nth = 0; nth < stats.size(); ++nth) {
+        statistics current;
+        load_statistics(data, statistics_key(nth), current);
+        stats.at(nth) += current;
+    }
+
+    if (config.adapters.barcode_count()) {
+        demux_statistics current(config.adapters.barcode_count());
+        load_statistics(data, "demux", current);
+        demux_stats += current;
+    }
+}
+
+
+int merge_statistics(const userconfig& config)
+{
+    std::cerr << "Merging statistics of " << config.merge_stats.size()
+              << " shard(s) ..." << std::endl;
+
+    const std::auto_ptr<statistics> empty_stats(config.create_stats());
+    std::vector<statistics> stats(std::max<size_t>(1, config.adapters.barcode_count()),
+                                  *empty_stats);
+    demux_statistics demux_stats(config.adapters.barcode_count());
+    std::vector<bool> shards;
+
+    for (string_vec_citer it = config.merge_stats.begin(); it != config.merge_stats.end(); ++it) {
+        try {
+            merge_shard_statistics(config, *it, stats, demux_stats, shards);
+        } catch (const std::ios_base::failure& error) {
+            std::cerr << "IO error reading statistics; aborting:\n"
+                      << cli_formatter::fmt(error.what()) << std::endl;
+            return 1;
+        } catch (const checkpoint_error& error) {
+            std::cerr << "Error merging statistics from '" << *it << "'; aborting:\n"
+                      << cli_formatter::fmt(error.what()) << std::endl;
+            return 1;
+        }
+    }
+
+    for (size_t nth = 0; nth < shards.size(); ++nth) {
+        if (!shards.at(nth)) {
+            std::cerr << "Error: Statistics for shard " << nth + 1 << "/"
+                      << shards.size() << " not specified; aborting!"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    for (size_t nth = 0; nth < stats.size(); ++nth) {
+        if (!write_settings(config, stats.at(nth), nth)) {
+            return 1;
+        }
+    }
+
+    if (config.adapters.barcode_count() && !write_demux_settings(config, demux_stats)) {
+        return 1;
     }
 
     return 0;
@@ -0,0 +1,498 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <time.h>
+
+#include "linereader.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "strutils.h"
+#include "timer.h"
+#include "userconfig.h"
+
+namespace ar
+{
+
+//! Max number of seconds between checks for termination of the writer thread
+const double METRICS_POLL_INTERVAL = 0.1;
+
+
+/** Value of a 'metrics_counter' at the time of a snapshot. */
+struct counter_value
+{
+    counter_value(const metrics_counter& counter)
+      : name(counter.name())
+      , help(counter.help())
+      , labels(counter.labels())
+      , value(counter.current())
+    {
+    }
+
+    /** Sorts by name only, so that (stable) sorting keeps the order of labels. */
+    bool operator<(const counter_value& other) const
+    {
+        return name < other.name;
+    }
+
+    std::string name;
+    std::string help;
+    std::string labels;
+    size_t value;
+};
+
+typedef std::vector<counter_value> counter_value_vec;
+typedef std::list<const metrics_counter*> counter_list;
+
+
+/** Registry of live counters; created on first use, to avoid order issues. */
+struct counter_registry
+{
+    counter_registry()
+      : lock()
+      , counters()
+    {
+    }
+
+    //! Lock used to control access to 'counters'
+    mutex lock;
+    //! Counters in the order they were created
+    counter_list counters;
+};
+
+
+counter_registry& get_registry()
+{
+    static counter_registry registry;
+
+    return registry;
+}
+
+
+metrics_counter& get_reads_counter()
+{
+    static metrics_counter counter("adapterremoval_reads_total",
+                                   "Number of reads processed.");
+
+    return counter;
+}
+
+
+/** Writes the HELP and TYPE lines for a metric. */
+void write_header(std::ostream& stream, const std::string& name,
+                  const std::string& help, const std::string& type)
+{
+    stream << "# HELP " << name << " " << help << "\n"
+           << "# TYPE " << name << " " << type << "\n";
+}
+
+
+/** Writes a single metric sample, including labels if not empty. */
+template <typename T>
+void write_sample(std::ostream& stream, const std::string& name,
+                  const std::string& labels, T value)
+{
+    stream << name;
+    if (!labels.empty()) {
+        stream << "{" << labels << "}";
+    }
+
+    stream << " " << value << "\n";
+}
+
+
+/** Writes a metric with a single, unlabeled sample. */
+template <typename T>
+void write_metric(std::ostream& stream, const std::string& name,
+                  const std::string& help, const std::string& type, T value)
+{
+    write_header(stream, name, help, type);
+    write_sample(stream, name, std::string(), value);
+}
+
+
+/** Returns the labels used for the metrics of a single step. */
+std::string get_step_labels(const step_metrics& step)
+{
+    std::ostringstream step_id;
+    step_id << step.step_id;
+
+    return metrics_label("step", step.name) + "," + metrics_label("id", step_id.str());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'metrics_counter'
+
+metrics_counter::metrics_counter(const std::string& name,
+                                 const std::string& help,
+                                 const std::string& labels)
+  : m_name(name)
+  , m_help(help)
+  , m_labels(labels)
+  , m_value(0)
+{
+    counter_registry& registry = get_registry();
+    mutex_locker lock(registry.lock);
+    registry.counters.push_back(this);
+}
+
+
+metrics_counter::~metrics_counter()
+{
+    counter_registry& registry = get_registry();
+    mutex_locker lock(registry.lock);
+    registry.counters.remove(this);
+}
+
+
+void metrics_counter::increment(size_t value)
+{
+    m_value.increment(value);
+}
+
+
+size_t metrics_counter::current() const
+{
+    return m_value.current();
+}
+
+
+const std::string& metrics_counter::name() const
+{
+    return m_name;
+}
+
+
+const std::string& metrics_counter::help() const
+{
+    return m_help;
+}
+
+
+const std::string& metrics_counter::labels() const
+{
+    return m_labels;
+}
+
+
+std::string metrics_label(const std::string& key, const std::string& value)
+{
+    std::string label = key + "=\"";
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        switch (*it) {
+            case '\\':
+                label += "\\\\";
+                break;
+
+            case '"':
+                label += "\\\"";
+                break;
+
+            case '\n':
+                label += "\\n";
+                break;
+
+            default:
+                label += *it;
+        }
+    }
+
+    return label + "\"";
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'metrics_writer'
+
+metrics_writer::metrics_writer(const std::string& filename, double interval,
+                               const scheduler* sch)
+#ifdef AR_PTHREAD_SUPPORT
+  : m_thread()
+  , m_started(false)
+  , m_lock()
+#else
+  : m_lock()
+#endif
+  , m_stop(false)
+  , m_warned(false)
+  , m_filename(filename)
+  , m_interval(interval)
+  , m_scheduler(sch)
+  , m_start_time(get_current_time())
+  , m_last_time(m_start_time)
+  , m_last_reads(get_reads_counter().current())
+{
+    // Errors in the first snapshot (e.g. invalid paths) are reported at once
+    write_snapshot(1);
+
+#ifdef AR_PTHREAD_SUPPORT
+    if (pthread_create(&m_thread, NULL, &run_wrapper, this)) {
+        throw thread_error("metrics_writer: failed to create thread");
+    }
+
+    m_started = true;
+#endif
+}
+
+
+metrics_writer::~metrics_writer()
+{
+    stop_thread();
+}
+
+
+void metrics_writer::finalize(bool success)
+{
+    stop_thread();
+    try_write_snapshot(success ? 0 : -1);
+}
+
+
+void metrics_writer::stop_thread()
+{
+    {
+        mutex_locker lock(m_lock);
+        m_stop = true;
+    }
+
+#ifdef AR_PTHREAD_SUPPORT
+    if (m_started) {
+        if (pthread_join(m_thread, NULL)) {
+            print_locker lock;
+            std::cerr << "metrics_writer: error joining thread" << std::endl;
+            std::exit(1);
+        }
+
+        m_started = false;
+    }
+#endif
+}
+
+
+#ifdef AR_PTHREAD_SUPPORT
+
+void* metrics_writer::run_wrapper(void* ptr)
+{
+    static_cast<metrics_writer*>(ptr)->run();
+
+    return NULL;
+}
+
+
+void metrics_writer::run()
+{
+    double next_snapshot = get_current_time() + m_interval;
+    while (true) {
+        const double remaining = next_snapshot - get_current_time();
+        if (remaining <= 0) {
+            try_write_snapshot(1);
+            next_snapshot += m_interval * (1 + static_cast<size_t>(-remaining / m_interval));
+            continue;
+        }
+
+        // Sleep in short steps, so that termination is not delayed
+        const double seconds = std::min(remaining, METRICS_POLL_INTERVAL);
+        struct timespec duration;
+        duration.tv_sec = static_cast<time_t>(seconds);
+        duration.tv_nsec = static_cast<long>((seconds - duration.tv_sec) * 1e9);
+        nanosleep(&duration, NULL);
+
+        mutex_locker lock(m_lock);
+        if (m_stop) {
+            break;
+        }
+    }
+}
+
+#endif
+
+
+void metrics_writer::write_snapshot(int state)
+{
+    const double current_time = get_current_time();
+    const size_t reads = get_reads_counter().current();
+    const double seconds = current_time - m_last_time;
+    const double rate = (seconds > 0) ? (reads - m_last_reads) / seconds : 0.0;
+
+    m_last_time = current_time;
+    m_last_reads = reads;
+
+    counter_value_vec counters;
+    {
+        counter_registry& registry = get_registry();
+        mutex_locker lock(registry.lock);
+        for (counter_list::const_iterator it = registry.counters.begin();
+             it != registry.counters.end(); ++it) {
+            counters.push_back(counter_value(**it));
+        }
+    }
+
+    std::stable_sort(counters.begin(), counters.end());
+
+    std::ostringstream stream;
+    stream.precision(6);
+    stream << std::fixed;
+
+    write_metric(stream, "adapterremoval_running",
+                 "1 while running, 0 once finished.", "gauge", state > 0);
+    write_metric(stream, "adapterremoval_failed",
+                 "1 if the run was terminated due to errors.", "gauge", state < 0);
+    write_metric(stream, "adapterremoval_start_time_seconds",
+                 "Time at which the run was started, in seconds since the epoch.",
+                 "gauge", m_start_time);
+    write_metric(stream, "adapterremoval_snapshot_time_seconds",
+                 "Time at which this snapshot was written, in seconds since the epoch.",
+                 "gauge", current_time);
+    write_metric(stream, "adapterremoval_reads_per_second",
+                 "Reads processed per second since the previous snapshot.",
+                 "gauge", rate);
+
+    for (size_t i = 0; i < counters.size(); ++i) {
+        const counter_value& counter = counters.at(i);
+        if (!i || counters.at(i - 1).name != counter.name) {
+            write_header(stream, counter.name, counter.help, "counter");
+        }
+
+        write_sample(stream, counter.name, counter.labels, counter.value);
+    }
+
+    if (m_scheduler) {
+        const step_metrics_vec steps = m_scheduler->get_step_metrics();
+
+        write_header(stream, "adapterremoval_step_queued_chunks",
+                     "Number of chunks waiting to be processed by a step.", "gauge");
+        for (step_metrics_vec::const_iterator it = steps.begin(); it != steps.end(); ++it) {
+            write_sample(stream, "adapterremoval_step_queued_chunks",
+                         get_step_labels(*it), it->queued);
+        }
+
+        write_header(stream, "adapterremoval_step_processed_chunks_total",
+                     "Number of chunks processed by a step.", "counter");
+        for (step_metrics_vec::const_iterator it = steps.begin(); it != steps.end(); ++it) {
+            write_sample(stream, "adapterremoval_step_processed_chunks_total",
+                         get_step_labels(*it), it->processed);
+        }
+
+        write_header(stream, "adapterremoval_step_busy_seconds_total",
+                     "Time spent processing chunks by a step, summed across threads.",
+                     "counter");
+        for (step_metrics_vec::const_iterator it = steps.begin(); it != steps.end(); ++it) {
+            write_sample(stream, "adapterremoval_step_busy_seconds_total",
+                         get_step_labels(*it), it->busy_seconds);
+        }
+    }
+
+    // The snapshot is written to a temporary file, which then replaces the
+    // destination, so that readers never see partially written snapshots
+    const std::string tmp_filename = m_filename + ".tmp";
+    std::ofstream output(tmp_filename.c_str(), std::ios::out | std::ios::trunc);
+    output << stream.str();
+    output.close();
+
+    if (!output) {
+        throw io_error("error writing metrics to '" + tmp_filename + "'", errno);
+    } else if (std::rename(tmp_filename.c_str(), m_filename.c_str())) {
+        throw io_error("error renaming metrics file to '" + m_filename + "'", errno);
+    }
+}
+
+
+void metrics_writer::try_write_snapshot(int state)
+{
+    try {
+        write_snapshot(state);
+    } catch (const io_error& error) {
+        if (!m_warned) {
+            print_locker lock;
+            std::cerr << "\nWARNING: Failed to write metrics snapshot:\n"
+                      << cli_formatter::fmt(error.what()) << std::endl;
+            m_warned = true;
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+bool run_pipeline(const userconfig& config, scheduler& sch)
+{
+    std::auto_ptr<metrics_writer> metrics;
+    if (!config.metrics_file.empty()) {
+        try {
+            metrics.reset(new metrics_writer(config.metrics_file,
+                                             config.metrics_interval,
+                                             &sch));
+        } catch (const std::exception& error) {
+            std::cerr << "Error writing metrics file; aborting:\n"
+                      << cli_formatter::fmt(error.what()) << std::endl;
+            return false;
+        }
+    }
+
+#ifdef AR_TRACE_SUPPORT
+    if (!config.trace_file.empty()) {
+        sch.enable_trace();
+    }
+#endif
+
+    sch.set_thread_pinning(config.pin_threads);
+
+    bool success = sch.run(config.max_threads, config.seed,
+                           config.max_io_threads,
+                           config.max_memory * static_cast<size_t>(1024 * 1024));
+
+    if (metrics.get()) {
+        metrics->finalize(success);
+    }
+
+#ifdef AR_TRACE_SUPPORT
+    const trace_log* trace = sch.get_trace();
+    if (trace) {
+        print_locker lock;
+        trace->print_summary(std::cerr);
+
+        try {
+            trace->write_json(config.trace_file);
+        } catch (const std::exception& error) {
+            std::cerr << "Error writing trace file:\n"
+                      << cli_formatter::fmt(error.what()) << std::endl;
+            success = false;
+        }
+    }
+#endif
+
+    return success;
+}
+
+} // namespace ar
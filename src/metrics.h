@@ -0,0 +1,189 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_METRICS_H
+#define AR_METRICS_H
+
+#include <string>
+
+#include "threads.h"
+
+namespace ar
+{
+
+class scheduler;
+class userconfig;
+
+
+//! Default number of seconds between snapshots written by 'metrics_writer'
+const double METRICS_DEFAULT_INTERVAL = 10.0;
+
+
+/**
+ * Thread-safe counter included in the snapshots written by 'metrics_writer';
+ * counters register themselves on construction, and are removed from
+ * snapshots once destroyed. Counters sharing a name form a single metric,
+ * and must therefore have distinct labels (e.g. 'file="reads.fq"').
+ */
+class metrics_counter
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param name Name of the metric, e.g. "adapterremoval_input_bytes_total".
+     * @param help Short description of the metric.
+     * @param labels Labels identifying this counter; see 'metrics_label'.
+     */
+    metrics_counter(const std::string& name,
+                    const std::string& help,
+                    const std::string& labels = std::string());
+
+    /** Destructor; unregisters the counter. */
+    ~metrics_counter();
+
+    /** Adds 'value' to the counter. */
+    void increment(size_t value = 1);
+
+    /** Returns the current value of the counter. */
+    size_t current() const;
+
+    /** Returns the name of the metric. */
+    const std::string& name() const;
+    /** Returns the description of the metric. */
+    const std::string& help() const;
+    /** Returns the labels identifying this counter. */
+    const std::string& labels() const;
+
+private:
+    //! Not implemented
+    metrics_counter(const metrics_counter&);
+    //! Not implemented
+    metrics_counter& operator=(const metrics_counter&);
+
+    //! Name of the metric
+    const std::string m_name;
+    //! Description of the metric
+    const std::string m_help;
+    //! Labels identifying this counter
+    const std::string m_labels;
+    //! Current value
+    atomic_counter m_value;
+};
+
+
+/** Returns a label of the form key="value", escaping the value as needed. */
+std::string metrics_label(const std::string& key, const std::string& value);
+
+
+/**
+ * Periodically writes a snapshot of all 'metrics_counter's and of the steps
+ * run by a scheduler (see scheduler::get_step_metrics) to a file, using the
+ * Prometheus text format; the file is replaced atomically, and may therefore
+ * be read at any time, e.g. by the node_exporter "textfile" collector.
+ *
+ * Snapshots are written by a background thread every 'interval' seconds, if
+ * threads are supported, and once more by 'finalize'. Errors writing the
+ * first snapshot are reported using 'io_error'; later errors only result in
+ * a warning, so that long runs are not aborted due to the metrics file.
+ */
+class metrics_writer
+{
+public:
+    /** Writes the first snapshot, and starts the background thread. */
+    metrics_writer(const std::string& filename, double interval,
+                   const scheduler* sch);
+
+    /** Stops the background thread, if 'finalize' has not been called. */
+    ~metrics_writer();
+
+    /** Stops the background thread and writes a final snapshot. */
+    void finalize(bool success);
+
+private:
+    //! Not implemented
+    metrics_writer(const metrics_writer&);
+    //! Not implemented
+    metrics_writer& operator=(const metrics_writer&);
+
+    /** Writes a snapshot; 'state' is 1 while running, 0 when done, -1 on error. */
+    void write_snapshot(int state);
+    /** Writes a snapshot, printing a warning on the first failure. */
+    void try_write_snapshot(int state);
+
+    /** Stops and joins the background thread, if running. */
+    void stop_thread();
+
+#ifdef AR_PTHREAD_SUPPORT
+    /** Wrapper function which calls 'run' on the provided writer. */
+    static void* run_wrapper(void* ptr);
+    /** Work function; writes snapshots until stopped. */
+    void run();
+
+    //! Background thread writing snapshots
+    pthread_t m_thread;
+    //! Set if the background thread was started
+    bool m_started;
+#endif
+
+    //! Lock used to control access to 'm_stop'
+    mutex m_lock;
+    //! Set to terminate the background thread
+    bool m_stop;
+    //! Set once a warning has been printed for a failed snapshot
+    bool m_warned;
+
+    //! Destination file
+    const std::string m_filename;
+    //! Seconds between snapshots
+    const double m_interval;
+    //! Scheduler for which step metrics are written; may be NULL
+    const scheduler* m_scheduler;
+
+    //! Time at which the writer was created
+    const double m_start_time;
+    //! Time of the previous snapshot, for calculating current rates
+    double m_last_time;
+    //! Reads processed at the time of the previous snapshot
+    size_t m_last_reads;
+};
+
+
+/**
+ * Counter for reads processed by the program (mates are counted separately);
+ * used to derive the rate of processing in snapshots by 'metrics_writer'.
+ */
+metrics_counter& get_reads_counter();
+
+
+/**
+ * Runs the scheduler using the thread and memory limits set in 'config'. If
+ * --metrics-file is set, metrics snapshots are written during the run, and
+ * if --trace is set, a trace is written and summarized once the run is over.
+ * Returns false if the run failed, or if these files could not be written.
+ */
+bool run_pipeline(const userconfig& config, scheduler& sch);
+
+} // namespace ar
+
+#endif
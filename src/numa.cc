@@ -0,0 +1,225 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "numa.h"
+#include "debug.h"
+
+namespace ar
+{
+
+//! Directory containing the NUMA topology on Linux
+const char* const NUMA_SYSFS_ROOT = "/sys/devices/system/node/";
+
+
+/** Parses a non-negative number in a CPU list; see 'parse_cpu_list'. */
+int parse_cpu_number(const std::string& value, const std::string& list)
+{
+    if (value.empty() || value.size() > 6) {
+        throw std::invalid_argument("invalid CPU list '" + list + "'");
+    }
+
+    int number = 0;
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        if (!std::isdigit(*it)) {
+            throw std::invalid_argument("invalid CPU list '" + list + "'");
+        }
+
+        number = number * 10 + (*it - '0');
+    }
+
+    return number;
+}
+
+
+/** Reads the first line of a file into 'line', returning false on failure. */
+bool read_first_line(const std::string& filename, std::string& line)
+{
+    std::ifstream file(filename.c_str());
+
+    return static_cast<bool>(std::getline(file, line));
+}
+
+
+cpu_vec parse_cpu_list(const std::string& value)
+{
+    std::string list;
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        if (!std::isspace(*it)) {
+            list.push_back(*it);
+        }
+    }
+
+    cpu_vec cpus;
+    std::istringstream stream(list);
+    for (std::string range; std::getline(stream, range, ',');) {
+        const size_t dash = range.find('-');
+        const int first = parse_cpu_number(range.substr(0, dash), value);
+        int last = first;
+        if (dash != std::string::npos) {
+            last = parse_cpu_number(range.substr(dash + 1), value);
+        }
+
+        if (last < first) {
+            throw std::invalid_argument("invalid CPU list '" + value + "'");
+        }
+
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    if (!list.empty() && *list.rbegin() == ',') {
+        throw std::invalid_argument("invalid CPU list '" + value + "'");
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+    return cpus;
+}
+
+
+numa_node_vec read_numa_nodes()
+{
+    cpu_vec allowed = get_thread_cpus();
+    if (allowed.empty()) {
+        return numa_node_vec();
+    }
+
+    numa_node_vec nodes;
+    try {
+        std::string line;
+        if (read_first_line(std::string(NUMA_SYSFS_ROOT) + "online", line)) {
+            const cpu_vec node_ids = parse_cpu_list(line);
+            for (cpu_vec::const_iterator it = node_ids.begin(); it != node_ids.end(); ++it) {
+                std::ostringstream filename;
+                filename << NUMA_SYSFS_ROOT << "node" << *it << "/cpulist";
+
+                if (!read_first_line(filename.str(), line)) {
+                    continue;
+                }
+
+                const cpu_vec node_cpus = parse_cpu_list(line);
+                cpu_vec cpus;
+                std::set_intersection(node_cpus.begin(), node_cpus.end(),
+                                      allowed.begin(), allowed.end(),
+                                      std::back_inserter(cpus));
+                if (!cpus.empty()) {
+                    nodes.push_back(cpus);
+                }
+            }
+        }
+    } catch (const std::invalid_argument&) {
+        // Malformed topology; fall back to treating all CPUs as one node
+        nodes.clear();
+    }
+
+    if (nodes.empty()) {
+        nodes.push_back(allowed);
+    }
+
+    return nodes;
+}
+
+
+std::vector<size_t> assign_numa_nodes(const numa_node_vec& nodes, size_t nthreads)
+{
+    AR_DEBUG_ASSERT(!nodes.empty());
+
+    std::vector<size_t> assignments;
+    while (assignments.size() < nthreads) {
+        for (size_t node = 0; node < nodes.size(); ++node) {
+            for (size_t i = 0; i < nodes.at(node).size() && assignments.size() < nthreads; ++i) {
+                assignments.push_back(node);
+            }
+        }
+    }
+
+    return assignments;
+}
+
+
+#ifdef __linux__
+
+cpu_vec get_thread_cpus()
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+
+    cpu_vec cpus;
+    if (!sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    return cpus;
+}
+
+
+bool set_thread_cpus(const cpu_vec& cpus)
+{
+    AR_DEBUG_ASSERT(!cpus.empty());
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (cpu_vec::const_iterator it = cpus.begin(); it != cpus.end(); ++it) {
+        if (*it < 0 || *it >= CPU_SETSIZE) {
+            return false;
+        }
+
+        CPU_SET(*it, &cpuset);
+    }
+
+    return !sched_setaffinity(0, sizeof(cpuset), &cpuset);
+}
+
+#else
+
+cpu_vec get_thread_cpus()
+{
+    return cpu_vec();
+}
+
+
+bool set_thread_cpus(const cpu_vec&)
+{
+    return false;
+}
+
+#endif
+
+} // namespace ar
@@ -0,0 +1,81 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_NUMA_H
+#define AR_NUMA_H
+
+#include <string>
+#include <vector>
+
+namespace ar
+{
+
+typedef std::vector<int> cpu_vec;
+//! CPUs belonging to each NUMA node, as returned by 'read_numa_nodes'
+typedef std::vector<cpu_vec> numa_node_vec;
+
+
+/**
+ * Parses a list of CPUs (or NUMA nodes) in the format used by the Linux kernel,
+ * e.g. "0-3,8,10-11", returning the sorted list of numbers; an empty (or all
+ * whitespace) string results in an empty list. Throws std::invalid_argument if
+ * the list is malformed.
+ */
+cpu_vec parse_cpu_list(const std::string& value);
+
+
+/**
+ * Returns the CPUs of each NUMA node that the process is allowed to run on,
+ * excluding nodes with no such CPUs. All allowed CPUs are returned as a
+ * single node if the NUMA topology is unavailable, and an empty list is
+ * returned if the CPU affinity of threads cannot be set on this platform.
+ */
+numa_node_vec read_numa_nodes();
+
+
+/**
+ * Assigns 'nthreads' threads to NUMA nodes, returning the index of the node
+ * assigned to each thread. Nodes are filled in order, with one thread per
+ * CPU, so that threads share a node whenever possible; once every CPU has
+ * been assigned a thread, assignment starts over from the first node.
+ */
+std::vector<size_t> assign_numa_nodes(const numa_node_vec& nodes, size_t nthreads);
+
+
+/**
+ * Returns the CPUs that the calling thread may run on, or an empty list if
+ * the CPU affinity of threads is not supported on this platform.
+ */
+cpu_vec get_thread_cpus();
+
+
+/**
+ * Restricts the calling thread to the given (non-empty list of) CPUs; threads
+ * created by this thread afterwards inherit this restriction. Returns false if
+ * this is not supported or if the affinity could not be set.
+ */
+bool set_thread_cpus(const cpu_vec& cpus);
+
+} // namespace ar
+
+#endif
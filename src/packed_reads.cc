@@ -0,0 +1,231 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <cstring>
+
+#include "debug.h"
+#include "fastq_enc.h"
+#include "packed_reads.h"
+
+namespace ar
+{
+
+//! Nucleotides for each 4-bit code; codes greater than 4 are not used
+const char PACKED_CODE_TO_BASE[] = "ACGTNNNNNNNNNNNN";
+//! Phred scores for each bin; see 'bin_phred_score'
+const char PACKED_BIN_TO_SCORE[] = { 0, 1, 6, 15, 22, 27, 33, 37, 40,
+                                     40, 40, 40, 40, 40, 40, 40 };
+
+
+/** Returns the 4-bit code of a nucleotide; other characters are stored as N. */
+inline unsigned pack_nucleotide(char nt)
+{
+    switch (nt) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return 4;
+    }
+}
+
+
+/** Returns the bin of a Phred score; see PACKED_BIN_TO_SCORE. */
+inline unsigned pack_score(int score)
+{
+    if (score < 2) {
+        return score < 0 ? 0 : score;
+    } else if (score < 10) {
+        return 2;
+    } else if (score < 20) {
+        return 3;
+    } else if (score < 25) {
+        return 4;
+    } else if (score < 30) {
+        return 5;
+    } else if (score < 35) {
+        return 6;
+    } else if (score < 40) {
+        return 7;
+    }
+
+    return 8;
+}
+
+
+/** Packs bases, two per byte, appending (length + 1) / 2 bytes to 'dst'. */
+void pack_nucleotides(std::string& dst, const std::string& sequence)
+{
+    const size_t length = sequence.size();
+    const size_t offset = dst.size();
+    dst.resize(offset + (length + 1) / 2);
+
+    for (size_t i = 0; i < length; i += 2) {
+        const unsigned low = (i + 1 < length) ? pack_nucleotide(sequence[i + 1]) : 0;
+        dst[offset + i / 2] = static_cast<char>((pack_nucleotide(sequence[i]) << 4) | low);
+    }
+}
+
+
+/** Packs Phred+33 encoded scores into bin indices; see 'pack_nucleotides'. */
+void pack_scores(std::string& dst, const std::string& qualities)
+{
+    const size_t length = qualities.size();
+    const size_t offset = dst.size();
+    dst.resize(offset + (length + 1) / 2);
+
+    for (size_t i = 0; i < length; i += 2) {
+        const unsigned high = pack_score(qualities[i] - PHRED_OFFSET_33);
+        const unsigned low = (i + 1 < length) ? pack_score(qualities[i + 1] - PHRED_OFFSET_33) : 0;
+        dst[offset + i / 2] = static_cast<char>((high << 4) | low);
+    }
+}
+
+
+/** Returns the nth 4-bit value in 'src'; high bits come first. */
+inline unsigned get_nibble(const char* src, size_t nth)
+{
+    return (static_cast<unsigned char>(src[nth / 2]) >> ((nth % 2) ? 0 : 4)) & 0xf;
+}
+
+
+int bin_phred_score(int score)
+{
+    return PACKED_BIN_TO_SCORE[pack_score(score)];
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+packed_reads::packed_reads()
+  : m_headers()
+  , m_sequences()
+  , m_qualities()
+  , m_header_lengths()
+  , m_lengths()
+  , m_binned(false)
+{
+}
+
+
+void packed_reads::clear()
+{
+    m_headers.clear();
+    m_sequences.clear();
+    m_qualities.clear();
+    m_header_lengths.clear();
+    m_lengths.clear();
+    m_binned = false;
+}
+
+
+size_t packed_reads::size() const
+{
+    return m_lengths.size();
+}
+
+
+bool packed_reads::empty() const
+{
+    return m_lengths.empty();
+}
+
+
+void packed_reads::add(const fastq& read, read_packing packing)
+{
+    AR_DEBUG_ASSERT(packing != rp_none);
+    AR_DEBUG_ASSERT(empty() || m_binned == (packing == rp_binned));
+    m_binned = (packing == rp_binned);
+
+    m_headers.append(read.header());
+    m_header_lengths.push_back(read.header().size());
+    m_lengths.push_back(read.length());
+
+    pack_nucleotides(m_sequences, read.sequence());
+    if (m_binned) {
+        pack_scores(m_qualities, read.qualities());
+    } else {
+        m_qualities.append(read.qualities());
+    }
+}
+
+
+void packed_reads::add(const fastq_vec& reads, read_packing packing)
+{
+    for (fastq_vec::const_iterator it = reads.begin(); it != reads.end(); ++it) {
+        add(*it, packing);
+    }
+}
+
+
+void packed_reads::unpack(fastq_vec& dst, fastq_vec& spare) const
+{
+    AR_DEBUG_ASSERT(dst.empty());
+    dst.swap(spare);
+    dst.resize(size());
+
+    const char* header = m_headers.data();
+    const char* packed_sequence = m_sequences.data();
+    const char* packed_qualities = m_qualities.data();
+
+    for (size_t nth = 0; nth < size(); ++nth) {
+        fastq& read = dst.at(nth);
+        const size_t length = m_lengths.at(nth);
+        read.set_header(header, m_header_lengths.at(nth));
+        header += m_header_lengths.at(nth);
+
+        char* sequence = NULL;
+        char* qualities = NULL;
+        read.resize(length, sequence, qualities);
+
+        for (size_t i = 0; i < length; ++i) {
+            sequence[i] = PACKED_CODE_TO_BASE[get_nibble(packed_sequence, i)];
+        }
+
+        if (m_binned) {
+            for (size_t i = 0; i < length; ++i) {
+                const unsigned bin = get_nibble(packed_qualities, i);
+                qualities[i] = static_cast<char>(PACKED_BIN_TO_SCORE[bin] + PHRED_OFFSET_33);
+            }
+
+            packed_qualities += (length + 1) / 2;
+        } else {
+            if (length) {
+                std::memcpy(qualities, packed_qualities, length);
+            }
+
+            packed_qualities += length;
+        }
+
+        packed_sequence += (length + 1) / 2;
+    }
+}
+
+
+size_t packed_reads::bytes() const
+{
+    return m_headers.size() + m_sequences.size() + m_qualities.size()
+        + (m_header_lengths.size() + m_lengths.size()) * sizeof(size_t);
+}
+
+} // namespace ar
@@ -0,0 +1,103 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_PACKED_READS_H
+#define AR_PACKED_READS_H
+
+#include <string>
+#include <vector>
+
+#include "commontypes.h"
+#include "fastq.h"
+
+namespace ar
+{
+
+/**
+ * Returns the score used for Phred score 'score' with Illumina 8-level
+ * binning: 2-9 -> 6, 10-19 -> 15, 20-24 -> 22, 25-29 -> 27, 30-34 -> 33,
+ * 35-39 -> 37, and 40+ -> 40. Scores of 0 and 1 are kept as is.
+ */
+int bin_phred_score(int score);
+
+
+/**
+ * Compact storage of FASTQ records waiting to be processed.
+ *
+ * Nucleotides are stored as 4-bit codes, two per byte, and quality scores
+ * either as is (one byte per base) or, if binned, as the 4-bit index of the
+ * bin (see 'bin_phred_score'). Records therefore take up 1.5 or 1 bytes per
+ * base, plus the header, instead of the 2 bytes per base (and the overhead
+ * of 3 strings) of a 'fastq' record. All records are stored contiguously in
+ * a few buffers, which are retained when the container is cleared.
+ */
+class packed_reads
+{
+public:
+    /** Constructs an empty container. */
+    packed_reads();
+
+    /** Removes all records, but retains allocated buffers. */
+    void clear();
+
+    /** Returns the number of records. */
+    size_t size() const;
+    /** Returns true if there are no records. */
+    bool empty() const;
+
+    /**
+     * Appends a record; qualities are binned if 'packing' is rp_binned. The
+     * same packing must be used for all records until the next 'clear'.
+     */
+    void add(const fastq& read, read_packing packing);
+    /** Appends every record in 'reads'; see above. */
+    void add(const fastq_vec& reads, read_packing packing);
+
+    /**
+     * Replaces the contents of 'dst' with the unpacked records; records in
+     * 'spare' (left by earlier uses of 'dst') are overwritten in place, so
+     * that the memory used by these may be re-used.
+     */
+    void unpack(fastq_vec& dst, fastq_vec& spare) const;
+
+    /** Returns the approximate number of bytes used by the records. */
+    size_t bytes() const;
+
+private:
+    //! Concatenated headers of all records
+    std::string m_headers;
+    //! Concatenated 4-bit nucleotides; each record starts on a new byte
+    std::string m_sequences;
+    //! Concatenated (binned) scores; each record starts on a new byte
+    std::string m_qualities;
+    //! Length of the header of each record
+    size_vec m_header_lengths;
+    //! Length of the sequence of each record
+    size_vec m_lengths;
+    //! Indicates that scores are stored as 4-bit bin indices
+    bool m_binned;
+};
+
+} // namespace ar
+
+#endif
@@ -24,6 +24,7 @@
 
 #include <cerrno>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
 #include <queue>
 #include <stdexcept>
@@ -33,6 +34,8 @@
 #include "debug.h"
 #include "scheduler.h"
 #include "strutils.h"
+#include "timer.h"
+#include "trace.h"
 
 namespace ar
 {
@@ -58,6 +61,12 @@ analytical_chunk::~analytical_chunk()
 }
 
 
+size_t analytical_chunk::bytes() const
+{
+    return 0;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // analytical_step
 
@@ -72,6 +81,38 @@ analytical_step::~analytical_step()
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// pipeline_barrier
+
+pipeline_barrier::pipeline_barrier()
+    : m_requested(false)
+{
+}
+
+pipeline_barrier::~pipeline_barrier()
+{
+}
+
+
+void pipeline_barrier::request()
+{
+    m_requested = true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// step_metrics
+
+step_metrics::step_metrics()
+    : step_id(0)
+    , name()
+    , queued(0)
+    , processed(0)
+    , busy_seconds(0)
+{
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // scheduler
 
@@ -82,6 +123,9 @@ struct data_chunk
                analytical_chunk* data_ = NULL)
       : chunk_id(chunk_id_)
       , data(data_)
+#ifdef AR_TRACE_SUPPORT
+      , queued_time(0)
+#endif
       , nrefs(NULL)
     {
         increment_refs();
@@ -90,6 +134,9 @@ struct data_chunk
     data_chunk(const data_chunk& parent, analytical_chunk* data = NULL)
       : chunk_id(parent.chunk_id)
       , data(data ? data : parent.data)
+#ifdef AR_TRACE_SUPPORT
+      , queued_time(parent.queued_time)
+#endif
       , nrefs(parent.nrefs)
     {
         increment_refs();
@@ -109,6 +156,9 @@ struct data_chunk
         nrefs = other.nrefs;
         chunk_id = other.chunk_id;
         data = other.data;
+#ifdef AR_TRACE_SUPPORT
+        queued_time = other.queued_time;
+#endif
 
         return *this;
     }
@@ -127,15 +177,31 @@ struct data_chunk
         return false;
     }
 
-    bool unique()
+    /**
+     * Releases the reference held by this chunk, returning true if it was the
+     * last reference; unlike checking the count and then releasing, this
+     * ensures that exactly one holder of a shared chunk sees the last release.
+     */
+    bool release()
     {
-        return nrefs->current() == 1;
+        const bool last = !nrefs->decrement();
+        if (last) {
+            delete nrefs;
+        }
+
+        nrefs = NULL;
+
+        return last;
     }
 
     //! Strictly increasing counter; used to sort chunks for 'ordered' tasks
     unsigned chunk_id;
     //! Use generated data; is not freed by this struct
     analytical_chunk* data;
+#ifdef AR_TRACE_SUPPORT
+    //! Time at which the chunk was queued; only set when tracing
+    double queued_time;
+#endif
 
 private:
     void increment_refs() const
@@ -149,7 +215,7 @@ private:
 
     void decrement_refs() const
     {
-        if (nrefs->decrement() == 0) {
+        if (nrefs && nrefs->decrement() == 0) {
             delete nrefs;
             nrefs = NULL;
         }
@@ -162,12 +228,17 @@ private:
 
 struct scheduler_step
 {
-    scheduler_step(analytical_step* value)
+    scheduler_step(size_t id_, const std::string& name_, analytical_step* value)
       : lock()
+      , id(id_)
+      , name(name_)
       , ptr(value)
       , current_chunk(0)
       , last_chunk(0)
       , queue()
+      , queued(0)
+      , processed(0)
+      , busy_usec(0)
     {
     }
 
@@ -196,6 +267,10 @@ struct scheduler_step
 
     //! Mutex used to control access to step
     mutex lock;
+    //! ID of the step, i.e. the index of the step in the pipeline
+    const size_t id;
+    //! Name of the step; used to report metrics
+    const std::string name;
     //! Analytical step implementation
     std::auto_ptr<analytical_step> ptr;
     //! The current chunk to be processed
@@ -206,6 +281,13 @@ struct scheduler_step
     //! (Ordered) vector of chunks to be processed
     std::priority_queue<data_chunk> queue;
 
+    //! Number of chunks queued for this step, but not yet processed
+    atomic_counter queued;
+    //! Number of chunks processed by this step
+    atomic_counter processed;
+    //! Time spent processing chunks, in microseconds
+    atomic_counter busy_usec;
+
 private:
     //! Not implemented
     scheduler_step(const scheduler_step&);
@@ -214,12 +296,95 @@ private:
 };
 
 
+/**
+ * Per-thread queue of chunks for unordered steps not involving IO. The owning
+ * thread adds tasks at the back and takes tasks from the front of the queue,
+ * so that chunks are processed in order when running with a single thread,
+ * while other threads steal tasks from the back, once their queue is empty.
+ */
+struct scheduler_worker
+{
+    typedef std::pair<scheduler_step*, data_chunk> task;
+    typedef std::deque<task> task_deque;
+
+    scheduler_worker()
+      : lock()
+      , tasks()
+      , node(0)
+      , victims()
+    {
+    }
+
+    /** Deletes any remaining chunks. */
+    ~scheduler_worker() {
+        while (!tasks.empty()) {
+            delete tasks.back().second.data;
+            tasks.pop_back();
+        }
+    }
+
+    //! Mutex used to control access to the queue
+    mutex lock;
+    //! Queued steps and the chunks to be processed by those steps
+    task_deque tasks;
+    //! NUMA node of the thread using this queue; 0 unless threads are pinned
+    size_t node;
+    //! Other workers to steal tasks from, in order of preference
+    std::vector<size_t> victims;
+
+private:
+    //! Not implemented
+    scheduler_worker(const scheduler_worker&);
+    //! Not implemented
+    scheduler_worker& operator=(const scheduler_worker&);
+};
+
+
+/**
+ * Locks a mutex like 'mutex_locker'; if tracing is enabled (i.e. 'event' is
+ * not NULL), the time spent waiting for the mutex is added to the event.
+ */
+class traced_locker
+{
+public:
+#ifdef AR_TRACE_SUPPORT
+    traced_locker(mutex& to_lock, trace_event* event)
+      : m_start(event ? get_current_time() : 0.0)
+      , m_locker(to_lock)
+    {
+        if (event) {
+            event->lock_wait += get_current_time() - m_start;
+        }
+    }
+#else
+    traced_locker(mutex& to_lock, trace_event*)
+      : m_locker(to_lock)
+    {
+    }
+#endif
+
+private:
+    //! Not implemented
+    traced_locker(const traced_locker&);
+    //! Not implemented
+    traced_locker& operator=(const traced_locker&);
+
+#ifdef AR_TRACE_SUPPORT
+    //! Time at which locking was attempted
+    const double m_start;
+#endif
+    //! The lock held
+    mutex_locker m_locker;
+};
+
+
 /** Simple structure used to pass parameters to threads. */
 struct thread_info
 {
-    thread_info(unsigned seed_, scheduler* sch_)
+    thread_info(unsigned seed_, scheduler* sch_, size_t worker_)
       : seed(seed_)
       , sch(sch_)
+      , worker(worker_)
     {
     }
 
@@ -227,6 +392,8 @@ struct thread_info
     unsigned seed;
     //! Pointer to current scheduler
     scheduler* sch;
+    //! Index of the worker queue used by the thread
+    size_t worker;
 };
 
 
@@ -242,8 +409,24 @@ scheduler::scheduler()
   , m_queue_lock()
   , m_queue_calc()
   , m_queue_io()
-  , m_io_active(false)
+  , m_io_active(0)
+  , m_max_io(1)
   , m_live_chunks(0)
+  , m_workers()
+  , m_idle_threads(0)
+  , m_memory_lock()
+  , m_max_memory(0)
+  , m_queued_bytes(0)
+  , m_first_step_paused(false)
+  , m_pin_threads(false)
+  , m_numa_nodes()
+  , m_barrier(NULL)
+  , m_barrier_pending(false)
+#ifdef AR_TRACE_SUPPORT
+  , m_trace_enabled(false)
+  , m_trace()
+  , m_queue_io_times()
+#endif
 {
 }
 
@@ -260,7 +443,7 @@ scheduler::~scheduler()
 }
 
 
-void scheduler::add_step(size_t step_id, analytical_step* step)
+void scheduler::add_step(size_t step_id, const std::string& name, analytical_step* step)
 {
     mutex_locker lock(m_running);
     if (m_steps.size() <= step_id) {
@@ -270,12 +453,13 @@ void scheduler::add_step(size_t step_id, analytical_step* step)
     AR_DEBUG_ASSERT(step);
     AR_DEBUG_ASSERT(!m_steps.at(step_id));
 
-    m_steps.at(step_id) = new scheduler_step(step);
+    m_steps.at(step_id) = new scheduler_step(step_id, name, step);
 }
 
 
 
-bool scheduler::run(int nthreads, unsigned seed)
+bool scheduler::run(int nthreads, unsigned seed, unsigned max_io,
+                    size_t max_memory)
 {
     AR_DEBUG_ASSERT(!m_steps.empty());
     AR_DEBUG_ASSERT(m_steps.front());
@@ -289,22 +473,54 @@ bool scheduler::run(int nthreads, unsigned seed)
         }
     }
 
+    for (int i = 0; i < nthreads; ++i) {
+        m_workers.push_back(new scheduler_worker());
+    }
+
+    assign_worker_nodes();
+    // The main thread is bound to the node of the first worker while running
+    const cpu_vec main_thread_cpus = m_numa_nodes.empty() ? cpu_vec() : get_thread_cpus();
+
+#ifdef AR_TRACE_SUPPORT
+    m_queue_io_times.clear();
+    if (m_trace_enabled) {
+        string_vec names;
+        for (pipeline::iterator it = m_steps.begin(); it != m_steps.end(); ++it) {
+            names.push_back(*it ? (*it)->name : std::string());
+        }
+
+        m_trace.reset(new trace_log(names, nthreads));
+    }
+#endif
+
     for (unsigned task = 3 * nthreads; task; --task) {
-        m_steps.front()->queue.push(data_chunk(m_chunk_counter++));
+        data_chunk chunk(m_chunk_counter++);
+        mark_queued(m_steps.front(), chunk);
+        m_steps.front()->queue.push(chunk);
     }
 
     queue_analytical_step(m_steps.front(), 0);
 
-    m_io_active = false;
+    m_io_active = 0;
+    m_max_io = max_io ? max_io : nthreads;
+    m_max_memory = max_memory;
+    m_queued_bytes = 0;
+    m_first_step_paused = false;
+    m_barrier_pending = false;
     m_errors = !initialize_threads(nthreads - 1, seed + 1);
 
     // Signal for threads to start, or terminate in case of errors
     signal_threads();
 
-    thread_info* info = new thread_info(seed, this);
+    thread_info* info = new thread_info(seed, this, 0);
     m_errors = !run_wrapper(info) || m_errors;
     m_errors = !join_threads() || m_errors;
 
+    if (!main_thread_cpus.empty()) {
+        set_thread_cpus(main_thread_cpus);
+        set_thread_node(0);
+    }
+
     if (!m_errors) {
         for (pipeline::iterator it = m_steps.begin(); it != m_steps.end(); ++it) {
             if (*it) {
@@ -320,12 +536,76 @@ bool scheduler::run(int nthreads, unsigned seed)
                 m_errors = true;
             }
         }
+
+        for (worker_vec::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+            if (!(*it)->tasks.empty()) {
+                print_locker lock;
+                std::cerr << "ERROR: Not all parts run for worker " << it - m_workers.begin()
+                          << "; " << (*it)->tasks.size() << " left ..." << std::endl;
+                m_errors = true;
+            }
+        }
+    }
+
+    for (worker_vec::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        delete *it;
     }
 
+    m_workers.clear();
+
     return !m_errors;
 }
 
 
+void scheduler::set_barrier(pipeline_barrier* barrier)
+{
+    mutex_locker lock(m_running);
+    m_barrier = barrier;
+}
+
+
+void scheduler::set_thread_pinning(bool enabled)
+{
+    mutex_locker lock(m_running);
+    m_pin_threads = enabled;
+}
+
+
+#ifdef AR_TRACE_SUPPORT
+
+void scheduler::enable_trace()
+{
+    mutex_locker lock(m_running);
+    m_trace_enabled = true;
+}
+
+
+const trace_log* scheduler::get_trace() const
+{
+    return m_trace.get();
+}
+
+#endif
+
+
+step_metrics_vec scheduler::get_step_metrics() const
+{
+    step_metrics_vec metrics;
+    for (pipeline::const_iterator it = m_steps.begin(); it != m_steps.end(); ++it) {
+        if (*it) {
+            metrics.push_back(step_metrics());
+            metrics.back().step_id = (*it)->id;
+            metrics.back().name = (*it)->name;
+            metrics.back().queued = (*it)->queued.current();
+            metrics.back().processed = (*it)->processed.current();
+            metrics.back().busy_seconds = (*it)->busy_usec.current() / 1e6;
+        }
+    }
+
+    return metrics;
+}
+
+
 void* scheduler::run_wrapper(void* ptr)
 {
     std::auto_ptr<thread_info> info(reinterpret_cast<thread_info*>(ptr));
@@ -335,7 +615,9 @@ void* scheduler::run_wrapper(void* ptr)
     srandom(info->seed);
 
     try {
-        return sch->do_run();
+        sch->bind_worker_thread(info->worker);
+
+        return sch->do_run(info->worker);
     } catch (const thread_abort&) {
         // Error messaging is assumed to have been done by thrower
     } catch (const std::exception& error) {
@@ -354,39 +636,82 @@ void* scheduler::run_wrapper(void* ptr)
 }
 
 
-void* scheduler::do_run()
+void* scheduler::do_run(size_t worker)
 {
     // Wait to allow early termination in case of errors during setup
     m_condition.wait();
 
     while (!m_errors) {
         scheduler_step* current_step = NULL;
+        data_chunk chunk;
+
+#ifdef AR_TRACE_SUPPORT
+        trace_event trace;
+        trace_event* const event = m_trace.get() ? &trace : NULL;
+#else
+        trace_event* const event = NULL;
+#endif
+
+        // Tasks queued by this thread are processed first, without locking
+        // any shared queues
+        if (pop_task(worker, current_step, chunk)) {
+            remove_queued_bytes(chunk.data);
+            execute_analytical_step(worker, current_step, chunk, event);
+            continue;
+        }
+
+        bool stolen = false;
+        bool signalled = false;
 
         {
-            mutex_locker lock(m_queue_lock);
+            traced_locker lock(m_queue_lock, event);
 
             // Try to keep the disk busy by preferring IO chunks
-            if (m_io_active || m_queue_io.empty()) {
-                if (!m_queue_calc.empty()) {
-                    current_step = m_queue_calc.front();
-                    m_queue_calc.pop_front();
-                } else if (!m_live_chunks) {
+            if (m_io_active < m_max_io && !m_queue_io.empty()) {
+                current_step = m_queue_io.front();
+                m_queue_io.pop_front();
+                m_io_active++;
+
+#ifdef AR_TRACE_SUPPORT
+                if (event) {
+                    event->io_wait = get_current_time() - m_queue_io_times.front();
+                    m_queue_io_times.pop_front();
+                }
+#endif
+            } else if (!m_queue_calc.empty()) {
+                current_step = m_queue_calc.front();
+                m_queue_calc.pop_front();
+            } else {
+                // The thread is registered as idle before checking the worker
+                // queues, so that tasks queued after the check will wake it
+                m_idle_threads.increment();
+
+                if (steal_task(worker, current_step, chunk)) {
+                    stolen = true;
+                    // Failure means that another thread is about to signal
+                    signalled = !m_idle_threads.try_decrement();
+                } else if (!m_live_chunks.current()) {
                     // Nothing left to do at all
                     break;
                 }
-            } else {
-                current_step = m_queue_io.front();
-                m_queue_io.pop_front();
-                m_io_active = true;
             }
         }
 
-        if (current_step) {
-            execute_analytical_step(current_step);
-        } else {
-            // Nothing to do yet ...
+        if (signalled || !current_step) {
+            // Nothing to do yet, or consume signal meant for this thread
             m_condition.wait();
         }
+
+        if (!current_step) {
+            continue;
+        } else if (!stolen) {
+            traced_locker lock(current_step->lock, event);
+            chunk = current_step->queue.top();
+            current_step->queue.pop();
+        }
+
+        remove_queued_bytes(chunk.data);
+        execute_analytical_step(worker, current_step, chunk, event);
     }
 
     // Signal any waiting threads
@@ -396,74 +721,108 @@ void* scheduler::do_run()
 }
 
 
-void scheduler::execute_analytical_step(scheduler_step* step)
+void scheduler::execute_analytical_step(size_t worker, scheduler_step* step,
+                                        data_chunk& chunk, trace_event* event)
 {
-    data_chunk chunk;
-
-    {
-        mutex_locker lock(step->lock);
-        chunk = step->queue.top();
-        step->queue.pop();
-    }
+    step->queued.decrement();
 
+    const double start_time = get_current_time();
     chunk_vec chunks = step->ptr->process(chunk.data);
+    const double end_time = get_current_time();
+    step->busy_usec.increment(static_cast<size_t>((end_time - start_time) * 1e6));
+    step->processed.increment();
 
     // Unlock use of IO steps immediately after finishing processing
     if (step->ptr->file_io()) {
-        mutex_locker lock(m_queue_lock);
-        m_io_active = false;
+        traced_locker lock(m_queue_lock, event);
+        m_io_active--;
         if (!m_queue_io.empty()) {
-            m_condition.signal();
+            wake_idle_thread();
         }
     }
 
+    if (step == m_steps.front() && m_barrier && m_barrier->m_requested) {
+        m_barrier->m_requested = false;
+
+        // Held until the barrier has been run, so that threads do not exit
+        // once the pipeline has been drained; see 'run_barrier'
+        m_live_chunks.increment();
+
+        traced_locker lock(step->lock, event);
+        m_barrier_pending = true;
+    }
+
     // Schedule each of the resulting blocks
     for (chunk_vec::iterator it = chunks.begin(); it != chunks.end(); ++it) {
         scheduler_step* other_step = m_steps.at(it->first);
         AR_DEBUG_ASSERT(other_step != NULL);
 
-        mutex_locker lock(other_step->lock);
         // Inherit reference count from source chunk
         data_chunk next_chunk(chunk, it->second);
-        if (step->ptr->get_ordering() == analytical_step::ordered) {
-            // Ordered steps are allowed to not return results, so the chunk
-            // numbering is remembered for down-stream steps
-            next_chunk.chunk_id = other_step->last_chunk++;
-        }
+        add_queued_bytes(next_chunk.data);
+
+        if (other_step->ptr->get_ordering() == analytical_step::unordered
+            && !other_step->ptr->file_io()) {
+            if (step->ptr->get_ordering() == analytical_step::ordered) {
+                traced_locker lock(other_step->lock, event);
+                next_chunk.chunk_id = other_step->last_chunk++;
+            }
+
+            mark_queued(other_step, next_chunk);
+            push_task(worker, other_step, next_chunk);
+        } else {
+            traced_locker lock(other_step->lock, event);
+            if (step->ptr->get_ordering() == analytical_step::ordered) {
+                // Ordered steps are allowed to not return results, so the chunk
+                // numbering is remembered for down-stream steps
+                next_chunk.chunk_id = other_step->last_chunk++;
+            }
 
-        other_step->queue.push(next_chunk);
-        queue_analytical_step(other_step, next_chunk.chunk_id);
+            mark_queued(other_step, next_chunk);
+            other_step->queue.push(next_chunk);
+            queue_analytical_step(other_step, next_chunk.chunk_id);
+        }
     }
 
     // Reschedule current step if ordered and next chunk is available
     {
         if (step->ptr->get_ordering() == analytical_step::ordered) {
-            mutex_locker lock(step->lock);
+            traced_locker lock(step->lock, event);
 
             step->current_chunk++;
-            if (!step->queue.empty()) {
+            if (step->queue.empty()) {
+                // Nothing to do
+            } else if (step == m_steps.front()) {
+                queue_first_step_locked(step->queue.top().chunk_id);
+            } else {
                 queue_analytical_step(step, step->queue.top().chunk_id);
             }
         }
     }
 
-    // End of the line for this chunk; re-schedule first step
-    if (chunks.empty() && chunk.unique() && step != m_steps.front()) {
-        scheduler_step* other_step = m_steps.front();
-
-        mutex_locker lock(other_step->lock);
-        other_step->queue.push(data_chunk(m_chunk_counter));
-
-        queue_analytical_step(other_step, m_chunk_counter);
+    // End of the line for this chunk (including any derived chunks, which may
+    // have finished first on other threads); re-schedule first step, unless
+    // the first step itself produced nothing (EOF)
+    if (chunk.release() && !(chunks.empty() && step == m_steps.front())) {
+        queue_first_step();
+    }
 
-        m_chunk_counter++;
+#ifdef AR_TRACE_SUPPORT
+    if (event) {
+        event->step_id = step->id;
+        event->start = start_time;
+        event->duration = end_time - start_time;
+        event->queued = start_time - chunk.queued_time;
+        m_trace->add(worker, *event);
     }
+#endif
 
     // Counter is decremented last, so that threads do not exit while new
-    // parts are being scheduled.
-    {
-        mutex_locker lock(m_queue_lock);
-        m_live_chunks--;
+    // parts are being scheduled. A count of one means that only the hold
+    // taken for a pending barrier remains, i.e. that the pipeline is drained;
+    // the flag is checked again while holding the lock by 'run_barrier'
+    if (m_live_chunks.decrement() == 1 && m_barrier_pending) {
+        run_barrier();
     }
 }
 
@@ -474,16 +833,249 @@ void scheduler::queue_analytical_step(scheduler_step* step, size_t current)
         mutex_locker lock(m_queue_lock);
         if (step->ptr->file_io()) {
             m_queue_io.push_back(step);
+
+#ifdef AR_TRACE_SUPPORT
+            if (m_trace.get()) {
+                m_queue_io_times.push_back(get_current_time());
+            }
+#endif
         } else {
             m_queue_calc.push_back(step);
         }
 
-        m_live_chunks++;
+        m_live_chunks.increment();
+        wake_idle_thread();
+    }
+}
+
+
+void scheduler::push_task(size_t worker, scheduler_step* step, const data_chunk& chunk)
+{
+    // Counted before being queued, so that threads do not exit prematurely
+    m_live_chunks.increment();
+
+    {
+        scheduler_worker* queue = m_workers.at(worker);
+        mutex_locker lock(queue->lock);
+        queue->tasks.push_back(scheduler_worker::task(step, chunk));
+    }
+
+    wake_idle_thread();
+}
+
+
+bool scheduler::pop_task(size_t worker, scheduler_step*& step, data_chunk& chunk)
+{
+    scheduler_worker* queue = m_workers.at(worker);
+    mutex_locker lock(queue->lock);
+    if (queue->tasks.empty()) {
+        return false;
+    }
+
+    step = queue->tasks.front().first;
+    chunk = queue->tasks.front().second;
+    queue->tasks.pop_front();
+
+    return true;
+}
+
+
+bool scheduler::steal_task(size_t worker, scheduler_step*& step, data_chunk& chunk)
+{
+    const std::vector<size_t>& victims = m_workers.at(worker)->victims;
+    for (size_t i = 0; i < victims.size(); ++i) {
+        scheduler_worker* queue = m_workers.at(victims.at(i));
+        mutex_locker lock(queue->lock);
+        if (!queue->tasks.empty()) {
+            step = queue->tasks.back().first;
+            chunk = queue->tasks.back().second;
+            queue->tasks.pop_back();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void scheduler::mark_queued(scheduler_step* step, data_chunk& chunk)
+{
+    step->queued.increment();
+
+#ifdef AR_TRACE_SUPPORT
+    if (m_trace.get()) {
+        chunk.queued_time = get_current_time();
+    }
+#else
+    (void)chunk;
+#endif
+}
+
+
+void scheduler::queue_first_step()
+{
+    scheduler_step* first_step = m_steps.front();
+
+    mutex_locker lock(first_step->lock);
+    data_chunk chunk(m_chunk_counter);
+    mark_queued(first_step, chunk);
+    first_step->queue.push(chunk);
+
+    queue_first_step_locked(m_chunk_counter);
+
+    m_chunk_counter++;
+}
+
+
+void scheduler::queue_first_step_locked(size_t current)
+{
+    scheduler_step* first_step = m_steps.front();
+    if (!first_step->can_run(current)) {
+        return;
+    } else if (m_barrier_pending) {
+        // Resumed by 'run_barrier'
+        return;
+    } else if (m_max_memory) {
+        mutex_locker lock(m_memory_lock);
+        if (m_queued_bytes > m_max_memory) {
+            // Resumed by 'remove_queued_bytes'
+            m_first_step_paused = true;
+            return;
+        }
+    }
+
+    queue_analytical_step(first_step, current);
+}
+
+
+void scheduler::add_queued_bytes(const analytical_chunk* chunk)
+{
+    if (m_max_memory && chunk) {
+        const size_t nbytes = chunk->bytes();
+
+        mutex_locker lock(m_memory_lock);
+        m_queued_bytes += nbytes;
+    }
+}
+
+
+void scheduler::remove_queued_bytes(const analytical_chunk* chunk)
+{
+    if (m_max_memory && chunk) {
+        const size_t nbytes = chunk->bytes();
+        bool resume = false;
+
+        {
+            mutex_locker lock(m_memory_lock);
+            m_queued_bytes -= nbytes;
+
+            if (m_first_step_paused && m_queued_bytes <= m_max_memory) {
+                m_first_step_paused = false;
+                resume = true;
+            }
+        }
+
+        if (resume) {
+            scheduler_step* first_step = m_steps.front();
+
+            mutex_locker lock(first_step->lock);
+            if (!first_step->queue.empty()) {
+                queue_first_step_locked(first_step->queue.top().chunk_id);
+            }
+        }
+    }
+}
+
+
+void scheduler::run_barrier()
+{
+    scheduler_step* first_step = m_steps.front();
+
+    {
+        mutex_locker lock(first_step->lock);
+        if (!m_barrier_pending) {
+            return;
+        }
+
+        m_barrier->run();
+        m_barrier_pending = false;
+
+        if (!first_step->queue.empty()) {
+            queue_first_step_locked(first_step->queue.top().chunk_id);
+        }
+    }
+
+    // Releases the hold taken when the barrier was requested
+    m_live_chunks.decrement();
+}
+
+
+void scheduler::wake_idle_thread()
+{
+    // Only idle threads are signalled, and each idle thread is signalled once
+    if (m_idle_threads.try_decrement()) {
         m_condition.signal();
     }
 }
 
 
+void scheduler::bind_worker_thread(size_t worker)
+{
+    if (m_numa_nodes.empty()) {
+        return;
+    }
+
+    const size_t node = m_workers.at(worker)->node;
+    set_thread_node(node);
+
+    if (!set_thread_cpus(m_numa_nodes.at(node))) {
+        print_locker lock;
+        std::cerr << "WARNING: Could not bind thread " << worker
+                  << " to NUMA node " << node << std::endl;
+    }
+}
+
+
+void scheduler::assign_worker_nodes()
+{
+    m_numa_nodes.clear();
+    if (m_pin_threads) {
+        m_numa_nodes = read_numa_nodes();
+
+        if (m_numa_nodes.empty()) {
+            print_locker lock;
+            std::cerr << "WARNING: Binding threads to CPUs is not supported "
+                      << "on this platform; threads are not pinned" << std::endl;
+        }
+    }
+
+    if (!m_numa_nodes.empty()) {
+        const std::vector<size_t> nodes = assign_numa_nodes(m_numa_nodes, m_workers.size());
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers.at(i)->node = nodes.at(i);
+        }
+    }
+
+    // Work is stolen from workers on the same node first, and otherwise from
+    // the following workers in turn, wrapping around
+    for (size_t worker = 0; worker < m_workers.size(); ++worker) {
+        scheduler_worker* current = m_workers.at(worker);
+        current->victims.clear();
+
+        for (int pass = 0; pass < 2; ++pass) {
+            const bool same_node = !pass;
+            for (size_t i = 1; i < m_workers.size(); ++i) {
+                const size_t other = (worker + i) % m_workers.size();
+                if ((m_workers.at(other)->node == current->node) == same_node) {
+                    current->victims.push_back(other);
+                }
+            }
+        }
+    }
+}
+
+
 bool scheduler::initialize_threads(int nthreads, unsigned seed)
 {
 #ifdef AR_PTHREAD_SUPPORT
@@ -494,7 +1086,7 @@ bool scheduler::initialize_threads(int nthreads, unsigned seed)
         for (int i = 0; i < nthreads; ++i) {
             m_threads.push_back(pthread_t());
             // Each thread is assigned a unique seed, based on the (user) seed
-            thread_info* info = new thread_info(seed + i, this);
+            thread_info* info = new thread_info(seed + i, this, i + 1);
             switch (pthread_create(&m_threads.back(), NULL, &run_wrapper, info)) {
                 case 0:
                     break;
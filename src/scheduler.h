@@ -24,18 +24,23 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include <deque>
 #include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "numa.h"
 #include "threads.h"
+#include "trace.h"
 
 namespace ar
 {
 
 struct data_chunk;
 struct scheduler_step;
+struct scheduler_worker;
 
 
 /**
@@ -61,6 +66,12 @@ public:
 
     /** Destructor; does nothing. */
     virtual ~analytical_chunk();
+
+    /**
+     * Returns the (approximate) number of bytes of data held by the chunk;
+     * used to limit the memory used by queued chunks. Returns 0 by default.
+     */
+    virtual size_t bytes() const;
 };
 
 
@@ -68,12 +79,20 @@ typedef std::pair<size_t, analytical_chunk*> chunk_pair;
 typedef std::vector<chunk_pair> chunk_vec;
 
 
+//! Number of per-thread slots in a statistics_sink; see get_thread_slot
+const size_t STATISTICS_SINK_SLOTS = 128;
+
+
 /**
  * Sink for generating in-memory data-sinks of type T on demand, and reducing
  * these to a single result upon completion of analyses. Using this class
  * allows multiple threads to collect summary statistics, while the final
  * consumer sees only a single statistics object.
  *
+ * Each thread is assigned its own sink, which is looked up without locking
+ * (see get_thread_slot), and sinks are only combined by 'finalize'. Threads
+ * beyond the first STATISTICS_SINK_SLOTS threads share a locked map instead.
+ *
  * The class T must implement the += operator, to allow the reduction of sinks.
  */
 template <typename T>
@@ -86,31 +105,85 @@ public:
     /** Destructor; deletes any remaining sinks. */
     virtual ~statistics_sink();
 
-    /** Returns unused sink, or a new sink if no unused sinks are available. */
+    /**
+     * Returns the sink of the calling thread, creating it on first use. The
+     * sink is owned by this object, and must not be used after 'finalize'.
+     */
     virtual T* get_sink();
 
-    /** Return a sink after it has been used. */
-    virtual void return_sink(T* ptr);
-
     /**
      * Return a single sink that is the sum of all sink objects, consuming (and
-     * freeing) all sink objects generated by and returned to the sink.
+     * freeing) all sink objects generated by the sink; must only be called
+     * once all threads using the sink have been joined.
      */
     virtual T* finalize();
 
+    /**
+     * Returns a new sink that is the sum of all current sinks, without
+     * consuming these; must only be called while no threads are using the
+     * sinks, e.g. from a 'pipeline_barrier'.
+     */
+    T* snapshot();
+
 protected:
     /** Returns a new sink object; to be implemented in subclasses. */
     virtual T* new_sink() const = 0;
 
 private:
-    typedef std::list<T*> sink_list;
-    typedef typename sink_list::iterator sink_list_iter;
-    typedef typename sink_list::const_iterator sink_list_citer;
-
-    //! Lock used to control access to sink lists
-    mutex m_sinks_lock;
-    //! List of inactive sinks
-    sink_list m_sinks;
+    typedef std::vector<T*> sink_vec;
+    typedef std::map<size_t, T*> sink_map;
+
+    //! Not implemented
+    statistics_sink(const statistics_sink&);
+    //! Not implemented
+    statistics_sink& operator=(const statistics_sink&);
+
+    //! Per-thread sinks; each slot is only accessed by a single thread
+    sink_vec m_slots;
+    //! Lock used to control access to 'm_overflow'
+    mutex m_overflow_lock;
+    //! Sinks for threads with slots past the end of 'm_slots'
+    sink_map m_overflow;
+};
+
+
+/**
+ * Thread-safe pool of unused objects of type T, allowing objects and the
+ * memory held by them to be re-used for new chunks, instead of being freed
+ * and re-allocated for every chunk. Objects are kept per NUMA node (see
+ * get_thread_node), so that threads only re-use memory local to their node;
+ * at most 'max_size' objects are kept per node.
+ */
+template <typename T>
+class object_pool
+{
+public:
+    /** Constructor; 'max_size' is the max number of objects kept per node. */
+    object_pool(size_t max_size);
+
+    /** Destructor; deletes any objects remaining in the pool. */
+    ~object_pool();
+
+    /** Returns an unused object from the node of the calling thread, if any. */
+    T* acquire();
+
+    /** Adds an object to the pool, or deletes it if the pool is full. */
+    void release(T* ptr);
+
+private:
+    typedef std::vector<T*> object_vec;
+
+    //! Not implemented
+    object_pool(const object_pool&);
+    //! Not implemented
+    object_pool& operator=(const object_pool&);
+
+    //! Lock used to control access to the list of objects
+    mutex m_lock;
+    //! Unused objects for each NUMA node
+    std::vector<object_vec> m_objects;
+    //! Max number of unused objects per node
+    const size_t m_max_size;
 };
 
 
@@ -189,9 +262,80 @@ private:
 };
 
 
+/**
+ * Callback run by the scheduler once the pipeline has been drained; used to
+ * capture a consistent state of all steps (see 'checkpointer').
+ *
+ * The barrier is requested by the first step of the pipeline, while
+ * processing a chunk. The first step is then paused, and 'run' is called
+ * once all chunks produced so far (including the current chunk) have been
+ * processed by all steps, after which the first step is resumed.
+ */
+class pipeline_barrier
+{
+public:
+    /** Constructor; does nothing. */
+    pipeline_barrier();
+
+    /** Destructor; does nothing. */
+    virtual ~pipeline_barrier();
+
+    /** Requests the barrier; must only be called by the first step. */
+    void request();
+
+    /**
+     * Called once the pipeline has been drained; no steps are run while this
+     * function runs. Exceptions are handled like exceptions thrown by steps.
+     */
+    virtual void run() = 0;
+
+private:
+    //! Not implemented
+    pipeline_barrier(const pipeline_barrier&);
+    //! Not implemented
+    pipeline_barrier& operator=(const pipeline_barrier&);
+
+    friend class scheduler;
+
+    //! Set by 'request'; cleared by the scheduler once the first step returns
+    bool m_requested;
+};
+
+
+/** Snapshot of the activity of a step; see 'scheduler::get_step_metrics'. */
+struct step_metrics
+{
+    /** Constructor; zero-initializes all values. */
+    step_metrics();
+
+    //! ID of the step, as passed to 'scheduler::add_step'
+    size_t step_id;
+    //! Name of the step, as passed to 'scheduler::add_step'
+    std::string name;
+    //! Number of chunks waiting to be processed by the step
+    size_t queued;
+    //! Number of chunks processed by the step so far
+    size_t processed;
+    //! Total (wall-clock) time spent processing chunks, in seconds
+    double busy_seconds;
+};
+
+typedef std::vector<step_metrics> step_metrics_vec;
+
+
 /**
  * Multithreaded scheduler.
  *
+ * Chunks for unordered steps not involving IO are queued in per-thread
+ * queues; each thread processes its own queue first, and steals work from
+ * the queues of other threads when its own queue and the shared queues are
+ * empty. Ordered steps and
+ * steps involving IO are queued using shared queues.
+ *
+ * If thread pinning is enabled, each thread is bound to the CPUs of a NUMA
+ * node, and threads steal work from threads on the same node first, so that
+ * chunks are mostly processed on the node where they were read.
+ *
  * See 'analytical_step' for information on implementing analyses.
  */
 class scheduler
@@ -207,19 +351,60 @@ public:
      * Adds a step to the pipeline.
      *
      * @param step_id Unique ID of current step; cannot be used twice.
+     * @param name Short description of the step, used to report metrics.
      * @param step A analytical step; is deleted when scheduler is destroyed.
      *
      * The ID specified here is specified as the first value of 'chunk_pair's
      * in order to determine to which analytical step a chunk is assigned.
      **/
-    void add_step(size_t step_id, analytical_step* step);
+    void add_step(size_t step_id, const std::string& name, analytical_step* step);
 
-    /** Runs the pipeline with n threads; return false on error. */
-    bool run(int nthreads, unsigned seed);
+    /**
+     * Runs the pipeline with n threads; return false on error.
+     *
+     * Each step involving IO is only run by one thread at a time, but
+     * different IO steps (i.e. different files) may run at the same time;
+     * 'max_io' limits the number of threads doing IO at once (0 = no limit).
+     *
+     * If 'max_memory' is set, the first step is paused while the chunks
+     * waiting to be processed hold more than this number of bytes (see
+     * analytical_chunk::bytes), until enough chunks have been processed.
+     */
+    bool run(int nthreads, unsigned seed, unsigned max_io = 0,
+             size_t max_memory = 0);
+
+    /**
+     * Sets the barrier requested by the first step, if any; the barrier must
+     * remain valid until the pipeline has been run. See 'pipeline_barrier'.
+     */
+    void set_barrier(pipeline_barrier* barrier);
+
+    /**
+     * Enables binding of threads to NUMA nodes during subsequent runs; see
+     * 'assign_numa_nodes'. Threads started by the steps (e.g. for reading
+     * compressed input) inherit the node of the thread starting them.
+     */
+    void set_thread_pinning(bool enabled);
+
+    /**
+     * Returns a snapshot of the activity of each step added to the pipeline;
+     * may be called by other threads while the pipeline is running, but not
+     * while steps are being added.
+     */
+    step_metrics_vec get_step_metrics() const;
+
+#ifdef AR_TRACE_SUPPORT
+    /** Enables recording of a trace during subsequent runs; see 'get_trace'. */
+    void enable_trace();
+
+    /** Returns the trace of the last run, or NULL if tracing is not enabled. */
+    const trace_log* get_trace() const;
+#endif
 
 private:
     typedef std::list<scheduler_step*> runables;
     typedef std::vector<scheduler_step*> pipeline;
+    typedef std::vector<scheduler_worker*> worker_vec;
 
     //! Not implemented
     scheduler(const scheduler&);
@@ -228,8 +413,8 @@ private:
 
     /** Wrapper function which calls do_run on the provided thread. */
     static void* run_wrapper(void*);
-    /** Work function; invoked by each thread. */
-    void* do_run();
+    /** Work function; invoked by each thread, using the nth worker queue. */
+    void* do_run(size_t worker);
 
     /** Initializes n threads, returning false if any errors occured. */
     bool initialize_threads(int nthreads, unsigned seed);
@@ -238,10 +423,39 @@ private:
     /** Joins all threads, returning false if any errors occured. */
     bool join_threads();
 
-    /** Executes an analytical step. */
-    void execute_analytical_step(scheduler_step* step);
+    /**
+     * Executes an analytical step on a chunk, using the given worker queue;
+     * the reference held by 'chunk' is released.
+     */
+    void execute_analytical_step(size_t worker, scheduler_step* step,
+                                 data_chunk& chunk, trace_event* event);
     /** Attempts to queue an analytical step given a current chunk. */
     void queue_analytical_step(scheduler_step* step, size_t current);
+    /** Queues a (unordered, non-IO) step and chunk in a worker queue. */
+    void push_task(size_t worker, scheduler_step* step, const data_chunk& chunk);
+    /** Pops the oldest task from the worker's own queue. */
+    bool pop_task(size_t worker, scheduler_step*& step, data_chunk& chunk);
+    /** Steals the most recently queued task of any other worker. */
+    bool steal_task(size_t worker, scheduler_step*& step, data_chunk& chunk);
+    /** Wakes up a thread waiting for work, if any. */
+    void wake_idle_thread();
+    /** Binds the calling thread to the NUMA node of the worker, if enabled. */
+    void bind_worker_thread(size_t worker);
+    /** Assigns nodes to the workers and sets the order of stealing work. */
+    void assign_worker_nodes();
+
+    /** Counts a chunk as queued for a step; call before queuing the chunk. */
+    void mark_queued(scheduler_step* step, data_chunk& chunk);
+    /** Adds a new chunk to the queue of the first step. */
+    void queue_first_step();
+    /** Queues first step, unless memory usage is too high; requires lock. */
+    void queue_first_step_locked(size_t current);
+    /** Adds the size of a chunk to the size of queued chunks. */
+    void add_queued_bytes(const analytical_chunk* chunk);
+    /** Subtracts the size of a chunk; may resume the first step. */
+    void remove_queued_bytes(const analytical_chunk* chunk);
+    /** Runs the barrier if requested, resuming the first step afterwards. */
+    void run_barrier();
 
     //! Analytical steps
     pipeline m_steps;
@@ -267,10 +481,46 @@ private:
     runables m_queue_calc;
     //! Queue used for currently runnable steps involving IO
     runables m_queue_io;
-    //! Indicates if a thread is doing IO; access control through 'm_queue_lock'
-    bool m_io_active;
+    //! Number of threads doing IO; access control through 'm_queue_lock'
+    unsigned m_io_active;
+    //! Max number of threads doing IO at the same time
+    unsigned m_max_io;
     //! Count of currently live chunks
-    size_t m_live_chunks;
+    atomic_counter m_live_chunks;
+
+    //! Per-thread queues of tasks for unordered steps
+    worker_vec m_workers;
+    //! Number of threads waiting for work that have not yet been signalled
+    atomic_counter m_idle_threads;
+
+    //! Lock used to control access to memory usage counters
+    mutex m_memory_lock;
+    //! Max number of bytes in queued chunks before throttling; 0 = no limit
+    size_t m_max_memory;
+    //! Number of bytes held by queued chunks, if 'm_max_memory' is set
+    size_t m_queued_bytes;
+    //! Set if the first step can run, but is paused due to memory usage
+    bool m_first_step_paused;
+
+    //! Set if threads should be bound to NUMA nodes
+    bool m_pin_threads;
+    //! CPUs of each NUMA node, if threads are bound to nodes during this run
+    numa_node_vec m_numa_nodes;
+
+    //! Barrier which may be requested by the first step; may be NULL
+    pipeline_barrier* m_barrier;
+    //! Set while waiting for the pipeline to drain before running the
+    //! barrier; access control through the lock of the first step
+    bool m_barrier_pending;
+
+#ifdef AR_TRACE_SUPPORT
+    //! Set if runs should be traced
+    bool m_trace_enabled;
+    //! Trace of the current / last run; NULL if tracing is not enabled
+    std::auto_ptr<trace_log> m_trace;
+    //! Times at which the steps in 'm_queue_io' were queued, if tracing
+    std::deque<double> m_queue_io_times;
+#endif
 };
 
 
@@ -279,8 +529,9 @@ private:
 
 template <typename T>
 statistics_sink<T>::statistics_sink()
-  : m_sinks_lock()
-  , m_sinks()
+  : m_slots(STATISTICS_SINK_SLOTS, NULL)
+  , m_overflow_lock()
+  , m_overflow()
 {
 }
 
@@ -288,56 +539,157 @@ statistics_sink<T>::statistics_sink()
 template <typename T>
 statistics_sink<T>::~statistics_sink()
 {
-    for (sink_list_iter it = m_sinks.begin(); it != m_sinks.end(); ++it) {
+    for (typename sink_vec::iterator it = m_slots.begin(); it != m_slots.end(); ++it) {
         delete *it;
     }
+
+    for (typename sink_map::iterator it = m_overflow.begin(); it != m_overflow.end(); ++it) {
+        delete it->second;
+    }
 }
 
 
 template <typename T>
 T* statistics_sink<T>::get_sink()
 {
-    mutex_locker lock(m_sinks_lock);
-    if (m_sinks.empty()) {
-        return new_sink();
+    const size_t slot = get_thread_slot();
+    if (slot < m_slots.size()) {
+        T*& ptr = m_slots[slot];
+        if (!ptr) {
+            ptr = new_sink();
+        }
+
+        return ptr;
     }
 
-    T* ptr = m_sinks.front();
-    m_sinks.pop_front();
+    mutex_locker lock(m_overflow_lock);
+    T*& ptr = m_overflow[slot];
+    if (!ptr) {
+        ptr = new_sink();
+    }
 
     return ptr;
 }
 
 
 template <typename T>
-void statistics_sink<T>::return_sink(T* ptr)
+T* statistics_sink<T>::finalize()
 {
-    mutex_locker lock(m_sinks_lock);
-    m_sinks.push_back(ptr);
+    std::auto_ptr<T> result;
+    for (typename sink_vec::iterator it = m_slots.begin(); it != m_slots.end(); ++it) {
+        if (!*it) {
+            continue;
+        } else if (result.get()) {
+            *result += **it;
+            delete *it;
+        } else {
+            result.reset(*it);
+        }
+
+        *it = NULL;
+    }
+
+    for (typename sink_map::iterator it = m_overflow.begin(); it != m_overflow.end(); ++it) {
+        if (result.get()) {
+            *result += *it->second;
+            delete it->second;
+        } else {
+            result.reset(it->second);
+        }
+    }
+
+    m_overflow.clear();
+
+    if (!result.get()) {
+        return new_sink();
+    }
+
+    return result.release();
 }
 
 
 template <typename T>
-T* statistics_sink<T>::finalize()
+T* statistics_sink<T>::snapshot()
 {
-    mutex_locker lock(m_sinks_lock);
-    if (m_sinks.empty()) {
-        return new_sink();
+    std::auto_ptr<T> result(new_sink());
+    for (typename sink_vec::iterator it = m_slots.begin(); it != m_slots.end(); ++it) {
+        if (*it) {
+            *result += **it;
+        }
     }
 
-    std::auto_ptr<T> result(m_sinks.back());
-    m_sinks.pop_back();
-
-    while (!m_sinks.empty()) {
-        *result += *m_sinks.back();
-        delete m_sinks.back();
-        m_sinks.pop_back();
+    mutex_locker lock(m_overflow_lock);
+    for (typename sink_map::iterator it = m_overflow.begin(); it != m_overflow.end(); ++it) {
+        *result += *it->second;
     }
 
     return result.release();
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'object_pool'
+
+template <typename T>
+object_pool<T>::object_pool(size_t max_size)
+  : m_lock()
+  , m_objects()
+  , m_max_size(max_size)
+{
+}
+
+
+template <typename T>
+object_pool<T>::~object_pool()
+{
+    for (size_t node = 0; node < m_objects.size(); ++node) {
+        object_vec& objects = m_objects.at(node);
+        while (!objects.empty()) {
+            delete objects.back();
+            objects.pop_back();
+        }
+    }
+}
+
+
+template <typename T>
+T* object_pool<T>::acquire()
+{
+    const size_t node = get_thread_node();
+
+    mutex_locker lock(m_lock);
+    if (node >= m_objects.size() || m_objects.at(node).empty()) {
+        return NULL;
+    }
+
+    T* ptr = m_objects.at(node).back();
+    m_objects.at(node).pop_back();
+
+    return ptr;
+}
+
+
+template <typename T>
+void object_pool<T>::release(T* ptr)
+{
+    const size_t node = get_thread_node();
+
+    {
+        mutex_locker lock(m_lock);
+        if (node >= m_objects.size()) {
+            m_objects.resize(node + 1);
+        }
+
+        if (m_objects.at(node).size() < m_max_size) {
+            m_objects.at(node).push_back(ptr);
+            return;
+        }
+    }
+
+    delete ptr;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'analytical_step'
 
@@ -0,0 +1,156 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "shard.h"
+
+namespace ar
+{
+
+/** Returns the offset following 'nlines' lines starting at 'offset'. */
+size_t skip_lines(const char* data, size_t size, size_t offset, size_t nlines)
+{
+    for (; nlines && offset < size; --nlines) {
+        const void* ptr = std::memchr(data + offset, '\n', size - offset);
+        if (!ptr) {
+            return size;
+        }
+
+        offset = static_cast<const char*>(ptr) - data + 1;
+    }
+
+    return offset;
+}
+
+
+/** Returns the number of lines (newlines) in the range [begin, end). */
+size_t count_lines(const char* data, size_t begin, size_t end)
+{
+    return std::count(data + begin, data + end, '\n');
+}
+
+
+/** Maps an input file, which must be a regular, uncompressed file. */
+mapped_file* open_shard_file(const std::string& filename)
+{
+    if (!mapped_file::can_map(filename)) {
+        throw io_error("--shard requires regular input files, which '"
+                       + filename + "' is not");
+    }
+
+    std::auto_ptr<mapped_file> file(new mapped_file(filename));
+    if (file->is_compressed()) {
+        throw io_error("--shard requires uncompressed input files, but '"
+                       + filename + "' is compressed");
+    }
+
+    return file.release();
+}
+
+
+size_t find_record_start(const char* data, size_t size, size_t offset)
+{
+    if (!offset) {
+        return 0;
+    }
+
+    // Start of the first line at or after 'offset'
+    size_t line = skip_lines(data, size, offset - 1, 1);
+    while (line < size) {
+        if (data[line] == '@') {
+            const size_t separator = skip_lines(data, size, line, 2);
+            if (separator < size && data[separator] == '+') {
+                return line;
+            }
+        }
+
+        line = skip_lines(data, size, line, 1);
+    }
+
+    return size;
+}
+
+
+/** As 'find_record_start', but returns the next mate 1 record of a pair. */
+size_t find_pair_start(const char* data, size_t size, size_t offset)
+{
+    const size_t start = find_record_start(data, size, offset);
+
+    // Mate 1 records are preceded by an even number of records (8N lines)
+    return (count_lines(data, 0, start) % 8) ? skip_lines(data, size, start, 4) : start;
+}
+
+
+void find_shard_ranges(const std::string& filename_1,
+                       const std::string& filename_2,
+                       bool interleaved,
+                       size_t shard,
+                       size_t nshards,
+                       file_range& range_1,
+                       file_range& range_2)
+{
+    const std::auto_ptr<mapped_file> file_1(open_shard_file(filename_1));
+    const char* data_1 = file_1->data();
+    const size_t size_1 = file_1->size();
+
+    // Shards end where the next shard begins, so that every record is used
+    const size_t offset_begin = shard * size_1 / nshards;
+    const size_t offset_end = (shard + 1) * size_1 / nshards;
+
+    range_2 = file_range();
+    if (interleaved) {
+        range_1.begin = find_pair_start(data_1, size_1, offset_begin);
+        range_1.end = find_pair_start(data_1, size_1, offset_end);
+    } else {
+        range_1.begin = find_record_start(data_1, size_1, offset_begin);
+        range_1.end = find_record_start(data_1, size_1, offset_end);
+
+        if (!filename_2.empty()) {
+            // Mate 2 records are found by counting the mate 1 records
+            // preceding and contained in the shard
+            const size_t lines_before = count_lines(data_1, 0, range_1.begin);
+            const size_t lines = count_lines(data_1, range_1.begin, range_1.end);
+
+            const std::auto_ptr<mapped_file> file_2(open_shard_file(filename_2));
+            const char* data_2 = file_2->data();
+            const size_t size_2 = file_2->size();
+
+            range_2.begin = skip_lines(data_2, size_2, 0, lines_before);
+            range_2.end = skip_lines(data_2, size_2, range_2.begin, lines);
+
+            // The last line may not be terminated by a newline
+            if (range_1.begin == size_1) {
+                range_2.begin = size_2;
+            }
+
+            if (range_1.end == size_1) {
+                range_2.end = size_2;
+            }
+        }
+    }
+}
+
+} // namespace ar
@@ -0,0 +1,66 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_SHARD_H
+#define AR_SHARD_H
+
+#include <string>
+
+#include "linereader.h"
+
+namespace ar
+{
+
+/**
+ * Returns the offset of the first FASTQ record starting at or after 'offset'
+ * in the buffer 'data' of 'size' bytes, or 'size' if there is no such record.
+ * Records are identified as lines starting with '@' followed two lines later
+ * by a line starting with '+'; quality lines starting with '@' are followed
+ * two lines later by a sequence and are therefore never mistaken for headers.
+ */
+size_t find_record_start(const char* data, size_t size, size_t offset);
+
+
+/**
+ * Selects the records in shard 'shard' (counting from 0) of 'nshards' shards
+ * of (uncompressed, regular) FASTQ files, splitting 'filename_1' into ranges
+ * of approximately the same size, each starting at a record boundary. Mate 2
+ * records in 'filename_2' are selected to match those in 'filename_1', while
+ * an empty 'filename_2' indicates single-end reads, unless 'interleaved' is
+ * set, in which case shards always start with a mate 1 record.
+ *
+ * Ranges are found by scanning both files up to the end of the shard, unless
+ * single-end reads are used (in which case only a few lines are scanned).
+ * Throws io_error if the files cannot be sharded.
+ */
+void find_shard_ranges(const std::string& filename_1,
+                       const std::string& filename_2,
+                       bool interleaved,
+                       size_t shard,
+                       size_t nshards,
+                       file_range& range_1,
+                       file_range& range_2);
+
+} // namespace ar
+
+#endif
@@ -0,0 +1,94 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <stdexcept>
+
+#include "simd.h"
+
+namespace ar
+{
+namespace simd
+{
+
+instruction_set_vec supported()
+{
+    instruction_set_vec choices;
+    choices.push_back(none);
+
+#if defined(AR_SIMD_X86)
+    // Required when called during static initialization, e.g. to select
+    // alignment kernels; checks for both CPU and OS (XSAVE) support.
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        choices.push_back(sse2);
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        choices.push_back(avx2);
+    }
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        choices.push_back(avx512);
+    }
+#elif defined(AR_SIMD_NEON)
+    choices.push_back(neon);
+#endif
+
+    return choices;
+}
+
+
+instruction_set best_supported()
+{
+    return supported().back();
+}
+
+
+bool has_popcnt()
+{
+#if defined(AR_SIMD_X86)
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("popcnt");
+#else
+    return false;
+#endif
+}
+
+
+std::string name(instruction_set value)
+{
+    switch (value) {
+        case none: return "none";
+        case sse2: return "SSE2";
+        case avx2: return "AVX2";
+        case avx512: return "AVX512";
+        case neon: return "NEON";
+        default:
+            throw std::invalid_argument("Invalid value in simd::name");
+    }
+}
+
+} // namespace simd
+} // namespace ar
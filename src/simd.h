@@ -0,0 +1,83 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_SIMD_H
+#define AR_SIMD_H
+
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+//! SSE2, AVX2 and AVX-512BW kernels are built (see Makefile)
+#define AR_SIMD_X86
+#elif defined(__aarch64__)
+//! NEON kernels are built; NEON is a mandatory part of ARMv8-A
+#define AR_SIMD_NEON
+#endif
+
+namespace ar
+{
+namespace simd
+{
+
+/** SIMD instruction sets for which optimized kernels may be available. */
+enum instruction_set
+{
+    //! Portable implementation; always available
+    none = 0,
+    //! 16-byte SSE2 instructions (x86 / AMD64)
+    sse2,
+    //! 32-byte AVX2 instructions (x86 / AMD64)
+    avx2,
+    //! 64-byte AVX-512 instructions, requiring the BW extension (x86 / AMD64)
+    avx512,
+    //! 16-byte NEON instructions (AArch64)
+    neon
+};
+
+typedef std::vector<instruction_set> instruction_set_vec;
+
+
+/**
+ * Returns the instruction sets supported by both the binary and the CPU
+ * and OS that the program is running on, from least to most preferable.
+ * The first value is always 'none'.
+ */
+instruction_set_vec supported();
+
+/** Returns the most preferable instruction set (see 'supported'). */
+instruction_set best_supported();
+
+/**
+ * Returns true if the CPU supports the POPCNT instruction (x86 / AMD64); this
+ * is independent of the instruction sets above. False on other platforms.
+ */
+bool has_popcnt();
+
+/** Returns a human readable name for an instruction set. */
+std::string name(instruction_set value);
+
+} // namespace simd
+} // namespace ar
+
+#endif
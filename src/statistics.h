@@ -25,6 +25,7 @@
 #ifndef STATISTICS_H
 #define STATISTICS_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <vector>
 
@@ -33,6 +34,10 @@
 namespace ar
 {
 
+//! Read length for which length distributions are preallocated by default
+const size_t STATISTICS_RESERVED_LENGTH = 512;
+
+
 /** Object used to collect summary statistics for trimming and other tasks. */
 struct statistics
 {
@@ -51,6 +56,7 @@ struct statistics
       , discard2(0)
       , records(0)
       , read_lengths()
+      , length_rows(0)
     {
     }
 
@@ -85,15 +91,37 @@ struct statistics
 
     /** Increment the number of reads with of a given type / length. */
     void inc_length_count(read_type type, size_t length) {
-        if (length >= read_lengths.size()) {
-            read_lengths.resize(length + 1, std::vector<size_t>(rt_max));
+        const size_t index = length * rt_max + static_cast<size_t>(type);
+        if (index >= read_lengths.size()) {
+            // Grow geometrically, so that resizing is rare for long reads
+            reserve_lengths(std::max(length, 2 * (read_lengths.size() / rt_max)));
+        }
+
+        ++read_lengths[index];
+        if (length >= length_rows) {
+            length_rows = length + 1;
         }
+    }
+
+    /** Returns the number of reads of a given type / length. */
+    size_t length_count(read_type type, size_t length) const {
+        const size_t index = length * rt_max + static_cast<size_t>(type);
+
+        return (index < read_lengths.size()) ? read_lengths[index] : 0;
+    }
 
-        ++read_lengths.at(length).at(static_cast<size_t>(type));
+    /** Preallocates length distributions for reads of up to 'length' bases. */
+    void reserve_lengths(size_t length) {
+        if ((length + 1) * rt_max > read_lengths.size()) {
+            read_lengths.resize((length + 1) * rt_max);
+        }
     }
 
-    //! Per read-type length distributions of reads
-    std::vector<std::vector<size_t> > read_lengths;
+    //! Per read-type length distributions of reads; indexed by (length
+    //! * rt_max + type), and preallocated for lengths past 'length_rows'.
+    std::vector<size_t> read_lengths;
+    //! One more than the greatest length counted; 0 if no lengths counted
+    size_t length_rows;
 
     /** Combine statistics objects, e.g. those used by different threads. */
     statistics& operator+=(const statistics& other) {
@@ -113,7 +141,8 @@ struct statistics
         records += other.records;
 
         merge_vectors(number_of_reads_with_adapter, other.number_of_reads_with_adapter);
-        merge_sub_vectors(read_lengths, other.read_lengths);
+        merge_vectors(read_lengths, other.read_lengths);
+        length_rows = std::max(length_rows, other.length_rows);
 
         return *this;
     }
@@ -140,6 +169,15 @@ struct demux_statistics
         return total;
     }
 
+    /** Combine statistics objects, e.g. those used by different threads. */
+    demux_statistics& operator+=(const demux_statistics& other) {
+        merge_vectors(barcodes, other.barcodes);
+        unidentified += other.unidentified;
+        ambiguous += other.ambiguous;
+
+        return *this;
+    }
+
     //! Number of reads / pairs identified for a given barcode / pair of barcodes
     std::vector<size_t> barcodes;
     //! Number of reads / pairs with no hits
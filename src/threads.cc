@@ -324,6 +324,44 @@ atomic_counter::atomic_counter(size_t init)
 }
 
 
+// GCC and Clang provide atomic builtins, which avoid locking the mutex
+#if defined(__GNUC__)
+
+size_t atomic_counter::current() const
+{
+    return __sync_add_and_fetch(&m_count, 0);
+}
+
+
+size_t atomic_counter::increment(size_t inc)
+{
+    return __sync_add_and_fetch(&m_count, inc);
+}
+
+
+size_t atomic_counter::decrement()
+{
+    return __sync_sub_and_fetch(&m_count, 1);
+}
+
+
+bool atomic_counter::try_decrement()
+{
+    size_t value = current();
+    while (value) {
+        const size_t previous = __sync_val_compare_and_swap(&m_count, value, value - 1);
+        if (previous == value) {
+            return true;
+        }
+
+        value = previous;
+    }
+
+    return false;
+}
+
+#else
+
 size_t atomic_counter::current() const
 {
     mutex_locker locker(m_lock);
@@ -332,11 +370,11 @@ size_t atomic_counter::current() const
 }
 
 
-size_t atomic_counter::increment()
+size_t atomic_counter::increment(size_t inc)
 {
     mutex_locker locker(m_lock);
 
-    return ++m_count;
+    return m_count += inc;
 }
 
 
@@ -347,4 +385,122 @@ size_t atomic_counter::decrement()
     return --m_count;
 }
 
+
+bool atomic_counter::try_decrement()
+{
+    mutex_locker locker(m_lock);
+    if (m_count) {
+        --m_count;
+        return true;
+    }
+
+    return false;
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// get_thread_slot
+
+#ifdef AR_PTHREAD_SUPPORT
+
+//! Key for per-thread slot numbers; values are stored as slot + 1
+static pthread_key_t s_slot_key;
+//! Ensures that 's_slot_key' is created only once
+static pthread_once_t s_slot_key_once = PTHREAD_ONCE_INIT;
+//! Number of slots assigned so far
+static atomic_counter s_slot_count;
+
+
+void create_slot_key()
+{
+    if (pthread_key_create(&s_slot_key, NULL)) {
+        print_locker lock;
+        std::cerr << "get_thread_slot: could not create pthread key" << std::endl;
+        std::exit(1);
+    }
+}
+
+
+size_t get_thread_slot()
+{
+    pthread_once(&s_slot_key_once, create_slot_key);
+
+    void* value = pthread_getspecific(s_slot_key);
+    if (!value) {
+        value = reinterpret_cast<void*>(s_slot_count.increment());
+
+        if (pthread_setspecific(s_slot_key, value)) {
+            throw thread_error("get_thread_slot: could not set thread-specific value");
+        }
+    }
+
+    return reinterpret_cast<size_t>(value) - 1;
+}
+
+#else
+
+size_t get_thread_slot()
+{
+    return 0;
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// get_thread_node / set_thread_node
+
+#ifdef AR_PTHREAD_SUPPORT
+
+//! Key for per-thread NUMA nodes; values are stored as node + 1
+static pthread_key_t s_node_key;
+//! Ensures that 's_node_key' is created only once
+static pthread_once_t s_node_key_once = PTHREAD_ONCE_INIT;
+
+
+void create_node_key()
+{
+    if (pthread_key_create(&s_node_key, NULL)) {
+        print_locker lock;
+        std::cerr << "set_thread_node: could not create pthread key" << std::endl;
+        std::exit(1);
+    }
+}
+
+
+size_t get_thread_node()
+{
+    pthread_once(&s_node_key_once, create_node_key);
+
+    const void* value = pthread_getspecific(s_node_key);
+
+    return value ? reinterpret_cast<size_t>(value) - 1 : 0;
+}
+
+
+void set_thread_node(size_t node)
+{
+    pthread_once(&s_node_key_once, create_node_key);
+
+    if (pthread_setspecific(s_node_key, reinterpret_cast<void*>(node + 1))) {
+        throw thread_error("set_thread_node: could not set thread-specific value");
+    }
+}
+
+#else
+
+size_t get_thread_node()
+{
+    return 0;
+}
+
+
+void set_thread_node(size_t)
+{
+}
+
+#endif
+
 } // namespace ar
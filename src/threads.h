@@ -172,19 +172,40 @@ public:
     /** Returns the current value (which may have changed already). */
     size_t current() const;
 
-    /** Increment the current value. */
-    size_t increment();
+    /** Increment the current value by 'inc'; returns the new value. */
+    size_t increment(size_t inc = 1);
 
     /** Decrement the current value. */
     size_t decrement();
 
+    /** Decrement the current value if not zero; returns true if decremented. */
+    bool try_decrement();
+
 private:
-    //! Mutex used to control access to the counter/
+    //! Mutex used to control access to the counter, if atomics are unavailable
     mutable mutex m_lock;
-    //! Raw counter value; access controlled using m_lock;
-    size_t m_count;
+    //! Raw counter value; access controlled using m_lock or atomic builtins
+    mutable size_t m_count;
 };
 
+
+/**
+ * Returns a small number unique to the calling thread, assigned on the first
+ * call by each thread, starting from 0; used to index per-thread data. The
+ * value 0 is always returned if threads are not supported.
+ */
+size_t get_thread_slot();
+
+
+/**
+ * Returns the NUMA node assigned to the calling thread using 'set_thread_node',
+ * or 0 if no node has been assigned; used to select per-node resources.
+ */
+size_t get_thread_node();
+
+/** Sets the NUMA node returned by 'get_thread_node' for the calling thread. */
+void set_thread_node(size_t node);
+
 } // namespace ar
 
 #endif
@@ -99,6 +99,7 @@ std::string format_time(double seconds)
 timer::timer(const std::string& what)
   : m_what(what)
   , m_total(0)
+  , m_resumed(0)
   , m_first_time(get_current_time())
   , m_counts()
 {
@@ -131,12 +132,19 @@ void timer::increment(size_t inc)
 }
 
 
+void timer::resume(size_t inc)
+{
+    m_total += inc;
+    m_resumed += inc;
+}
+
+
 void timer::finalize() const
 {
     const double current_time = get_current_time();
     const double seconds = current_time - m_first_time;
 
-    do_print(static_cast<size_t>(m_total / seconds), current_time, true);
+    do_print(static_cast<size_t>((m_total - m_resumed) / seconds), current_time, true);
 }
 
 
@@ -31,6 +31,10 @@
 namespace ar
 {
 
+/** Returns the current (wall-clock) time in seconds. */
+double get_current_time();
+
+
 /**
  * Simply class for reporting current progress of a run.
  *
@@ -53,6 +57,12 @@ public:
     /** Increment the progress, and (possibly) print a status report. */
     void increment(size_t inc = 1);
 
+    /**
+     * Adds items processed before a run was resumed; these are included in
+     * totals, but not when calculating rates.
+     */
+    void resume(size_t inc);
+
     /** Print final summary based on the number of increments. */
     void finalize() const;
 
@@ -67,6 +77,8 @@ private:
     std::string m_what;
     //! Total number of items processed
     size_t m_total;
+    //! Number of items processed before the run was resumed
+    size_t m_resumed;
     //! Starting time (in seconds) of the timer.
     double m_first_time;
     //! Counts for last N updates, for calculating running mean rate.
@@ -0,0 +1,214 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iomanip>
+
+#include "linereader.h"
+#include "timer.h"
+#include "trace.h"
+
+namespace ar
+{
+
+/** Returns a quoted JSON string. */
+std::string json_string(const std::string& value)
+{
+    std::string result = "\"";
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        switch (*it) {
+            case '\\':
+                result += "\\\\";
+                break;
+
+            case '"':
+                result += "\\\"";
+                break;
+
+            case '\n':
+                result += "\\n";
+                break;
+
+            case '\t':
+                result += "\\t";
+                break;
+
+            default:
+                if (static_cast<unsigned char>(*it) < 0x20) {
+                    result += ' ';
+                } else {
+                    result += *it;
+                }
+        }
+    }
+
+    return result + "\"";
+}
+
+
+/** Per step totals; see 'trace_log::print_summary'. */
+struct step_summary
+{
+    step_summary()
+      : chunks(0)
+      , duration(0)
+      , queued(0)
+      , lock_wait(0)
+      , io_wait(0)
+    {
+    }
+
+    void add(const trace_event& event)
+    {
+        chunks += 1;
+        duration += event.duration;
+        queued += event.queued;
+        lock_wait += event.lock_wait;
+        io_wait += event.io_wait;
+    }
+
+    size_t chunks;
+    double duration;
+    double queued;
+    double lock_wait;
+    double io_wait;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'trace_event'
+
+trace_event::trace_event()
+  : step_id(0)
+  , start(0)
+  , duration(0)
+  , queued(0)
+  , lock_wait(0)
+  , io_wait(0)
+{
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'trace_log'
+
+trace_log::trace_log(const string_vec& step_names, size_t nthreads)
+  : m_step_names(step_names)
+  , m_events(nthreads)
+  , m_start_time(get_current_time())
+{
+}
+
+
+void trace_log::add(size_t thread, const trace_event& event)
+{
+    m_events.at(thread).push_back(event);
+}
+
+
+void trace_log::write_json(const std::string& filename) const
+{
+    std::ofstream output(filename.c_str(), std::ios::out | std::ios::trunc);
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+           << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+           << "\"tid\": 0, \"args\": {\"name\": \"AdapterRemoval\"}}";
+
+    for (size_t thread = 0; thread < m_events.size(); ++thread) {
+        output << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+               << "\"tid\": " << thread << ", \"args\": {\"name\": "
+               << json_string(thread ? "worker" : "main") << "}}";
+
+        const trace_event_vec& events = m_events.at(thread);
+        for (trace_event_vec::const_iterator it = events.begin(); it != events.end(); ++it) {
+            output << ",\n{\"name\": " << json_string(m_step_names.at(it->step_id))
+                   << ", \"cat\": \"step\", \"ph\": \"X\", \"pid\": 1"
+                   << ", \"tid\": " << thread
+                   << ", \"ts\": " << (it->start - m_start_time) * 1e6
+                   << ", \"dur\": " << it->duration * 1e6
+                   << ", \"args\": {\"step_id\": " << it->step_id
+                   << ", \"queued_us\": " << it->queued * 1e6
+                   << ", \"lock_wait_us\": " << it->lock_wait * 1e6
+                   << ", \"io_wait_us\": " << it->io_wait * 1e6 << "}}";
+        }
+    }
+
+    output << "\n]}\n";
+    output.close();
+
+    if (!output) {
+        throw io_error("error writing trace to '" + filename + "'", errno);
+    }
+}
+
+
+void trace_log::print_summary(std::ostream& out) const
+{
+    std::vector<step_summary> steps(m_step_names.size());
+    step_summary total;
+    for (thread_event_vec::const_iterator it = m_events.begin(); it != m_events.end(); ++it) {
+        for (trace_event_vec::const_iterator event = it->begin(); event != it->end(); ++event) {
+            steps.at(event->step_id).add(*event);
+            total.add(*event);
+        }
+    }
+
+    size_t name_width = 5;
+    for (size_t step_id = 0; step_id < steps.size(); ++step_id) {
+        name_width = std::max(name_width, m_step_names.at(step_id).size());
+    }
+
+    const std::ios_base::fmtflags flags = out.flags();
+    out << "Time spent per step, in seconds (summed across threads):\n"
+        << std::left << std::setw(name_width) << "Step" << std::right
+        << std::setw(10) << "Chunks"
+        << std::setw(11) << "Running"
+        << std::setw(11) << "Queued"
+        << std::setw(11) << "Locking"
+        << std::setw(11) << "IO-wait" << "\n"
+        << std::fixed << std::setprecision(3);
+
+    for (size_t step_id = 0; step_id <= steps.size(); ++step_id) {
+        const bool is_total = (step_id == steps.size());
+        const step_summary& step = is_total ? total : steps.at(step_id);
+        if (!is_total && !step.chunks) {
+            continue;
+        }
+
+        out << std::left << std::setw(name_width)
+            << (is_total ? std::string("Total") : m_step_names.at(step_id))
+            << std::right
+            << std::setw(10) << step.chunks
+            << std::setw(11) << step.duration
+            << std::setw(11) << step.queued
+            << std::setw(11) << step.lock_wait
+            << std::setw(11) << step.io_wait << "\n";
+    }
+
+    out.flags(flags);
+    out.flush();
+}
+
+} // namespace ar
@@ -0,0 +1,98 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_TRACE_H
+#define AR_TRACE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "commontypes.h"
+
+namespace ar
+{
+
+/** Timings for a single chunk processed by an analytical step. */
+struct trace_event
+{
+    /** Constructor; zero-initializes all values. */
+    trace_event();
+
+    //! ID of the step processing the chunk
+    size_t step_id;
+    //! Wall-clock time at which processing started, in seconds
+    double start;
+    //! Time spent processing the chunk
+    double duration;
+    //! Time between the chunk being queued for the step and processing
+    double queued;
+    //! Time spent waiting on locks held by other threads while scheduling
+    double lock_wait;
+    //! Time spent waiting for an IO slot (see --io-threads); IO steps only
+    double io_wait;
+};
+
+typedef std::vector<trace_event> trace_event_vec;
+
+
+/**
+ * Trace of all chunks processed during a run of a 'scheduler'; events are
+ * recorded per thread, without locking, and can be written as a Chrome trace
+ * (JSON) file, for viewing in e.g. https://ui.perfetto.dev, or summarized
+ * per step.
+ */
+class trace_log
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param step_names Names of steps, indexed by step ID.
+     * @param nthreads Number of threads adding events.
+     */
+    trace_log(const string_vec& step_names, size_t nthreads);
+
+    /** Records an event; must only be called by the given thread. */
+    void add(size_t thread, const trace_event& event);
+
+    /** Writes all events as a Chrome trace file; throws io_error on errors. */
+    void write_json(const std::string& filename) const;
+
+    /** Prints the total time spent by / waiting for each step. */
+    void print_summary(std::ostream& out) const;
+
+private:
+    typedef std::vector<trace_event_vec> thread_event_vec;
+
+    //! Names of steps, indexed by step ID
+    string_vec m_step_names;
+    //! Events recorded by each thread
+    thread_event_vec m_events;
+    //! Time at which the trace was started; used to offset event times
+    double m_start_time;
+};
+
+} // namespace ar
+
+#endif
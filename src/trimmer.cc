@@ -0,0 +1,240 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <stdexcept>
+#include <vector>
+
+#include "main.h"
+#include "trimmer.h"
+#include "trimming.h"
+
+namespace ar
+{
+
+/** Destination for 'trimmed_destinations', collecting records in a vector. */
+class fastq_vec_sink
+{
+public:
+    fastq_vec_sink(fastq_vec& reads)
+      : m_reads(reads)
+    {
+    }
+
+    void add(const fastq_encoding&, const fastq& read, size_t = 1)
+    {
+        m_reads.push_back(read);
+    }
+
+    void add(const fastq_encoding&, const fastq_batch& batch, size_t nth,
+             const std::string& header, read_type)
+    {
+        m_reads.push_back(batch.get(nth, header));
+    }
+
+private:
+    fastq_vec& m_reads;
+};
+
+
+/** Parses options as if these were given on the command-line. */
+userconfig* new_trimmer_config(const string_vec& args, bool paired_end)
+{
+    string_vec all_args;
+    all_args.push_back(NAME);
+    all_args.push_back("--file1");
+    all_args.push_back("<in-memory mate 1>");
+    if (paired_end) {
+        all_args.push_back("--file2");
+        all_args.push_back("<in-memory mate 2>");
+    }
+    all_args.insert(all_args.end(), args.begin(), args.end());
+
+    std::vector<char*> argv;
+    for (string_vec::iterator it = all_args.begin(); it != all_args.end(); ++it) {
+        argv.push_back(&(*it)[0]);
+    }
+
+    std::auto_ptr<userconfig> config(new userconfig(NAME, VERSION, HELPTEXT));
+    if (config->parse_args(static_cast<int>(argv.size()), &argv.front()) != argparse::pr_ok) {
+        throw std::invalid_argument("invalid trimming options");
+    } else if (config->identify_adapters) {
+        throw std::invalid_argument("adapter identification is not supported "
+                                    "by the trimmer");
+    } else if (config->adapters.barcode_count()) {
+        throw std::invalid_argument("demultiplexing is not supported by the "
+                                    "trimmer");
+    } else if (config->argparser.is_set("--qualitybase-output")) {
+        // Output records use the Phred+33 encoding of the 'fastq' class
+        throw std::invalid_argument("--qualitybase-output is not supported by "
+                                    "the trimmer");
+    }
+
+    return config.release();
+}
+
+
+/** Trims a batch; the processing of reads is selected once per batch. */
+template <bool TRIM, bool COLLAPSE>
+void trim_batch(const userconfig& config,
+                const fastq_pair_vec& adapters,
+                const adapter_index* index,
+                statistics& stats,
+                fastq_vec& reads_1,
+                const fastq_vec* reads_2,
+                trimmed_reads& out)
+{
+    fastq_vec_sink mate_1(out.mate_1);
+    fastq_vec_sink mate_2(out.mate_2);
+    fastq_vec_sink singleton(out.singleton);
+    fastq_vec_sink collapsed(out.collapsed);
+    fastq_vec_sink collapsed_truncated(out.collapsed_truncated);
+    fastq_vec_sink discarded(out.discarded);
+
+    trimmed_destinations<fastq_vec_sink> dst;
+    dst.mate_1 = &mate_1;
+    dst.mate_2 = &mate_2;
+    dst.singleton = &singleton;
+    dst.collapsed = &collapsed;
+    dst.collapsed_truncated = &collapsed_truncated;
+    dst.discarded = &discarded;
+
+    if (reads_2) {
+        fastq_batch batch_1;
+        fastq_batch batch_2;
+
+        trim_paired_end_reads<TRIM, COLLAPSE>(config, adapters, index, stats,
+                                              reads_1, *reads_2,
+                                              batch_1, batch_2, dst);
+    } else {
+        trim_single_end_reads<TRIM, COLLAPSE>(config, adapters, index, stats,
+                                              reads_1, dst);
+    }
+}
+
+
+
+/** Trims a batch, selecting a specialized 'trim_batch' for the options. */
+statistics trim_batch(const userconfig& config,
+                      const fastq_pair_vec& adapters,
+                      const adapter_index* index,
+                      fastq_vec& reads_1,
+                      const fastq_vec* reads_2,
+                      trimmed_reads& out)
+{
+    std::auto_ptr<statistics> stats = config.create_stats();
+
+    if (config.is_quality_trimming_enabled()) {
+        if (config.collapse) {
+            trim_batch<true, true>(config, adapters, index, *stats, reads_1, reads_2, out);
+        } else {
+            trim_batch<true, false>(config, adapters, index, *stats, reads_1, reads_2, out);
+        }
+    } else if (config.collapse) {
+        trim_batch<false, true>(config, adapters, index, *stats, reads_1, reads_2, out);
+    } else {
+        trim_batch<false, false>(config, adapters, index, *stats, reads_1, reads_2, out);
+    }
+
+    return *stats;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+trimmed_reads::trimmed_reads()
+  : mate_1()
+  , mate_2()
+  , singleton()
+  , collapsed()
+  , collapsed_truncated()
+  , discarded()
+{
+}
+
+
+void trimmed_reads::clear()
+{
+    mate_1.clear();
+    mate_2.clear();
+    singleton.clear();
+    collapsed.clear();
+    collapsed_truncated.clear();
+    discarded.clear();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+trimmer::trimmer(const string_vec& args, bool paired_end)
+  : m_config(new_trimmer_config(args, paired_end))
+  , m_adapters(m_config->adapters.get_adapter_set(0))
+  , m_index()
+{
+    if (m_config->index_adapters) {
+        m_index.reset(new adapter_index(m_adapters, paired_end));
+    }
+}
+
+
+trimmer::~trimmer()
+{
+}
+
+
+bool trimmer::paired_end() const
+{
+    return m_config->paired_ended_mode;
+}
+
+
+statistics trimmer::process_batch(const fastq_vec& reads,
+                                  trimmed_reads& out) const
+{
+    if (paired_end()) {
+        throw std::logic_error("SE batch passed to PE trimmer");
+    }
+
+    // Records are trimmed in place, and copied to 'out' once done
+    fastq_vec mates_1 = reads;
+
+    return trim_batch(*m_config, m_adapters, m_index.get(), mates_1, NULL, out);
+}
+
+
+statistics trimmer::process_batch(const fastq_vec& reads_1,
+                                  const fastq_vec& reads_2,
+                                  trimmed_reads& out) const
+{
+    if (!paired_end()) {
+        throw std::logic_error("PE batch passed to SE trimmer");
+    } else if (reads_1.size() != reads_2.size()) {
+        throw std::invalid_argument("number of mate 1 and mate 2 reads differ");
+    }
+
+    // Mate 1 records are trimmed in place, and re-used for collapsed reads
+    fastq_vec mates_1 = reads_1;
+
+    return trim_batch(*m_config, m_adapters, m_index.get(), mates_1, &reads_2, out);
+}
+
+} // namespace ar
@@ -0,0 +1,130 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_TRIMMER_H
+#define AR_TRIMMER_H
+
+#include <memory>
+
+#include "commontypes.h"
+#include "fastq.h"
+#include "statistics.h"
+
+namespace ar
+{
+
+class adapter_index;
+class userconfig;
+
+
+/** Reads produced by trimming a batch of reads; see 'trimmer'. */
+struct trimmed_reads
+{
+    trimmed_reads();
+
+    /** Removes all reads. */
+    void clear();
+
+    //! Retained mate 1 reads (SE reads), paired with reads in 'mate_2' if PE
+    fastq_vec mate_1;
+    //! Retained mate 2 reads, paired with reads in 'mate_1'
+    fastq_vec mate_2;
+    //! Retained PE reads, for which the other mate was discarded
+    fastq_vec singleton;
+    //! Collapsed reads (--collapse) not trimmed for low-quality bases
+    fastq_vec collapsed;
+    //! Collapsed reads (--collapse) trimmed for low-quality bases
+    fastq_vec collapsed_truncated;
+    //! Reads discarded due to their length or the number of Ns
+    fastq_vec discarded;
+};
+
+
+/**
+ * Adapter trimming of in-memory batches of reads, for use when AdapterRemoval
+ * is linked into another program. Reads are trimmed, collapsed, and filtered
+ * exactly as by the AdapterRemoval executable, but without any file IO.
+ *
+ * 'process_batch' does not modify the trimmer, and may be called by any
+ * number of threads at the same time.
+ *
+ * When collapsing (--collapse), the base used for mismatches with equal
+ * quality scores is chosen using random(), i.e. the RNG of the process, which
+ * is shared by all threads and trimmers; --seed has no effect. Collapsed
+ * reads can therefore only be reproduced by seeding this RNG (srandom) and
+ * processing batches in a fixed order using a single thread.
+ */
+class trimmer
+{
+public:
+    /**
+     * Creates a trimmer from command-line options, without the program name
+     * and input files, e.g. { "--adapter1", "AGATCGG...", "--trimns" }; PE
+     * or SE mode is selected using 'paired_end'. Options for output files,
+     * threads, and similar are accepted but have no effect. Throws
+     * std::invalid_argument if the options are invalid (details are written
+     * to STDERR), if they enable demultiplexing or adapter identification,
+     * or if --qualitybase-output is set, since the resulting records always
+     * use the (Phred+33) encoding of the 'fastq' class.
+     */
+    trimmer(const string_vec& args, bool paired_end);
+
+    ~trimmer();
+
+    /** Returns true if the trimmer processes PE reads. */
+    bool paired_end() const;
+
+    /**
+     * Trims a batch of SE reads, adding the resulting reads to 'out', and
+     * returns statistics for this batch; these may be combined using '+='.
+     * Throws std::logic_error if the trimmer was created for PE reads.
+     */
+    statistics process_batch(const fastq_vec& reads, trimmed_reads& out) const;
+
+    /**
+     * Trims a batch of PE reads, where 'reads_2' contains the mate of each
+     * read in 'reads_1'; see above. Throws fastq_error if the names of mates
+     * do not match, and std::logic_error if the trimmer was created for SE
+     * reads.
+     */
+    statistics process_batch(const fastq_vec& reads_1,
+                             const fastq_vec& reads_2,
+                             trimmed_reads& out) const;
+
+private:
+    //! Not implemented
+    trimmer(const trimmer&);
+    //! Not implemented
+    trimmer& operator=(const trimmer&);
+
+    //! Options used for trimming
+    std::auto_ptr<userconfig> m_config;
+    //! Adapters (pairs) to be trimmed
+    fastq_pair_vec m_adapters;
+    //! Index used to select candidate adapters, if --index-adapters is set
+    std::auto_ptr<adapter_index> m_index;
+};
+
+} // namespace ar
+
+#endif
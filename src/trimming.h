@@ -0,0 +1,290 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_TRIMMING_H
+#define AR_TRIMMING_H
+
+#include <cstddef>
+
+#include "adapterset.h"
+#include "alignment.h"
+#include "debug.h"
+#include "fastq.h"
+#include "statistics.h"
+#include "userconfig.h"
+
+namespace ar
+{
+
+/**
+ * Destinations of reads processed by 'trim_single_end_reads' and
+ * 'trim_paired_end_reads'; 'T' must implement the 'add' functions of the
+ * fastq_output_chunk class. The mate 2 destination may be the same object as
+ * the mate 1 destination (for interleaved output), and the collapsed
+ * destinations may be NULL unless collapsing is enabled. The singleton and
+ * mate 2 destinations are not used for SE reads.
+ */
+template <typename T>
+struct trimmed_destinations
+{
+    trimmed_destinations()
+      : mate_1(NULL)
+      , mate_2(NULL)
+      , singleton(NULL)
+      , collapsed(NULL)
+      , collapsed_truncated(NULL)
+      , discarded(NULL)
+    {
+    }
+
+    T* mate_1;
+    T* mate_2;
+    T* singleton;
+    T* collapsed;
+    T* collapsed_truncated;
+    T* discarded;
+};
+
+
+/** Quality trims, filters, and counts a collapsed read. */
+template <typename T>
+void process_collapsed_read(const userconfig& config, statistics& stats,
+                            fastq& collapsed_read,
+                            const trimmed_destinations<T>& dst)
+{
+    const fastq::ntrimmed trimmed = config.trim_sequence_by_quality_if_enabled(collapsed_read);
+
+    // If trimmed, the external coordinates are no longer reliable
+    // for determining the size of the original template.
+    const bool was_trimmed = trimmed.first || trimmed.second;
+    if (was_trimmed) {
+        collapsed_read.add_prefix_to_header("MT_");
+    } else {
+        collapsed_read.add_prefix_to_header("M_");
+    }
+
+    const size_t read_count = config.paired_ended_mode ? 2 : 1;
+    if (config.is_acceptable_read(collapsed_read)) {
+        stats.total_number_of_nucleotides += collapsed_read.length();
+        stats.total_number_of_good_reads++;
+        stats.inc_length_count(was_trimmed ? rt_collapsed_truncated : rt_collapsed,
+                               collapsed_read.length());
+
+        if (was_trimmed) {
+            dst.collapsed_truncated->add(*config.quality_output_fmt, collapsed_read, read_count);
+            stats.number_of_truncated_collapsed++;
+        } else {
+            dst.collapsed->add(*config.quality_output_fmt, collapsed_read, read_count);
+            stats.number_of_full_length_collapsed++;
+        }
+    } else {
+        stats.discard1++;
+        stats.discard2++;
+        stats.inc_length_count(rt_discarded, collapsed_read.length());
+        dst.discarded->add(*config.quality_output_fmt, collapsed_read, read_count);
+    }
+}
+
+
+/**
+ * Trims, collapses (if COLLAPSE), quality trims (if TRIM), and filters SE
+ * reads; reads are modified in place, before being added to 'dst'. The
+ * 'index' is used to select candidate adapters, unless it is NULL.
+ */
+template <bool TRIM, bool COLLAPSE, typename T>
+void trim_single_end_reads(const userconfig& config,
+                           const fastq_pair_vec& adapters,
+                           const adapter_index* index,
+                           statistics& stats,
+                           fastq_vec& reads,
+                           const trimmed_destinations<T>& dst)
+{
+    const fastq_encoding& encoding = *config.quality_output_fmt;
+
+    size_vec candidates;
+    for (fastq_vec::iterator it = reads.begin(); it != reads.end(); ++it) {
+        fastq& read = *it;
+
+        const alignment_info alignment = index
+            ? align_single_ended_sequence(read, adapters, config.shift,
+                                          index->select_candidates(read, candidates))
+            : align_single_ended_sequence(read, adapters, config.shift);
+        const userconfig::alignment_type aln_type = config.evaluate_alignment(alignment);
+
+        if (aln_type == userconfig::valid_alignment) {
+            truncate_single_ended_sequence(alignment, read);
+            stats.number_of_reads_with_adapter.at(alignment.adapter_id)++;
+            stats.well_aligned_reads++;
+
+            if (COLLAPSE && config.is_alignment_collapsible(alignment)) {
+                process_collapsed_read(config, stats, read, dst);
+                continue;
+            }
+        } else if (aln_type == userconfig::poor_alignment) {
+            stats.poorly_aligned_reads++;
+        } else {
+            stats.unaligned_reads++;
+        }
+
+        if (TRIM) {
+            config.trim_sequence_by_quality_if_enabled(read);
+        }
+
+        if (config.is_acceptable_read(read)) {
+            stats.keep1++;
+            stats.total_number_of_good_reads++;
+            stats.total_number_of_nucleotides += read.length();
+
+            dst.mate_1->add(encoding, read);
+            stats.inc_length_count(rt_mate_1, read.length());
+        } else {
+            stats.discard1++;
+            stats.inc_length_count(rt_discarded, read.length());
+
+            dst.discarded->add(encoding, read);
+        }
+    }
+
+    stats.records += reads.size();
+}
+
+
+/**
+ * Trims PE reads; see 'trim_single_end_reads'. The 'mates_1' and 'mates_2'
+ * batches are used to store the sequences and qualities of the reads while
+ * these are processed, and the mate 1 records are re-used for collapsed reads.
+ */
+template <bool TRIM, bool COLLAPSE, typename T>
+void trim_paired_end_reads(const userconfig& config,
+                           const fastq_pair_vec& adapters,
+                           const adapter_index* index,
+                           statistics& stats,
+                           fastq_vec& reads_1,
+                           const fastq_vec& reads_2,
+                           fastq_batch& mates_1,
+                           fastq_batch& mates_2,
+                           const trimmed_destinations<T>& dst)
+{
+    AR_DEBUG_ASSERT(reads_1.size() == reads_2.size());
+
+    const fastq_encoding& encoding = *config.quality_output_fmt;
+    const size_t n_pairs = reads_1.size();
+
+    for (size_t nth = 0; nth < n_pairs; ++nth) {
+        // Throws if read-names or mate numbering does not match
+        fastq::validate_paired_reads(reads_1.at(nth), reads_2.at(nth));
+    }
+
+    // Sequences and qualities are stored in batches; headers are taken from
+    // the original reads
+    mates_1.assign(reads_1);
+    // Reverse complement to match the orientation of read1
+    mates_2.assign(reads_2, true);
+
+    // Alignment, truncation, trimming, filtering, and output of each pair is
+    // carried out in a single pass, while the records are still in the cache;
+    // trim points are offsets into the batch, so only retained bases are
+    // copied, once, when the records are written to the destinations
+    size_vec candidates;
+    for (size_t nth = 0; nth < n_pairs; ++nth) {
+        const alignment_info alignment = index
+            ? align_paired_ended_sequences(mates_1, mates_2, nth, adapters, config.shift,
+                                           index->select_candidates(mates_1, mates_2, nth, candidates))
+            : align_paired_ended_sequences(mates_1, mates_2, nth, adapters, config.shift);
+        const userconfig::alignment_type aln_type = config.evaluate_alignment(alignment);
+        if (aln_type == userconfig::valid_alignment) {
+            stats.well_aligned_reads++;
+            const size_t n_adapters = truncate_paired_ended_sequences(alignment, mates_1, mates_2, nth);
+            stats.number_of_reads_with_adapter.at(alignment.adapter_id) += n_adapters;
+
+            if (COLLAPSE && config.is_alignment_collapsible(alignment)) {
+                // The mate 1 record keeps its header, and its buffers are re-used
+                fastq& collapsed_read = reads_1.at(nth);
+                collapse_paired_ended_sequences(alignment, mates_1, mates_2, nth, collapsed_read);
+                process_collapsed_read(config, stats, collapsed_read, dst);
+                continue;
+            }
+        } else if (aln_type == userconfig::poor_alignment) {
+            stats.poorly_aligned_reads++;
+        } else {
+            stats.unaligned_reads++;
+        }
+
+        // Reads were not aligned or collapsing is not enabled
+        // Undo reverse complementation (post truncation of adapters)
+        mates_2.reverse_complement(nth);
+
+        if (TRIM) {
+            config.trim_sequence_by_quality_if_enabled(mates_1, nth);
+            config.trim_sequence_by_quality_if_enabled(mates_2, nth);
+        }
+
+        const std::string& header_1 = reads_1.at(nth).header();
+        const std::string& header_2 = reads_2.at(nth).header();
+        const size_t length_1 = mates_1.length(nth);
+        const size_t length_2 = mates_2.length(nth);
+
+        // Are the reads good enough? Not too many Ns?
+        const bool read_1_acceptable = config.is_acceptable_read(mates_1, nth);
+        const bool read_2_acceptable = config.is_acceptable_read(mates_2, nth);
+
+        stats.total_number_of_nucleotides += read_1_acceptable ? length_1 : 0u;
+        stats.total_number_of_nucleotides += read_1_acceptable ? length_2 : 0u;
+        stats.total_number_of_good_reads += read_1_acceptable;
+        stats.total_number_of_good_reads += read_2_acceptable;
+
+        if (read_1_acceptable && read_2_acceptable) {
+            dst.mate_1->add(encoding, mates_1, nth, header_1, rt_mate_1);
+            dst.mate_2->add(encoding, mates_2, nth, header_2, rt_mate_2);
+
+            stats.inc_length_count(rt_mate_1, length_1);
+            stats.inc_length_count(rt_mate_2, length_2);
+        } else {
+            // Keep one or none of the reads ...
+            stats.keep1 += read_1_acceptable;
+            stats.keep2 += read_2_acceptable;
+            stats.discard1 += !read_1_acceptable;
+            stats.discard2 += !read_2_acceptable;
+            stats.inc_length_count(read_1_acceptable ? rt_mate_1 : rt_discarded, length_1);
+            stats.inc_length_count(read_2_acceptable ? rt_mate_2 : rt_discarded, length_2);
+
+            if (read_1_acceptable) {
+                dst.singleton->add(encoding, mates_1, nth, header_1, rt_mate_1);
+            } else {
+                dst.discarded->add(encoding, mates_1, nth, header_1, rt_mate_1);
+            }
+
+            if (read_2_acceptable) {
+                dst.singleton->add(encoding, mates_2, nth, header_2, rt_mate_2);
+            } else {
+                dst.discarded->add(encoding, mates_2, nth, header_2, rt_mate_2);
+            }
+        }
+    }
+
+    stats.records += n_pairs;
+}
+
+} // namespace ar
+
+#endif
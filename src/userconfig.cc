@@ -22,6 +22,7 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cerrno>
@@ -29,10 +30,13 @@
 #include <stdexcept>
 #include <sys/time.h>
 #include <limits>
+#include <sstream>
 
 #include "userconfig.h"
 #include "fastq.h"
 #include "alignment.h"
+#include "checkpoint.h"
+#include "metrics.h"
 #include "strutils.h"
 
 namespace ar
@@ -78,6 +82,8 @@ userconfig::userconfig(const std::string& name,
     , input_file_1()
     , input_file_2()
     , paired_ended_mode(false)
+    , interleaved_input(false)
+    , interleaved_output(false)
     , min_genomic_length(15)
     , max_genomic_length(std::numeric_limits<unsigned>::max())
     , min_adapter_overlap(0)
@@ -87,15 +93,41 @@ userconfig::userconfig(const std::string& name,
     , quality_output_fmt()
     , trim_by_quality(false)
     , low_quality_score(2)
+    , trim_window_length(-1.0)
+    , trim_mott_rate(-1.0)
     , trim_ambiguous_bases(false)
     , max_ambiguous_bases(1000)
     , collapse(false)
     , shift(2)
+    , index_adapters(false)
     , seed(get_seed())
     , identify_adapters(false)
+    , identify_adapters_sample(1)
+    , identify_adapters_stop(0)
     , max_threads(1)
+    , max_io_threads(0)
+    , max_memory(0)
+    , pin_threads(false)
+    , mmap_input(false)
+    , bam_input(false)
+    , chunk_size(0)
+    , pack_reads(false)
+    , bin_qualities(false)
+    , direct_io(false)
+    , preallocate(false)
+    , metrics_file()
+    , metrics_interval(METRICS_DEFAULT_INTERVAL)
+    , trace_file()
+    , checkpoint_file()
+    , checkpoint_interval(CHECKPOINT_DEFAULT_INTERVAL)
+    , resume(false)
+    , shard(0)
+    , shard_count(0)
+    , merge_stats()
     , gzip(false)
     , gzip_level(6)
+    , bgzf(false)
+    , bam_output(false)
     , bzip2(false)
     , bzip2_level(9)
     , barcode_mm(0)
@@ -112,11 +144,33 @@ userconfig::userconfig(const std::string& name,
 {
     argparser["--file1"] =
         new argparse::any(&input_file_1, "FILE",
-            "Input file containing mate 1 reads or single-ended reads "
-            "[REQUIRED].");
+            "Input file containing mate 1 reads or single-ended reads; "
+            "use '-' to read from STDIN [REQUIRED].");
     argparser["--file2"] =
         new argparse::any(&input_file_2, "FILE",
             "Input file containing mate 2 reads [OPTIONAL].");
+    argparser["--interleaved-input"] =
+        new argparse::flag(&interleaved_input,
+            "The (single) input file (--file1) contains both mate 1 and mate "
+            "2 reads, with each mate 1 read followed by the mate 2 read "
+            "[current: %default].");
+    argparser["--interleaved"] =
+        new argparse::flag(NULL,
+            "Enables both --interleaved-input and --interleaved-output "
+            "[current: %default].");
+    argparser["--mmap"] =
+        new argparse::flag(&mmap_input,
+            "Memory map uncompressed input files, in which case records are "
+            "parsed using all --threads; compressed files are read as "
+            "normal [current: %default].");
+#ifdef AR_GZIP_SUPPORT
+    argparser["--bam-input"] =
+        new argparse::flag(&bam_input,
+            "The input file (--file1) is an unaligned BAM file; in PE mode, "
+            "each mate 1 record must be followed by the mate 2 record, and "
+            "--interleaved-input must be set. Tags are kept for records "
+            "written as BAM (see --bam-output) [current: %default].");
+#endif
 
     argparser.add_header("FASTQ OPTIONS:");
     argparser["--qualitybase"] =
@@ -148,12 +202,19 @@ userconfig::userconfig(const std::string& name,
             "[default: BASENAME.settings]");
     argparser["--output1"] =
         new argparse::any(NULL, "FILE",
-            "Output file containing trimmed mate1 reads [default: "
+            "Output file containing trimmed mate1 reads; use '-' to write "
+            "to STDOUT, as for other output files [default: "
             "BASENAME.pair1.truncated (PE) or BASENAME.truncated (SE)]");
     argparser["--output2"] =
         new argparse::any(NULL, "FILE",
             "Output file containing trimmed mate 2 reads [default: "
             "BASENAME.pair2.truncated (only used in PE mode)]");
+    argparser["--interleaved-output"] =
+        new argparse::flag(&interleaved_output,
+            "Write mate 1 and mate 2 reads to a single file (--output1), "
+            "with each mate 1 read followed by the mate 2 read [default: "
+            "BASENAME.paired.truncated]; only used in PE mode "
+            "[current: %default].");
     argparser["--singleton"] =
         new argparse::any(NULL, "FILE",
             "Output file to which containing paired reads for which the mate "
@@ -175,6 +236,16 @@ userconfig::userconfig(const std::string& name,
         new argparse::any(NULL, "FILE",
             "Contains reads discarded due to the --minlength, --maxlength or "
             "--maxns options [default: BASENAME.discarded]");
+    argparser["--direct-io"] =
+        new argparse::flag(&direct_io,
+            "Write output files using direct IO (O_DIRECT), bypassing the "
+            "page cache, where supported by the file system "
+            "[current: %default]");
+    argparser["--preallocate"] =
+        new argparse::flag(&preallocate,
+            "Reserve space for output files ahead of writes (using "
+            "fallocate), where supported by the file system; reduces "
+            "fragmentation and metadata updates [current: %default]");
 
 
 #if defined(AR_GZIP_SUPPORT) || defined(AR_BZIP2_SUPPORT)
@@ -188,6 +259,17 @@ userconfig::userconfig(const std::string& name,
     argparser["--gzip-level"] =
         new argparse::knob(&gzip_level, "LEVEL",
             "Compression level, 0 - 9 [current: %default]");
+    argparser["--bgzf"] =
+        new argparse::flag(&bgzf,
+            "Write gzip compressed output as BGZF; blocks are compressed "
+            "independently, allowing compression to make use of all "
+            "--threads. Implies --gzip [current: %default]");
+    argparser["--bam-output"] =
+        new argparse::flag(&bam_output,
+            "Write reads as unaligned BAM records; fields in read headers "
+            "following the name are written as tags, where valid, and as a "
+            "CO tag otherwise. Pairs of mates are written to --output1. "
+            "Implies --bgzf [current: %default]");
 #endif
 #ifdef AR_BZIP2_SUPPORT
     argparser["--bzip2"] =
@@ -220,6 +302,13 @@ userconfig::userconfig(const std::string& name,
             "the first column was supplied to --adapter1, and the second "
             "column was supplied to --adapter2; only the first adapter in "
             "each pair is required SE trimming mode [current: %default].");
+    argparser["--index-adapters"] =
+        new argparse::flag(&index_adapters,
+            "If set, reads are only aligned against the adapters (pairs) "
+            "sharing the greatest number of 12-mers with the read, or against "
+            "all adapters if no 12-mers are shared; this greatly speeds up "
+            "trimming with large --adapter-list tables, but may select a "
+            "different adapter for some reads [current: %default].");
 
     argparser.add_seperator();
     argparser["--mm"]
@@ -246,10 +335,23 @@ userconfig::userconfig(const std::string& name,
         new argparse::flag(&trim_by_quality,
             "If set, trim bases at 5'/3' termini with quality scores <= to "
             "--minquality value [current: %default]");
+    argparser["--trimwindows"] =
+        new argparse::floaty_knob(&trim_window_length, "WINDOW_SIZE",
+            "If set, quality trimming is carried out using sliding windows: "
+            "5' bases are trimmed until the first window with a mean quality "
+            "> --minquality, and the read is truncated at the first window "
+            "with a mean quality <= --minquality. WINDOW_SIZE is in bases if "
+            ">= 1, and a fraction of the read length otherwise "
+            "[current: off].");
+    argparser["--trimmott"] =
+        new argparse::floaty_knob(&trim_mott_rate, "RATE",
+            "If set, quality trimming is carried out using the modified Mott "
+            "algorithm, retaining the segment of the read maximizing the sum "
+            "of RATE minus the per-base error probabilities [current: off].");
     argparser["--minquality"] =
         new argparse::knob(&low_quality_score, "PHRED",
-            "Inclusive minimum; see --trimqualities for details "
-            "[current: %default]");
+            "Inclusive minimum; see --trimqualities / --trimwindows for "
+            "details [current: %default]");
     argparser["--minlength"] =
         new argparse::knob(&min_genomic_length, "LENGTH",
             "Reads shorter than this length are discarded "
@@ -314,6 +416,18 @@ userconfig::userconfig(const std::string& name,
         new argparse::flag(&identify_adapters,
             "Attempt to identify the adapter pair of PE reads, by searching "
             "for overlapping reads [current: %default].");
+    argparser["--identify-adapters-sample"] =
+        new argparse::knob(&identify_adapters_sample, "N",
+            "Only use every Nth pair of reads when identifying adapters; "
+            "reads are still read and validated, but only these pairs are "
+            "aligned [current: %default].");
+    argparser["--identify-adapters-stop"] =
+        new argparse::knob(&identify_adapters_stop, "N",
+            "Stop reading input when identifying adapters, once the "
+            "consensus of the first N bases of both adapters has converged, "
+            "i.e. when the most common base at each position is unlikely to "
+            "change given additional reads. Set to 0 to use all reads "
+            "[current: %default].");
     argparser["--seed"] =
         new argparse::knob(&seed, "SEED",
             "Sets the RNG seed used when choosing between bases with equal "
@@ -325,6 +439,91 @@ userconfig::userconfig(const std::string& name,
     argparser["--threads"] =
         new argparse::knob(&max_threads, "THREADS",
             "Maximum number of threads [current: %default]");
+    argparser["--io-threads"] =
+        new argparse::knob(&max_io_threads, "THREADS",
+            "Maximum number of threads reading or writing files at the same "
+            "time; each file is only accessed by one thread at a time. Set to "
+            "1 for spinning disks, or to 0 for no limit beyond --threads "
+            "[current: %default]");
+    argparser["--max-memory"] =
+        new argparse::knob(&max_memory, "MB",
+            "Soft limit on the memory used by reads waiting to be processed, "
+            "compressed or written; reading of input is paused while this "
+            "limit is exceeded. Set to 0 for no limit [current: %default]");
+    argparser["--pin-threads"] =
+        new argparse::flag(&pin_threads,
+            "Bind each thread to the CPUs of a NUMA node, filling one node "
+            "before using the next, and prefer processing reads on the node "
+            "where they were read. Threads used to decompress input files are "
+            "bound to the node of the thread reading the file. Only supported "
+            "on Linux [current: off].");
+#endif
+    argparser["--chunk-size"] =
+        new argparse::knob(&chunk_size, "N",
+            "Number of reads (or pairs of reads) processed together as a "
+            "single unit of work. Set to 0 to adjust the size at runtime, "
+            "based on the time taken to process reads [current: %default]");
+    argparser["--pack-reads"] =
+        new argparse::flag(&pack_reads,
+            "Store reads waiting to be processed (e.g. while demultiplexing) "
+            "in packed form, using 4 bits per nucleotide, to reduce the "
+            "memory used by queued reads [current: %default]");
+    argparser["--bin-qualities"] =
+        new argparse::flag(&bin_qualities,
+            "Bin quality scores using the 8 levels used by Illumina (6, 15, "
+            "22, 27, 33, 37, and 40 for scores of 2 and above), such that "
+            "packed scores use 4 bits. This is lossy and applies to all "
+            "output. Implies --pack-reads [current: %default]");
+    argparser["--metrics-file"] =
+        new argparse::any(&metrics_file, "FILE",
+            "Periodically write a snapshot of the progress of the run to "
+            "FILE, including reads processed per second, bytes read and "
+            "written per file, and the number of queued chunks and busy "
+            "time of each step. Uses the Prometheus text format, and the "
+            "file is replaced atomically [default: not written]");
+    argparser["--metrics-interval"] =
+        new argparse::floaty_knob(&metrics_interval, "SECONDS",
+            "Number of seconds between snapshots written to --metrics-file "
+            "[current: %default]");
+    argparser["--checkpoint"] =
+        new argparse::any(&checkpoint_file, "FILE",
+            "Periodically pause the run once all queued reads have been "
+            "written, and record the number of reads consumed from each "
+            "input file, the size of each output file, and the statistics "
+            "collected so far in FILE. The file is removed once the run "
+            "completes [default: not written]");
+    argparser["--checkpoint-interval"] =
+        new argparse::floaty_knob(&checkpoint_interval, "SECONDS",
+            "Number of seconds between checkpoints written to --checkpoint "
+            "[current: %default]");
+    argparser["--resume"] =
+        new argparse::flag(&resume,
+            "Resume an interrupted run from the file specified using "
+            "--checkpoint; the run must use the same input files and "
+            "options. Starts from the beginning if no checkpoint exists "
+            "[current: %default]");
+    argparser["--shard"] =
+        new argparse::any(NULL, "I/N",
+            "Split the input files into N parts of roughly identical size, "
+            "and process only the I'th part (counting from 1), so that a "
+            "single sample can be processed on N machines. Statistics are "
+            "additionally written to BASENAME.stats, which may be combined "
+            "using --merge-stats. Requires uncompressed input files "
+            "[default: not set]");
+    argparser["--merge-stats"] =
+        new argparse::many(&merge_stats, "FILE",
+            "Combine the statistics (BASENAME.stats) written for each part "
+            "of a run using --shard, and write the settings file(s) for the "
+            "entire run. Must be combined with the options used to process "
+            "each part, other than --shard and --basename [default: not set]");
+#ifdef AR_TRACE_SUPPORT
+    argparser["--trace"] =
+        new argparse::any(&trace_file, "FILE",
+            "Record the time spent processing each chunk of reads by each "
+            "step, as well as time spent queued and waiting for locks or IO, "
+            "and write this trace to FILE in the Chrome trace (JSON) format, "
+            "for use with e.g. https://ui.perfetto.dev; a per-step summary "
+            "is printed once done [default: not written]");
 #endif
 }
 
@@ -375,6 +574,24 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
         return argparse::pr_error;
     }
 
+    if ((trim_by_quality + argparser.is_set("--trimwindows")
+                         + argparser.is_set("--trimmott")) > 1) {
+        std::cerr << "Error: --trimqualities, --trimwindows, and --trimmott "
+                  << "are mutually exclusive." << std::endl;
+        return argparse::pr_error;
+    } else if (argparser.is_set("--trimwindows") && trim_window_length <= 0) {
+        std::cerr << "Error: Invalid value for --trimwindows: "
+                  << trim_window_length << "\n"
+                  << "   must be greater than 0" << std::endl;
+        return argparse::pr_error;
+    } else if (argparser.is_set("--trimmott")
+               && (trim_mott_rate <= 0 || trim_mott_rate > 1)) {
+        std::cerr << "Error: Invalid value for --trimmott: "
+                  << trim_mott_rate << "\n"
+                  << "   must be in the range (0, 1]" << std::endl;
+        return argparse::pr_error;
+    }
+
     // Check for invalid combinations of settings
     const bool file_1_set = argparser.is_set("--file1");
     const bool file_2_set = argparser.is_set("--file2");
@@ -387,16 +604,56 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
     } else if (file_2_set && !file_1_set) {
         std::cerr << "Error: --file2 specified, but --file1 is not specified." << std::endl;
         return argparse::pr_error;
-    } else if (identify_adapters && !(file_1_set && file_2_set)) {
+    }
+
+    if (argparser.is_set("--interleaved")) {
+        interleaved_input = true;
+        interleaved_output = true;
+    }
+
+    if (bam_input && file_2_set) {
+        std::cerr << "Error: --file2 cannot be used with --bam-input; use "
+                  << "--interleaved-input to read both mates from --file1."
+                  << std::endl;
+        return argparse::pr_error;
+    } else if (bam_input && identify_adapters) {
+        std::cerr << "Error: --bam-input cannot be used with "
+                  << "--identify-adapters." << std::endl;
+        return argparse::pr_error;
+    }
+
+    if (interleaved_input && file_2_set) {
+        std::cerr << "Error: --file2 cannot be used with --interleaved-input; "
+                  << "both mates are read from --file1." << std::endl;
+        return argparse::pr_error;
+    } else if (identify_adapters && !(file_2_set || interleaved_input)) {
         std::cerr << "Error: Both input files (--file1 / --file2) must be "
-                  << "specified when using --identify-adapters."
+                  << "specified when using --identify-adapters, unless "
+                  << "--interleaved-input is used."
+                  << std::endl;
+        return argparse::pr_error;
+    } else if (!identify_adapters_sample) {
+        std::cerr << "Error: --identify-adapters-sample must be at least 1."
+                  << std::endl;
+        return argparse::pr_error;
+    } else if (file_2_set && input_file_1 == "-" && input_file_2 == "-") {
+        std::cerr << "Error: --file1 and --file2 cannot both be read from "
+                  << "STDIN ('-'); use --interleaved-input instead."
                   << std::endl;
         return argparse::pr_error;
     }
 
-    if (file_2_set) {
+    if (file_2_set || interleaved_input) {
         paired_ended_mode = true;
         min_adapter_overlap = 0;
+        // Mates are flagged as such, and always written together
+        interleaved_output = interleaved_output || bam_output;
+    } else {
+        interleaved_output = false;
+    }
+
+    if (!check_stdout_usage()) {
+        return argparse::pr_error;
     }
 
     // (Optionally) read adapters from file and validate
@@ -416,6 +673,14 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
         }
     }
 
+    if (bam_output) {
+        bgzf = true;
+    }
+
+    if (bgzf) {
+        gzip = true;
+    }
+
     if (gzip_level > 9) {
         std::cerr << "Error: --gzip-level must be in the range 0 to 9, not "
                   << gzip_level << std::endl;
@@ -440,14 +705,138 @@ argparse::parse_result userconfig::parse_args(int argc, char *argv[])
         return argparse::pr_error;
     }
 
+    if (metrics_interval <= 0) {
+        std::cerr << "Error: --metrics-interval must be greater than 0, not "
+                  << metrics_interval << std::endl;
+        return argparse::pr_error;
+    }
+
+    if (!check_checkpoint_usage()) {
+        return argparse::pr_error;
+    }
+
+    if (!setup_shards()) {
+        return argparse::pr_error;
+    }
+
     return argparse::pr_ok;
 }
 
 
+bool userconfig::check_stdout_usage() const
+{
+    const char* keys[] = { "--output1", "--output2", "--singleton",
+                           "--outputcollapsed", "--outputcollapsedtruncated",
+                           "--discarded", "--settings" };
+
+    std::string first_key;
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        if (argparser.is_set(keys[i]) && argparser.at(keys[i])->to_str() == "-") {
+            if (!first_key.empty()) {
+                std::cerr << "Error: Both " << first_key << " and " << keys[i]
+                          << " are set to write to STDOUT ('-'); at most one "
+                          << "output file may be written to STDOUT. Use "
+                          << "--interleaved-output to write both mates to "
+                          << "a single file." << std::endl;
+                return false;
+            }
+
+            first_key = keys[i];
+        }
+    }
+
+    return true;
+}
+
+
+bool userconfig::check_checkpoint_usage() const
+{
+    if (checkpoint_file.empty()) {
+        if (resume) {
+            std::cerr << "Error: --resume requires --checkpoint!" << std::endl;
+            return false;
+        }
+
+        return true;
+    } else if (checkpoint_interval <= 0) {
+        std::cerr << "Error: --checkpoint-interval must be greater than 0, "
+                  << "not " << checkpoint_interval << std::endl;
+        return false;
+    } else if (identify_adapters) {
+        std::cerr << "Error: --checkpoint cannot be used with "
+                  << "--identify-adapters!" << std::endl;
+        return false;
+    } else if (bam_input) {
+        std::cerr << "Error: --checkpoint cannot be used with --bam-input!"
+                  << std::endl;
+        return false;
+    } else if (direct_io) {
+        std::cerr << "Error: --checkpoint cannot be used with --direct-io!"
+                  << std::endl;
+        return false;
+    }
+
+    // Output written to STDOUT cannot be truncated when resuming
+    const char* keys[] = { "--output1", "--output2", "--singleton",
+                           "--outputcollapsed", "--outputcollapsedtruncated",
+                           "--discarded" };
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        if (argparser.is_set(keys[i]) && argparser.at(keys[i])->to_str() == "-") {
+            std::cerr << "Error: --checkpoint cannot be used when " << keys[i]
+                      << " is written to STDOUT ('-')!" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool userconfig::setup_shards()
+{
+    if (argparser.is_set("--shard")) {
+        const std::string value = argparser.at("--shard")->to_str();
+
+        std::istringstream stream(value);
+        char separator = '\0';
+        int nth = 0;
+        int count = 0;
+        if (!(stream >> nth >> separator >> count) || separator != '/'
+            || !stream.eof() || nth < 1 || nth > count) {
+            std::cerr << "Error: Invalid value for --shard: '" << value << "'; "
+                      << "expected I/N, where 1 <= I <= N!" << std::endl;
+            return false;
+        } else if (!merge_stats.empty()) {
+            std::cerr << "Error: --shard cannot be used with --merge-stats!"
+                      << std::endl;
+            return false;
+        } else if (bam_input) {
+            std::cerr << "Error: --shard cannot be used with --bam-input!"
+                      << std::endl;
+            return false;
+        }
+
+        shard = static_cast<size_t>(nth - 1);
+        shard_count = static_cast<size_t>(count);
+    }
+
+    if ((shard_count || !merge_stats.empty()) && identify_adapters) {
+        std::cerr << "Error: --shard and --merge-stats cannot be used with "
+                  << "--identify-adapters!" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
 std::auto_ptr<statistics> userconfig::create_stats() const
 {
     std::auto_ptr<statistics> stats(new statistics());
     stats->number_of_reads_with_adapter.resize(adapters.adapter_count());
+    // Length distributions grow as needed, but are preallocated for typical reads
+    stats->reserve_lengths(std::min<size_t>(max_genomic_length, STATISTICS_RESERVED_LENGTH));
     return stats;
 }
 
@@ -510,6 +899,17 @@ bool userconfig::is_acceptable_read(const fastq& seq) const
 }
 
 
+bool userconfig::is_acceptable_read(const fastq_batch& batch, size_t nth) const
+{
+    const size_t seq_len = batch.length(nth);
+
+    return seq_len >= min_genomic_length
+        && seq_len <= max_genomic_length
+        && (max_ambiguous_bases >= seq_len
+            || batch.count_ns(nth) <= max_ambiguous_bases);
+}
+
+
 std::string userconfig::get_output_filename(const std::string& key,
                                             size_t nth) const
 {
@@ -517,15 +917,21 @@ std::string userconfig::get_output_filename(const std::string& key,
 
     if (key == "demux_stats") {
         return filename += ".settings";
+    } else if (key == "shard_stats") {
+        return filename += ".stats";
     } else if (key == "demux_unknown") {
         filename += ".unidentified";
 
-        if (nth) {
+        if (nth && paired_ended_mode && interleaved_output) {
+            filename += "_interleaved";
+        } else if (nth) {
             filename.push_back('_');
             filename.push_back('0' + nth);
         }
 
-        if (gzip) {
+        if (bam_output) {
+            filename += ".bam";
+        } else if (gzip) {
             filename += ".gz";
         } else if (bzip2) {
             filename += ".bz2";
@@ -549,7 +955,7 @@ std::string userconfig::get_output_filename(const std::string& key,
         filename += ".discarded";
     } else if (paired_ended_mode) {
         if (key == "--output1") {
-            filename += ".pair1.truncated";
+            filename += interleaved_output ? ".paired.truncated" : ".pair1.truncated";
         } else if (key == "--output2") {
             filename += ".pair2.truncated";
         } else if (key == "--singleton") {
@@ -565,7 +971,9 @@ std::string userconfig::get_output_filename(const std::string& key,
         }
     }
 
-    if (gzip) {
+    if (bam_output) {
+        filename += ".bam";
+    } else if (gzip) {
         filename += ".gz";
     } else if (bzip2) {
         filename += ".bz2";
@@ -575,10 +983,43 @@ std::string userconfig::get_output_filename(const std::string& key,
 }
 
 
+output_format userconfig::get_output_format(bool pairs) const
+{
+    if (!bam_output) {
+        return of_fastq;
+    }
+
+    return pairs ? of_bam_pairs : of_bam;
+}
+
+
+read_packing userconfig::get_read_packing() const
+{
+    if (bin_qualities) {
+        return rp_binned;
+    }
+
+    return pack_reads ? rp_lossless : rp_none;
+}
+
+
+bool userconfig::is_quality_trimming_enabled() const
+{
+    return trim_ambiguous_bases || trim_by_quality
+        || trim_window_length >= 0 || trim_mott_rate >= 0;
+}
+
+
 fastq::ntrimmed userconfig::trim_sequence_by_quality_if_enabled(fastq& read) const
 {
     fastq::ntrimmed trimmed;
-    if (trim_ambiguous_bases || trim_by_quality) {
+    if (trim_window_length >= 0) {
+        trimmed = read.trim_windowed_bases(trim_ambiguous_bases,
+                                           low_quality_score,
+                                           trim_window_length);
+    } else if (trim_mott_rate >= 0) {
+        trimmed = read.trim_mott_bases(trim_ambiguous_bases, trim_mott_rate);
+    } else if (trim_ambiguous_bases || trim_by_quality) {
         char quality_score = trim_by_quality ? low_quality_score : -1;
         trimmed = read.trim_low_quality_bases(trim_ambiguous_bases,
                                               quality_score);
@@ -588,6 +1029,26 @@ fastq::ntrimmed userconfig::trim_sequence_by_quality_if_enabled(fastq& read) con
 }
 
 
+fastq::ntrimmed userconfig::trim_sequence_by_quality_if_enabled(fastq_batch& batch,
+                                                                size_t nth) const
+{
+    fastq::ntrimmed trimmed;
+    if (trim_window_length >= 0) {
+        trimmed = batch.trim_windowed_bases(nth, trim_ambiguous_bases,
+                                            low_quality_score,
+                                            trim_window_length);
+    } else if (trim_mott_rate >= 0) {
+        trimmed = batch.trim_mott_bases(nth, trim_ambiguous_bases, trim_mott_rate);
+    } else if (trim_ambiguous_bases || trim_by_quality) {
+        char quality_score = trim_by_quality ? low_quality_score : -1;
+        trimmed = batch.trim_low_quality_bases(nth, trim_ambiguous_bases,
+                                               quality_score);
+    }
+
+    return trimmed;
+}
+
+
 bool check_and_set_barcode_mm(const argparse::parser& argparser,
                               const std::string& key,
                               unsigned barcode_mm,
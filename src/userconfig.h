@@ -65,6 +65,15 @@ public:
 
     std::string get_output_filename(const std::string& key, size_t nth = 0) const;
 
+    /**
+     * Returns the format of output files; BAM records are written for
+     * interleaved pairs of mates if 'pairs' is set.
+     */
+    output_format get_output_format(bool pairs = false) const;
+
+    /** Returns the storage used for reads waiting to be processed. */
+    read_packing get_read_packing() const;
+
 
     enum alignment_type
     {
@@ -84,10 +93,17 @@ public:
 
     /** Returns true if the read matches the quality criteria set by the user. **/
     bool is_acceptable_read(const fastq& seq) const;
+    /** Returns true if the nth record in the batch matches the criteria. **/
+    bool is_acceptable_read(const fastq_batch& batch, size_t nth) const;
 
 
+    /** Returns true if any form of quality / N trimming is enabled. */
+    bool is_quality_trimming_enabled() const;
     /** Trims a read if enabled, returning the #bases removed from each end. */
     fastq::ntrimmed trim_sequence_by_quality_if_enabled(fastq& read) const;
+    /** Trims the nth record in the batch if enabled; see above. */
+    fastq::ntrimmed trim_sequence_by_quality_if_enabled(fastq_batch& batch,
+                                                        size_t nth) const;
 
 
     //! Argument parser setup to parse the arguments expected by AR
@@ -100,8 +116,13 @@ public:
     //! Path to input file containing mate 2 reads (for PE reads)
     std::string input_file_2;
 
-    //! Set to true if both --input1 and --input2 are set.
+    //! Set to true if both --input1 and --input2 are set, or if
+    //! --interleaved-input is set.
     bool paired_ended_mode;
+    //! Mate 1 and mate 2 reads are read from --file1, one pair at a time
+    bool interleaved_input;
+    //! Mate 1 and mate 2 reads are written to --output1, one pair at a time
+    bool interleaved_output;
 
     //! The minimum length of trimmed reads (ie. genomic nts) to be retained
     unsigned min_genomic_length;
@@ -125,6 +146,11 @@ public:
     bool trim_by_quality;
     //! The highest quality score which is considered low-quality
     unsigned low_quality_score;
+    //! Sliding window size for window based trimming; fractions of the read
+    //! length if < 1; window based trimming is disabled if < 0.
+    double trim_window_length;
+    //! Error rate limit for Mott trimming; Mott trimming is disabled if < 0.
+    double trim_mott_rate;
 
     //! If true, ambiguous bases (N) at read termini are trimmed.
     bool trim_ambiguous_bases;
@@ -138,20 +164,71 @@ public:
     // Allow for slipping basepairs by allowing missing bases in adapter
     unsigned shift;
 
+    //! If true, reads are only aligned against adapters sharing k-mers with
+    //! the read, unless no such adapters exist (see adapter_index).
+    bool index_adapters;
+
     //! RNG seed for randomly selecting between to bases with the same quality
     //! when collapsing overllapping PE reads.
     unsigned seed;
 
     //! If true, the program attempts to identify the adapter pair of PE reads
     bool identify_adapters;
+    //! Only every Nth pair of reads is used to identify adapters
+    unsigned identify_adapters_sample;
+    //! Stop once the consensus of the first N bases of both adapters has
+    //! converged; 0 to process all reads (see main_adapter_id.cc).
+    unsigned identify_adapters_stop;
 
     //! The maximum number of threads used by the program
     unsigned max_threads;
+    //! The maximum number of threads doing file IO at once; 0 for no limit
+    unsigned max_io_threads;
+    //! Soft limit on memory (in MB) used by queued reads; 0 for no limit
+    unsigned max_memory;
+    //! Bind threads to NUMA nodes, keeping work on the node where it started
+    bool pin_threads;
+    //! Memory map uncompressed input files, allowing parallel parsing
+    bool mmap_input;
+    //! Read input from an unaligned BAM file (--file1) instead of FASTQ
+    bool bam_input;
+    //! Number of reads per chunk; 0 to adjust the size at runtime
+    unsigned chunk_size;
+    //! Store reads waiting to be processed in packed form
+    bool pack_reads;
+    //! Bin quality scores (lossy) when packing reads; implies pack_reads
+    bool bin_qualities;
+    //! Write output files using O_DIRECT, where supported
+    bool direct_io;
+    //! Preallocate space for output files, where supported
+    bool preallocate;
+    //! File to which metrics snapshots are written; disabled if empty
+    std::string metrics_file;
+    //! Seconds between metrics snapshots
+    double metrics_interval;
+    //! File to which a trace of the run is written; disabled if empty
+    std::string trace_file;
+    //! File to which checkpoints are written; disabled if empty
+    std::string checkpoint_file;
+    //! Seconds between checkpoints
+    double checkpoint_interval;
+    //! Resume the run from the last checkpoint, if any
+    bool resume;
+    //! Shard of the input files processed, counting from 0; see --shard
+    size_t shard;
+    //! Number of shards the input files are split into; 0 if not sharded
+    size_t shard_count;
+    //! Statistics files written for each shard, which are to be merged
+    string_vec merge_stats;
 
     //! GZip compression enabled / disabled
     bool gzip;
     //! GZip compression level used for output reads
     unsigned int gzip_level;
+    //! Write gzip output as independently compressed BGZF blocks
+    bool bgzf;
+    //! Write unaligned BAM records instead of FASTQ records; implies bgzf
+    bool bam_output;
 
     //! BZip2 compression enabled / disabled
     bool bzip2;
@@ -180,6 +257,15 @@ private:
      */
     bool setup_adapter_sequences();
 
+    /** Returns false if more than one output file is written to STDOUT. */
+    bool check_stdout_usage() const;
+
+    /** Returns false if options incompatible with --checkpoint are used. */
+    bool check_checkpoint_usage() const;
+
+    /** Parses --shard and returns false if invalid or incompatible options are used. */
+    bool setup_shards();
+
 
     //! Sink for --adapter1, adapter sequence expected at 3' of mate 1 reads
     std::string adapter_1;
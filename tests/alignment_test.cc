@@ -22,12 +22,15 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <cstdlib>
 #include <limits>
 #include <sstream>
 #include <vector>
 #include <gtest/gtest.h>
 
 #include "alignment.h"
+#include "alignment_packed.h"
+#include "alignment_simd.h"
 #include "fastq.h"
 
 namespace ar
@@ -499,6 +502,143 @@ TEST(alignment_pe, no_expected_overlap)
 }
 
 
+TEST(alignment_pe, completely_overlapping_long_sequences)
+{
+    // Long enough that adapter + read does not fit in the stack buffer
+    std::string sequence;
+    for (size_t i = 0; i < 700; ++i) {
+        sequence.push_back("ACGTTGCAAGC"[(i * i) % 11]);
+    }
+
+    const fastq record1("Rec", sequence, std::string(sequence.length(), '!'));
+    const fastq record2("Rec", sequence, std::string(sequence.length(), '!'));
+    const fastq_pair_vec adapters = create_adapter_vec(fastq("PCR1", "CGCTGA", "!!!!!!"),
+                                                       fastq("PCR2", "TGTAC",  "!!!!!"));
+    const alignment_info expected = new_aln(700, 0, 700);
+    const alignment_info result = align_paired_ended_sequences(record1, record2, adapters, 0);
+    ASSERT_EQ(expected, result);
+    ASSERT_TRUNCATED_PE_IS_UNCHANGED(result, record1, record2);
+}
+
+
+/** Returns a random sequence of 'length' nts, with ~1/8 'N's. **/
+std::string random_sequence(size_t length)
+{
+    const char nts[] = "ACGTACGTACGTACGTACGTACGTACGTNNNN";
+
+    std::string result(length, 'N');
+    for (size_t i = 0; i < length; ++i) {
+        result.at(i) = nts[std::rand() % 32];
+    }
+
+    return result;
+}
+
+
+fastq random_read(const std::string& sequence)
+{
+    return fastq("Rec", sequence, std::string(sequence.length(), '!'));
+}
+
+
+TEST(alignment_pe, multiple_adapters_match_individual_alignments)
+{
+    std::srand(1234);
+    for (size_t round = 0; round < 500; ++round) {
+        fastq_pair_vec adapters;
+        for (size_t i = 1 + std::rand() % 8; i; --i) {
+            adapters.push_back(fastq_pair(random_read(random_sequence(std::rand() % 30)),
+                                          random_read(random_sequence(std::rand() % 30))));
+        }
+
+        // Construct a template shorter or longer than the reads, which are
+        // then (partially) followed by one of the adapters
+        const std::string insert = random_sequence(1 + std::rand() % 150);
+        const fastq_pair& pair = adapters.at(std::rand() % adapters.size());
+        fastq record1 = random_read(insert + pair.first.sequence() + random_sequence(50));
+        fastq record2 = random_read(insert + pair.second.sequence() + random_sequence(50));
+        record1.truncate(0, 50 + std::rand() % 50);
+        record2.truncate(0, 50 + std::rand() % 50);
+        record2.reverse_complement();
+
+        const int max_shift = std::rand() % 3;
+        size_vec candidates;
+        alignment_info expected;
+        for (size_t i = 0; i < adapters.size(); ++i) {
+            alignment_info current = align_paired_ended_sequences(record1, record2, create_adapter_vec(adapters.at(i).first, adapters.at(i).second), max_shift);
+            if (current.adapter_id == 0) {
+                current.adapter_id = i;
+            }
+
+            if (!i || current.is_better_than(expected)) {
+                expected = current;
+            }
+
+            if (std::rand() % 2) {
+                candidates.push_back(i);
+            }
+        }
+
+        ASSERT_EQ(expected, align_paired_ended_sequences(record1, record2, adapters, max_shift));
+
+        expected = alignment_info();
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const size_t adapter_id = candidates.at(i);
+            alignment_info current = align_paired_ended_sequences(record1, record2, create_adapter_vec(adapters.at(adapter_id).first, adapters.at(adapter_id).second), max_shift);
+            if (current.adapter_id == 0) {
+                current.adapter_id = adapter_id;
+            }
+
+            if (!i || current.is_better_than(expected)) {
+                expected = current;
+            }
+        }
+
+        ASSERT_EQ(expected, align_paired_ended_sequences(record1, record2, adapters, max_shift, candidates));
+    }
+}
+
+
+TEST(alignment_pe, batches_match_individual_alignments)
+{
+    std::srand(4321);
+    fastq_pair_vec adapters;
+    for (size_t i = 0; i < 4; ++i) {
+        adapters.push_back(fastq_pair(random_read(random_sequence(std::rand() % 30)),
+                                      random_read(random_sequence(std::rand() % 30))));
+    }
+
+    fastq_vec reads_1;
+    fastq_vec reads_2;
+    for (size_t i = 0; i < 200; ++i) {
+        const std::string insert = random_sequence(1 + std::rand() % 150);
+        const fastq_pair& pair = adapters.at(std::rand() % adapters.size());
+        reads_1.push_back(random_read(insert + pair.first.sequence() + random_sequence(50)));
+        reads_2.push_back(random_read(insert + pair.second.sequence() + random_sequence(50)));
+        reads_1.back().truncate(0, 50 + std::rand() % 50);
+        reads_2.back().truncate(0, 50 + std::rand() % 50);
+        reads_2.back().reverse_complement();
+    }
+
+    fastq_batch mates_1;
+    fastq_batch mates_2;
+    mates_1.assign(reads_1);
+    mates_2.assign(reads_2);
+
+    for (size_t i = 0; i < reads_1.size(); ++i) {
+        const alignment_info expected = align_paired_ended_sequences(reads_1.at(i), reads_2.at(i), adapters, 1);
+        ASSERT_EQ(expected, align_paired_ended_sequences(mates_1, mates_2, i, adapters, 1));
+
+        fastq read_1 = reads_1.at(i);
+        fastq read_2 = reads_2.at(i);
+        ASSERT_EQ(truncate_paired_ended_sequences(expected, read_1, read_2),
+                  truncate_paired_ended_sequences(expected, mates_1, mates_2, i));
+        ASSERT_EQ(read_1, mates_1.get(i, "Rec"));
+        ASSERT_EQ(read_2, mates_2.get(i, "Rec"));
+    }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Case 2 PE: Partial overlap between sequences:
 //         AAAAAAAAAAA
@@ -850,6 +990,31 @@ TEST(collapsing, offset_past_the_end)
 }
 
 
+TEST(collapsing, batch_matches_records)
+{
+    // Long enough to cover both blocks of identical bases and single bases
+    fastq_vec reads_1;
+    reads_1.push_back(fastq("Rec1", "ACGTACGTACGTACGTNCGTACGTAAGTACGTACG",
+                                    "0123456789ABCDEFGHIJ0123456789ABCDE"));
+    fastq_vec reads_2;
+    reads_2.push_back(fastq("Rec2", "GTACGTACGTACGTNCGTACGTACGTACGTTTTTT",
+                                    "ABCDEFGHIJABCDEFGHIJ0123456789ABCDE"));
+
+    const alignment_info alignment = new_aln(0, 2);
+    const fastq expected = collapse_paired_ended_sequences(alignment, reads_1.front(), reads_2.front());
+
+    fastq_batch mates_1;
+    fastq_batch mates_2;
+    mates_1.assign(reads_1);
+    mates_2.assign(reads_2);
+
+    fastq result("Rec1", "TTTT", "IIII");
+    collapse_paired_ended_sequences(alignment, mates_1, mates_2, 0, result);
+    ASSERT_EQ(expected, result);
+    ASSERT_EQ(37u, result.length());
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Barcode extraction
 
@@ -1003,11 +1168,6 @@ TEST(extract_adapter_sequences, case_8_reads_extends_past_each_pther)
 // Simply check all combinations involving 3 bases varying, for a range of
 // sequence lengths to help catch corner cases with the optimizations
 
-// The function is not exposed, so a declaration is required
-bool compare_subsequences(const alignment_info& best, alignment_info& current,
-                          const char* seq_1_ptr, const char* seq_2_ptr);
-
-
 /** Naive reimplementation of alignment calculation. **/
 void update_alignment(alignment_info& aln,
                       const std::string& a,
@@ -1057,35 +1217,42 @@ std::vector<std::string> get_combinations()
 
 TEST(compare_subsequences, brute_force_validation)
 {
-    const alignment_info best;
-    const std::vector<std::string> combinations = get_combinations();
-    for (size_t seqlen = 10; seqlen <= 20; ++seqlen) {
-        for (size_t pos = 0; pos < seqlen; ++pos) {
-            const size_t nbases = std::min<int>(3, seqlen - pos);
-
-            for (size_t i = 0; i < combinations.size(); ++i) {
-                for (size_t j = 0; j < combinations.size(); ++j) {
-                    alignment_info expected;
-                    expected.length = seqlen;
-                    expected.score = seqlen - nbases;
-                    update_alignment(expected, combinations.at(i), combinations.at(j), nbases);
-
-                    std::string mate1 = std::string(seqlen, 'A');
-                    mate1.replace(pos, nbases, combinations.at(i).substr(0, nbases));
-                    std::string mate2 = std::string(seqlen, 'A');
-                    mate2.replace(pos, nbases, combinations.at(j).substr(0, nbases));
-
-                    alignment_info current;
-                    current.length = seqlen;
-                    compare_subsequences(best, current, mate1.c_str(), mate2.c_str());
-
-                    if (!(expected == current)) {
-                        std::cerr << "seqlen = " << seqlen << "\n"
-                                  << "pos    = " << pos << "\n"
-                                  << "nbases = " << nbases << "\n"
-                                  << "mate1  = " << mate1 << "\n"
-                                  << "mate2  = " << mate2 << std::endl;
-                        ASSERT_EQ(expected, current);
+    const simd::instruction_set_vec supported = simd::supported();
+    for (size_t is_idx = 0; is_idx < supported.size(); ++is_idx) {
+        const compare_subsequences_func compare_subsequences
+            = select_compare_subsequences(supported.at(is_idx));
+        SCOPED_TRACE(simd::name(supported.at(is_idx)));
+
+        const alignment_info best;
+        const std::vector<std::string> combinations = get_combinations();
+        for (size_t seqlen = 10; seqlen <= 20; ++seqlen) {
+            for (size_t pos = 0; pos < seqlen; ++pos) {
+                const size_t nbases = std::min<int>(3, seqlen - pos);
+
+                for (size_t i = 0; i < combinations.size(); ++i) {
+                    for (size_t j = 0; j < combinations.size(); ++j) {
+                        alignment_info expected;
+                        expected.length = seqlen;
+                        expected.score = seqlen - nbases;
+                        update_alignment(expected, combinations.at(i), combinations.at(j), nbases);
+
+                        std::string mate1 = std::string(seqlen, 'A');
+                        mate1.replace(pos, nbases, combinations.at(i).substr(0, nbases));
+                        std::string mate2 = std::string(seqlen, 'A');
+                        mate2.replace(pos, nbases, combinations.at(j).substr(0, nbases));
+
+                        alignment_info current;
+                        current.length = seqlen;
+                        compare_subsequences(best, current, mate1.c_str(), mate2.c_str());
+
+                        if (!(expected == current)) {
+                            std::cerr << "seqlen = " << seqlen << "\n"
+                                      << "pos    = " << pos << "\n"
+                                      << "nbases = " << nbases << "\n"
+                                      << "mate1  = " << mate1 << "\n"
+                                      << "mate2  = " << mate2 << std::endl;
+                            ASSERT_EQ(expected, current);
+                        }
                     }
                 }
             }
@@ -1093,4 +1260,182 @@ TEST(compare_subsequences, brute_force_validation)
     }
 }
 
+
+TEST(compare_subsequences, simd_kernels_match_portable_kernel)
+{
+    const compare_subsequences_func portable
+        = select_compare_subsequences(simd::none);
+    const simd::instruction_set_vec supported = simd::supported();
+
+    std::srand(1234);
+    for (size_t is_idx = 0; is_idx < supported.size(); ++is_idx) {
+        const compare_subsequences_func kernel
+            = select_compare_subsequences(supported.at(is_idx));
+        SCOPED_TRACE(simd::name(supported.at(is_idx)));
+
+        for (size_t seqlen = 0; seqlen <= 200; ++seqlen) {
+            for (size_t round = 0; round < 10; ++round) {
+                std::string mate1 = random_sequence(seqlen);
+                std::string mate2 = mate1;
+                // Introduce a variable number of differences
+                for (size_t i = 0; i < seqlen * round / 10; ++i) {
+                    mate2.at(std::rand() % seqlen) = "ACGTN"[std::rand() % 5];
+                }
+
+                // Best scores range from trivial to best-possible
+                const alignment_info best = new_aln(static_cast<int>(seqlen * round / 9));
+
+                alignment_info expected;
+                expected.length = seqlen;
+                const bool expected_result = portable(best, expected, mate1.data(), mate2.data());
+
+                alignment_info current;
+                current.length = seqlen;
+                const bool current_result = kernel(best, current, mate1.data(), mate2.data());
+
+                ASSERT_EQ(expected_result, current_result);
+                if (expected_result) {
+                    ASSERT_EQ(expected, current);
+                }
+            }
+        }
+    }
+}
+
+
+TEST(select_compare_subsequences, unknown_instruction_set)
+{
+    ASSERT_THROW(select_compare_subsequences(static_cast<simd::instruction_set>(-1)),
+                 std::invalid_argument);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bit-parallel alignment engine
+
+TEST(packed_sequence, append)
+{
+    packed_sequence packed;
+    ASSERT_EQ(0, packed.length());
+    ASSERT_TRUE(packed.append("ACGTN"));
+    ASSERT_TRUE(packed.append(""));
+    ASSERT_TRUE(packed.append("TTA"));
+    ASSERT_EQ(8, packed.length());
+
+    // A C G T N T T A
+    ASSERT_EQ(0x6a, packed.lo()[0]);
+    ASSERT_EQ(0x6c, packed.hi()[0]);
+    ASSERT_EQ(0x10, packed.ns()[0]);
+}
+
+
+TEST(packed_sequence, append__invalid_characters)
+{
+    packed_sequence packed;
+    ASSERT_FALSE(packed.append("ACGTa"));
+    packed.clear();
+    ASSERT_FALSE(packed.append("ACG.T"));
+    packed.clear();
+    ASSERT_TRUE(packed.append("ACGT"));
+    ASSERT_EQ(4, packed.length());
+}
+
+
+TEST(packed_sequence, append__max_length)
+{
+    packed_sequence packed;
+    ASSERT_TRUE(packed.append(std::string(packed_sequence::MAX_LENGTH - 1, 'A')));
+    ASSERT_TRUE(packed.append("A"));
+    ASSERT_FALSE(packed.append("A"));
+}
+
+
+TEST(packed_sequence, clear)
+{
+    packed_sequence packed;
+    ASSERT_TRUE(packed.append(std::string(100, 'T')));
+    packed.clear();
+    ASSERT_EQ(0, packed.length());
+    ASSERT_TRUE(packed.append("A"));
+
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_EQ(0, packed.lo()[i]);
+        ASSERT_EQ(0, packed.hi()[i]);
+        ASSERT_EQ(0, packed.ns()[i]);
+    }
+}
+
+
+/** Reference implementation of pairwise_align_packed_func. */
+alignment_info pairwise_align_reference(const alignment_info& best_alignment,
+                                        const std::string& seq1,
+                                        const std::string& seq2,
+                                        int start_offset,
+                                        int end_offset)
+{
+    const compare_subsequences_func compare = select_compare_subsequences(simd::none);
+
+    alignment_info best = best_alignment;
+    for (int offset = start_offset; offset <= end_offset; ++offset) {
+        const size_t seq1_pos = std::max<int>(0,  offset);
+        const size_t seq2_pos = std::max<int>(0, -offset);
+
+        alignment_info current;
+        current.offset = offset;
+        current.length = std::min(seq1.length() - seq1_pos, seq2.length() - seq2_pos);
+
+        if (compare(best, current, seq1.data() + seq1_pos, seq2.data() + seq2_pos)) {
+            best = current;
+        }
+    }
+
+    return best;
+}
+
+
+TEST(select_pairwise_align_packed, hardware_popcnt)
+{
+    ASSERT_EQ(&pairwise_align_packed_none, select_pairwise_align_packed(false));
+#if defined(AR_SIMD_X86)
+    ASSERT_EQ(&pairwise_align_packed_popcnt, select_pairwise_align_packed(true));
+#else
+    ASSERT_EQ(&pairwise_align_packed_none, select_pairwise_align_packed(true));
+#endif
+}
+
+
+TEST(pairwise_align_packed, matches_reference_implementation)
+{
+    std::vector<bool> hardware_popcnt(1, false);
+    if (simd::has_popcnt()) {
+        hardware_popcnt.push_back(true);
+    }
+
+    std::srand(4321);
+    for (size_t idx = 0; idx < hardware_popcnt.size(); ++idx) {
+        const pairwise_align_packed_func align
+            = select_pairwise_align_packed(hardware_popcnt.at(idx));
+        SCOPED_TRACE(hardware_popcnt.at(idx) ? "popcnt" : "portable");
+
+        for (size_t round = 0; round < 2000; ++round) {
+            const std::string seq1 = random_sequence(1 + std::rand() % 300);
+            std::string seq2 = random_sequence(1 + std::rand() % 300);
+            // Ensure that some offsets give (near) perfect alignments
+            const size_t overlap = std::min(seq1.length(), seq2.length()) / (1 + std::rand() % 4);
+            seq2.replace(0, overlap, seq1.substr(seq1.length() - overlap));
+
+            packed_sequence packed1;
+            packed_sequence packed2;
+            ASSERT_TRUE(packed1.append(seq1));
+            ASSERT_TRUE(packed2.append(seq2));
+
+            const alignment_info best = new_aln(std::rand() % 20, 0, 20);
+            const int start_offset = -static_cast<int>(seq2.length()) + 1 + std::rand() % 10;
+            const int end_offset = static_cast<int>(seq1.length()) - 1;
+
+            const alignment_info expected = pairwise_align_reference(best, seq1, seq2, start_offset, end_offset);
+            ASSERT_EQ(expected, align(best, packed1, packed2, start_offset, end_offset));
+        }
+    }
+}
+
 } // namespace ar
@@ -178,6 +178,48 @@ TEST(any, consume__with_sink__preset)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// many -- strings
+
+TEST(many, defaults)
+{
+	string_vec sink;
+	consumer_autoptr ptr(new argparse::many(&sink));
+	ASSERT_FALSE(ptr->is_set());
+	ASSERT_EQ("", ptr->metavar());
+	ASSERT_EQ("", ptr->help());
+	ASSERT_EQ("<not set>", ptr->to_str());
+}
+
+
+TEST(many, consumes_until_next_option)
+{
+	string_vec arguments;
+	arguments.push_back("foo");
+	arguments.push_back("-");
+	arguments.push_back("--bar");
+	arguments.push_back("zod");
+	string_vec sink;
+	consumer_autoptr ptr(new argparse::many(&sink));
+	ASSERT_EQ(2, ptr->consume(arguments.begin(), arguments.end()));
+	ASSERT_TRUE(ptr->is_set());
+	ASSERT_EQ(string_vec(arguments.begin(), arguments.begin() + 2), sink);
+	ASSERT_EQ("foo -", ptr->to_str());
+}
+
+
+TEST(many, consume_past_the_end)
+{
+	string_vec arguments;
+	arguments.push_back("--bar");
+	string_vec sink;
+	consumer_autoptr ptr(new argparse::many(&sink));
+	ASSERT_EQ(static_cast<size_t>(-1), ptr->consume(arguments.begin(), arguments.end()));
+	ASSERT_EQ(static_cast<size_t>(-1), ptr->consume(arguments.end(), arguments.end()));
+	ASSERT_FALSE(ptr->is_set());
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // knob -- unsigned
 
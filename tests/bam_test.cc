@@ -0,0 +1,196 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <gtest/gtest.h>
+
+#include "bam.h"
+#include "fastq.h"
+#include "fastq_enc.h"
+#include "temporary_file.h"
+
+namespace ar
+{
+
+std::string make_bam(const std::string& text, const fastq* begin, const fastq* end,
+                     unsigned flags = BAM_FUNMAP)
+{
+    std::string data;
+    append_bam_header(data, text);
+    for (; begin != end; ++begin) {
+        append_bam_record(data, begin->header(), begin->sequence().data(),
+                          begin->qualities().data(), begin->length(), flags);
+    }
+
+    return data;
+}
+
+
+TEST(bam, sam_header_for_new_file)
+{
+    ASSERT_EQ("@HD\tVN:1.6\tSO:unknown\n"
+              "@PG\tID:AR\tPN:AR\tVN:1.0\n",
+              build_sam_header("", "AR", "1.0"));
+}
+
+
+TEST(bam, sam_header_keeps_existing_lines)
+{
+    const std::string text = "@HD\tVN:1.5\tSO:unsorted\n"
+                             "@RG\tID:foo\n"
+                             "@PG\tID:AR\tPN:AR\tVN:0.9\n"
+                             "@PG\tID:AR.1\tPN:AR\tPP:AR\tVN:0.9";
+
+    ASSERT_EQ(text + "\n@PG\tID:AR.2\tPN:AR\tPP:AR.1\tVN:1.0\n",
+              build_sam_header(text, "AR", "1.0"));
+}
+
+
+TEST(bam, round_trip_of_records)
+{
+    const fastq records[] = {
+        fastq("read_1", "ACGTN", "!#I~5", FASTQ_ENCODING_SAM),
+        fastq("read_2", "", "", FASTQ_ENCODING_33),
+        fastq("read_3", "TTGCA", "IIIII", FASTQ_ENCODING_33),
+    };
+
+    const temporary_file file(make_bam("@RG\tID:foo\n", records, records + 3));
+    bam_reader reader(file.path());
+    ASSERT_EQ("@RG\tID:foo\n", reader.header());
+
+    fastq record;
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_TRUE(reader.read(record));
+        ASSERT_EQ(records[i], record);
+    }
+
+    ASSERT_FALSE(reader.read(record));
+}
+
+
+TEST(bam, mate_numbers_are_stored_as_flags)
+{
+    const fastq records[] = {
+        fastq("read/1", "ACG", "III", FASTQ_ENCODING_33),
+        fastq("read/2", "TGA", "III", FASTQ_ENCODING_33),
+    };
+
+    std::string data;
+    append_bam_header(data, "");
+    append_bam_record(data, records[0].header(), "ACG", "III", 3,
+                      BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP | BAM_FREAD1);
+    append_bam_record(data, records[1].header(), "TGA", "III", 3,
+                      BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP | BAM_FREAD2);
+
+    // The name follows the 12 byte header, block_size, and 32 bytes of fields
+    ASSERT_EQ(std::string("read\0", 5), data.substr(12 + 4 + 32, 5));
+
+    const temporary_file file(data);
+    bam_reader reader(file.path());
+
+    fastq record;
+    ASSERT_TRUE(reader.read(record));
+    ASSERT_EQ(records[0], record);
+    ASSERT_TRUE(reader.read(record));
+    ASSERT_EQ(records[1], record);
+}
+
+
+TEST(bam, reverse_complemented_records)
+{
+    const fastq forward("read", "AACGT", "ABCDE", FASTQ_ENCODING_33);
+    const fastq reverse("read", "ACGTT", "EDCBA", FASTQ_ENCODING_33);
+
+    const temporary_file file(make_bam("", &reverse, &reverse + 1,
+                                      BAM_FUNMAP | BAM_FREVERSE));
+    bam_reader reader(file.path());
+
+    fastq record;
+    ASSERT_TRUE(reader.read(record));
+    ASSERT_EQ(forward, record);
+}
+
+
+TEST(bam, secondary_records_are_skipped)
+{
+    const fastq records[] = {
+        fastq("read_1", "ACGT", "IIII", FASTQ_ENCODING_33),
+        fastq("read_2", "TTTT", "IIII", FASTQ_ENCODING_33),
+    };
+
+    std::string data = make_bam("", records, records + 1, BAM_FUNMAP | BAM_FSECONDARY);
+    append_bam_record(data, records[1].header(), "TTTT", "IIII", 4, BAM_FUNMAP);
+
+    const temporary_file file(data);
+    bam_reader reader(file.path());
+
+    fastq record;
+    ASSERT_TRUE(reader.read(record));
+    ASSERT_EQ(records[1], record);
+    ASSERT_FALSE(reader.read(record));
+}
+
+
+TEST(bam, tags_and_comments)
+{
+    const fastq input("read comment 1:N:0\tBC:Z:ACGT\tXA:A:c\tXI:i:-5\tX1:i:70000"
+                      "\tXF:f:1.5\tXB:B:s,1,-2,300\tXH:H:1AE3\tbad tag",
+                      "ACGT", "IIII", FASTQ_ENCODING_33);
+    const fastq expected("read\tBC:Z:ACGT\tXA:A:c\tXI:i:-5\tX1:i:70000"
+                         "\tXF:f:1.5\tXB:B:s,1,-2,300\tXH:H:1AE3"
+                         "\tCO:Z:comment 1:N:0 bad tag",
+                         "ACGT", "IIII", FASTQ_ENCODING_33);
+
+    const temporary_file file(make_bam("", &input, &input + 1));
+    bam_reader reader(file.path());
+
+    fastq record;
+    ASSERT_TRUE(reader.read(record));
+    ASSERT_EQ(expected, record);
+}
+
+
+TEST(bam, invalid_files)
+{
+    const temporary_file not_bam("@read\nACGT\n+\nIIII\n");
+    ASSERT_THROW(bam_reader reader(not_bam.path()), fastq_error);
+
+    const fastq input("read", "ACGT", "IIII", FASTQ_ENCODING_33);
+    const std::string data = make_bam("", &input, &input + 1);
+    const temporary_file truncated(data.substr(0, data.size() - 1));
+    bam_reader reader(truncated.path());
+
+    fastq record;
+    ASSERT_THROW(reader.read(record), fastq_error);
+}
+
+
+TEST(bam, long_names_are_rejected)
+{
+    const std::string name(255, 'A');
+
+    std::string data;
+    ASSERT_THROW(append_bam_record(data, name, "", "", 0, BAM_FUNMAP), fastq_error);
+    append_bam_record(data, name.substr(1), "", "", 0, BAM_FUNMAP);
+}
+
+} // namespace ar
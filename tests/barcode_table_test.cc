@@ -0,0 +1,131 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include "barcode_table.h"
+
+namespace ar
+{
+
+typedef std::vector<barcode_table::candidate> candidate_vec;
+
+
+fastq_pair_vec make_barcodes(const std::string& barcode_1,
+                             const std::string& barcode_2 = std::string())
+{
+    fastq_pair_vec barcodes;
+    barcodes.push_back(fastq_pair(fastq("bc1", barcode_1), fastq("bc1", "")));
+    if (!barcode_2.empty()) {
+        barcodes.push_back(fastq_pair(fastq("bc2", barcode_2), fastq("bc2", "")));
+    }
+
+    return barcodes;
+}
+
+
+candidate_vec lookup(const barcode_table& table, const std::string& sequence)
+{
+    const barcode_table::candidate* begin = NULL;
+    const barcode_table::candidate* end = NULL;
+    table.lookup(sequence, begin, end);
+
+    candidate_vec result(begin, end);
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+
+TEST(barcode_table, is_supported)
+{
+    ASSERT_TRUE(barcode_table::is_supported(make_barcodes("ACGT"), 2));
+    ASSERT_FALSE(barcode_table::is_supported(make_barcodes("ACGT"), 3));
+    ASSERT_FALSE(barcode_table::is_supported(fastq_pair_vec(), 0));
+    ASSERT_FALSE(barcode_table::is_supported(make_barcodes("ACGT", "ACG"), 0));
+
+    const std::string max_length(BARCODE_TABLE_MAX_LENGTH, 'A');
+    ASSERT_TRUE(barcode_table::is_supported(make_barcodes(max_length), 0));
+    ASSERT_FALSE(barcode_table::is_supported(make_barcodes(max_length + "A"), 0));
+}
+
+
+TEST(barcode_table, unsupported_table_is_empty)
+{
+    const barcode_table table(make_barcodes("ACGT"), 3);
+    ASSERT_TRUE(table.empty());
+    ASSERT_TRUE(lookup(table, "ACGT").empty());
+}
+
+
+TEST(barcode_table, exact_matches)
+{
+    const barcode_table table(make_barcodes("ACGT", "TTGA"), 0);
+    ASSERT_FALSE(table.empty());
+
+    candidate_vec expected(1, barcode_table::candidate(0, 0));
+    ASSERT_EQ(expected, lookup(table, "ACGTTTTT"));
+    expected.front().first = 1;
+    ASSERT_EQ(expected, lookup(table, "TTGA"));
+    ASSERT_TRUE(lookup(table, "ACGA").empty());
+}
+
+
+TEST(barcode_table, reads_shorter_than_barcodes)
+{
+    const barcode_table table(make_barcodes("ACGT"), 1);
+    ASSERT_TRUE(lookup(table, "ACG").empty());
+    ASSERT_TRUE(lookup(table, "").empty());
+}
+
+
+TEST(barcode_table, mismatches)
+{
+    const barcode_table table(make_barcodes("AAAA"), 2);
+
+    ASSERT_EQ(candidate_vec(1, barcode_table::candidate(0, 1)), lookup(table, "AAGA"));
+    ASSERT_EQ(candidate_vec(1, barcode_table::candidate(0, 2)), lookup(table, "CAAT"));
+    ASSERT_TRUE(lookup(table, "CCCA").empty());
+}
+
+
+TEST(barcode_table, overlapping_neighborhoods)
+{
+    const barcode_table table(make_barcodes("AAAA", "AACC"), 2);
+
+    candidate_vec expected;
+    expected.push_back(barcode_table::candidate(0, 1));
+    expected.push_back(barcode_table::candidate(1, 1));
+    ASSERT_EQ(expected, lookup(table, "AAAC"));
+}
+
+
+TEST(barcode_table, ambiguous_bases_match_the_quadtree)
+{
+    // The quadtree used for demultiplexing hashes N like G (see ACGT_TO_IDX)
+    const barcode_table table(make_barcodes("ACGT"), 0);
+    ASSERT_EQ(candidate_vec(1, barcode_table::candidate(0, 0)), lookup(table, "ACNT"));
+}
+
+} // namespace ar
@@ -0,0 +1,133 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <gtest/gtest.h>
+
+#include "checkpoint.h"
+#include "temporary_file.h"
+
+namespace ar
+{
+
+TEST(checkpoint_data, round_trip)
+{
+    std::vector<size_t> values;
+    values.push_back(3);
+    values.push_back(0);
+    values.push_back(12345678901ULL);
+
+    checkpoint_data data;
+    data.set("input:my file.fq", 40);
+    data.set("counts", values);
+    data.set("empty", std::vector<size_t>());
+
+    const temporary_file file;
+    data.write(file.path());
+
+    checkpoint_data result;
+    result.read(file.path());
+
+    ASSERT_TRUE(result.contains("input:my file.fq"));
+    ASSERT_EQ(40, result.get("input:my file.fq"));
+    ASSERT_EQ(values, result.get_vector("counts"));
+    ASSERT_EQ(std::vector<size_t>(), result.get_vector("empty"));
+}
+
+
+TEST(checkpoint_data, missing_keys)
+{
+    checkpoint_data data;
+    data.set("foo", 1);
+
+    ASSERT_FALSE(data.contains("bar"));
+    ASSERT_THROW(data.get("bar"), checkpoint_error);
+    ASSERT_THROW(data.get_vector("bar"), checkpoint_error);
+}
+
+
+TEST(checkpoint_data, invalid_values)
+{
+    std::vector<size_t> values(2, 7);
+
+    checkpoint_data data;
+    data.set("foo", values);
+
+    ASSERT_THROW(data.get("foo"), checkpoint_error);
+}
+
+
+TEST(checkpoint_data, invalid_files)
+{
+    const temporary_file file("foo\t1\n");
+
+    checkpoint_data data;
+    ASSERT_THROW(data.read(file.path()), checkpoint_error);
+}
+
+
+TEST(checkpoint_data, statistics)
+{
+    statistics stats;
+    stats.number_of_reads_with_adapter.resize(2);
+    stats.number_of_reads_with_adapter.at(1) = 5;
+    stats.inc_length_count(rt_mate_1, 100);
+    stats.inc_length_count(rt_discarded, 3);
+    stats.keep1 = 7;
+    stats.records = 11;
+
+    checkpoint_data data;
+    save_statistics(data, "stats", stats);
+
+    statistics result;
+    load_statistics(data, "stats", result);
+
+    ASSERT_EQ(stats.number_of_reads_with_adapter, result.number_of_reads_with_adapter);
+    ASSERT_EQ(stats.read_lengths, result.read_lengths);
+    ASSERT_EQ(stats.length_rows, result.length_rows);
+    ASSERT_EQ(1, result.length_count(rt_mate_1, 100));
+    ASSERT_EQ(7, result.keep1);
+    ASSERT_EQ(11, result.records);
+}
+
+
+TEST(checkpoint_data, demux_statistics)
+{
+    demux_statistics stats(3);
+    stats.barcodes.at(2) = 4;
+    stats.unidentified = 5;
+    stats.ambiguous = 6;
+
+    checkpoint_data data;
+    save_statistics(data, "demux", stats);
+
+    demux_statistics result(3);
+    load_statistics(data, "demux", result);
+    ASSERT_EQ(stats.barcodes, result.barcodes);
+    ASSERT_EQ(5, result.unidentified);
+    ASSERT_EQ(6, result.ambiguous);
+
+    demux_statistics wrong_size(2);
+    ASSERT_THROW(load_statistics(data, "demux", wrong_size), checkpoint_error);
+}
+
+} // namespace ar
@@ -27,6 +27,7 @@
 #include <gtest/gtest.h>
 
 #include "fastq.h"
+#include "fastq_simd.h"
 #include "linereader.h"
 
 namespace ar
@@ -299,6 +300,97 @@ TEST(fastq, trim_low_quality_bases__trim_everything)
 
 
 
+TEST(fastq, trim_windowed_bases__trim_window)
+{
+    const fastq expected_record("Rec", "GTAC", "5555");
+    const fastq::ntrimmed expected_ntrim(2, 4);
+    fastq record("Rec", "ACGTACGTAC", "!!5555!!!5");
+
+    ASSERT_EQ(expected_ntrim, record.trim_windowed_bases(false, 2, 3));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_windowed_bases__fractional_window)
+{
+    const fastq expected_record("Rec", "GTAC", "5555");
+    const fastq::ntrimmed expected_ntrim(2, 4);
+    fastq record("Rec", "ACGTACGTAC", "!!5555!!!5");
+
+    ASSERT_EQ(expected_ntrim, record.trim_windowed_bases(false, 2, 0.3));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_windowed_bases__no_low_quality_windows)
+{
+    const fastq expected_record("Rec", "CGTACGTA", "55555555");
+    const fastq::ntrimmed expected_ntrim(1, 1);
+    fastq record("Rec", "ACGTACGTAC", "!55555555!");
+
+    ASSERT_EQ(expected_ntrim, record.trim_windowed_bases(false, 2, 4));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_windowed_bases__trim_3p_bases_before_low_quality_window)
+{
+    // Window at the 3' end is low quality, but is preceded by a Q10 base
+    const fastq expected_record("Rec", "CCCC", "IIII");
+    const fastq::ntrimmed expected_ntrim(0, 5);
+    fastq record("Rec", "CCCCCCCCC", "IIII++BB!");
+
+    ASSERT_EQ(expected_ntrim, record.trim_windowed_bases(false, 20, 4));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_windowed_bases__trim_everything)
+{
+    fastq record("Rec", "TAGN", "!!!I");
+    const fastq expected_record = fastq("Rec", "", "");
+    const fastq::ntrimmed expected_ntrim(0, 4);
+
+    ASSERT_EQ(expected_ntrim, record.trim_windowed_bases(true, 2, 2));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_mott_bases__trim_low_quality_bases)
+{
+    const fastq expected_record("Rec", "CGTACGT", "5555+55");
+    const fastq::ntrimmed expected_ntrim(1, 2);
+    fastq record("Rec", "ACGTACGTAC", "!5555+55!5");
+
+    ASSERT_EQ(expected_ntrim, record.trim_mott_bases(false, 0.05));
+    ASSERT_EQ(expected_record, record);
+}
+
+
+TEST(fastq, trim_mott_bases__trim_ns)
+{
+    const fastq original("Rec", "NACGTACGTA", "IIIIIIIIII");
+
+    fastq record = original;
+    ASSERT_EQ(fastq::ntrimmed(0, 0), record.trim_mott_bases(false, 0.05));
+    ASSERT_EQ(original, record);
+
+    ASSERT_EQ(fastq::ntrimmed(1, 0), record.trim_mott_bases(true, 0.05));
+    ASSERT_EQ(fastq("Rec", "ACGTACGTA", "IIIIIIIII"), record);
+}
+
+
+TEST(fastq, trim_mott_bases__trim_everything)
+{
+    fastq record("Rec", "TAG", "!!+");
+    const fastq expected_record = fastq("Rec", "", "");
+    const fastq::ntrimmed expected_ntrim(0, 3);
+
+    ASSERT_EQ(expected_ntrim, record.trim_mott_bases(true, 0.05));
+    ASSERT_EQ(expected_record, record);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Truncate
 
@@ -394,6 +486,204 @@ TEST(fastq, reverse_complement)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Batches of records
+
+fastq_vec batch_records()
+{
+    fastq_vec reads;
+    reads.push_back(fastq("Rec1", "NACNTCTGTA", "9876543210"));
+    reads.push_back(fastq("Rec2", "", ""));
+    reads.push_back(fastq("Rec3", "TTANNACGA", "!!7$&2!!#"));
+
+    return reads;
+}
+
+
+TEST(fastq_batch, assign_and_get)
+{
+    const fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    ASSERT_EQ(reads.size(), batch.size());
+    for (size_t i = 0; i < reads.size(); ++i) {
+        ASSERT_EQ(reads.at(i).length(), batch.length(i));
+        ASSERT_EQ(reads.at(i).count_ns(), batch.count_ns(i));
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+
+    batch.clear();
+    ASSERT_EQ(0u, batch.size());
+}
+
+
+TEST(fastq_batch, truncate)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    reads.at(0).truncate(3, 4);
+    batch.truncate(0, 3, 4);
+    reads.at(2).truncate(5);
+    batch.truncate(2, 5);
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+
+    ASSERT_THROW(batch.truncate(1, 1), std::out_of_range);
+}
+
+
+TEST(fastq_batch, reverse_complement)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    batch.reverse_complement();
+    for (size_t i = 0; i < reads.size(); ++i) {
+        reads.at(i).reverse_complement();
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+
+    batch.reverse_complement(2);
+    reads.at(2).reverse_complement();
+    ASSERT_EQ(reads.at(2), batch.get(2, reads.at(2).header()));
+}
+
+
+TEST(fastq_batch, assign_reverse_complemented)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads, true);
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+        ASSERT_FALSE(batch.is_reversed(i));
+        reads.at(i).reverse_complement();
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+}
+
+
+TEST(fastq_batch, lazy_reverse_complement)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    // Truncation and trimming after flipping use the orientation of the record
+    batch.reverse_complement();
+    batch.truncate(0, 1, 5);
+    batch.reverse_complement(0);
+    batch.truncate(0, 1, 3);
+    batch.reverse_complement(2);
+    batch.trim_low_quality_bases(true, 2);
+
+    reads.at(0).reverse_complement();
+    reads.at(0).truncate(1, 5);
+    reads.at(0).reverse_complement();
+    reads.at(0).truncate(1, 3);
+    reads.at(1).reverse_complement();
+    for (size_t i = 0; i < reads.size(); ++i) {
+        reads.at(i).trim_low_quality_bases(true, 2);
+    }
+
+    std::string expected;
+    std::string result;
+    for (size_t i = 0; i < reads.size(); ++i) {
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+
+        reads.at(i).to_str(expected);
+        batch.to_str(result, i, reads.at(i).header());
+    }
+
+    ASSERT_EQ(expected, result);
+}
+
+
+TEST(fastq_batch, trim_low_quality_bases)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    batch.trim_low_quality_bases(true, 2);
+    for (size_t i = 0; i < reads.size(); ++i) {
+        reads.at(i).trim_low_quality_bases(true, 2);
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+}
+
+
+TEST(fastq_batch, trim_low_quality_bases__nth_record)
+{
+    fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    // Trimmed bases are reported relative to the orientation of the record
+    batch.reverse_complement(2);
+    reads.at(2).reverse_complement();
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+        const fastq::ntrimmed expected = reads.at(i).trim_low_quality_bases(true, 2);
+
+        ASSERT_EQ(expected, batch.trim_low_quality_bases(i, true, 2));
+        ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+    }
+}
+
+
+TEST(fastq_batch, trim_windowed_and_mott_bases__nth_record)
+{
+    const fastq_vec original = batch_records();
+
+    for (size_t mode = 0; mode < 2; ++mode) {
+        fastq_vec reads = original;
+        fastq_batch batch;
+        batch.assign(reads, true);
+
+        for (size_t i = 0; i < reads.size(); ++i) {
+            reads.at(i).reverse_complement();
+
+            fastq::ntrimmed expected;
+            fastq::ntrimmed result;
+            if (mode) {
+                expected = reads.at(i).trim_mott_bases(true, 0.05);
+                result = batch.trim_mott_bases(i, true, 0.05);
+            } else {
+                expected = reads.at(i).trim_windowed_bases(true, 2, 3);
+                result = batch.trim_windowed_bases(i, true, 2, 3);
+            }
+
+            ASSERT_EQ(expected, result);
+            ASSERT_EQ(reads.at(i), batch.get(i, reads.at(i).header()));
+        }
+    }
+}
+
+
+TEST(fastq_batch, to_str_matches_records)
+{
+    const fastq_vec reads = batch_records();
+    fastq_batch batch;
+    batch.assign(reads);
+
+    std::string expected;
+    std::string result;
+    for (size_t i = 0; i < reads.size(); ++i) {
+        reads.at(i).to_str(expected, FASTQ_ENCODING_64);
+        batch.to_str(result, i, reads.at(i).header(), FASTQ_ENCODING_64);
+    }
+
+    ASSERT_EQ(expected, result);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Adding prefixes to the header
 
@@ -755,4 +1045,215 @@ TEST(fastq, validate_paired_reads__throws_if_name_differs)
    ASSERT_THROW(fastq::validate_paired_reads(mate1, mate2), fastq_error);
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMD kernels for quality scores and sequences
+
+/** Returns the number of bytes expected to be processed by a SIMD kernel. */
+size_t expected_block_bytes(simd::instruction_set is, size_t length, size_t invalid)
+{
+    if (is == simd::none) {
+        return 0;
+    }
+
+    return (std::min(length, invalid) / 16) * 16;
+}
+
+
+TEST(fastq, simd_decode_phred_matches_portable)
+{
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        const fastq_kernels kernels = select_fastq_kernels(*it);
+
+        for (size_t length = 1; length < 80; ++length) {
+            // Invalid scores at every position, or (invalid == length) none
+            for (size_t invalid = 0; invalid <= length; ++invalid) {
+                std::string raw;
+                for (size_t i = 0; i < length; ++i) {
+                    raw.push_back('@' + (i * 7) % 42);
+                }
+
+                if (invalid < length) {
+                    raw.at(invalid) = (invalid % 2) ? '?' : 'j';
+                }
+
+                std::string result = raw;
+                const size_t n = kernels.decode_phred(&result[0], length, '@', 'i');
+
+                ASSERT_EQ(expected_block_bytes(*it, length, invalid), n) << simd::name(*it);
+                for (size_t i = 0; i < length; ++i) {
+                    ASSERT_EQ(i < n ? raw.at(i) - 31 : raw.at(i), result.at(i));
+                }
+            }
+        }
+    }
+}
+
+
+TEST(fastq, simd_encode_phred_matches_portable)
+{
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        const fastq_kernels kernels = select_fastq_kernels(*it);
+
+        for (size_t length = 1; length < 80; ++length) {
+            std::string raw;
+            for (size_t i = 0; i < length; ++i) {
+                raw.push_back('!' + (i * 7) % 94);
+            }
+
+            std::string result = raw;
+            const size_t n = kernels.encode_phred(&result[0], length, '@', 'i');
+
+            ASSERT_EQ(expected_block_bytes(*it, length, length), n) << simd::name(*it);
+            for (size_t i = 0; i < length; ++i) {
+                const char expected = std::min<int>('i', raw.at(i) + 31);
+                ASSERT_EQ(i < n ? expected : raw.at(i), result.at(i));
+            }
+        }
+    }
+}
+
+
+TEST(fastq, simd_clean_sequence_matches_portable)
+{
+    const std::string nucleotides = "acgtnACGTN.";
+    const std::string cleaned = "ACGTNACGTNN";
+    const std::string invalid_chars = "sS!7\x80";
+
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        const fastq_kernels kernels = select_fastq_kernels(*it);
+
+        for (size_t length = 1; length < 80; ++length) {
+            for (size_t invalid = 0; invalid <= length; ++invalid) {
+                std::string raw;
+                std::string expected;
+                for (size_t i = 0; i < length; ++i) {
+                    raw.push_back(nucleotides.at((i * 7) % nucleotides.size()));
+                    expected.push_back(cleaned.at((i * 7) % nucleotides.size()));
+                }
+
+                if (invalid < length) {
+                    raw.at(invalid) = invalid_chars.at(invalid % invalid_chars.size());
+                }
+
+                std::string result = raw;
+                const size_t n = kernels.clean_sequence(&result[0], length);
+
+                ASSERT_EQ(expected_block_bytes(*it, length, invalid), n) << simd::name(*it);
+                for (size_t i = 0; i < length; ++i) {
+                    ASSERT_EQ(i < n ? expected.at(i) : raw.at(i), result.at(i));
+                }
+            }
+        }
+    }
+}
+
+
+TEST(fastq, simd_reverse_complement_matches_portable)
+{
+    const std::string nucleotides = "ACGTNNAGGTCA";
+    const std::string complements = "TGCANNTCCAGT";
+
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        const fastq_kernels kernels = select_fastq_kernels(*it);
+
+        for (size_t length = 1; length < 160; ++length) {
+            std::string sequence;
+            std::string qualities;
+            for (size_t i = 0; i < length; ++i) {
+                sequence.push_back(nucleotides.at((i * 7) % nucleotides.size()));
+                qualities.push_back('!' + (i * 11) % 42);
+            }
+
+            std::string result_seq = sequence;
+            std::string result_quals = qualities;
+            const size_t n = kernels.reverse_complement(&result_seq[0], &result_quals[0], length);
+
+            ASSERT_EQ(expected_block_bytes(*it, length / 2, length / 2), n) << simd::name(*it);
+            for (size_t i = 0; i < length; ++i) {
+                if (i < n || i >= length - n) {
+                    const size_t j = length - i - 1;
+                    const size_t idx = nucleotides.find(sequence.at(j));
+
+                    ASSERT_EQ(complements.at(idx), result_seq.at(i));
+                    ASSERT_EQ(qualities.at(j), result_quals.at(i));
+                } else {
+                    ASSERT_EQ(sequence.at(i), result_seq.at(i));
+                    ASSERT_EQ(qualities.at(i), result_quals.at(i));
+                }
+            }
+        }
+    }
+}
+
+
+TEST(fastq, simd_low_quality_scan_matches_portable)
+{
+    const std::string nucleotides = "ACGTNAGN";
+
+    const simd::instruction_set_vec sets = simd::supported();
+    for (simd::instruction_set_vec::const_iterator it = sets.begin(); it != sets.end(); ++it) {
+        const fastq_kernels kernels = select_fastq_kernels(*it);
+
+        for (size_t trim_ns = 0; trim_ns < 2; ++trim_ns) {
+            for (size_t length = 1; length < 80; ++length) {
+                // A single good base at every position, or (good == length) none
+                for (size_t good = 0; good <= length; ++good) {
+                    std::string sequence;
+                    std::string qualities;
+                    for (size_t i = 0; i < length; ++i) {
+                        sequence.push_back(nucleotides.at((i * 7) % nucleotides.size()));
+                        qualities.push_back((trim_ns && sequence.at(i) == 'N') ? 'I' : '!' + i % 3);
+                    }
+
+                    if (good < length) {
+                        sequence.at(good) = 'N';
+                        qualities.at(good) = 'I';
+                        if (trim_ns) {
+                            sequence.at(good) = 'A';
+                        }
+                    }
+
+                    const size_t prefix = kernels.low_quality_prefix(sequence.data(),
+                                                                     qualities.data(),
+                                                                     length, '#', trim_ns);
+                    const size_t suffix = kernels.low_quality_suffix(sequence.data(),
+                                                                     qualities.data(),
+                                                                     length, '#', trim_ns);
+                    const size_t good_from_end = (good < length) ? length - good - 1 : length;
+
+                    ASSERT_EQ(expected_block_bytes(*it, length, good), prefix) << simd::name(*it);
+                    ASSERT_EQ(expected_block_bytes(*it, length, good_from_end), suffix)
+                        << simd::name(*it);
+                }
+            }
+        }
+    }
+}
+
+
+TEST(fastq, long_records_are_validated)
+{
+    const std::string sequence = "ACGTNacgtn.ACGTNacgtn.ACGTNacgtn.ACGTNacgtn.ACGTN";
+    const std::string qualities(sequence.length(), 'I');
+
+    const fastq record("Rec", sequence, qualities);
+    ASSERT_EQ("ACGTNACGTNNACGTNACGTNNACGTNACGTNNACGTNACGTNNACGTN", record.sequence());
+    ASSERT_EQ(qualities, record.qualities());
+
+    for (size_t i = 0; i < sequence.length(); ++i) {
+        std::string invalid_sequence = sequence;
+        invalid_sequence.at(i) = 'S';
+        ASSERT_THROW(fastq("Rec", invalid_sequence, qualities), fastq_error);
+
+        std::string invalid_qualities = qualities;
+        invalid_qualities.at(i) = 'K';
+        ASSERT_THROW(fastq("Rec", sequence, invalid_qualities), fastq_error);
+    }
+}
+
 } // namespace ar
@@ -0,0 +1,132 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "numa.h"
+
+namespace ar
+{
+
+cpu_vec make_cpus(int first, int last)
+{
+    cpu_vec cpus;
+    for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+
+TEST(numa, parse_cpu_list__empty)
+{
+    ASSERT_EQ(cpu_vec(), parse_cpu_list(""));
+    ASSERT_EQ(cpu_vec(), parse_cpu_list("\n"));
+}
+
+
+TEST(numa, parse_cpu_list__single)
+{
+    ASSERT_EQ(cpu_vec(1, 7), parse_cpu_list("7"));
+    ASSERT_EQ(cpu_vec(1, 12), parse_cpu_list("12\n"));
+}
+
+
+TEST(numa, parse_cpu_list__ranges)
+{
+    ASSERT_EQ(make_cpus(0, 3), parse_cpu_list("0-3"));
+
+    cpu_vec expected = make_cpus(0, 1);
+    expected.push_back(4);
+    expected.push_back(8);
+    expected.push_back(9);
+    ASSERT_EQ(expected, parse_cpu_list("0-1,4,8-9\n"));
+}
+
+
+TEST(numa, parse_cpu_list__sorted_and_unique)
+{
+    ASSERT_EQ(make_cpus(0, 3), parse_cpu_list("2-3,0-2,1"));
+}
+
+
+TEST(numa, parse_cpu_list__invalid)
+{
+    ASSERT_THROW(parse_cpu_list("a"), std::invalid_argument);
+    ASSERT_THROW(parse_cpu_list("1,"), std::invalid_argument);
+    ASSERT_THROW(parse_cpu_list(",1"), std::invalid_argument);
+    ASSERT_THROW(parse_cpu_list("1-"), std::invalid_argument);
+    ASSERT_THROW(parse_cpu_list("3-1"), std::invalid_argument);
+    ASSERT_THROW(parse_cpu_list("-1"), std::invalid_argument);
+}
+
+
+TEST(numa, assign_numa_nodes__fills_nodes_in_order)
+{
+    numa_node_vec nodes;
+    nodes.push_back(make_cpus(0, 1));
+    nodes.push_back(make_cpus(2, 4));
+
+    std::vector<size_t> expected;
+    expected.push_back(0);
+    expected.push_back(0);
+    expected.push_back(1);
+    ASSERT_EQ(expected, assign_numa_nodes(nodes, 3));
+}
+
+
+TEST(numa, assign_numa_nodes__more_threads_than_cpus)
+{
+    numa_node_vec nodes;
+    nodes.push_back(make_cpus(0, 0));
+    nodes.push_back(make_cpus(1, 2));
+
+    std::vector<size_t> expected;
+    expected.push_back(0);
+    expected.push_back(1);
+    expected.push_back(1);
+    expected.push_back(0);
+    expected.push_back(1);
+    ASSERT_EQ(expected, assign_numa_nodes(nodes, 5));
+}
+
+
+TEST(numa, read_numa_nodes__includes_current_cpus)
+{
+    const cpu_vec allowed = get_thread_cpus();
+    const numa_node_vec nodes = read_numa_nodes();
+
+    cpu_vec cpus;
+    for (numa_node_vec::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+        ASSERT_FALSE(it->empty());
+        cpus.insert(cpus.end(), it->begin(), it->end());
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    ASSERT_EQ(allowed, cpus);
+}
+
+} // namespace ar
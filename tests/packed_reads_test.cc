@@ -0,0 +1,147 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <gtest/gtest.h>
+
+#include "fastq.h"
+#include "packed_reads.h"
+
+namespace ar
+{
+
+fastq_vec make_reads()
+{
+    fastq_vec reads;
+    reads.push_back(fastq("read_1 comment", "ACGTN", "!#5?I", FASTQ_ENCODING_33));
+    reads.push_back(fastq("read_2", "", "", FASTQ_ENCODING_33));
+    reads.push_back(fastq("read_3", "TTGCAAG", "IIII'''", FASTQ_ENCODING_33));
+
+    return reads;
+}
+
+
+TEST(packed_reads, bin_phred_score)
+{
+    const int expected[] = { 0, 1, 6, 6, 6, 6, 6, 6, 6, 6, 15, 15, 15, 15, 15,
+                             15, 15, 15, 15, 15, 22, 22, 22, 22, 22, 27, 27,
+                             27, 27, 27, 33, 33, 33, 33, 33, 37, 37, 37, 37,
+                             37, 40, 40 };
+
+    for (int score = 0; score < 42; ++score) {
+        ASSERT_EQ(expected[score], bin_phred_score(score)) << score;
+    }
+
+    ASSERT_EQ(40, bin_phred_score(93));
+}
+
+
+TEST(packed_reads, empty_container)
+{
+    const packed_reads packed;
+    ASSERT_TRUE(packed.empty());
+    ASSERT_EQ(0u, packed.size());
+
+    fastq_vec dst;
+    fastq_vec spare = make_reads();
+    packed.unpack(dst, spare);
+    ASSERT_TRUE(dst.empty());
+}
+
+
+TEST(packed_reads, lossless_round_trip)
+{
+    const fastq_vec reads = make_reads();
+
+    packed_reads packed;
+    packed.add(reads, rp_lossless);
+    ASSERT_EQ(3u, packed.size());
+
+    fastq_vec dst;
+    fastq_vec spare;
+    packed.unpack(dst, spare);
+    ASSERT_EQ(reads, dst);
+}
+
+
+TEST(packed_reads, binned_round_trip)
+{
+    fastq_vec expected = make_reads();
+    expected.at(0) = fastq("read_1 comment", "ACGTN", "!'7BI", FASTQ_ENCODING_33);
+    expected.at(2) = fastq("read_3", "TTGCAAG", "IIII'''", FASTQ_ENCODING_33);
+
+    packed_reads packed;
+    packed.add(make_reads(), rp_binned);
+
+    fastq_vec dst;
+    fastq_vec spare;
+    packed.unpack(dst, spare);
+    ASSERT_EQ(expected, dst);
+}
+
+
+TEST(packed_reads, unpack_overwrites_spare_records)
+{
+    const fastq_vec reads = make_reads();
+
+    packed_reads packed;
+    packed.add(reads.back(), rp_lossless);
+
+    fastq_vec dst;
+    fastq_vec spare = reads;
+    packed.unpack(dst, spare);
+    ASSERT_EQ(fastq_vec(1, reads.back()), dst);
+}
+
+
+TEST(packed_reads, clear_allows_a_different_packing)
+{
+    packed_reads packed;
+    packed.add(make_reads(), rp_binned);
+    packed.clear();
+    ASSERT_TRUE(packed.empty());
+
+    const fastq_vec reads = make_reads();
+    packed.add(reads, rp_lossless);
+
+    fastq_vec dst;
+    fastq_vec spare;
+    packed.unpack(dst, spare);
+    ASSERT_EQ(reads, dst);
+}
+
+
+TEST(packed_reads, bytes_per_base)
+{
+    const fastq read("read", std::string(100, 'A'), std::string(100, 'I'),
+                     FASTQ_ENCODING_33);
+
+    packed_reads lossless;
+    lossless.add(read, rp_lossless);
+    packed_reads binned;
+    binned.add(read, rp_binned);
+
+    ASSERT_EQ(4 + 50 + 100 + 2 * sizeof(size_t), lossless.bytes());
+    ASSERT_EQ(4 + 50 + 50 + 2 * sizeof(size_t), binned.bytes());
+}
+
+} // namespace ar
@@ -0,0 +1,141 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "shard.h"
+#include "temporary_file.h"
+
+namespace ar
+{
+
+const std::string RECORDS = "@rec1\nACGT\n+\n@III\n"
+                            "@rec2\nTTGA\n+rec2\n+III\n"
+                            "@rec3\nGG\n+\n@@\n";
+
+
+size_t find_start(const std::string& data, size_t offset)
+{
+    return find_record_start(data.data(), data.size(), offset);
+}
+
+
+/** Returns the number of (4 line) records in a range of 'data'. */
+size_t count_records(const std::string& data, const file_range& range)
+{
+    const std::string lines = data.substr(range.begin, range.end - range.begin);
+    const size_t nlines = std::count(lines.begin(), lines.end(), '\n');
+
+    // The last line may not be terminated by a newline
+    return (nlines + (!lines.empty() && *lines.rbegin() != '\n')) / 4;
+}
+
+
+TEST(shard, find_record_start)
+{
+    const size_t rec_2 = RECORDS.find("@rec2");
+    const size_t rec_3 = RECORDS.find("@rec3");
+
+    ASSERT_EQ(0, find_start(RECORDS, 0));
+    // Quality lines starting with '@' are not mistaken for headers
+    for (size_t offset = 1; offset <= rec_2; ++offset) {
+        ASSERT_EQ(rec_2, find_start(RECORDS, offset));
+    }
+
+    ASSERT_EQ(rec_3, find_start(RECORDS, rec_2 + 1));
+    ASSERT_EQ(RECORDS.size(), find_start(RECORDS, rec_3 + 1));
+    ASSERT_EQ(RECORDS.size(), find_start(RECORDS, RECORDS.size()));
+}
+
+
+TEST(shard, find_record_start__empty)
+{
+    ASSERT_EQ(0, find_start("", 0));
+}
+
+
+TEST(shard, paired_shards_select_every_record_once)
+{
+    // The last line of mate 2 reads is not terminated by a newline
+    const std::string records_2 = "@rec1\nAC\n+\nII\n@rec2\nTTGAAA\n+\nIIIIII\n"
+                                  "@rec3\nG\n+\nI";
+    const temporary_file file_1(RECORDS);
+    const temporary_file file_2(records_2);
+
+    file_range last_range_1(0, 0);
+    file_range last_range_2(0, 0);
+    size_t nrecords = 0;
+    for (size_t shard = 0; shard < 7; ++shard) {
+        file_range range_1;
+        file_range range_2;
+        find_shard_ranges(file_1.path(), file_2.path(), false, shard, 7, range_1, range_2);
+
+        // Each shard starts where the previous shard ended
+        ASSERT_EQ(last_range_1.end, range_1.begin);
+        ASSERT_EQ(last_range_2.end, range_2.begin);
+        ASSERT_LE(range_1.begin, range_1.end);
+        ASSERT_LE(range_2.begin, range_2.end);
+
+        const size_t records = count_records(RECORDS, range_1);
+        ASSERT_EQ(records, count_records(records_2, range_2));
+        nrecords += records;
+
+        last_range_1 = range_1;
+        last_range_2 = range_2;
+    }
+
+    ASSERT_EQ(RECORDS.size(), last_range_1.end);
+    ASSERT_EQ(records_2.size(), last_range_2.end);
+    ASSERT_EQ(3, nrecords);
+}
+
+
+TEST(shard, interleaved_shards_start_with_mate_1)
+{
+    const std::string records = RECORDS + "@rec4\nA\n+\nI\n";
+    const temporary_file file(records);
+
+    file_range range_1;
+    file_range range_2;
+    find_shard_ranges(file.path(), "", true, 0, 2, range_1, range_2);
+    ASSERT_EQ(0, range_1.begin);
+    ASSERT_EQ(records.find("@rec3"), range_1.end);
+
+    find_shard_ranges(file.path(), "", true, 1, 2, range_1, range_2);
+    ASSERT_EQ(records.find("@rec3"), range_1.begin);
+    ASSERT_EQ(records.size(), range_1.end);
+}
+
+
+TEST(shard, compressed_files_are_rejected)
+{
+    const temporary_file file("\x1f\x8b\x08\x00");
+
+    file_range range_1;
+    file_range range_2;
+    ASSERT_THROW(find_shard_ranges(file.path(), "", false, 0, 2, range_1, range_2), io_error);
+}
+
+} // namespace ar
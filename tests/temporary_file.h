@@ -0,0 +1,94 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2011 by Stinus Lindgreen - stinus@binf.ku.dk            *
+ * Copyright (C) 2014 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#ifndef AR_TEMPORARY_FILE_H
+#define AR_TEMPORARY_FILE_H
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace ar
+{
+
+/**
+ * Temporary file used by tests, created in $TMPDIR (defaulting to /tmp); the
+ * file is removed when the object is destroyed, including when an assertion
+ * fails, and may be replaced or re-created using 'path' in the mean time.
+ */
+class temporary_file
+{
+public:
+    /** Creates a temporary file containing 'data'. */
+    explicit temporary_file(const std::string& data = std::string())
+      : m_path()
+    {
+        const char* tmpdir = std::getenv("TMPDIR");
+        std::string path = (tmpdir && *tmpdir) ? tmpdir : "/tmp";
+        path += "/ar_test_XXXXXX";
+
+        std::vector<char> filename(path.begin(), path.end());
+        filename.push_back('\0');
+
+        const int fd = mkstemp(&filename.front());
+        if (fd == -1) {
+            throw std::runtime_error("could not create temporary file");
+        }
+
+        m_path = &filename.front();
+        if (write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+            close(fd);
+            unlink(m_path.c_str());
+            throw std::runtime_error("could not write temporary file");
+        }
+
+        close(fd);
+    }
+
+    ~temporary_file()
+    {
+        unlink(m_path.c_str());
+    }
+
+    /** Returns the path of the temporary file. */
+    const std::string& path() const
+    {
+        return m_path;
+    }
+
+private:
+    //! Not implemented
+    temporary_file(const temporary_file&);
+    //! Not implemented
+    temporary_file& operator=(const temporary_file&);
+
+    //! Path of the temporary file
+    std::string m_path;
+};
+
+} // namespace ar
+
+#endif
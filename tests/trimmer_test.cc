@@ -0,0 +1,170 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2016 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * S. Lindgreen (2012): AdapterRemoval: Easy Cleaning of Next Generation *
+ * Sequencing Reads, BMC Research Notes, 5:337                           *
+ * http://www.biomedcentral.com/1756-0500/5/337/                         *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include "fastq.h"
+#include "trimmer.h"
+
+namespace ar
+{
+
+const std::string INSERT = "ACGTTGCAAGTCCTAGGTACGGATC";
+const std::string ADAPTER_1 = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+const std::string ADAPTER_2 = "AGATCGGAAGAGCGTCGTGTAGGGAAAGAGTGT";
+
+
+inline std::ostream& operator<<(std::ostream& stream, const fastq& record)
+{
+    stream << "'@" << record.header() << "\\n"
+           << record.sequence() << "\\n+\\n"
+           << record.qualities() << "\\n'";
+
+    return stream;
+}
+
+
+string_vec make_args(const char* arg_1 = NULL, const char* arg_2 = NULL)
+{
+    string_vec args;
+    if (arg_1) {
+        args.push_back(arg_1);
+    }
+    if (arg_2) {
+        args.push_back(arg_2);
+    }
+
+    return args;
+}
+
+
+fastq make_read(const std::string& header, const std::string& sequence)
+{
+    return fastq(header, sequence, std::string(sequence.length(), 'I'));
+}
+
+
+std::string reverse_complement(std::string sequence)
+{
+    fastq read("read", sequence);
+    read.reverse_complement();
+
+    return read.sequence();
+}
+
+
+TEST(trimmer, se_reads)
+{
+    const trimmer trim(make_args(), false);
+    ASSERT_FALSE(trim.paired_end());
+
+    fastq_vec reads;
+    reads.push_back(make_read("read_1", INSERT + ADAPTER_1.substr(0, 20)));
+    reads.push_back(make_read("read_2", INSERT.substr(0, 10) + ADAPTER_1));
+
+    trimmed_reads out;
+    const statistics stats = trim.process_batch(reads, out);
+
+    ASSERT_EQ(fastq_vec(1, make_read("read_1", INSERT)), out.mate_1);
+    ASSERT_EQ(fastq_vec(1, make_read("read_2", INSERT.substr(0, 10))), out.discarded);
+    ASSERT_TRUE(out.mate_2.empty());
+    ASSERT_TRUE(out.collapsed.empty());
+
+    ASSERT_EQ(2u, stats.records);
+    ASSERT_EQ(2u, stats.well_aligned_reads);
+    ASSERT_EQ(1u, stats.keep1);
+    ASSERT_EQ(1u, stats.discard1);
+}
+
+
+TEST(trimmer, pe_reads)
+{
+    const trimmer trim(make_args(), true);
+    ASSERT_TRUE(trim.paired_end());
+
+    const fastq_vec reads_1(1, make_read("read/1", INSERT + ADAPTER_1.substr(0, 20)));
+    const fastq_vec reads_2(1, make_read("read/2", reverse_complement(INSERT) + ADAPTER_2.substr(0, 20)));
+
+    trimmed_reads out;
+    const statistics stats = trim.process_batch(reads_1, reads_2, out);
+
+    ASSERT_EQ(fastq_vec(1, make_read("read/1", INSERT)), out.mate_1);
+    ASSERT_EQ(fastq_vec(1, make_read("read/2", reverse_complement(INSERT))), out.mate_2);
+    ASSERT_EQ(1u, stats.records);
+    ASSERT_EQ(2u, stats.number_of_reads_with_adapter.at(0));
+
+    // Input reads are not modified, and output is appended to 'out'
+    trim.process_batch(reads_1, reads_2, out);
+    ASSERT_EQ(2u, out.mate_1.size());
+    ASSERT_EQ(INSERT.length() + 20, reads_1.front().length());
+}
+
+
+TEST(trimmer, pe_reads_collapsed)
+{
+    const trimmer trim(make_args("--collapse"), true);
+
+    const fastq_vec reads_1(1, make_read("read/1", INSERT + ADAPTER_1.substr(0, 20)));
+    const fastq_vec reads_2(1, make_read("read/2", reverse_complement(INSERT) + ADAPTER_2.substr(0, 20)));
+
+    trimmed_reads out;
+    const statistics stats = trim.process_batch(reads_1, reads_2, out);
+
+    ASSERT_EQ(1u, out.collapsed.size());
+    ASSERT_EQ("M_read/1", out.collapsed.front().header());
+    ASSERT_EQ(INSERT, out.collapsed.front().sequence());
+    ASSERT_TRUE(out.mate_1.empty());
+    ASSERT_EQ(1u, stats.number_of_full_length_collapsed);
+}
+
+
+TEST(trimmer, mismatched_mates)
+{
+    const trimmer trim(make_args(), true);
+
+    const fastq_vec reads_1(1, make_read("read_a/1", INSERT));
+    const fastq_vec reads_2(1, make_read("read_b/2", INSERT));
+
+    trimmed_reads out;
+    ASSERT_THROW(trim.process_batch(reads_1, reads_2, out), fastq_error);
+    ASSERT_THROW(trim.process_batch(reads_1, fastq_vec(), out), std::invalid_argument);
+}
+
+
+TEST(trimmer, wrong_mode)
+{
+    trimmed_reads out;
+    ASSERT_THROW(trimmer(make_args(), true).process_batch(fastq_vec(), out), std::logic_error);
+    ASSERT_THROW(trimmer(make_args(), false).process_batch(fastq_vec(), fastq_vec(), out), std::logic_error);
+}
+
+
+TEST(trimmer, invalid_options)
+{
+    ASSERT_THROW(trimmer(make_args("--minlength", "foo"), false), std::invalid_argument);
+    ASSERT_THROW(trimmer(make_args("--identify-adapters"), true), std::invalid_argument);
+    ASSERT_THROW(trimmer(make_args("--qualitybase-output", "64"), false), std::invalid_argument);
+}
+
+} // namespace ar